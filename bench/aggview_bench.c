@@ -0,0 +1,160 @@
+/*
+ * aggview_bench.c
+ *
+ * Compares answering a grouped aggregate from an incrementally maintained
+ * view with recomputing it by a full scan through hashagg. The cost which
+ * a view adds to each write is measured first, by feeding records to a
+ * view of an empty table, applied as they arrive and then in batches.
+ * The table is then loaded, with a view, and the aggregate is read
+ * repeatedly, both by scanning the table and from the view.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096).
+ *
+ * usage: aggview_bench [record_cnt] [groups] [batch]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "aggview.h"
+#include "bench.h"
+#include "exec.h"
+#include "hashagg.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define READS 20
+
+// (grp INT, val INT, score FLOAT)
+schema bench_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, FLOAT},
+    .field_lengths = {0, 0, 0}
+};
+
+// SELECT grp, COUNT(*), SUM(val), MIN(val), MAX(val), AVG(score) GROUP BY grp
+int group_cols[] = {0};
+agg_spec aggs[] = {
+    {.func = AGG_COUNT},
+    {.func = AGG_SUM, .col = 1},
+    {.func = AGG_MIN, .col = 1},
+    {.func = AGG_MAX, .col = 1},
+    {.func = AGG_AVG, .col = 2},
+};
+
+
+static void make_rec(byte *rec, int i, int groups, unsigned int *seed)
+{
+    tp_setint(rec, 0, rand_r(seed) % groups);
+    tp_setint(rec, 4, rand_r(seed) % 100000);
+    tp_setfloat(rec, 8, i * 0.5);
+}
+
+
+/*
+ * Feed record_cnt records to a view of the (empty) table, applied
+ * batch_size at a time, and return the time taken per record.
+ */
+static double maintain(table *tbl, int record_cnt, int groups, int batch_size)
+{
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, batch_size);
+    byte rec[BLOCKSIZE] = {0};
+    unsigned int seed = 7;
+
+    double start = bench_now();
+    for (int i=0; i<record_cnt; i++) {
+        make_rec(rec, i, groups, &seed);
+        av_insert(view, rec);
+    }
+    av_flush(view);
+    double elapsed = bench_now() - start;
+
+    tbl_view_drop(tbl, view);
+    return elapsed / record_cnt;
+}
+
+
+static int count_rows(byte *row, void *ctx)
+{
+    (void) row;
+    (*(long *) ctx)++;
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int groups = (argc > 2) ? atoi(argv[2]) : 100;
+    int batch_size = (argc > 3) ? atoi(argv[3]) : AV_DEFAULT_BATCH;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(8192);
+
+    table *tbl = tbl_create("aggview", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    double immediate = maintain(tbl, record_cnt, groups, 0);
+    double deferred = maintain(tbl, record_cnt, groups, batch_size);
+
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, batch_size);
+    byte rec[BLOCKSIZE] = {0}, row[BLOCKSIZE];
+    unsigned int seed = 7;
+
+    double start = bench_now();
+    for (int i=0; i<record_cnt; i++) {
+        make_rec(rec, i, groups, &seed);
+        tbl_insert(tbl, rec);
+    }
+    double load = bench_now() - start;
+
+    printf("records=%d groups=%d batch=%d\n", record_cnt, groups, batch_size);
+    printf("load %.3fs (%.0f ns/insert)  view maintenance: immediate %.1f ns/record  "
+           "deferred %.1f ns/record\n", load, load / record_cnt * 1e9, immediate * 1e9,
+           deferred * 1e9);
+
+    agg_opts opts;
+    agg_default_opts(&opts);
+
+    long rows = 0;
+    start = bench_now();
+    for (int r=0; r<READS; r++) {
+        exec_op *agg = exec_hashagg(exec_scan(tbl), 1, group_cols, 5, aggs, &opts);
+        batch *b;
+        while ((b = exec_next(agg))) rows += b->count;
+        exec_close(agg);
+    }
+    double scanned = (bench_now() - start) / READS;
+
+    long view_rows = 0;
+    start = bench_now();
+    for (int r=0; r<READS; r++) av_scan(view, count_rows, &view_rows);
+    double viewed = (bench_now() - start) / READS;
+
+    long found = 0;
+    start = bench_now();
+    for (int r=0; r<READS * 1000; r++) {
+        tp_setint(rec, 0, r % groups);
+        found += av_lookup(view, rec, row);
+    }
+    double looked_up = (bench_now() - start) / (READS * 1000);
+
+    printf("full scan + hashagg:  %10.1f us  (%ld groups)\n", scanned * 1e6, rows / READS);
+    printf("view, all groups:     %10.1f us  (%ld groups)\n", viewed * 1e6, view_rows / READS);
+    printf("view, one group:      %10.3f us  (%ld found)\n", looked_up * 1e6, found);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+ * arena_bench.c
+ *
+ * Benchmark for reading CHAR fields during a scan. A table is loaded and
+ * then scanned block by block, reading each record's name with
+ * pg_getchar, once with every value malloc'd and freed, and once with
+ * the values taken from an arena which is reset after each block. It
+ * reports the scan time and the number of allocations made per row.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096), or the time
+ * spent pinning the many small blocks will hide the difference.
+ *
+ * usage: arena_bench [record_cnt] [passes]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "arena.h"
+#include "bench.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, name CHAR(20))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 20}
+};
+
+
+/*
+ * Scan the table, reading every name, and return the time taken. The
+ * sum of the names' first characters is added to *check.
+ */
+static double scan(table *tbl, int record_cnt, arena *a, long *check)
+{
+    int per_blk = tbl_recs_per_blk(tbl);
+    int rec_len = tbl->fields.record_length;
+    int name_off = tbl_field_offset(&tbl->fields, 1);
+
+    double start = bench_now();
+    for (int rid=0; rid<record_cnt; rid+=per_blk) {
+        int blk_no = tbl_rec_blk(tbl, rid);
+        page *pg = buff_pin(tbl, blk_no);
+
+        int cnt = (record_cnt - rid < per_blk) ? record_cnt - rid : per_blk;
+        for (int i=0; i<cnt; i++) {
+            char *name = pg_getchar(pg, i * rec_len + name_off, 20, a);
+            *check += name[0];
+            if (!a) free(name);
+        }
+
+        buff_unpin(tbl, blk_no);
+        if (a) arena_reset(a);
+    }
+
+    return bench_now() - start;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int passes = (argc > 2) ? atoi(argv[2]) : 5;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(8192);
+
+    table *tbl = tbl_create("arena", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setchar(rec, 4, (i % 2) ? "an odd name" : "an even name", 20);
+        tbl_insert(tbl, rec);
+    }
+
+    long check = 0;
+    scan(tbl, record_cnt, NULL, &check);
+
+    double mallocd = 0;
+    for (int p=0; p<passes; p++) mallocd += scan(tbl, record_cnt, NULL, &check);
+
+    arena *a = arena_create(0);
+    double arenad = 0;
+    for (int p=0; p<passes; p++) arenad += scan(tbl, record_cnt, a, &check);
+
+    long rows = (long) record_cnt * passes;
+    printf("records=%d passes=%d blocks=%d  (checksum %ld)\n", record_cnt, passes,
+           tbl_blk_cnt(tbl), check);
+    printf("malloc: %8.3fs  %6.1f ns/row  1.000 allocations/row\n", mallocd,
+           mallocd / rows * 1e9);
+    printf("arena:  %8.3fs  %6.1f ns/row  %.3f allocations/row\n", arenad, arenad / rows * 1e9,
+           (double) a->mallocs / rows);
+
+    arena_free(a);
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+/*
+ * art_bench.c
+ *
+ * Benchmark of adaptive radix tree indexes against a hash index, for
+ * INT keys mapping to record ids. The hash index is the simplest one
+ * that would do as an in-memory primary index: open addressing with
+ * linear probing, sized up front to twice the key count. Each index is
+ * run through:
+ *
+ *   insert  key_cnt keys, in random order,
+ *   lookup  lookup_cnt lookups of keys chosen at random, half of them
+ *           absent,
+ *   range   range_cnt scans of range_len consecutive keys. The hash index
+ *           can only answer these by looking up every key in the range,
+ *           which is only possible at all because the keys are dense
+ *           integers,
+ *
+ * and then the ART's lookups are repeated from 1 to max_threads threads
+ * at once, with an insert thread running alongside.
+ *
+ * usage: art_bench [key_cnt] [lookup_cnt] [range_cnt] [range_len] [max_threads]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "art.h"
+#include "bench.h"
+#include "types.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_EMPTY (-2147483647 - 1)
+
+typedef struct hash_index {
+    int *keys;
+    int *rids;
+    long cap;
+} hash_index;
+
+
+static hash_index *hash_create(long cnt)
+{
+    hash_index *h = malloc(sizeof(hash_index));
+    h->cap = 16;
+    while (h->cap < cnt * 2) h->cap *= 2;
+
+    h->keys = malloc(sizeof(int) * h->cap);
+    h->rids = malloc(sizeof(int) * h->cap);
+    for (long i=0; i<h->cap; i++) h->keys[i] = HASH_EMPTY;
+
+    return h;
+}
+
+
+static inline long hash_slot(hash_index *h, int key)
+{
+    return ((unsigned int) key * 2654435761u) & (h->cap - 1);
+}
+
+
+static int hash_insert(hash_index *h, int key, int rid)
+{
+    for (long s = hash_slot(h, key);; s = (s + 1) & (h->cap - 1)) {
+        if (h->keys[s] == key) return 0;
+        if (h->keys[s] == HASH_EMPTY) {
+            h->keys[s] = key;
+            h->rids[s] = rid;
+            return 1;
+        }
+    }
+}
+
+
+static int hash_lookup(hash_index *h, int key)
+{
+    for (long s = hash_slot(h, key);; s = (s + 1) & (h->cap - 1)) {
+        if (h->keys[s] == key) return h->rids[s];
+        if (h->keys[s] == HASH_EMPTY) return -1;
+    }
+}
+
+
+static void hash_free(hash_index *h)
+{
+    free(h->keys);
+    free(h->rids);
+    free(h);
+}
+
+
+/*
+ * Random keys in [0, cnt), each exactly once
+ */
+static int *shuffled(int cnt, unsigned int seed)
+{
+    int *keys = malloc(sizeof(int) * cnt);
+    for (int i=0; i<cnt; i++) keys[i] = i;
+
+    for (int i=cnt - 1; i>0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        int t = keys[i];
+        keys[i] = keys[j];
+        keys[j] = t;
+    }
+
+    return keys;
+}
+
+
+static void report(const char *index, const char *phase, long cnt, double elapsed, long found)
+{
+    printf("%-5s %-7s %10ld ops  %8.3f s  %7.3f Mops/s  (%ld found)\n", index, phase, cnt, elapsed,
+           cnt / elapsed / 1e6, found);
+}
+
+
+static int sum_rids(const unsigned char *key, int rid, void *ctx)
+{
+    (void) key;
+    *(long *) ctx += rid;
+    return 1;
+}
+
+
+static void bench_hash(int key_cnt, int *keys, int lookup_cnt, int range_cnt, int range_len)
+{
+    hash_index *h = hash_create(key_cnt);
+    unsigned int seed = 7;
+    long found = 0;
+
+    double start = bench_now();
+    for (int i=0; i<key_cnt; i++) found += hash_insert(h, keys[i], i);
+    report("hash", "insert", key_cnt, bench_now() - start, found);
+
+    found = 0;
+    start = bench_now();
+    for (int i=0; i<lookup_cnt; i++) {
+        found += hash_lookup(h, rand_r(&seed) % (2 * key_cnt)) >= 0;
+    }
+    report("hash", "lookup", lookup_cnt, bench_now() - start, found);
+
+    long sum = 0;
+    found = 0;
+    start = bench_now();
+    for (int i=0; i<range_cnt; i++) {
+        int lo = rand_r(&seed) % key_cnt;
+        for (int k=lo; k<lo + range_len; k++) {
+            int rid = hash_lookup(h, k);
+            if (rid >= 0) {
+                sum += rid;
+                found++;
+            }
+        }
+    }
+    report("hash", "range", range_cnt, bench_now() - start, found);
+
+    hash_free(h);
+}
+
+
+static art_tree *bench_art(int key_cnt, int *keys, int lookup_cnt, int range_cnt, int range_len)
+{
+    art_tree *art = art_create(4);
+    unsigned char key[4], lo[4], hi[4];
+    unsigned int seed = 7;
+    long found = 0;
+
+    double start = bench_now();
+    for (int i=0; i<key_cnt; i++) {
+        tp_intkey(keys[i], key);
+        found += art_insert(art, key, i);
+    }
+    report("art", "insert", key_cnt, bench_now() - start, found);
+
+    found = 0;
+    start = bench_now();
+    for (int i=0; i<lookup_cnt; i++) {
+        tp_intkey(rand_r(&seed) % (2 * key_cnt), key);
+        found += art_lookup(art, key) >= 0;
+    }
+    report("art", "lookup", lookup_cnt, bench_now() - start, found);
+
+    long sum = 0;
+    found = 0;
+    start = bench_now();
+    for (int i=0; i<range_cnt; i++) {
+        int k = rand_r(&seed) % key_cnt;
+        tp_intkey(k, lo);
+        tp_intkey(k + range_len - 1, hi);
+        found += art_scan(art, lo, hi, sum_rids, &sum);
+    }
+    report("art", "range", range_cnt, bench_now() - start, found);
+
+    return art;
+}
+
+
+typedef struct lookup_arg {
+    art_tree *art;
+    int key_cnt;
+    int lookup_cnt;
+    unsigned int seed;
+    long found;
+} lookup_arg;
+
+typedef struct insert_arg {
+    art_tree *art;
+    int next_key;
+    atomic_int stop;
+    long inserted;
+} insert_arg;
+
+
+static void *lookup_worker(void *arg)
+{
+    lookup_arg *l = arg;
+    unsigned char key[4];
+
+    for (int i=0; i<l->lookup_cnt; i++) {
+        tp_intkey(rand_r(&l->seed) % l->key_cnt, key);
+        l->found += art_lookup(l->art, key) >= 0;
+    }
+
+    return NULL;
+}
+
+
+// Adds new keys above the existing ones until told to stop
+static void *insert_worker(void *arg)
+{
+    insert_arg *w = arg;
+    unsigned char key[4];
+
+    while (!atomic_load(&w->stop)) {
+        tp_intkey(w->next_key, key);
+        w->inserted += art_insert(w->art, key, w->next_key) == 1;
+        w->next_key++;
+    }
+
+    return NULL;
+}
+
+
+static void bench_art_threads(art_tree *art, int key_cnt, int lookup_cnt, int max_threads)
+{
+    int next_key = key_cnt * 2;
+
+    for (int threads=1; threads<=max_threads; threads*=2) {
+        pthread_t tids[threads];
+        lookup_arg args[threads];
+        pthread_t writer;
+        insert_arg w = {.art = art, .next_key = next_key};
+        atomic_init(&w.stop, 0);
+
+        pthread_create(&writer, NULL, insert_worker, &w);
+
+        double start = bench_now();
+        for (int t=0; t<threads; t++) {
+            args[t] = (lookup_arg) {.art = art, .key_cnt = key_cnt, .lookup_cnt = lookup_cnt,
+                                    .seed = t + 1};
+            pthread_create(&tids[t], NULL, lookup_worker, &args[t]);
+        }
+
+        long found = 0;
+        for (int t=0; t<threads; t++) {
+            pthread_join(tids[t], NULL);
+            found += args[t].found;
+        }
+        double elapsed = bench_now() - start;
+
+        atomic_store(&w.stop, 1);
+        pthread_join(writer, NULL);
+        next_key = w.next_key;
+
+        printf("art   %2d threads %10ld lookups  %8.3f s  %7.3f Mops/s  (%ld found, %ld inserted "
+               "alongside)\n", threads, (long) threads * lookup_cnt, elapsed,
+               (double) threads * lookup_cnt / elapsed / 1e6, found, w.inserted);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int key_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int lookup_cnt = (argc > 2) ? atoi(argv[2]) : 2000000;
+    int range_cnt = (argc > 3) ? atoi(argv[3]) : 100000;
+    int range_len = (argc > 4) ? atoi(argv[4]) : 100;
+    int max_threads = (argc > 5) ? atoi(argv[5]) : 4;
+
+    printf("keys=%d lookups=%d ranges=%d x %d threads<=%d\n", key_cnt, lookup_cnt, range_cnt,
+           range_len, max_threads);
+
+    int *keys = shuffled(key_cnt, 42);
+    bench_hash(key_cnt, keys, lookup_cnt, range_cnt, range_len);
+    art_tree *art = bench_art(key_cnt, keys, lookup_cnt, range_cnt, range_len);
+    bench_art_threads(art, key_cnt, lookup_cnt, max_threads);
+
+    art_free(art);
+    free(keys);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/*
+ * artbatch_bench.c
+ *
+ * Benchmark of batched, interleaved ART lookups (art_lookup_batch and
+ * tbl_art_read_batch) against looking keys up one at a time. Random keys
+ * are looked up, in batches of 1 to ART_BATCH_MAX, in three settings:
+ *
+ *   tree    an in-memory tree of key_cnt INT keys, far larger than the
+ *           CPU's caches, so that most node visits are cache misses,
+ *   memory  an indexed table of rec_cnt records, whose records are then
+ *           read, with every block resident in the buffer pool,
+ *   disk    the same table with a pool of pool_size frames, where the
+ *           operating system is asked to drop its own cached copy of the
+ *           table's file before each run, so that most reads go to disk.
+ *
+ * Each is reported in lookups per second. The "serial" rows are
+ * art_lookup, and tbl_art_find followed by tbl_read, called once per key.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096).
+ *
+ * usage: artbatch_bench [key_cnt] [lookup_cnt] [rec_cnt] [table_lookup_cnt] [pool_size] [db_dir]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "art.h"
+#include "bench.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (id INT, pad CHAR(60))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 60}
+};
+
+static const int batch_sizes[] = {1, 2, 4, 8, 16, 32, 64};
+#define BATCH_SIZE_CNT 7
+
+
+static void bench_tree(int key_cnt, long lookups)
+{
+    art_tree *art = art_create(4);
+    unsigned char key[4];
+    unsigned int seed = 7;
+
+    for (int i=0; i<key_cnt; i++) {
+        tp_intkey(rand_r(&seed), key);
+        art_insert(art, key, i);
+    }
+
+    unsigned char keys[ART_BATCH_MAX * 4];
+    int rids[ART_BATCH_MAX];
+    long found = 0;
+
+    // Look up the keys inserted, so that searches go all the way down
+    seed = 7;
+    double start = bench_now();
+    for (long i=0; i<lookups; i++) {
+        tp_intkey(rand_r(&seed), key);
+        found += art_lookup(art, key) >= 0;
+    }
+    double elapsed = bench_now() - start;
+    printf("tree    serial %8.2f M lookups/s  (found %ld)\n", lookups / elapsed / 1e6, found);
+
+    for (int s=0; s<BATCH_SIZE_CNT; s++) {
+        int bs = batch_sizes[s];
+        seed = 7;
+        found = 0;
+
+        start = bench_now();
+        for (long i=0; i<lookups; i+=bs) {
+            int n = (lookups - i < bs) ? lookups - i : bs;
+            for (int j=0; j<n; j++) tp_intkey(rand_r(&seed), keys + j * 4);
+            found += art_lookup_batch(art, keys, n, rids);
+        }
+        elapsed = bench_now() - start;
+        printf("tree    batch %2d %8.2f M lookups/s  (found %ld)\n", bs, lookups / elapsed / 1e6,
+               found);
+    }
+
+    art_free(art);
+}
+
+
+static void drop_os_cache(table *tbl, int disk)
+{
+    if (!disk) return;
+
+    // Pages not yet written back can't be dropped
+    buff_evict_tbl(tbl);
+    fflush(tbl->file);
+    fsync(fileno(tbl->file));
+    posix_fadvise(fileno(tbl->file), 0, 0, POSIX_FADV_DONTNEED);
+}
+
+
+static void bench_table(table *tbl, int rec_cnt, long lookups, int disk)
+{
+    const char *label = disk ? "disk  " : "memory";
+    int rec_len = tbl->fields.record_length;
+    byte *probes = calloc(ART_BATCH_MAX, rec_len);
+    byte *records = malloc((size_t) ART_BATCH_MAX * rec_len);
+    int rids[ART_BATCH_MAX];
+    unsigned int seed = 11;
+    long found = 0;
+
+    drop_os_cache(tbl, disk);
+    double start = bench_now();
+    for (long i=0; i<lookups; i++) {
+        tp_setint(probes, 0, rand_r(&seed) % rec_cnt);
+        int rid = tbl_art_find(tbl, probes);
+        found += rid >= 0 && tbl_read(tbl, rid, records);
+    }
+    double elapsed = bench_now() - start;
+    printf("%s  serial %8.3f M lookups/s  (found %ld)\n", label, lookups / elapsed / 1e6, found);
+
+    for (int s=0; s<BATCH_SIZE_CNT; s++) {
+        int bs = batch_sizes[s];
+        seed = 11;
+        found = 0;
+
+        drop_os_cache(tbl, disk);
+        start = bench_now();
+        for (long i=0; i<lookups; i+=bs) {
+            int n = (lookups - i < bs) ? lookups - i : bs;
+            for (int j=0; j<n; j++) tp_setint(probes + j * rec_len, 0, rand_r(&seed) % rec_cnt);
+            found += tbl_art_read_batch(tbl, probes, n, records, rids);
+        }
+        elapsed = bench_now() - start;
+        printf("%s  batch %2d %8.3f M lookups/s  (found %ld)\n", label, bs,
+               lookups / elapsed / 1e6, found);
+    }
+
+    free(probes);
+    free(records);
+}
+
+
+int main(int argc, char **argv)
+{
+    int key_cnt = (argc > 1) ? atoi(argv[1]) : 2000000;
+    long lookups = (argc > 2) ? atol(argv[2]) : 2000000;
+    int rec_cnt = (argc > 3) ? atoi(argv[3]) : 100000;
+    long tbl_lookups = (argc > 4) ? atol(argv[4]) : 20000;
+    int pool_size = (argc > 5) ? atoi(argv[5]) : 256;
+    char *db = (argc > 6) ? argv[6] : "bench/benchdb";
+
+    bench_tree(key_cnt, lookups);
+
+    mkdir("bench/benchdb", 0777);
+
+    // Big enough to hold the whole table, for the in-memory runs
+    buff_pool_init(rec_cnt / 32);
+    table *tbl = tbl_create("artbatch", db, &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<rec_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+
+    if (!tbl_art_create(tbl, 0)) {
+        fprintf(stderr, "failed to index table\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("table=%d blocks\n", tbl_blk_cnt(tbl));
+    bench_table(tbl, rec_cnt, tbl_lookups, FALSE);
+
+    // Then move the table to a small pool of its own for the disk runs
+    buff_pool *small = buff_pool_create("artbatch", pool_size, BUFF_POLICY_CLOCK);
+    buff_pool_bind(tbl, small);
+    printf("pool=%d frames\n", pool_size);
+    bench_table(tbl, rec_cnt, tbl_lookups, TRUE);
+
+    tbl_close(tbl);
+    buff_pool_free(small);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/*
+ * bench.h
+ *
+ * Shared helpers for the yahi-db benchmark programs.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#pragma once
+
+#include "exec.h"
+#include "types.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+static inline double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * A source operator producing rows of (key INT, payload INT) from memory,
+ * so that an operator can be measured without the cost of a table scan
+ * underneath it. If seed is 0, keys are dense and ascending (0, 1, ...);
+ * otherwise they are drawn uniformly at random from [0, domain).
+ */
+typedef struct bench_gen_state {
+    long rows;
+    long produced;
+    long domain;
+    unsigned int seed;
+    batch out;
+} bench_gen_state;
+
+
+static inline batch *bench_gen_next(exec_op *op)
+{
+    bench_gen_state *st = op->state;
+    if (st->produced >= st->rows) return NULL;
+
+    int cnt = EXEC_BATCH_SIZE;
+    if (st->rows - st->produced < cnt) cnt = st->rows - st->produced;
+
+    for (int i=0; i<cnt; i++) {
+        long r = st->produced + i;
+        st->out.cols[0].ints[i] = st->seed ? rand_r(&st->seed) % st->domain : r;
+        st->out.cols[1].ints[i] = r;
+    }
+
+    st->produced += cnt;
+    st->out.count = cnt;
+    return &st->out;
+}
+
+
+static inline void bench_gen_close(exec_op *op)
+{
+    bench_gen_state *st = op->state;
+    exec_batch_free(&st->out);
+    free(st);
+}
+
+
+static inline exec_op *bench_gen_create(long rows, long domain, unsigned int seed)
+{
+    int types[] = {INT, INT};
+    int lengths[] = {0, 0};
+
+    bench_gen_state *st = calloc(1, sizeof(bench_gen_state));
+    st->rows = rows;
+    st->domain = domain;
+    st->seed = seed;
+    exec_batch_init(&st->out, 2, types, lengths);
+
+    exec_op *op = calloc(1, sizeof(exec_op));
+    op->name = "generate";
+    op->state = st;
+    op->next = bench_gen_next;
+    op->close = bench_gen_close;
+
+    return op;
+}
@@ -0,0 +1,128 @@
+/*
+ * bloom_bench.c
+ *
+ * Benchmark for Bloom filter negative lookups. Loads a table with keys
+ * scattered across its blocks (so that zone maps can't narrow a lookup),
+ * then runs point lookups (filtered scans for key = k) at miss rates from
+ * 0% to 99%, with and without a Bloom filter on the key column. Also
+ * reports the raw probe cost and false positive rate of the filter.
+ *
+ * usage: bloom_bench [record_cnt] [lookups] [pool_size]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "bloom.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (key INT, val INT, pad CHAR(12))
+schema bench_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, CHAR},
+    .field_lengths = {0, 0, 12}
+};
+
+#define KEY_PRIME 1000003
+
+
+// Present keys are even, scattered by a multiplicative permutation
+static int present_key(long i)
+{
+    return (int) ((i * 7919) % KEY_PRIME) * 2;
+}
+
+
+table *load_table(int record_cnt)
+{
+    table *tbl = tbl_create("bloom", "bench/benchdb", &bench_schema);
+    if (!tbl) return NULL;
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, present_key(i));
+        tp_setint(rec, 4, i);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl;
+}
+
+
+double run_lookups(table *tbl, int record_cnt, int lookups, int miss_pct, long *found)
+{
+    unsigned int seed = 17;
+    *found = 0;
+
+    double start = bench_now();
+    for (int i=0; i<lookups; i++) {
+        int key = present_key(rand_r(&seed) % record_cnt);
+        if (rand_r(&seed) % 100 < miss_pct) key++;
+
+        exec_op *op = exec_filter_int(exec_scan(tbl), 0, CMP_EQ, key);
+        batch *b;
+        while ((b = exec_next(op))) *found += b->count;
+        exec_close(op);
+    }
+
+    return bench_now() - start;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 200000;
+    int lookups = (argc > 2) ? atoi(argv[2]) : 200;
+    int pool_size = (argc > 3) ? atoi(argv[3]) : 1024;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    table *tbl = load_table(record_cnt);
+    if (!tbl || !tbl_bloom_create(tbl, 0, BF_DEFAULT_BITS_PER_KEY)) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    // Raw filter cost and accuracy
+    bloom *bf = tbl->bloom;
+    long probes = 10000000, hits = 0;
+    double start = bench_now();
+    for (long i=0; i<probes; i++) hits += bf_may_contain(bf, (int) (i * 2 + 1));
+    double probe = bench_now() - start;
+
+    printf("records=%d lookups=%d pool=%d filter=%ld blocks (%ld KiB)\n", record_cnt,
+           lookups, pool_size, bf->blk_cnt, bf->blk_cnt * sizeof(bf_block) / 1024);
+    printf("probe %.1f ns, false positive rate %.3f%%\n\n", probe / probes * 1e9,
+           100.0 * hits / probes);
+
+    printf("%-6s %10s %12s %12s %8s\n", "miss", "found", "bloom(s)", "none(s)", "speedup");
+
+    int miss_rates[] = {0, 25, 50, 75, 90, 99};
+    for (size_t i=0; i<sizeof(miss_rates) / sizeof(miss_rates[0]); i++) {
+        long found, found_none;
+        double with = run_lookups(tbl, record_cnt, lookups, miss_rates[i], &found);
+
+        tbl->bloom = NULL;
+        double without = run_lookups(tbl, record_cnt, lookups, miss_rates[i], &found_none);
+        tbl->bloom = bf;
+
+        printf("%5d%% %10ld %12.4f %12.4f %7.1fx\n", miss_rates[i], found, with, without,
+               without / with);
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+/*
+ * bmindex_bench.c
+ *
+ * Compares answering predicates on low-cardinality columns from bitmap
+ * indexes with filtering a full scan. A table of (id, region, status,
+ * amount) records is loaded with bitmap indexes on region and status,
+ * and each query is run both as a scan under filters, and as a scan of
+ * just the rows of the combined bitmaps (exec_scan_rows). The time taken
+ * by the bitmap operations alone is reported separately.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096).
+ *
+ * usage: bmindex_bench [record_cnt] [regions] [statuses]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "bmindex.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "roaring.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define READS 10
+
+// (id INT, region INT, status INT, amount FLOAT)
+schema bench_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, INT, INT, FLOAT},
+    .field_lengths = {0, 0, 0, 0}
+};
+
+
+static long drain(exec_op *op)
+{
+    long rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) rows += b->count;
+    exec_close(op);
+
+    return rows;
+}
+
+
+/*
+ * region = 1 AND status = 2
+ */
+static roaring *conj_rows(table *tbl)
+{
+    roaring *region = tbl_bitmap_int(tbl, 1, 1);
+    roaring *status = tbl_bitmap_int(tbl, 2, 2);
+    roaring *rows = rb_and(region, status);
+
+    rb_free(region);
+    rb_free(status);
+    return rows;
+}
+
+
+/*
+ * region = 1 AND status != 0
+ */
+static roaring *neg_rows(table *tbl)
+{
+    roaring *region = tbl_bitmap_int(tbl, 1, 1);
+    roaring *status = tbl_bitmap_int(tbl, 2, 0);
+    roaring *rows = rb_andnot(region, status);
+
+    rb_free(region);
+    rb_free(status);
+    return rows;
+}
+
+
+/*
+ * region = 1 OR region = 2 OR status = 2
+ */
+static roaring *disj_rows(table *tbl)
+{
+    roaring *r1 = tbl_bitmap_int(tbl, 1, 1);
+    roaring *r2 = tbl_bitmap_int(tbl, 1, 2);
+    roaring *s2 = tbl_bitmap_int(tbl, 2, 2);
+    roaring *either = rb_or(r1, r2);
+    roaring *rows = rb_or(either, s2);
+
+    rb_free(r1);
+    rb_free(r2);
+    rb_free(s2);
+    rb_free(either);
+    return rows;
+}
+
+
+static void run_bitmap(table *tbl, const char *label, roaring *(*rows_fn)(table *),
+                       double filtered, long expect)
+{
+    long rows = 0;
+    double ops = 0;
+
+    double start = bench_now();
+    for (int r=0; r<READS; r++) {
+        double op_start = bench_now();
+        roaring *rows_rb = rows_fn(tbl);
+        ops += bench_now() - op_start;
+
+        rows += drain(exec_scan_rows(tbl, rows_rb));
+        rb_free(rows_rb);
+    }
+    double elapsed = (bench_now() - start) / READS;
+
+    printf("%-32s filter %9.1f us  bitmap %9.1f us (ops %7.1f us)  %ld rows%s\n", label,
+           filtered * 1e6, elapsed * 1e6, ops / READS * 1e6, rows / READS,
+           (expect >= 0 && rows / READS != expect) ? "  MISMATCH" : "");
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int regions = (argc > 2) ? atoi(argv[2]) : 50;
+    int statuses = (argc > 3) ? atoi(argv[3]) : 4;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(8192);
+
+    table *tbl = tbl_create("bmindex", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    unsigned int seed = 7;
+
+    tbl_bitmap_create(tbl, 1);
+    tbl_bitmap_create(tbl, 2);
+
+    double start = bench_now();
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, rand_r(&seed) % regions);
+        tp_setint(rec, 8, rand_r(&seed) % statuses);
+        tp_setfloat(rec, 12, i * 0.25);
+        tbl_insert(tbl, rec);
+    }
+    double load = bench_now() - start;
+
+    printf("records=%d regions=%d statuses=%d\n", record_cnt, regions, statuses);
+    printf("load with 2 bitmap indexes: %.3fs (%.0f ns/insert)\n", load,
+           load / record_cnt * 1e9);
+
+    long conj = 0, neg = 0;
+    start = bench_now();
+    for (int r=0; r<READS; r++) {
+        exec_op *op = exec_filter_int(exec_scan(tbl), 1, CMP_EQ, 1);
+        conj += drain(exec_filter_int(op, 2, CMP_EQ, 2));
+    }
+    double conj_time = (bench_now() - start) / READS;
+
+    start = bench_now();
+    for (int r=0; r<READS; r++) {
+        exec_op *op = exec_filter_int(exec_scan(tbl), 1, CMP_EQ, 1);
+        neg += drain(exec_filter_int(op, 2, CMP_NE, 0));
+    }
+    double neg_time = (bench_now() - start) / READS;
+
+    // There is no OR filter, so the disjunction is timed against a scan
+    // of the whole table, which it must at least make
+    start = bench_now();
+    for (int r=0; r<READS; r++) drain(exec_scan(tbl));
+    double scan_time = (bench_now() - start) / READS;
+
+    run_bitmap(tbl, "region = 1 AND status = 2", conj_rows, conj_time, conj / READS);
+    run_bitmap(tbl, "region = 1 AND status != 0", neg_rows, neg_time, neg / READS);
+    run_bitmap(tbl, "region IN (1, 2) OR status = 2", disj_rows, scan_time, -1);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+/*
+ * codec_bench.c
+ *
+ * Benchmark for schema-specialized record codecs. A block of records is
+ * built in memory and repeatedly decoded into dense columns three ways:
+ *
+ *   row      record at a time, dispatching on each field's type and copying
+ *            it with the tp_getas* accessors (CHAR fields by a memcpy of
+ *            runtime length),
+ *   column   column at a time, dispatching once per column, but with each
+ *            CHAR value still copied by a runtime-length memcpy (the scan's
+ *            decode loop before codecs),
+ *   codec    through the schema's codec.
+ *
+ * The records are then sorted, comparing all fields, with a comparator that
+ * dispatches on type per field and with cd_compare.
+ *
+ * usage: codec_bench [records] [passes]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "codec.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// (id INT, price FLOAT, sku CHAR(16), region CHAR(8), qty INT, tag CHAR(4))
+schema bench_schema = {
+    .field_cnt = 6,
+    .field_types = {INT, FLOAT, CHAR, CHAR, INT, CHAR},
+    .field_lengths = {4, 8, 16, 8, 4, 4}
+};
+
+int offsets[MAX_ATTRS];
+
+
+void decode_row(byte *rows, int cnt, void **cols)
+{
+    schema *sch = &bench_schema;
+    int reclen = sch->record_length;
+
+    for (int i=0; i<cnt; i++) {
+        byte *rec = rows + (size_t) i * reclen;
+        for (int c=0; c<sch->field_cnt; c++) {
+            int len = sch->field_lengths[c];
+            switch (sch->field_types[c]) {
+                case INT:
+                    ((int *) cols[c])[i] = tp_getasint(rec, offsets[c]);
+                    break;
+                case FLOAT:
+                    ((double *) cols[c])[i] = tp_getasfloat(rec, offsets[c]);
+                    break;
+                case CHAR:
+                    memcpy((char *) cols[c] + (size_t) i * len, rec + offsets[c], len);
+                    break;
+            }
+        }
+    }
+}
+
+
+void decode_column(byte *rows, int cnt, void **cols)
+{
+    schema *sch = &bench_schema;
+    int reclen = sch->record_length;
+
+    for (int c=0; c<sch->field_cnt; c++) {
+        byte *src = rows + offsets[c];
+        int len = sch->field_lengths[c];
+
+        switch (sch->field_types[c]) {
+            case INT:
+                for (int i=0; i<cnt; i++) memcpy((int *) cols[c] + i, src + i*reclen, sizeof(int));
+                break;
+            case FLOAT:
+                for (int i=0; i<cnt; i++) memcpy((double *) cols[c] + i, src + i*reclen, sizeof(double));
+                break;
+            case CHAR:
+                for (int i=0; i<cnt; i++) memcpy((char *) cols[c] + i*len, src + i*reclen, len);
+                break;
+        }
+    }
+}
+
+
+int compare_switch(const void *pa, const void *pb, void *ctx)
+{
+    schema *sch = ctx;
+    byte *a = *(byte **) pa;
+    byte *b = *(byte **) pb;
+
+    for (int c=0; c<sch->field_cnt; c++) {
+        int r = 0;
+        switch (sch->field_types[c]) {
+            case INT: {
+                int x = tp_getasint(a, offsets[c]), y = tp_getasint(b, offsets[c]);
+                r = (x > y) - (x < y);
+                break;
+            }
+            case FLOAT: {
+                double x = tp_getasfloat(a, offsets[c]), y = tp_getasfloat(b, offsets[c]);
+                r = (x > y) - (x < y);
+                break;
+            }
+            case CHAR:
+                r = memcmp(a + offsets[c], b + offsets[c], sch->field_lengths[c]);
+                break;
+        }
+        if (r != 0) return r;
+    }
+
+    return 0;
+}
+
+
+int compare_codec(const void *pa, const void *pb, void *ctx)
+{
+    return cd_compare(ctx, *(byte **) pa, *(byte **) pb);
+}
+
+
+double sort_time(byte *rows, int cnt, int reclen, int (*cmp)(const void *, const void *, void *),
+                 void *ctx)
+{
+    byte **ptrs = malloc(sizeof(byte *) * cnt);
+    for (int i=0; i<cnt; i++) ptrs[i] = rows + (size_t) i * reclen;
+
+    double start = bench_now();
+    qsort_r(ptrs, cnt, sizeof(byte *), cmp, ctx);
+    double elapsed = bench_now() - start;
+
+    free(ptrs);
+    return elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    int cnt = (argc > 1) ? atoi(argv[1]) : 4096;
+    int passes = (argc > 2) ? atoi(argv[2]) : 2000;
+
+    schema *sch = &bench_schema;
+    sch->record_length = 0;
+    for (int c=0; c<sch->field_cnt; c++) {
+        offsets[c] = sch->record_length;
+        sch->record_length += sch->field_lengths[c];
+    }
+
+    codec *cd = cd_create(sch);
+    int reclen = sch->record_length;
+    byte *rows = malloc((size_t) cnt * reclen);
+
+    unsigned int seed = 42;
+    char buf[17];
+    for (int i=0; i<cnt; i++) {
+        byte *rec = rows + (size_t) i * reclen;
+        tp_setint(rec, offsets[0], rand_r(&seed) % 1000);
+        tp_setfloat(rec, offsets[1], rand_r(&seed) % 100 / 4.0);
+        snprintf(buf, sizeof(buf), "SKU-%012d", rand_r(&seed) % 50);
+        tp_setchar(rec, offsets[2], buf, 16);
+        snprintf(buf, sizeof(buf), "R%d", rand_r(&seed) % 8);
+        tp_setchar(rec, offsets[3], buf, 8);
+        tp_setint(rec, offsets[4], rand_r(&seed));
+        tp_setchar(rec, offsets[5], "tag", 4);
+    }
+
+    void *cols[MAX_ATTRS];
+    for (int c=0; c<sch->field_cnt; c++) cols[c] = malloc((size_t) cnt * 8 * 2);
+
+    const char *names[] = {"row", "column", "codec"};
+    double times[3];
+    long checksum = 0;
+
+    for (int m=0; m<3; m++) {
+        double start = bench_now();
+        for (int p=0; p<passes; p++) {
+            switch (m) {
+                case 0: decode_row(rows, cnt, cols); break;
+                case 1: decode_column(rows, cnt, cols); break;
+                case 2: cd_decode(cd, rows, reclen, cnt, cols); break;
+            }
+            checksum += ((int *) cols[4])[p % cnt];
+        }
+        times[m] = bench_now() - start;
+    }
+
+    printf("records=%d reclen=%d passes=%d (checksum %ld)\n", cnt, reclen, passes, checksum);
+    for (int m=0; m<3; m++) {
+        double recs = (double) cnt * passes;
+        printf("decode %-7s %8.1f Mrec/s  %7.2f GB/s  %.2fx\n", names[m], recs / times[m] / 1e6,
+               recs * reclen / times[m] / 1e9, times[0] / times[m]);
+    }
+
+    double t_switch = sort_time(rows, cnt, reclen, compare_switch, sch);
+    double t_codec = sort_time(rows, cnt, reclen, compare_codec, cd);
+    printf("sort   switch %7.3f ms  codec %7.3f ms  %.2fx\n", t_switch * 1e3, t_codec * 1e3,
+           t_switch / t_codec);
+
+    for (int c=0; c<sch->field_cnt; c++) free(cols[c]);
+    free(rows);
+    cd_free(cd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/*
+ * exec_bench.c
+ *
+ * Benchmark harness for the batch executor. Loads a synthetic table and
+ * runs a handful of representative queries over it, printing the wall
+ * time of each query along with the per-operator breakdown.
+ *
+ * usage: exec_bench [record_cnt] [pool_size]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, ts INT, qty INT, price FLOAT, tag CHAR(8))
+schema bench_schema = {
+    .field_cnt = 5,
+    .field_types = {INT, INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 0, 8}
+};
+
+
+table *load_table(int record_cnt)
+{
+    table *tbl = tbl_create("exec", "bench/benchdb", &bench_schema);
+    if (!tbl) return NULL;
+
+    static const char *tags[] = {"red", "green", "blue", "yellow"};
+    byte rec[BLOCKSIZE];
+
+    srand(42);
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i / 16);
+        tp_setint(rec, 8, rand() % 1000);
+        tp_setfloat(rec, 12, (rand() % 100000) / 100.0);
+        tp_setchar(rec, 20, (char *) tags[rand() % 4], 8);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl;
+}
+
+
+void run_query(const char *desc, exec_op *root)
+{
+    long rows = 0;
+    batch *b;
+
+    double start = bench_now();
+    while ((b = exec_next(root))) {
+        rows += b->count;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%s\n", desc);
+    printf("  rows=%ld time=%.3fms\n", rows, elapsed * 1000);
+    exec_report(root, stdout);
+    printf("\n");
+
+    exec_close(root);
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int pool_size = (argc > 2) ? atoi(argv[2]) : 64;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    double start = bench_now();
+    table *tbl = load_table(record_cnt);
+    if (!tbl) {
+        fprintf(stderr, "Unable to create benchmark table\n");
+        return EXIT_FAILURE;
+    }
+    printf("loaded %d records (%d blocks) in %.3fms\n\n", record_cnt,
+            tbl_blk_cnt(tbl), (bench_now() - start) * 1000);
+
+    run_query("Q1: SELECT * FROM exec", exec_scan(tbl));
+
+    run_query("Q2: SELECT * FROM exec WHERE qty < 10",
+            exec_filter_int(exec_scan(tbl), 2, CMP_LT, 10));
+
+    int q3_cols[] = {0, 3};
+    run_query("Q3: SELECT id, price FROM exec WHERE price >= 500.0 AND tag = 'red'",
+            exec_project(exec_filter_char(exec_filter_float(exec_scan(tbl), 3, CMP_GE, 500.0),
+                    4, CMP_EQ, "red"), 2, q3_cols));
+
+    run_query("Q4: SELECT * FROM exec WHERE ts > 1000 LIMIT 100",
+            exec_limit(exec_filter_int(exec_scan(tbl), 1, CMP_GT, 1000), 100));
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+
+    return EXIT_SUCCESS;
+}
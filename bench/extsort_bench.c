@@ -0,0 +1,73 @@
+/*
+ * extsort_bench.c
+ *
+ * Measures the external sort on an input several times larger than its
+ * memory budget (10x by default), against the same input sorted entirely
+ * in memory.
+ *
+ * usage: extsort_bench [mem_budget] [input_factor] [threads]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "extsort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+void run_sort(const char *desc, long rows, sort_opts *opts)
+{
+    sort_key keys[] = {{.col = 0, .desc = FALSE}};
+    exec_op *sort = exec_sort(bench_gen_create(rows, rows, 31), 1, keys, opts);
+
+    long out = 0;
+    int prev = -1, sorted = TRUE;
+    batch *b;
+
+    double start = bench_now();
+    while ((b = exec_next(sort))) {
+        for (int i=0; i<b->count; i++) {
+            sorted = sorted && (b->cols[0].ints[i] >= prev);
+            prev = b->cols[0].ints[i];
+        }
+        out += b->count;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%-10s budget=%-10ld threads=%-3d rows=%-10ld runs=%-6d passes=%-3d "
+            "time=%.3fs rows/s=%.0f %s\n", desc, opts->mem_budget, opts->threads, out,
+            exec_sort_runs(sort), exec_sort_passes(sort), elapsed, out / elapsed,
+            sorted ? "" : "(NOT SORTED)");
+
+    exec_close(sort);
+}
+
+
+int main(int argc, char **argv)
+{
+    long budget = (argc > 1) ? atol(argv[1]) : 16L * 1024 * 1024;
+    int factor = (argc > 2) ? atoi(argv[2]) : 10;
+    int threads = (argc > 3) ? atoi(argv[3]) : SORT_DEFAULT_THREADS;
+
+    // Each generated row takes 8 bytes, plus a pointer, in the sort buffer.
+    long rows = factor * (budget / (2 * sizeof(int) + sizeof(byte *)));
+
+    sort_opts opts;
+    sort_default_opts(&opts);
+    opts.threads = threads;
+
+    opts.mem_budget = budget;
+    run_sort("external", rows, &opts);
+
+    opts.mem_budget = rows * (2 * sizeof(int) + sizeof(byte *)) * 2;
+    run_sort("in-memory", rows, &opts);
+
+    return EXIT_SUCCESS;
+}
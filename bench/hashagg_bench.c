@@ -0,0 +1,73 @@
+/*
+ * hashagg_bench.c
+ *
+ * Measures hash aggregation throughput at a range of group cardinalities,
+ * from a handful of groups up to one group per input row.
+ *
+ * usage: hashagg_bench [rows] [threads] [mem_budget]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "hashagg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+int main(int argc, char **argv)
+{
+    long rows = (argc > 1) ? atol(argv[1]) : 10000000;
+    int threads = (argc > 2) ? atoi(argv[2]) : AGG_DEFAULT_THREADS;
+    long budget = (argc > 3) ? atol(argv[3]) : AGG_DEFAULT_MEM_BUDGET;
+
+    long cardinalities[] = {10, 1000, 100000, rows / 10, rows};
+    int card_cnt = sizeof(cardinalities) / sizeof(long);
+
+    // SELECT key, COUNT(*), SUM(payload), MIN(payload), MAX(payload),
+    //        AVG(payload) GROUP BY key
+    int groups[] = {0};
+    agg_spec aggs[] = {
+        {.func = AGG_COUNT},
+        {.func = AGG_SUM, .col = 1},
+        {.func = AGG_MIN, .col = 1},
+        {.func = AGG_MAX, .col = 1},
+        {.func = AGG_AVG, .col = 1},
+    };
+
+    printf("rows=%ld threads=%d mem_budget=%ld\n", rows, threads, budget);
+    printf("%-12s %-12s %-10s %-8s %-14s %s\n", "cardinality", "groups", "time(s)",
+            "spills", "rows/s", "groups/s");
+
+    for (int c=0; c<card_cnt; c++) {
+        agg_opts opts;
+        agg_default_opts(&opts);
+        opts.threads = threads;
+        opts.mem_budget = budget;
+
+        exec_op *agg = exec_hashagg(bench_gen_create(rows, cardinalities[c], 5), 1, groups,
+                5, aggs, &opts);
+
+        long out = 0;
+        batch *b;
+
+        double start = bench_now();
+        while ((b = exec_next(agg))) {
+            out += b->count;
+        }
+        double elapsed = bench_now() - start;
+
+        printf("%-12ld %-12ld %-10.3f %-8ld %-14.0f %.0f\n", cardinalities[c], out, elapsed,
+                exec_hashagg_spills(agg), rows / elapsed, out / elapsed);
+
+        exec_close(agg);
+    }
+
+    return EXIT_SUCCESS;
+}
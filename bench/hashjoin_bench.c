@@ -0,0 +1,61 @@
+/*
+ * hashjoin_bench.c
+ *
+ * Measures hash join throughput, in input tuples per second, against the
+ * number of join threads. The inputs are generated in memory so that the
+ * numbers reflect the join itself rather than the table scans.
+ *
+ * usage: hashjoin_bench [build_rows] [probe_rows] [max_threads] [mem_budget]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "hashjoin.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    long build_rows = (argc > 1) ? atol(argv[1]) : 2000000;
+    long probe_rows = (argc > 2) ? atol(argv[2]) : 8000000;
+    int max_threads = (argc > 3) ? atoi(argv[3]) : 8;
+    long budget = (argc > 4) ? atol(argv[4]) : HJ_DEFAULT_MEM_BUDGET;
+
+    printf("build=%ld probe=%ld mem_budget=%ld\n", build_rows, probe_rows, budget);
+    printf("%-8s %-10s %-12s %-10s %s\n", "threads", "time(s)", "matches", "spilled", "tuples/s");
+
+    for (int threads=1; threads<=max_threads; threads*=2) {
+        hj_opts opts;
+        hj_default_opts(&opts);
+        opts.threads = threads;
+        opts.mem_budget = budget;
+
+        exec_op *join = exec_hashjoin(bench_gen_create(build_rows, build_rows, 0),
+                bench_gen_create(probe_rows, build_rows, 17), 0, 0, &opts);
+
+        long matches = 0;
+        batch *b;
+
+        double start = bench_now();
+        while ((b = exec_next(join))) {
+            matches += b->count;
+        }
+        double elapsed = bench_now() - start;
+
+        printf("%-8d %-10.3f %-12ld %-10d %.0f\n", threads, elapsed, matches,
+                exec_hashjoin_spilled(join), (build_rows + probe_rows) / elapsed);
+
+        exec_close(join);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/*
+ * inserter_bench.c
+ *
+ * Insert scaling benchmark. record_cnt records are inserted into an empty
+ * table by 1 to max_threads threads at once, each inserting an equal
+ * share, in two ways:
+ *
+ *   locked    tbl_insert, serialized by a mutex around each call, which is
+ *             what sharing the table between threads takes without
+ *             inserters,
+ *   inserter  an inserter per thread (see inserter.h), with the session
+ *             ended (and the records packed and counted) inside the
+ *             timing.
+ *
+ * and the throughput of each is reported in records per second. The
+ * table has a unique index on its id column if run with index=1.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096).
+ *
+ * usage: inserter_bench [record_cnt] [max_threads] [pool_size] [index] [db_dir]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "art.h"
+#include "bench.h"
+#include "inserter.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, pad CHAR(60))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 60}
+};
+
+typedef struct worker_arg {
+    table *tbl;
+    pthread_mutex_t *lock;      // NULL to use an inserter
+    int from;
+    int to;
+    int errors;
+} worker_arg;
+
+
+static void *insert_worker(void *arg)
+{
+    worker_arg *w = arg;
+    byte rec[BLOCKSIZE] = {0};
+    inserter *ins = w->lock ? NULL : ins_open(w->tbl);
+
+    for (int i=w->from; i<w->to; i++) {
+        tp_setint(rec, 0, i);
+
+        if (ins) {
+            if (ins_insert(ins, rec) != 1) w->errors++;
+        } else {
+            pthread_mutex_lock(w->lock);
+            if (tbl_insert(w->tbl, rec) < 0) w->errors++;
+            pthread_mutex_unlock(w->lock);
+        }
+    }
+
+    if (ins) ins_close(ins);
+    return NULL;
+}
+
+
+static double run(char *db, int record_cnt, int threads, int index, int use_inserter)
+{
+    table *tbl = tbl_create("inserter", db, &bench_schema);
+    if (!tbl || (index && !tbl_art_create(tbl, 0))) {
+        fprintf(stderr, "failed to create table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t tids[threads];
+    worker_arg args[threads];
+    int errors = 0;
+
+    double start = bench_now();
+    if (use_inserter) tbl_ins_begin(tbl);
+
+    for (int t=0; t<threads; t++) {
+        args[t] = (worker_arg) {.tbl = tbl, .lock = use_inserter ? NULL : &lock,
+                                .from = (long) record_cnt * t / threads,
+                                .to = (long) record_cnt * (t + 1) / threads};
+        pthread_create(&tids[t], NULL, insert_worker, &args[t]);
+    }
+
+    for (int t=0; t<threads; t++) {
+        pthread_join(tids[t], NULL);
+        errors += args[t].errors;
+    }
+
+    if (use_inserter) tbl_ins_end(tbl);
+    double elapsed = bench_now() - start;
+
+    if (errors || tbl->record_cnt != record_cnt) {
+        fprintf(stderr, "%d errors, %d of %d records\n", errors, tbl->record_cnt, record_cnt);
+    }
+
+    tbl_close(tbl);
+    return record_cnt / elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 2000000;
+    int max_threads = (argc > 2) ? atoi(argv[2]) : 8;
+    int pool_size = (argc > 3) ? atoi(argv[3]) : 1024;
+    int index = (argc > 4) ? atoi(argv[4]) : 0;
+    char *db = (argc > 5) ? argv[5] : "bench/benchdb";
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    printf("records=%d pool=%d index=%s\n", record_cnt, pool_size, index ? "yes" : "no");
+    printf("threads  locked (M recs/s)  inserter (M recs/s)\n");
+
+    for (int threads=1; threads<=max_threads; threads*=2) {
+        double locked = run(db, record_cnt, threads, index, FALSE);
+        double ins = run(db, record_cnt, threads, index, TRUE);
+        printf("%7d  %18.2f  %19.2f\n", threads, locked / 1e6, ins / 1e6);
+    }
+
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ * lsm_bench.c
+ *
+ * Benchmark of LSM tables against heap tables under sustained writes. Each
+ * engine is run through two phases, with a buffer pool much smaller than
+ * the table:
+ *
+ *   ingest  record_cnt inserts of new keys, in random order,
+ *   upsert  update_cnt overwrites of existing keys chosen at random. The
+ *           heap updates the record in place (its keys are its record
+ *           ids), and the LSM table puts a new version.
+ *
+ * Each phase is timed until its writes are durable: the heap table is
+ * closed, writing back its dirty pages, and the LSM table flushed, with
+ * any merges it owes, and closed. Write amplification is the bytes
+ * written to the device (STAT_BYTES_WRITTEN) over the record bytes
+ * written by the phase.
+ *
+ * usage: lsm_bench [record_cnt] [update_cnt] [pool_size] [memtable_recs]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "lsm.h"
+#include "pgbuffer.h"
+#include "stats.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (key INT, val INT, pad CHAR(24))
+schema bench_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, CHAR},
+    .field_lengths = {0, 0, 24}
+};
+
+
+static long bytes_written()
+{
+    stat_snapshot snap;
+    stat_snapshot_get(&snap);
+    return snap.counters[STAT_BYTES_WRITTEN];
+}
+
+
+static void report(const char *engine, const char *phase, long cnt, int rec_len, double elapsed,
+                   long written)
+{
+    printf("%-5s %-7s %9ld records  %8.3f s  %7.3f Mrecs/s  write amp %6.2f\n", engine, phase,
+           cnt, elapsed, cnt / elapsed / 1e6, (double) written / ((double) cnt * rec_len));
+}
+
+
+/*
+ * Random keys in [0, cnt), each exactly once
+ */
+static int *shuffled(int cnt, unsigned int seed)
+{
+    int *keys = malloc(sizeof(int) * cnt);
+    for (int i=0; i<cnt; i++) keys[i] = i;
+
+    for (int i=cnt - 1; i>0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        int t = keys[i];
+        keys[i] = keys[j];
+        keys[j] = t;
+    }
+
+    return keys;
+}
+
+
+static void bench_heap(int record_cnt, int update_cnt, int *keys)
+{
+    byte rec[BLOCKSIZE] = {0};
+    unsigned int seed = 7;
+
+    table *tbl = tbl_create("lsmheap", "bench/benchdb", &bench_schema);
+    int rec_len = tbl->fields.record_length;
+
+    long base = bytes_written();
+    double start = bench_now();
+
+    // A heap's record ids are assigned in insert order, so store the keys
+    // in order, as the heap would need an index to find them otherwise
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, keys[i]);
+        tbl_insert(tbl, rec);
+    }
+
+    tbl_close(tbl);
+    report("heap", "ingest", record_cnt, rec_len, bench_now() - start, bytes_written() - base);
+
+    tbl = tbl_load("lsmheap", "bench/benchdb");
+    base = bytes_written();
+    start = bench_now();
+
+    for (int i=0; i<update_cnt; i++) {
+        int key = rand_r(&seed) % record_cnt;
+        tp_setint(rec, 0, key);
+        tp_setint(rec, 4, i);
+        tbl_update(tbl, key, rec);
+    }
+
+    tbl_close(tbl);
+    report("heap", "upsert", update_cnt, rec_len, bench_now() - start, bytes_written() - base);
+}
+
+
+static void bench_lsm(int record_cnt, int update_cnt, int *keys, int memtable_recs)
+{
+    byte rec[BLOCKSIZE] = {0};
+    unsigned int seed = 7;
+    lsm_opts opts;
+    lsm_default_opts(&opts);
+    opts.memtable_recs = memtable_recs;
+
+    table *tbl = tbl_create_lsm("lsmtree", "bench/benchdb", &bench_schema, 0, &opts);
+    int rec_len = tbl->fields.record_length;
+
+    long base = bytes_written();
+    double start = bench_now();
+
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, keys[i]);
+        tp_setint(rec, 4, i);
+        tbl_insert(tbl, rec);
+    }
+
+    lsm_flush(tbl->lsm);
+    lsm_stats stats;
+    lsm_stats_get(tbl->lsm, &stats);
+    tbl_close(tbl);
+    report("lsm", "ingest", record_cnt, rec_len, bench_now() - start, bytes_written() - base);
+
+    printf("      %ld flushes, %ld merges, runs per level:", stats.flushes, stats.merges);
+    for (int l=0; l<LSM_MAX_LEVELS && (l == 0 || stats.runs[l]); l++) printf(" %d", stats.runs[l]);
+    printf("\n");
+
+    tbl = tbl_load("lsmtree", "bench/benchdb");
+    base = bytes_written();
+    start = bench_now();
+
+    for (int i=0; i<update_cnt; i++) {
+        tp_setint(rec, 0, rand_r(&seed) % record_cnt);
+        tp_setint(rec, 4, i);
+        tbl_insert(tbl, rec);
+    }
+
+    lsm_flush(tbl->lsm);
+    lsm_stats_get(tbl->lsm, &stats);
+    tbl_close(tbl);
+    report("lsm", "upsert", update_cnt, rec_len, bench_now() - start, bytes_written() - base);
+
+    printf("      %ld flushes, %ld merges, runs per level:", stats.flushes, stats.merges);
+    for (int l=0; l<LSM_MAX_LEVELS && (l == 0 || stats.runs[l]); l++) printf(" %d", stats.runs[l]);
+    printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int update_cnt = (argc > 2) ? atoi(argv[2]) : 1000000;
+    int pool_size = (argc > 3) ? atoi(argv[3]) : 1024;
+    int memtable_recs = (argc > 4) ? atoi(argv[4]) : LSM_DEFAULT_MEMTABLE_RECS;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    printf("records=%d updates=%d pool=%d memtable=%d blocksize=%d\n", record_cnt, update_cnt,
+           pool_size, memtable_recs, BLOCKSIZE);
+
+    int *keys = shuffled(record_cnt, 42);
+    bench_heap(record_cnt, update_cnt, keys);
+    bench_lsm(record_cnt, update_cnt, keys, memtable_recs);
+
+    free(keys);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
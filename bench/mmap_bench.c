@@ -0,0 +1,140 @@
+/*
+ * mmap_bench.c
+ *
+ * Benchmark comparing read-only memory-mapped table access against the
+ * buffer pool. The table is loaded, closed, and read once so that the
+ * file is in the OS page cache, and then scanned in full and probed with
+ * random record reads through each access path.
+ *
+ * usage: mmap_bench [record_cnt] [pool_size] [lookups]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, ts INT, qty INT, price FLOAT, tag CHAR(8))
+schema bench_schema = {
+    .field_cnt = 5,
+    .field_types = {INT, INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 0, 8}
+};
+
+
+int load_table(int record_cnt)
+{
+    table *tbl = tbl_create("mmap", "bench/benchdb", &bench_schema);
+    if (!tbl) return 0;
+
+    byte rec[BLOCKSIZE] = {0};
+    srand(42);
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i / 16);
+        tp_setint(rec, 8, rand() % 1000);
+        tp_setfloat(rec, 12, (rand() % 100000) / 100.0);
+        tp_setchar(rec, 20, "tag", 8);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl_close(tbl);
+}
+
+
+double scan_table(table *tbl, long *sum)
+{
+    double start = bench_now();
+    exec_op *scan = exec_scan(tbl);
+
+    batch *b;
+    while ((b = exec_next(scan))) {
+        for (int i=0; i<b->count; i++) *sum += b->cols[2].ints[i];
+    }
+
+    exec_close(scan);
+    return bench_now() - start;
+}
+
+
+double probe_table(table *tbl, int lookups, long *sum)
+{
+    byte rec[BLOCKSIZE];
+    unsigned int seed = 7;
+
+    double start = bench_now();
+    for (int i=0; i<lookups; i++) {
+        tbl_read(tbl, rand_r(&seed) % tbl->record_cnt, rec);
+        *sum += tp_getasint(rec, 8);
+    }
+
+    return bench_now() - start;
+}
+
+
+void report(const char *mode, table *tbl, int lookups)
+{
+    long scan_sum = 0, probe_sum = 0;
+
+    // Run each access pattern twice, and report the second (warm) run
+    scan_table(tbl, &scan_sum);
+    scan_sum = 0;
+    double scan = scan_table(tbl, &scan_sum);
+
+    probe_table(tbl, lookups, &probe_sum);
+    probe_sum = 0;
+    double probe = probe_table(tbl, lookups, &probe_sum);
+
+    printf("%-18s %9.3f %10.1f %9.3f %10.1f   (checksums %ld %ld)\n", mode,
+           scan, tbl->record_cnt / scan / 1e6, probe, lookups / probe / 1e6,
+           scan_sum, probe_sum);
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int pool_size = (argc > 2) ? atoi(argv[2]) : 1024;
+    int lookups = (argc > 3) ? atoi(argv[3]) : 1000000;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    if (!load_table(record_cnt)) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("records=%d pool=%d lookups=%d blocksize=%d\n", record_cnt, pool_size, lookups, BLOCKSIZE);
+    printf("%-18s %9s %10s %9s %10s\n", "mode", "scan(s)", "Mrows/s", "probe(s)", "Mprobes/s");
+
+    table *tbl = tbl_load("mmap", "bench/benchdb");
+    report("buffered", tbl, lookups);
+    tbl_close(tbl);
+
+    tbl = tbl_load_mmap("mmap", "bench/benchdb", TBL_ACCESS_NORMAL);
+    report("mmap normal", tbl, lookups);
+    tbl_close(tbl);
+
+    tbl = tbl_load_mmap("mmap", "bench/benchdb", TBL_ACCESS_SEQUENTIAL);
+    report("mmap sequential", tbl, lookups);
+    tbl_close(tbl);
+
+    tbl = tbl_load_mmap("mmap", "bench/benchdb", TBL_ACCESS_RANDOM);
+    report("mmap random", tbl, lookups);
+    tbl_close(tbl);
+
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/*
+ * pgcompress_bench.c
+ *
+ * Benchmark for per-page compression. Loads the same synthetic table
+ * with each compression scheme, and reports the compression ratio along
+ * with the load time and full scan time through a small buffer pool, so
+ * that every page read during the scan must be decompressed.
+ *
+ * usage: pgcompress_bench [record_cnt] [pool_size]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "pgcompress.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, ts INT, qty INT, price FLOAT, tag CHAR(8))
+schema bench_schema = {
+    .field_cnt = 5,
+    .field_types = {INT, INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 0, 8}
+};
+
+static const char *names[] = {"none", "light", "lz4"};
+
+
+table *load_table(int compression, int record_cnt)
+{
+    table *tbl = tbl_create_compressed((char *) names[compression], "bench/benchdb", &bench_schema, compression);
+    if (!tbl) return NULL;
+
+    static const char *tags[] = {"red", "green", "blue", "yellow"};
+    byte rec[BLOCKSIZE];
+
+    srand(42);
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i / 16);
+        tp_setint(rec, 8, rand() % 1000);
+        tp_setfloat(rec, 12, (rand() % 100000) / 100.0);
+        tp_setchar(rec, 20, (char *) tags[rand() % 4], 8);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl;
+}
+
+
+double scan_table(table *tbl, long *sum)
+{
+    double start = bench_now();
+    exec_op *scan = exec_scan(tbl);
+
+    batch *b;
+    while ((b = exec_next(scan))) {
+        for (int i=0; i<b->count; i++) *sum += b->cols[2].ints[i];
+    }
+
+    exec_close(scan);
+    return bench_now() - start;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int pool_size = (argc > 2) ? atoi(argv[2]) : 64;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    printf("records=%d pool=%d blocksize=%d\n", record_cnt, pool_size, BLOCKSIZE);
+    printf("%-6s %10s %12s %7s %9s %9s\n", "scheme", "blocks", "stored", "ratio", "load(s)", "scan(s)");
+
+    for (int c=PGC_NONE; c<=PGC_LZ4; c++) {
+        double start = bench_now();
+        table *tbl = load_table(c, record_cnt);
+        if (!tbl) {
+            fprintf(stderr, "failed to create table\n");
+            return EXIT_FAILURE;
+        }
+
+        // Write everything back so that the scan starts from storage
+        buff_evict_tbl(tbl);
+        double load = bench_now() - start;
+
+        long sum = 0;
+        double scan = scan_table(tbl, &sum);
+
+        long raw = (long) (tbl_blk_cnt(tbl) - TBL_FIRST_BLK) * BLOCKSIZE;
+        long stored = pgc_stored_bytes(tbl);
+        if (c == PGC_NONE) stored = raw;
+
+        printf("%-6s %10d %12ld %7.2f %9.3f %9.3f   (checksum %ld)\n", names[c],
+               tbl_blk_cnt(tbl) - TBL_FIRST_BLK, stored, (double) raw / stored, load, scan, sum);
+
+        tbl_close(tbl);
+    }
+
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
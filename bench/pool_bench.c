@@ -0,0 +1,135 @@
+/*
+ * pool_bench.c
+ *
+ * Benchmark for buffer pool frame lookup and access. A table is sized to
+ * fit entirely within the pool and loaded, after which random blocks are
+ * repeatedly pinned, read from, and unpinned, so that the cost measured is
+ * that of finding a resident frame and touching its data, rather than of
+ * any I/O. The same is then done with the pins made batch_size at a time
+ * through buff_pin_batch, whose unpins need no lookup.
+ *
+ * Finally the table is evicted and read back in ranges of batch_size
+ * blocks, once pinning block by block, and once a range at a time, whose
+ * misses are read together.
+ *
+ * usage: pool_bench [pool_size] [pins] [batch_size]
+ *
+ * To see the TLB behaviour, run it under perf, e.g.
+ *      perf stat -e dTLB-loads,dTLB-load-misses ./bench/pool_bench
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, pad CHAR(46))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 46}
+};
+
+
+int main(int argc, char **argv)
+{
+    int pool_size = (argc > 1) ? atoi(argv[1]) : 8192;
+    long pins = (argc > 2) ? atol(argv[2]) : 200000;
+    int batch_size = (argc > 3) ? atoi(argv[3]) : 8;
+    if (batch_size < 1 || batch_size > BUFF_PIN_RUN) batch_size = 8;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    table *tbl = tbl_create("pool", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    // Leave one frame free for the header block
+    int per_blk = tbl_recs_per_blk(tbl);
+    int blk_cnt = pool_size - 1;
+
+    byte rec[BLOCKSIZE] = {0};
+    double start = bench_now();
+    for (int i=0; i<blk_cnt * per_blk; i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+    double load = bench_now() - start;
+
+    unsigned int seed = 42;
+    long sum = 0;
+
+    start = bench_now();
+    for (long i=0; i<pins; i++) {
+        int blk_no = TBL_FIRST_BLK + rand_r(&seed) % blk_cnt;
+        page *pg = buff_pin(tbl, blk_no);
+        sum += pg_getint(pg, (rand_r(&seed) % per_blk) * tbl->fields.record_length);
+        buff_unpin(tbl, blk_no);
+    }
+    double elapsed = bench_now() - start;
+
+    buff_handle hs[BUFF_PIN_RUN];
+    start = bench_now();
+    for (long i=0; i<pins; i+=batch_size) {
+        for (int k=0; k<batch_size; k++) {
+            hs[k] = (buff_handle) {.tbl = tbl, .blk_no = TBL_FIRST_BLK + rand_r(&seed) % blk_cnt};
+        }
+
+        buff_pin_batch(hs, batch_size);
+        for (int k=0; k<batch_size; k++) {
+            sum += pg_getint(hs[k].pg, (rand_r(&seed) % per_blk) * tbl->fields.record_length);
+        }
+        buff_unpin_batch(hs, batch_size);
+    }
+    double batched = bench_now() - start;
+
+    // Cold ranges, block by block and then batched
+    double ranges[2];
+    for (int mode=0; mode<2; mode++) {
+        buff_evict_tbl(tbl);
+        start = bench_now();
+
+        for (int first=TBL_FIRST_BLK; first + batch_size <= TBL_FIRST_BLK + blk_cnt;
+                first+=batch_size) {
+            if (mode == 0) {
+                for (int k=0; k<batch_size; k++) {
+                    sum += pg_getint(buff_pin(tbl, first + k), 0);
+                    buff_unpin(tbl, first + k);
+                }
+                continue;
+            }
+
+            for (int k=0; k<batch_size; k++) hs[k] = (buff_handle) {.tbl = tbl, .blk_no = first + k};
+            buff_pin_batch(hs, batch_size);
+            for (int k=0; k<batch_size; k++) sum += pg_getint(hs[k].pg, 0);
+            buff_unpin_batch(hs, batch_size);
+        }
+
+        ranges[mode] = bench_now() - start;
+    }
+
+    static const char *huge[] = {"none", "transparent", "explicit"};
+    printf("pool=%d blocks=%d pins=%ld hugepages=%s numa_nodes=%d\n", pool_size, blk_cnt,
+           pins, huge[buff_pool_hugepages()], buff_pool_nodes());
+    printf("load %.3fs  pins %.3fs  %.1f ns/pin  batched by %d %.1f ns/pin  (checksum %ld)\n",
+           load, elapsed, elapsed / pins * 1e9, batch_size, batched / pins * 1e9, sum);
+    printf("cold ranges of %d blocks: one at a time %.3fs  batched %.3fs\n", batch_size,
+           ranges[0], ranges[1]);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/*
+ * pscan_bench.c
+ *
+ * Benchmark for morsel-driven parallel scans. A table is loaded into a
+ * pool large enough to hold it, and then scanned with 1, 2, 4, ... up to
+ * max_threads threads, with two per-thread pipelines:
+ *
+ *   scan   counts the rows and sums one column,
+ *   agg    SUM(val), COUNT(*) GROUP BY grp over 64 groups, kept in
+ *          per-thread arrays that are merged after the scan.
+ *
+ * The single-threaded executor scan is reported alongside as a baseline.
+ * Each is run over the table through the buffer pool, and then again with
+ * the table opened with tbl_load_mmap, which takes the pool's frame lookup
+ * out of the per-block cost.
+ *
+ * usage: pscan_bench [record_cnt] [max_threads] [morsel_blks]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "pscan.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GROUPS 64
+
+// (id INT, grp INT, val FLOAT)
+schema bench_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, FLOAT},
+    .field_lengths = {0, 0, 0}
+};
+
+
+typedef struct agg_local {
+    double sums[GROUPS];
+    long counts[GROUPS];
+    long rows;
+    char pad[64];
+} agg_local;
+
+
+static int scan_pipeline(batch *b, int thread, void *ctx)
+{
+    agg_local *loc = (agg_local *) ctx + thread;
+    double sum = 0;
+
+    for (int i=0; i<b->count; i++) sum += b->cols[2].floats[i];
+
+    loc->sums[0] += sum;
+    loc->rows += b->count;
+    return 1;
+}
+
+
+static int agg_pipeline(batch *b, int thread, void *ctx)
+{
+    agg_local *loc = (agg_local *) ctx + thread;
+
+    for (int i=0; i<b->count; i++) {
+        int g = b->cols[1].ints[i];
+        loc->sums[g] += b->cols[2].floats[i];
+        loc->counts[g]++;
+    }
+
+    loc->rows += b->count;
+    return 1;
+}
+
+
+static double run(table *tbl, int threads, int morsel_blks, ps_pipeline fn, ps_stats *stats,
+                  double *check)
+{
+    agg_local *locs = calloc(threads, sizeof(agg_local));
+    ps_opts opts = {.threads = threads, .morsel_blks = morsel_blks};
+
+    double start = bench_now();
+    ps_run(tbl, &opts, fn, locs, stats);
+
+    // Merge the per-thread states
+    double total = 0;
+    for (int t=0; t<threads; t++) {
+        for (int g=0; g<GROUPS; g++) total += locs[t].sums[g];
+    }
+    double elapsed = bench_now() - start;
+
+    *check = total;
+    free(locs);
+    return elapsed;
+}
+
+
+static void bench_table(table *tbl, const char *label, int record_cnt, int max_threads,
+                        int morsel_blks)
+{
+    // Baseline: the single-threaded executor scan
+    double start = bench_now();
+    exec_op *scan = exec_scan(tbl);
+    double base_sum = 0;
+    batch *b;
+    while ((b = exec_next(scan))) {
+        for (int i=0; i<b->count; i++) base_sum += b->cols[2].floats[i];
+    }
+    exec_close(scan);
+    double base = bench_now() - start;
+    printf("%s exec_scan   1 thread   %7.1f Mrows/s\n", label, record_cnt / base / 1e6);
+
+    for (int threads=1; threads<=max_threads; threads*=2) {
+        ps_stats stats;
+        double check;
+
+        double t_scan = run(tbl, threads, morsel_blks, scan_pipeline, &stats, &check);
+        double t_agg = run(tbl, threads, morsel_blks, agg_pipeline, &stats, &check);
+
+        printf("%s pscan  %3d threads   scan %7.1f Mrows/s   agg %7.1f Mrows/s   "
+               "(%.2fx vs exec_scan, %ld/%ld morsels stolen)\n", label,
+               threads, record_cnt / t_scan / 1e6, record_cnt / t_agg / 1e6, base / t_scan,
+               stats.stolen, stats.morsels);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 2000000;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 2) ? atoi(argv[2]) : (ncpu > 4 ? ncpu : 4);
+    int morsel_blks = (argc > 3) ? atoi(argv[3]) : PS_DEFAULT_MORSEL_BLKS;
+
+    mkdir("bench/benchdb", 0777);
+
+    table *tbl = tbl_create("pscan", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    int blk_cnt = (record_cnt + tbl_recs_per_blk(tbl) - 1) / tbl_recs_per_blk(tbl);
+    buff_pool_init(blk_cnt + 16);
+
+    byte rec[BLOCKSIZE] = {0};
+    unsigned int seed = 42;
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, rand_r(&seed) % GROUPS);
+        tp_setfloat(rec, 8, (rand_r(&seed) % 10000) / 100.0);
+        tbl_insert(tbl, rec);
+    }
+
+    printf("records=%d blocks=%d morsel=%d blocks cpus=%ld\n", record_cnt, blk_cnt,
+           morsel_blks, ncpu);
+
+    bench_table(tbl, "pool", record_cnt, max_threads, morsel_blks);
+    tbl_close(tbl);
+
+    tbl = tbl_load_mmap("pscan", "bench/benchdb", TBL_ACCESS_SEQUENTIAL);
+    bench_table(tbl, "mmap", record_cnt, max_threads, morsel_blks);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
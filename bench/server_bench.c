@@ -0,0 +1,263 @@
+/*
+ * server_bench.c
+ *
+ * A load generator for the yahi-db server (see server.h). It loads a table
+ * of record_cnt records (key INT, value CHAR(24)) through the server, and
+ * then drives it from a number of client connections, each on its own
+ * thread and each keeping up to depth requests in flight, pipelined. The
+ * requests are reads of random records, with the given percentage of
+ * them being updates instead. It reports the requests per second across
+ * all connections, and percentiles of the latency of each request, from
+ * when it was sent to when its response arrived.
+ *
+ * By default the server is run in-process, on bench/benchdb; with -s it
+ * connects to a server already listening on the given socket instead.
+ *
+ * usage: server_bench [-s socket] [-c connections] [-d depth]
+ *                     [-n requests_per_connection] [-r record_cnt]
+ *                     [-u update_pct] [-p pool_size] [-w workers]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "client.h"
+#include "pgbuffer.h"
+#include "server.h"
+#include "table.h"
+#include "types.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 4096
+
+// (key INT, value CHAR(24))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 24}
+};
+
+typedef struct conn_arg {
+    char *path;
+    int tbl;
+    int rec_len;
+    int record_cnt;
+    int depth;
+    int requests;
+    int update_pct;
+    unsigned int seed;
+
+    double *latencies;
+    int errors;
+} conn_arg;
+
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+
+static void *conn_worker(void *arg)
+{
+    conn_arg *c = arg;
+    srv_client *cli = cli_connect(c->path);
+    if (!cli) {
+        c->errors++;
+        return NULL;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    double sent_at[MAX_DEPTH];
+    int sent = 0, done = 0;
+    srv_resp resp;
+    char *payload;
+
+    while (done < c->requests) {
+        // Top up the window, and send the new requests together
+        double now = bench_now();
+        while (sent < c->requests && sent - done < c->depth) {
+            uint32_t rid = rand_r(&c->seed) % c->record_cnt;
+            if ((int) (rand_r(&c->seed) % 100) < c->update_pct) {
+                tp_setint(rec, 0, rid);
+                tp_setchar(rec, 4, "updated", 24);
+                cli_queue(cli, SRV_UPDATE, c->tbl, &rid, sizeof(rid), rec, c->rec_len);
+            } else {
+                cli_queue(cli, SRV_READ, c->tbl, &rid, sizeof(rid), NULL, 0);
+            }
+
+            sent_at[sent++ % c->depth] = now;
+        }
+
+        if (!cli_flush(cli)) break;
+
+        // Take the next response, and any others which came with it
+        do {
+            if (!cli_recv(cli, &resp, &payload)) goto fail;
+            if (resp.status != 1) c->errors++;
+
+            c->latencies[done] = bench_now() - sent_at[done % c->depth];
+            done++;
+        } while (done < sent && cli_buffered(cli));
+    }
+
+    cli_close(cli);
+    return NULL;
+
+fail:
+    c->errors++;
+    cli_close(cli);
+    return NULL;
+}
+
+
+/*
+ * Create the table and insert its records, pipelined in batches.
+ */
+static int load(char *path, int record_cnt, int *rec_len)
+{
+    srv_client *cli = cli_connect(path);
+    if (!cli) return -1;
+
+    int tbl = cli_create(cli, "srvbench", &bench_schema, rec_len);
+    if (tbl < 0) {
+        cli_close(cli);
+        return -1;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    srv_resp resp;
+    char *payload;
+
+    for (int i=0; i<record_cnt; i+=1024) {
+        int cnt = (record_cnt - i < 1024) ? record_cnt - i : 1024;
+        for (int j=0; j<cnt; j++) {
+            tp_setint(rec, 0, i + j);
+            tp_setchar(rec, 4, "loaded", 24);
+            cli_queue(cli, SRV_INSERT, tbl, rec, *rec_len, NULL, 0);
+        }
+
+        cli_flush(cli);
+        for (int j=0; j<cnt; j++) {
+            if (!cli_recv(cli, &resp, &payload) || resp.status < 0) tbl = -1;
+        }
+    }
+
+    cli_close(cli);
+    return tbl;
+}
+
+
+int main(int argc, char **argv)
+{
+    char *path = NULL;
+    int conns = 4;
+    int depth = 32;
+    int requests = 200000;
+    int record_cnt = 100000;
+    int update_pct = 10;
+    int pool_size = 4096;
+    srv_opts opts;
+    srv_default_opts(&opts);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:d:n:r:u:p:w:h")) != -1) {
+        switch (opt) {
+            case 's': path = optarg; break;
+            case 'c': conns = atoi(optarg); break;
+            case 'd': depth = atoi(optarg); break;
+            case 'n': requests = atoi(optarg); break;
+            case 'r': record_cnt = atoi(optarg); break;
+            case 'u': update_pct = atoi(optarg); break;
+            case 'p': pool_size = atoi(optarg); break;
+            case 'w': opts.workers = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: server_bench [-s socket] [-c connections] [-d depth] "
+                        "[-n requests_per_connection] [-r record_cnt] [-u update_pct] "
+                        "[-p pool_size] [-w workers]\n");
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (conns <= 0 || depth <= 0 || depth > MAX_DEPTH || requests <= 0 || record_cnt <= 0) {
+        fprintf(stderr, "server_bench: bad arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    server *srv = NULL;
+    if (!path) {
+        path = "bench/benchdb/yahid.sock";
+        mkdir("bench/benchdb", 0777);
+        buff_pool_init(pool_size);
+        srv = srv_start(path, "bench/benchdb", &opts);
+        if (!srv) {
+            fprintf(stderr, "server_bench: could not start a server on %s\n", path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int rec_len;
+    int tbl = load(path, record_cnt, &rec_len);
+    if (tbl < 0) {
+        fprintf(stderr, "server_bench: could not load the table through %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    printf("connections=%d depth=%d requests=%d records=%d updates=%d%%\n", conns, depth, requests,
+           record_cnt, update_pct);
+    if (srv) printf("in-process server, %d workers, pool %d pages\n", opts.workers, pool_size);
+    else printf("server on %s\n", path);
+
+    pthread_t tids[conns];
+    conn_arg *args = calloc(conns, sizeof(conn_arg));
+    double *latencies = calloc((long) conns * requests, sizeof(double));
+
+    double start = bench_now();
+    for (int i=0; i<conns; i++) {
+        args[i] = (conn_arg) {.path = path, .tbl = tbl, .rec_len = rec_len,
+                              .record_cnt = record_cnt, .depth = depth, .requests = requests,
+                              .update_pct = update_pct, .seed = i + 1,
+                              .latencies = latencies + (long) i * requests};
+        pthread_create(&tids[i], NULL, conn_worker, &args[i]);
+    }
+
+    int errors = 0;
+    for (int i=0; i<conns; i++) {
+        pthread_join(tids[i], NULL);
+        errors += args[i].errors;
+    }
+    double elapsed = bench_now() - start;
+
+    long total = (long) conns * requests;
+    qsort(latencies, total, sizeof(double), cmp_double);
+
+    printf("%ld requests  %8.3f s  %9.0f req/s  latency us: p50 %.1f  p99 %.1f  p99.9 %.1f  "
+           "max %.1f  (%d errors)\n", total, elapsed, total / elapsed, latencies[total / 2] * 1e6,
+           latencies[total * 99 / 100] * 1e6, latencies[total * 999 / 1000] * 1e6,
+           latencies[total - 1] * 1e6, errors);
+
+    if (srv) {
+        srv_stats stats;
+        srv_stats_get(srv, &stats);
+        printf("server: %ld requests in %ld batches (%.1f per batch)\n", stats.requests,
+               stats.batches, (double) stats.requests / stats.batches);
+
+        srv_stop(srv);
+        buff_pool_destroy();
+    }
+
+    free(latencies);
+    free(args);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/*
+ * ssdcache_bench.c
+ *
+ * Benchmark for the second-tier page cache. A table several times the size
+ * of the buffer pool is loaded, and blocks are then pinned at random, with
+ * most pins going to a hot set larger than the pool but smaller than the
+ * cache. The same workload is run with no cache, and with caches using
+ * each admission policy, and the hit ratio and read latency of each tier
+ * (pool, cache, table file) are reported, from stat_tiers.
+ *
+ * Before each run the operating system is asked to drop its own cached
+ * copy of the table's file (but not of the cache's), standing in for a
+ * backing volume too large for the OS to keep in memory. Put the cache
+ * file on fast local storage, and the table on the slow volume, to see
+ * real figures.
+ *
+ * Build it with a realistic block size (make BLOCKSIZE=4096).
+ *
+ * usage: ssdcache_bench [pool_size] [pins] [cache_path] [db_dir]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "pgbuffer.h"
+#include "ssdcache.h"
+#include "stats.h"
+#include "table.h"
+#include "types.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, pad CHAR(60))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 60}
+};
+
+#define TABLE_FACTOR 8      // table blocks per pool frame
+#define CACHE_FACTOR 4      // cache slots per pool frame
+#define HOT_FACTOR 3        // hot blocks per pool frame
+#define HOT_PCT 90
+
+
+static void run(table *tbl, int blk_cnt, int hot_cnt, long pins, const char *label)
+{
+    fflush(tbl->file);
+    posix_fadvise(fileno(tbl->file), 0, 0, POSIX_FADV_DONTNEED);
+
+    stat_reset();
+    unsigned int seed = 42;
+    long sum = 0;
+
+    double start = bench_now();
+    for (long i=0; i<pins; i++) {
+        int r = rand_r(&seed);
+        int blk_no = TBL_FIRST_BLK + ((r % 100 < HOT_PCT) ? rand_r(&seed) % hot_cnt :
+                                                            rand_r(&seed) % blk_cnt);
+        page *pg = buff_pin(tbl, blk_no);
+        sum += pg_getint(pg, 0);
+        buff_unpin(tbl, blk_no);
+    }
+    double elapsed = bench_now() - start;
+
+    stat_snapshot snap;
+    stat_tier tiers[STAT_TIER_CNT];
+    stat_snapshot_get(&snap);
+    stat_tiers(&snap, tiers);
+
+    static const char *names[] = {"pool", "cache", "disk"};
+    printf("%-16s %8.0f ns/pin  (checksum %ld)\n", label, elapsed / pins * 1e9, sum);
+    for (int t=0; t<STAT_TIER_CNT; t++) {
+        if (tiers[t].lookups == 0) continue;
+        printf("    %-6s lookups %9ld  hit ratio %6.2f%%  read mean %9.0f ns  p99 %9ld ns\n",
+               names[t], tiers[t].lookups, tiers[t].hit_ratio * 100, tiers[t].mean_ns,
+               tiers[t].p99_ns);
+    }
+    printf("    cache writes %ld (mean %.0f ns)\n", snap.counters[STAT_CACHE_ADMITS],
+           stat_hist_mean(&snap.hists[STAT_HIST_CACHE_WRITE]));
+}
+
+
+int main(int argc, char **argv)
+{
+    int pool_size = (argc > 1) ? atoi(argv[1]) : 1024;
+    long pins = (argc > 2) ? atol(argv[2]) : 500000;
+    char *cache_path = (argc > 3) ? argv[3] : "bench/benchdb/ssd.cache";
+    char *db = (argc > 4) ? argv[4] : "bench/benchdb";
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+    buff_pool *pool = buff_pool_default();
+
+    table *tbl = tbl_create("ssdcache", db, &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    int blk_cnt = TABLE_FACTOR * pool_size;
+    int hot_cnt = HOT_FACTOR * pool_size;
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<blk_cnt * tbl_recs_per_blk(tbl); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+
+    printf("pool=%d frames  table=%d blocks  hot=%d blocks (%d%% of pins)  cache=%d slots\n",
+           pool_size, blk_cnt, hot_cnt, HOT_PCT, CACHE_FACTOR * pool_size);
+
+    buff_evict_tbl(tbl);
+    run(tbl, blk_cnt, hot_cnt, pins, "no cache");
+
+    int policies[] = {SC_ADMIT_ALL, SC_ADMIT_REPEAT};
+    const char *labels[] = {"cache, admit all", "cache, repeat"};
+
+    for (int p=0; p<2; p++) {
+        sc_cache *cache = sc_create(cache_path, CACHE_FACTOR * pool_size, policies[p]);
+        if (!cache) {
+            fprintf(stderr, "failed to create cache at %s\n", cache_path);
+            return EXIT_FAILURE;
+        }
+
+        buff_evict_tbl(tbl);
+        buff_pool_set_cache(pool, cache);
+        run(tbl, blk_cnt, hot_cnt, pins, labels[p]);
+
+        buff_evict_tbl(tbl);
+        buff_pool_set_cache(pool, NULL);
+        sc_free(cache);
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
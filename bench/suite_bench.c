@@ -0,0 +1,547 @@
+/*
+ * suite_bench.c
+ *
+ * The standard benchmark suite, run by `make bench`. It loads a key/value
+ * table (key INT, value CHAR) and runs, in turn:
+ *
+ *      a, b, c, d, e, f    YCSB core workloads A-F
+ *      scan                full sequential scan through the executor
+ *      blkread, blkwrite   random blk_read / blk_write of single blocks
+ *      pin                 random buff_pin / buff_unpin of table blocks
+ *
+ * Keys are record ids. Workloads A-C, E and F draw keys from a scrambled
+ * zipfian distribution (theta 0.99), and D from a "latest" distribution
+ * skewed towards recent inserts. Each result is written to stdout as a
+ * single line of JSON, recording the configuration along with throughput,
+ * latency percentiles and the buffer pool hit ratio.
+ *
+ * usage: suite_bench [-r records] [-o ops] [-p pool_size] [-t threads]
+ *                    [-v value_len] [-w workloads] [-s seed]
+ *
+ * where workloads is a comma-separated list of the names above (default
+ * all). The block size is fixed at build time, by make BLOCKSIZE=n.
+ *
+ * Tables take one writer at a time, and their reads may not overlap
+ * their writes, so with more than one thread the YCSB operations are
+ * serialized by a driver lock. The buffer pool takes concurrent pins, so
+ * the pin benchmark runs fully in parallel, as do the block I/O ones.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "blockio.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "stats.h"
+#include "table.h"
+#include "types.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SUITE_DB "bench/benchdb"
+#define SUITE_BLK_FILE SUITE_DB "/blkio.dat"
+#define ZIPF_THETA 0.99
+#define MAX_SCAN_LEN 100
+#define MAX_THREADS 64
+
+#define OP_READ 0
+#define OP_UPDATE 1
+#define OP_INSERT 2
+#define OP_SCAN 3
+#define OP_RMW 4
+#define OP_CNT 5
+
+typedef struct suite_config {
+    int records;
+    long ops;
+    int pool_size;
+    int threads;
+    int value_len;
+    unsigned long seed;
+} suite_config;
+
+typedef struct workload {
+    const char *name;
+    int mix[OP_CNT];    // percentage of each operation
+    int latest;         // draw keys from the latest distribution
+} workload;
+
+static const workload ycsb[] = {
+    {"a", {50, 50, 0, 0, 0}, 0},
+    {"b", {95, 5, 0, 0, 0}, 0},
+    {"c", {100, 0, 0, 0, 0}, 0},
+    {"d", {95, 0, 5, 0, 0}, 1},
+    {"e", {0, 0, 5, 95, 0}, 0},
+    {"f", {50, 0, 0, 0, 50}, 0},
+};
+
+typedef struct zipf {
+    long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipf;
+
+typedef struct worker {
+    pthread_t thread;
+    int id;
+    long ops;
+    uint64_t rng;
+    const workload *wl;
+    stat_hist latency;
+} worker;
+
+static suite_config cfg = {
+    .records = 100000,
+    .ops = 100000,
+    .pool_size = 1024,
+    .threads = 1,
+    .value_len = 96,
+    .seed = 42,
+};
+
+static table *tbl;
+static zipf key_dist;
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The operation run by each worker, and its argument
+static void (*suite_op)(worker *w);
+
+
+static inline uint64_t rng_next(uint64_t *state)
+{
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+static inline double rng_uniform(uint64_t *state)
+{
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/*
+ * The zipfian generator of Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases", as used by YCSB.
+ */
+static void zipf_init(zipf *z, long n, double theta)
+{
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = 0;
+    for (long i=1; i<=n; i++) z->zetan += 1.0 / pow(i, theta);
+
+    double zeta2 = 1.0 + 1.0 / pow(2, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+
+static long zipf_next(zipf *z, uint64_t *rng)
+{
+    double u = rng_uniform(rng);
+    double uz = u * z->zetan;
+
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+
+    long v = (long) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return (v < z->n) ? v : z->n - 1;
+}
+
+
+/*
+ * Spread the popular keys across the key space, as YCSB does, so that
+ * they don't all share a few blocks.
+ */
+static long zipf_scrambled(zipf *z, uint64_t *rng)
+{
+    uint64_t v = zipf_next(z, rng);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i=0; i<8; i++) {
+        hash ^= v & 0xff;
+        hash *= 0x100000001b3ULL;
+        v >>= 8;
+    }
+
+    return hash % z->n;
+}
+
+
+static long next_key(worker *w)
+{
+    long cnt = tbl->record_cnt;
+
+    if (w->wl->latest) {
+        long back = zipf_next(&key_dist, &w->rng);
+        return (back < cnt) ? cnt - 1 - back : 0;
+    }
+
+    long key = zipf_scrambled(&key_dist, &w->rng);
+    return (key < cnt) ? key : cnt - 1;
+}
+
+
+static void fill_value(byte *rec, long key, uint64_t *rng)
+{
+    tp_setint(rec, 0, key);
+    for (int i=0; i<cfg.value_len; i++) {
+        rec[sizeof(int) + i] = 'a' + rng_next(rng) % 26;
+    }
+}
+
+
+static void lock_engine()
+{
+    if (cfg.threads > 1) pthread_mutex_lock(&engine_lock);
+}
+
+
+static void unlock_engine()
+{
+    if (cfg.threads > 1) pthread_mutex_unlock(&engine_lock);
+}
+
+
+static void ycsb_op(worker *w)
+{
+    byte rec[BLOCKSIZE];
+    int choice = rng_next(&w->rng) % 100;
+    int op = 0;
+
+    while (choice >= w->wl->mix[op]) {
+        choice -= w->wl->mix[op];
+        op++;
+    }
+
+    if (op == OP_INSERT) {
+        fill_value(rec, 0, &w->rng);
+        lock_engine();
+        tp_setint(rec, 0, tbl->record_cnt);
+        tbl_insert(tbl, rec);
+        unlock_engine();
+        return;
+    }
+
+    if (op == OP_UPDATE) fill_value(rec, 0, &w->rng);
+
+    lock_engine();
+    long key = next_key(w);
+
+    switch (op) {
+        case OP_READ:
+            tbl_read(tbl, key, rec);
+            break;
+        case OP_UPDATE:
+            tp_setint(rec, 0, key);
+            tbl_update(tbl, key, rec);
+            break;
+        case OP_SCAN: {
+            int len = 1 + rng_next(&w->rng) % MAX_SCAN_LEN;
+            for (int i=0; i<len && tbl_read(tbl, key + i, rec); i++);
+            break;
+        }
+        case OP_RMW:
+            tbl_read(tbl, key, rec);
+            rec[sizeof(int)]++;
+            tbl_update(tbl, key, rec);
+            break;
+    }
+
+    unlock_engine();
+}
+
+
+static FILE *blk_files[MAX_THREADS];
+static int blk_cnt;
+
+static void blk_read_op(worker *w)
+{
+    byte data[BLOCKSIZE];
+    blk_read(blk_files[w->id], rng_next(&w->rng) % blk_cnt, data);
+}
+
+
+static void blk_write_op(worker *w)
+{
+    byte data[BLOCKSIZE];
+    memset(data, w->id, BLOCKSIZE);
+    blk_write(blk_files[w->id], rng_next(&w->rng) % blk_cnt, data);
+}
+
+
+static void pin_op(worker *w)
+{
+    int blk_no = TBL_FIRST_BLK + rng_next(&w->rng) % tbl_blk_cnt(tbl);
+
+    // No lock: the table isn't written while this runs
+    page *pg = buff_pin(tbl, blk_no);
+    if (!pg) return;
+
+    volatile int v = pg_getint(pg, 0);
+    (void) v;
+    buff_unpin(tbl, blk_no);
+}
+
+
+static void *worker_main(void *arg)
+{
+    worker *w = arg;
+
+    for (long i=0; i<w->ops; i++) {
+        long start = stat_clock();
+        suite_op(w);
+        long ns = stat_clock() - start;
+
+        w->latency.counts[stat_hist_bucket(ns)]++;
+        w->latency.total++;
+        w->latency.sum += ns;
+    }
+
+    return NULL;
+}
+
+
+static void report(const char *name, long ops, double secs, stat_hist *latency, long rows)
+{
+    stat_snapshot snap;
+    stat_snapshot_get(&snap);
+
+    long lookups = snap.counters[STAT_HITS] + snap.counters[STAT_MISSES];
+    double hit_ratio = lookups ? (double) snap.counters[STAT_HITS] / lookups : 0.0;
+
+    printf("{\"bench\":\"%s\",\"blocksize\":%d,\"pool\":%d,\"threads\":%d,\"records\":%d,"
+           "\"value_len\":%d,\"ops\":%ld,\"secs\":%.6f,\"ops_per_sec\":%.1f,",
+           name, BLOCKSIZE, cfg.pool_size, cfg.threads, cfg.records, cfg.value_len,
+           ops, secs, ops / secs);
+
+    if (latency) {
+        printf("\"mean_ns\":%.1f,\"p50_ns\":%ld,\"p95_ns\":%ld,\"p99_ns\":%ld,\"max_ns\":%ld,",
+               stat_hist_mean(latency), stat_hist_percentile(latency, 50),
+               stat_hist_percentile(latency, 95), stat_hist_percentile(latency, 99),
+               stat_hist_percentile(latency, 100));
+    }
+
+    if (rows >= 0) printf("\"rows\":%ld,", rows);
+
+    printf("\"hit_ratio\":%.4f,\"blk_reads\":%ld,\"blk_writes\":%ld}\n", hit_ratio,
+           snap.counters[STAT_BLK_READS], snap.counters[STAT_BLK_WRITES]);
+    fflush(stdout);
+}
+
+
+/*
+ * Run cfg.ops invocations of op, split across cfg.threads workers, and
+ * report the result under name.
+ */
+static void run(const char *name, void (*op)(worker *w), const workload *wl)
+{
+    worker workers[MAX_THREADS];
+    suite_op = op;
+
+    for (int t=0; t<cfg.threads; t++) {
+        memset(&workers[t], 0, sizeof(worker));
+        workers[t].id = t;
+        workers[t].ops = cfg.ops / cfg.threads + (t < cfg.ops % cfg.threads);
+        workers[t].rng = cfg.seed * 0x9E3779B97F4A7C15ULL + t + 1;
+        workers[t].wl = wl;
+    }
+
+    stat_reset();
+    double start = bench_now();
+
+    for (int t=1; t<cfg.threads; t++) {
+        pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+    }
+    worker_main(&workers[0]);
+    for (int t=1; t<cfg.threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    double secs = bench_now() - start;
+
+    stat_hist latency = {0};
+    for (int t=0; t<cfg.threads; t++) {
+        for (int b=0; b<STAT_HIST_BUCKETS; b++) latency.counts[b] += workers[t].latency.counts[b];
+        latency.total += workers[t].latency.total;
+        latency.sum += workers[t].latency.sum;
+    }
+
+    report(name, cfg.ops, secs, &latency, -1);
+}
+
+
+static void run_scan()
+{
+    stat_reset();
+    double start = bench_now();
+
+    long rows = 0;
+    exec_op *scan = exec_scan(tbl);
+    batch *b;
+    while ((b = exec_next(scan))) rows += b->count;
+    exec_close(scan);
+
+    report("scan", tbl_blk_cnt(tbl), bench_now() - start, NULL, rows);
+}
+
+
+static int blk_open(int cnt)
+{
+    FILE *file = fopen(SUITE_BLK_FILE, "w+");
+    if (!file) return 0;
+
+    byte data[BLOCKSIZE];
+    memset(data, 0, BLOCKSIZE);
+    for (int i=0; i<cnt; i++) blk_append(file, data, 1);
+    fclose(file);
+
+    for (int t=0; t<cfg.threads; t++) {
+        if (!(blk_files[t] = fopen(SUITE_BLK_FILE, "r+"))) return 0;
+    }
+
+    blk_cnt = cnt;
+    return 1;
+}
+
+
+static void blk_close()
+{
+    for (int t=0; t<cfg.threads; t++) {
+        if (blk_files[t]) fclose(blk_files[t]);
+        blk_files[t] = NULL;
+    }
+
+    unlink(SUITE_BLK_FILE);
+}
+
+
+static table *load_table()
+{
+    schema sch = {
+        .field_cnt = 2,
+        .field_types = {INT, CHAR},
+        .field_lengths = {0, cfg.value_len},
+    };
+
+    table *t = tbl_create("usertable", SUITE_DB, &sch);
+    if (!t) return NULL;
+
+    byte rec[BLOCKSIZE];
+    uint64_t rng = cfg.seed;
+    for (int i=0; i<cfg.records; i++) {
+        fill_value(rec, i, &rng);
+        tbl_insert(t, rec);
+    }
+
+    return t;
+}
+
+
+static int selected(const char *list, const char *name)
+{
+    if (!list) return 1;
+
+    size_t len = strlen(name);
+    for (const char *p = list; *p; ) {
+        const char *end = strchr(p, ',');
+        size_t n = end ? (size_t) (end - p) : strlen(p);
+
+        if (n == len && strncmp(p, name, n) == 0) return 1;
+        if (!end) break;
+        p = end + 1;
+    }
+
+    return 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-r records] [-o ops] [-p pool_size] [-t threads] "
+            "[-v value_len] [-w workloads] [-s seed]\n", prog);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *list = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:o:p:t:v:w:s:h")) != -1) {
+        switch (opt) {
+            case 'r': cfg.records = atoi(optarg); break;
+            case 'o': cfg.ops = atol(optarg); break;
+            case 'p': cfg.pool_size = atoi(optarg); break;
+            case 't': cfg.threads = atoi(optarg); break;
+            case 'v': cfg.value_len = atoi(optarg); break;
+            case 'w': list = optarg; break;
+            case 's': cfg.seed = strtoul(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (cfg.records <= 0 || cfg.ops <= 0 || cfg.pool_size <= 0 ||
+            cfg.threads <= 0 || cfg.threads > MAX_THREADS ||
+            cfg.value_len <= 0 || cfg.value_len + (int) sizeof(int) > BLOCKSIZE) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    mkdir(SUITE_DB, 0777);
+    buff_pool_init(cfg.pool_size);
+
+    tbl = load_table();
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    zipf_init(&key_dist, cfg.records, ZIPF_THETA);
+
+    for (size_t i=0; i<sizeof(ycsb) / sizeof(ycsb[0]); i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "ycsb-%s", ycsb[i].name);
+        if (selected(list, ycsb[i].name)) run(name, ycsb_op, &ycsb[i]);
+    }
+
+    if (selected(list, "scan")) run_scan();
+    if (selected(list, "pin")) run("pin", pin_op, NULL);
+
+    if ((selected(list, "blkread") || selected(list, "blkwrite"))) {
+        if (!blk_open(tbl_blk_cnt(tbl))) {
+            fprintf(stderr, "failed to create block file\n");
+            return EXIT_FAILURE;
+        }
+
+        if (selected(list, "blkread")) run("blkread", blk_read_op, NULL);
+        if (selected(list, "blkwrite")) run("blkwrite", blk_write_op, NULL);
+        blk_close();
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*
+ * tenant_bench.c
+ *
+ * Benchmark for buffer pool isolation between tenants. An OLTP tenant
+ * issues random point reads against a small table, interleaved with a
+ * second tenant repeatedly scanning a table many times larger than the
+ * pool. This is run twice with the same total number of frames: first with
+ * both tables sharing the default pool, and then with the OLTP table bound
+ * to a pool of its own, sized to hold it. The OLTP tenant's hit ratio and
+ * read latency are reported for each.
+ *
+ * usage: tenant_bench [oltp_blocks] [scan_blocks] [rounds]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, pad CHAR(46))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 46}
+};
+
+#define READS_PER_ROUND 100
+#define SCAN_PER_ROUND 100
+
+
+table *load_table(char *name, int blk_cnt)
+{
+    table *tbl = tbl_create(name, "bench/benchdb", &bench_schema);
+    if (!tbl) return NULL;
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<blk_cnt * tbl_recs_per_blk(tbl); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl;
+}
+
+
+void run(char *label, table *oltp, table *scan, int rounds)
+{
+    unsigned int seed = 42;
+    int scan_blks = tbl_blk_cnt(scan);
+    int scan_pos = 0;
+    long hits = 0, reads = 0;
+    double read_time = 0;
+    byte rec[BLOCKSIZE];
+
+    for (int r=0; r<rounds; r++) {
+        double start = bench_now();
+        for (int i=0; i<READS_PER_ROUND; i++) {
+            int rid = rand_r(&seed) % oltp->record_cnt;
+            hits += buff_find_pg(oltp, tbl_rec_blk(oltp, rid)) != NULL;
+            tbl_read(oltp, rid, rec);
+            reads++;
+        }
+        read_time += bench_now() - start;
+
+        for (int i=0; i<SCAN_PER_ROUND; i++) {
+            int blk_no = TBL_FIRST_BLK + scan_pos;
+            buff_pin(scan, blk_no);
+            buff_unpin(scan, blk_no);
+            scan_pos = (scan_pos + 1) % scan_blks;
+        }
+    }
+
+    printf("%-8s oltp hit ratio %.3f  %.1f ns/read\n", label,
+           (double) hits / reads, read_time / reads * 1e9);
+}
+
+
+int main(int argc, char **argv)
+{
+    int oltp_blks = (argc > 1) ? atoi(argv[1]) : 256;
+    int scan_blks = (argc > 2) ? atoi(argv[2]) : 16384;
+    int rounds = (argc > 3) ? atoi(argv[3]) : 2000;
+
+    // The scan tenant is given twice the OLTP tenant's budget in both runs
+    int pool_size = 3 * (oltp_blks + 1);
+
+    mkdir("bench/benchdb", 0777);
+    printf("oltp=%d blocks scan=%d blocks frames=%d rounds=%d\n", oltp_blks, scan_blks,
+           pool_size, rounds);
+
+    // Shared: both tables in one pool
+    buff_pool_init(pool_size);
+    table *oltp = load_table("oltp", oltp_blks);
+    table *scan = load_table("scan", scan_blks);
+    if (!oltp || !scan) {
+        fprintf(stderr, "failed to create tables\n");
+        return EXIT_FAILURE;
+    }
+
+    run("shared", oltp, scan, rounds);
+
+    tbl_close(oltp);
+    tbl_close(scan);
+    buff_pool_destroy();
+
+    // Isolated: the OLTP table gets a third of the frames to itself
+    buff_pool_init(pool_size - (oltp_blks + 1));
+    buff_pool *hot = buff_pool_create("oltp", oltp_blks + 1, BUFF_POLICY_CLOCK);
+
+    oltp = tbl_load("oltp", "bench/benchdb");
+    scan = tbl_load("scan", "bench/benchdb");
+    buff_pool_bind(oltp, hot);
+
+    run("isolated", oltp, scan, rounds);
+
+    tbl_close(oltp);
+    tbl_close(scan);
+    buff_pool_free(hot);
+    buff_pool_destroy();
+
+    return EXIT_SUCCESS;
+}
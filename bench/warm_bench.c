@@ -0,0 +1,191 @@
+/*
+ * warm_bench.c
+ *
+ * Benchmark for warm restarts of the buffer pool. A table several times
+ * larger than the pool is read with a skewed point-read workload (most
+ * reads going to a hot set that fits in the pool) until the hit ratio
+ * settles, and the pool is dumped and the process "restarted" by closing
+ * the table and destroying the pool. The same workload is then started
+ * against a fresh pool three times: cold, with the dump being reloaded in
+ * the background as traffic begins, and with the dump reloaded before any
+ * traffic is let in.
+ *
+ * For each, the hit ratio is sampled over windows of reads, and the number
+ * of reads and time taken until a window first reaches 95% of the
+ * steady-state hit ratio is reported. Before each restart the table's
+ * file is dropped from the page cache (where the kernel allows it), so
+ * that misses go to the device.
+ *
+ * usage: warm_bench [table_blocks] [pool_size] [window]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HOT_PCT 95
+#define WINDOWS 200
+
+// (id INT, pad CHAR(46))
+schema bench_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 46}
+};
+
+char *dump_path = "bench/benchdb/pool.dump";
+
+
+typedef struct warm_result {
+    double ratios[WINDOWS];
+    double times[WINDOWS];
+} warm_result;
+
+
+/*
+ * Run windows of point reads, sending HOT_PCT% of them to the first
+ * hot_blks blocks, and record the hit ratio of each window.
+ */
+static void traffic(table *tbl, int hot_blks, int window, unsigned int *seed, warm_result *res)
+{
+    int per_blk = tbl_recs_per_blk(tbl);
+    int blk_cnt = tbl_blk_cnt(tbl);
+    byte rec[BLOCKSIZE];
+    double start = bench_now();
+
+    for (int w=0; w<WINDOWS; w++) {
+        long hits = 0;
+        for (int i=0; i<window; i++) {
+            int blk = (rand_r(seed) % 100 < HOT_PCT) ? rand_r(seed) % hot_blks
+                                                      : rand_r(seed) % blk_cnt;
+            int rid = blk * per_blk + rand_r(seed) % per_blk;
+
+            hits += buff_find_pg(tbl, tbl_rec_blk(tbl, rid)) != NULL;
+            tbl_read(tbl, rid, rec);
+        }
+
+        res->ratios[w] = (double) hits / window;
+        res->times[w] = bench_now() - start;
+    }
+}
+
+
+static void drop_cache()
+{
+    int fd = open("bench/benchdb/warm.tbl", O_RDONLY);
+    if (fd < 0) return;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+static void report(const char *label, warm_result *res, double steady, int window)
+{
+    for (int w=0; w<WINDOWS; w++) {
+        if (res->ratios[w] >= 0.95 * steady) {
+            printf("%-10s first window hit ratio %.3f  steady after %7d reads  %8.2f ms\n",
+                   label, res->ratios[0], (w + 1) * window, res->times[w] * 1e3);
+            return;
+        }
+    }
+
+    printf("%-10s first window hit ratio %.3f  not steady within %d reads\n", label,
+           res->ratios[0], WINDOWS * window);
+}
+
+
+int main(int argc, char **argv)
+{
+    int blk_cnt = (argc > 1) ? atoi(argv[1]) : 40000;
+    int pool_size = (argc > 2) ? atoi(argv[2]) : 4096;
+    int window = (argc > 3) ? atoi(argv[3]) : 1000;
+    int hot_blks = pool_size * 9 / 10;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    table *tbl = tbl_create("warm", "bench/benchdb", &bench_schema);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<blk_cnt * tbl_recs_per_blk(tbl); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+
+    // Run until steady, and take the last windows as the steady state
+    unsigned int seed = 42;
+    warm_result res;
+    traffic(tbl, hot_blks, window, &seed, &res);
+    traffic(tbl, hot_blks, window, &seed, &res);
+
+    double steady = 0;
+    for (int w=WINDOWS - 20; w<WINDOWS; w++) steady += res.ratios[w] / 20;
+
+    double start = bench_now();
+    int dumped = buff_pool_dump(NULL, dump_path);
+    double dump_time = bench_now() - start;
+
+    printf("blocks=%d pool=%d hot=%d window=%d steady hit ratio %.3f\n", blk_cnt, pool_size,
+           hot_blks, window, steady);
+    printf("dump: %d pages in %.2f ms\n", dumped, dump_time * 1e3);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+
+    // Cold restart
+    drop_cache();
+    buff_pool_init(pool_size);
+    tbl = tbl_load("warm", "bench/benchdb");
+    seed = 7;
+    traffic(tbl, hot_blks, window, &seed, &res);
+    report("cold", &res, steady, window);
+    tbl_close(tbl);
+    buff_pool_destroy();
+
+    // Warm restart, reloading in the background as traffic starts
+    drop_cache();
+    buff_pool_init(pool_size);
+    tbl = tbl_load("warm", "bench/benchdb");
+    seed = 7;
+    buff_warmer *warmer = buff_pool_warm_start(NULL, dump_path, &tbl, 1);
+    traffic(tbl, hot_blks, window, &seed, &res);
+    int loaded = buff_pool_warm_finish(warmer);
+    report("warm", &res, steady, window);
+    printf("warm: %d pages reloaded\n", loaded);
+    tbl_close(tbl);
+    buff_pool_destroy();
+
+    // Warm restart, reloading before traffic is let in
+    drop_cache();
+    buff_pool_init(pool_size);
+    tbl = tbl_load("warm", "bench/benchdb");
+    seed = 7;
+    start = bench_now();
+    loaded = buff_pool_warm(NULL, dump_path, &tbl, 1);
+    double warm_time = bench_now() - start;
+    traffic(tbl, hot_blks, window, &seed, &res);
+    report("prewarmed", &res, steady, window);
+    printf("prewarm: %d pages reloaded in %.2f ms\n", loaded, warm_time * 1e3);
+    tbl_close(tbl);
+    buff_pool_destroy();
+
+    return EXIT_SUCCESS;
+}
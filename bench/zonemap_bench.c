@@ -0,0 +1,123 @@
+/*
+ * zonemap_bench.c
+ *
+ * Benchmark for zone map block skipping. Loads a table clustered on a
+ * time-ordered INT column, then runs range queries of varying selectivity
+ * over it with and without the zone map, reporting the blocks skipped and
+ * the speedup.
+ *
+ * usage: zonemap_bench [record_cnt] [pool_size]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bench.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+#include "zonemap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, ts INT, qty INT, price FLOAT, tag CHAR(8))
+schema bench_schema = {
+    .field_cnt = 5,
+    .field_types = {INT, INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 0, 8}
+};
+
+
+table *load_table(int record_cnt)
+{
+    table *tbl = tbl_create("zonemap", "bench/benchdb", &bench_schema);
+    if (!tbl) return NULL;
+
+    byte rec[BLOCKSIZE] = {0};
+    srand(42);
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i / 16 + rand() % 4);
+        tp_setint(rec, 8, rand() % 1000);
+        tp_setfloat(rec, 12, (rand() % 100000) / 100.0);
+        tp_setchar(rec, 20, "tag", 8);
+        tbl_insert(tbl, rec);
+    }
+
+    return tbl;
+}
+
+
+/*
+ * SELECT SUM(qty) FROM zonemap WHERE ts >= lo AND ts < hi
+ */
+double run_query(table *tbl, int lo, int hi, long *rows, long *skipped)
+{
+    double start = bench_now();
+
+    exec_op *scan = exec_scan(tbl);
+    exec_op *op = exec_filter_int(scan, 1, CMP_GE, lo);
+    op = exec_filter_int(op, 1, CMP_LT, hi);
+
+    long sum = 0;
+    *rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) {
+        for (int i=0; i<b->count; i++) sum += b->cols[2].ints[i];
+        *rows += b->count;
+    }
+
+    *skipped = exec_scan_skipped(scan);
+    exec_close(op);
+
+    return bench_now() - start;
+}
+
+
+int main(int argc, char **argv)
+{
+    int record_cnt = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int pool_size = (argc > 2) ? atoi(argv[2]) : 64;
+
+    mkdir("bench/benchdb", 0777);
+    buff_pool_init(pool_size);
+
+    table *tbl = load_table(record_cnt);
+    if (!tbl) {
+        fprintf(stderr, "failed to create table\n");
+        return EXIT_FAILURE;
+    }
+
+    int ts_max = record_cnt / 16 + 4;
+    double selectivity[] = {0.001, 0.01, 0.1, 0.5, 1.0};
+
+    printf("records=%d blocks=%d pool=%d\n", record_cnt, tbl_blk_cnt(tbl), pool_size);
+    printf("%-8s %9s %9s %10s %10s %8s\n", "select", "rows", "skipped", "zm(s)", "nozm(s)", "speedup");
+
+    for (size_t i=0; i<sizeof(selectivity) / sizeof(selectivity[0]); i++) {
+        int width = ts_max * selectivity[i];
+        int lo = (ts_max - width) / 2;
+        int hi = lo + width;
+        long rows, skipped, unused;
+
+        double with = run_query(tbl, lo, hi, &rows, &skipped);
+
+        zone_map *zm = tbl->zmap;
+        tbl->zmap = NULL;
+        double without = run_query(tbl, lo, hi, &rows, &unused);
+        tbl->zmap = zm;
+
+        printf("%7.1f%% %9ld %9ld %10.4f %10.4f %7.1fx\n", selectivity[i] * 100, rows,
+               skipped, with, without, without / with);
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+    return EXIT_SUCCESS;
+}
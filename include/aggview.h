@@ -0,0 +1,112 @@
+/* aggview.h
+ *
+ * Incrementally maintained aggregate views for the yahi-db project.
+ *
+ * A view holds the result of a grouped aggregate over a table (like the
+ * GROUP BY of hashagg.h), and is kept up to date as the table is written,
+ * so that reading it costs a hash lookup rather than a scan. It is built
+ * by tbl_view_create from the records already in the table, after which
+ * tbl_insert adds each new record to it, and tbl_update retracts the old
+ * version of a record and adds the new one.
+ *
+ * COUNT, SUM and AVG are simply adjusted by each change. MIN and MAX
+ * keep the number of records holding the current extreme; once all of
+ * those have been retracted, the group's bound is unknown, and the group
+ * is marked stale. Stale groups are recomputed together, by one scan of
+ * the table, when the view is next read.
+ *
+ * With a batch size above 1, maintenance is deferred: the write path only
+ * copies the changed records into a buffer, which is applied to the view
+ * once it holds batch records, or when the view is read, so that readers
+ * always see every write made before they read.
+ *
+ * View rows contain the group columns followed by one column per
+ * aggregate, laid out as described by the view's out schema. As with
+ * hashagg, COUNT produces an INT, SUM and AVG a FLOAT, and MIN and MAX the
+ * type of their input, and aggregates may only be taken over INT and
+ * FLOAT columns.
+ *
+ * Views live in memory only, and are dropped when their table is closed.
+ * A view may be read from any number of threads while its table is
+ * written by one.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hashagg.h"
+#include "table.h"
+#include "yahi.h"
+
+#define AV_DEFAULT_BATCH 256
+
+typedef struct av_acc {
+    double sum;         // FLOAT columns
+    long isum;          // INT columns, kept exactly
+    double min;
+    double max;
+    long min_cnt;       // records holding min and max
+    long max_cnt;
+} av_acc;
+
+typedef struct av_group {
+    struct av_group *next;
+    uint64_t hash;
+    long count;
+    int stale;
+    av_acc accs[];      // followed by the group key
+} av_group;
+
+typedef struct av_view {
+    struct av_view *next;   // the table's other views
+    table *tbl;
+
+    int group_cnt;
+    int group_cols[MAX_ATTRS];
+    int agg_cnt;
+    agg_spec aggs[MAX_ATTRS];
+    int key_len;
+    schema out;
+
+    pthread_mutex_t lock;
+    av_group **buckets;
+    long bucket_cnt;
+    long groups;
+    long stale;             // groups waiting for a rescan
+    int broken;             // a change could not be applied; rebuild
+
+    int batch;
+    int pending_cnt;
+    byte *pending;          // records waiting to be applied...
+    signed char *signs;     // ...and whether each is added or retracted
+
+    long applied;
+    long rescans;
+} av_view;
+
+/*
+ * Called by av_scan with each row of the view. Returning 0 stops the
+ * scan. The row is only valid during the call.
+ */
+typedef int (*av_scan_fn)(byte *row, void *ctx);
+
+av_view *tbl_view_create(table *tbl, int group_cnt, int *group_cols, int agg_cnt,
+                         agg_spec *aggs, int batch);
+int tbl_view_drop(table *tbl, av_view *view);
+void tbl_view_add(table *tbl, byte *record);
+void tbl_view_replace(table *tbl, byte *stored, byte *record);
+
+void av_free(av_view *view);
+int av_insert(av_view *view, byte *record);
+int av_remove(av_view *view, byte *record);
+int av_flush(av_view *view);
+
+int av_lookup(av_view *view, byte *record, byte *row);
+long av_scan(av_view *view, av_scan_fn fn, void *ctx);
@@ -0,0 +1,59 @@
+/* arena.h
+ *
+ * Region allocators for the yahi-db project.
+ *
+ * An arena hands out memory for the lifetime of a query or scan by bumping
+ * a pointer through large chunks, and frees all of it at once when the
+ * query ends, so that values read while scanning (see tp_getaschar and
+ * pg_getchar) cost no malloc or free per row. arena_reset releases
+ * everything allocated so far but keeps the chunks for reuse, so that a
+ * scan which resets its arena after each batch settles into allocating
+ * nothing at all.
+ *
+ * Any number of threads may allocate from one arena at once. Each thread
+ * bumps through a chunk of its own, found through a small thread-local
+ * cache, and only takes the arena's lock to get a new chunk. Allocations
+ * larger than a quarter of a chunk get a chunk to themselves. An arena
+ * must not be reset or freed while other threads are allocating from it.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "yahi.h"
+
+#define ARENA_DEFAULT_CHUNK (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t used;
+    size_t cap;
+    _Alignas(ARENA_ALIGN) char data[];
+} arena_chunk;
+
+typedef struct arena {
+    uint64_t id;            // changes on every reset, invalidating threads' chunks
+    size_t chunk_size;
+
+    pthread_mutex_t lock;
+    arena_chunk *chunks;    // handed out since the last reset
+    arena_chunk *spare;     // kept by arena_reset for reuse
+
+    long mallocs;           // chunks allocated from the system
+} arena;
+
+arena *arena_create(size_t chunk_size);
+void arena_free(arena *a);
+void arena_reset(arena *a);
+
+void *arena_alloc(arena *a, size_t size);
+char *arena_strndup(arena *a, const char *src, size_t len);
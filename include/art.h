@@ -0,0 +1,105 @@
+/* art.h
+ *
+ * Adaptive radix tree indexes for the yahi-db project.
+ *
+ * An ART maps fixed-length binary keys to record ids, branching on one
+ * key byte per level. Inner nodes come in four sizes, holding up to 4, 16,
+ * 48 and 256 children, and are replaced by the next size up as they fill,
+ * so that sparse levels stay small and dense ones are a single array
+ * lookup. Node16 is searched by comparing all of its keys at once with
+ * SSE2 where it is available. Runs of bytes shared by every key below a
+ * node are kept in the node as its prefix rather than as a chain of
+ * single-child nodes.
+ *
+ * Keys are the binary-comparable forms of column values produced by
+ * tp_getaskey (see types.h), so that a byte-wise comparison of two keys
+ * orders them as the values would be ordered, and range scans visit keys
+ * in order.
+ *
+ * Trees may be used from any number of threads at once, using optimistic
+ * lock coupling: each node carries a version, which writers lock and bump,
+ * while readers take no locks at all, instead checking that the versions
+ * of the nodes they pass through haven't changed, and starting over if
+ * they have. Since a reader may still be looking at a node which a writer
+ * has replaced, or a leaf which has been removed, those are kept on a list
+ * and freed along with the tree. Nodes are not shrunk as keys are removed.
+ *
+ * A table may have an ART on one of its columns, built by tbl_art_create
+ * and kept up to date by tbl_insert and tbl_update, acting as a unique
+ * (primary) index: inserts and updates which would duplicate a key fail.
+ * The index lives in memory only, and is rebuilt after the table is
+ * opened.
+ *
+ * art_lookup_batch looks up many keys at once, interleaving them: each
+ * key's search is advanced one level at a time, in turn, and the node it
+ * will visit next is prefetched before moving on to the next key, so that
+ * the cache misses of up to ART_BATCH_MAX searches overlap rather than
+ * following one another. tbl_art_read_batch does the same for a table's
+ * records, pinning the blocks of every record found at once, so that all
+ * of the reads of blocks not in the buffer pool are under way before any
+ * of them is waited on.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "table.h"
+#include "yahi.h"
+
+#define ART_NODE4 0
+#define ART_NODE16 1
+#define ART_NODE48 2
+#define ART_NODE256 3
+
+// The most lookups art_lookup_batch interleaves at once
+#define ART_BATCH_MAX 64
+
+typedef struct art_node {
+    _Atomic uint64_t version;   // bit 0: obsolete, bit 1: locked
+    uint8_t type;
+    uint16_t count;
+    uint32_t prefix_len;
+} art_node;
+
+typedef struct art_tree {
+    art_node *root;
+    int key_len;
+    int col;
+    _Atomic long size;
+
+    pthread_mutex_t retire_lock;
+    void **retired;
+    long retired_cnt;
+    long retired_cap;
+} art_tree;
+
+/*
+ * Called by art_scan with each key in the range, in order, and its record
+ * id. Returning 0 stops the scan.
+ */
+typedef int (*art_scan_fn)(const unsigned char *key, int rid, void *ctx);
+
+art_tree *art_create(int key_len);
+void art_free(art_tree *art);
+
+int art_insert(art_tree *art, const unsigned char *key, int rid);
+int art_lookup(art_tree *art, const unsigned char *key);
+int art_update(art_tree *art, const unsigned char *key, int rid);
+int art_lookup_batch(art_tree *art, const unsigned char *keys, int cnt, int *rids);
+int art_remove(art_tree *art, const unsigned char *key);
+long art_scan(art_tree *art, const unsigned char *lo, const unsigned char *hi, art_scan_fn fn,
+              void *ctx);
+
+int tbl_art_create(table *tbl, int col);
+int tbl_art_add(table *tbl, byte *record, int rid);
+int tbl_art_set(table *tbl, byte *record, int rid);
+int tbl_art_find(table *tbl, byte *record);
+int tbl_art_read_batch(table *tbl, byte *probes, int cnt, byte *records, int *rids);
@@ -0,0 +1,51 @@
+/* blkstream.h
+ *
+ * Sequential byte streams stored as consecutive blocks of a file, for the
+ * yahi-db project. These are used for the temporary runs and partitions
+ * that operators spill to disk. All I/O goes through the blockio module.
+ *
+ * A stream is written front to back with bs_write(), and then (after
+ * bs_rewind()) read front to back with bs_read(). Writes are staged and
+ * appended BS_WRITE_BLKS blocks at a time. Reads are served from a
+ * buffer of several blocks, and the next buffer's worth of the file is
+ * hinted to the kernel as it is consumed, so that reading many streams in
+ * an interleaved fashion (as in a k-way merge) does not degrade into
+ * single-block random reads.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include "blockio.h"
+#include "yahi.h"
+
+#define BS_DEFAULT_READAHEAD 16
+#define BS_WRITE_BLKS 16
+
+typedef struct bstream {
+    FILE *file;
+    long size;          // total bytes written to the stream
+
+    byte tail[BS_WRITE_BLKS * BLOCKSIZE];
+    int tail_len;
+    int flushed;
+
+    byte *buf;
+    int buf_blks;
+    long buf_start;     // stream offset of buf[0]
+    long buf_len;
+    long pos;           // stream offset of the next byte to read
+} bstream;
+
+int bs_open(bstream *s);
+int bs_write(bstream *s, byte *src, long len);
+int bs_rewind(bstream *s, int readahead);
+long bs_read(bstream *s, byte *dst, long len);
+byte *bs_load(bstream *s);
+void bs_close(bstream *s);
@@ -15,7 +15,10 @@
 #include <stdio.h>
 #include "yahi.h"
 
+// May be overridden at build time, e.g. make BLOCKSIZE=4096
+#ifndef BLOCKSIZE
 #define BLOCKSIZE 200
+#endif
 #define MAX_TBL_NAME 20
 
 off_t blk_flen(FILE *file);
@@ -23,6 +26,13 @@ int blk_offset(int blk_no);
 int blk_write(FILE *file, int blk_no, byte* data);
 int blk_read(FILE *file, int blk_no, byte* data);
 int blk_new(FILE *file);
+int blk_append(FILE *file, byte *data, int cnt);
+int blk_read_n(FILE *file, int blk_no, byte *data, int cnt);
+int blk_prefetch(FILE *file, int blk_no, int cnt);
+
+off_t blk_ext_append(FILE *file, byte *data, int length);
+int blk_ext_write(FILE *file, off_t offset, byte *data, int length);
+int blk_ext_read(FILE *file, off_t offset, byte *data, int length);
 
 
 
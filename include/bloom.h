@@ -0,0 +1,59 @@
+/* bloom.h
+ *
+ * Blocked Bloom filters on a key column of a yahi-db table.
+ *
+ * The filter is split into 64-byte blocks, each the size of a cache line.
+ * A key hashes to a single block, and sets one bit in each of that block's
+ * eight 64-bit words, so that a probe touches exactly one cache line. The
+ * eight bit positions are derived from the hash with eight multiplicative
+ * salts, which is done for all words at once using vector operations, as
+ * is the final test against the block.
+ *
+ * A table may have a filter on one INT column, built by tbl_bloom_create
+ * and then maintained as records are inserted or updated (updates only add
+ * keys, so a filter never gives a false negative). When the number of
+ * keys grows past twice what the filter was sized for, it is rebuilt at
+ * the larger size. The filter is saved to <db>/<name>.bf when the table is
+ * closed, and loaded with the table if that file exists; one saved for a
+ * different number of records than the table has is rebuilt instead.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "table.h"
+#include "yahi.h"
+
+#define BF_BLOCK_WORDS 8
+#define BF_DEFAULT_BITS_PER_KEY 10
+
+typedef struct bf_block {
+    uint64_t words[BF_BLOCK_WORDS];
+} __attribute__((aligned(64))) bf_block;
+
+typedef struct bloom {
+    int col;
+    int bits_per_key;
+    long capacity;
+    long keys;
+    long blk_cnt;
+    bf_block *blocks;
+} bloom;
+
+bloom *bf_create(int col, long capacity, int bits_per_key);
+void bf_free(bloom *bf);
+void bf_add(bloom *bf, int key);
+int bf_may_contain(bloom *bf, int key);
+
+int tbl_bloom_create(table *tbl, int col, int bits_per_key);
+int tbl_bloom_add(table *tbl, byte *record);
+int tbl_may_contain(table *tbl, int col, int key);
+bloom *bf_load(table *tbl);
+int bf_save(table *tbl);
+void bf_remove(table *tbl);
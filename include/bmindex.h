@@ -0,0 +1,58 @@
+/* bmindex.h
+ *
+ * Bitmap indexes on low-cardinality columns of yahi-db tables.
+ *
+ * A bitmap index keeps, for each distinct value of its column, a roaring
+ * bitmap (see roaring.h) of the ids of the records holding that value.
+ * The rows matching an equality predicate are then simply that value's
+ * bitmap, and conjunctions, disjunctions and negations of predicates,
+ * over one column or several, are the AND, OR and NOT of their bitmaps,
+ * which a scan can be restricted to with exec_scan_rows (see exec.h).
+ *
+ * An index is built from a table's records by tbl_bitmap_create, and
+ * kept up to date by tbl_insert and tbl_update. It is meant for columns
+ * with a handful of values: one which comes to hold more than
+ * BMI_MAX_VALUES distinct values is dropped.
+ *
+ * Values are kept as their binary-comparable keys (see tp_getaskey), in
+ * order. The index on column c is saved to <db>/<name>.bm<c> when the
+ * table is closed, written and read back through the table's buffer pool
+ * a page at a time, and is loaded with the table, or rebuilt from it if
+ * the table has changed since it was saved.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "roaring.h"
+#include "table.h"
+#include "yahi.h"
+
+#define BMI_MAX_VALUES 256
+
+typedef struct bm_index {
+    int col;
+    int key_len;
+    int value_cnt;
+    unsigned char *keys;    // value_cnt keys of key_len bytes, in order
+    roaring **rows;         // the records holding each value
+} bm_index;
+
+int tbl_bitmap_create(table *tbl, int col);
+void tbl_bitmap_drop(table *tbl, int col);
+int tbl_bitmap_add(table *tbl, byte *record, int rid);
+int tbl_bitmap_replace(table *tbl, byte *old, byte *record, int rid);
+
+roaring *tbl_bitmap_eq(table *tbl, int col, byte *record);
+roaring *tbl_bitmap_int(table *tbl, int col, int value);
+roaring *tbl_bitmap_char(table *tbl, int col, char *value);
+
+void bmi_free(bm_index *bmi);
+void bmi_load(table *tbl);
+int bmi_save(table *tbl);
+void bmi_remove(table *tbl);
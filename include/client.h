@@ -0,0 +1,57 @@
+/* client.h
+ *
+ * The client side of the yahi-db server protocol (see server.h).
+ *
+ * Requests are queued in the client's output buffer by cli_queue, and sent
+ * together by cli_flush, so that any number of them can be pipelined in a
+ * single write. Their responses are then taken, in order, one at a time,
+ * with cli_recv, which reads from the socket only once the responses
+ * already buffered have been taken.
+ *
+ * cli_create, cli_open, cli_insert, cli_read and cli_update each send a
+ * single request and wait for its response, matched by its request id.
+ * Any requests still queued are sent along with it, and the responses to
+ * those, and to any others outstanding, are dropped.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "server.h"
+#include "table.h"
+#include "yahi.h"
+
+typedef struct srv_client {
+    int fd;
+    uint32_t next_id;
+
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+
+    char *in;
+    size_t in_len;
+    size_t in_pos;
+    size_t in_cap;
+} srv_client;
+
+srv_client *cli_connect(char *path);
+void cli_close(srv_client *cli);
+
+uint32_t cli_queue(srv_client *cli, int op, int tbl, const void *a, uint32_t a_len, const void *b,
+                   uint32_t b_len);
+int cli_flush(srv_client *cli);
+int cli_recv(srv_client *cli, srv_resp *resp, char **payload);
+int cli_buffered(srv_client *cli);
+
+int cli_create(srv_client *cli, char *name, schema *schema, int *record_length);
+int cli_open(srv_client *cli, char *name, int *record_length);
+int cli_insert(srv_client *cli, int tbl, byte *record, int record_length);
+int cli_read(srv_client *cli, int tbl, int rid, byte *record);
+int cli_update(srv_client *cli, int tbl, int rid, byte *record, int record_length);
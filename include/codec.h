@@ -0,0 +1,64 @@
+/* codec.h
+ *
+ * Schema-specialized record codecs for yahi-db.
+ *
+ * A codec describes a fixed-length record layout (the field types, widths
+ * and offsets) together with, for each field, the routines used to decode
+ * it into a dense column, encode it back from one, and compare two values
+ * of it. The routines are chosen once, when the codec is built, from a
+ * table of kernels generated for each fixed width (see codec.c), so that
+ * code working through a codec runs without dispatching on field types or
+ * copying a variable number of bytes per value.
+ *
+ * Every table has a codec for its schema, built when the table is created
+ * or loaded, and executor operators which materialize rows describe them
+ * with one (row_layout, in exec.h).
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "table.h"
+#include "yahi.h"
+
+/*
+ * Decode cnt values of a field, stride bytes apart starting at src, into
+ * the dense array dst; and the reverse. length is the width of the field,
+ * which only the generic kernels need.
+ */
+typedef void (*cd_decode_fn)(const byte *src, int stride, int cnt, int length, void *dst);
+typedef void (*cd_encode_fn)(byte *dst, int stride, int cnt, int length, const void *src);
+
+/*
+ * Compare single values of a field, returning <0, 0 or >0.
+ */
+typedef int (*cd_cmp_fn)(const byte *a, const byte *b, int length);
+
+typedef struct codec {
+    int col_cnt;
+    int width;
+    int types[MAX_ATTRS];
+    int lengths[MAX_ATTRS];
+    int offsets[MAX_ATTRS];
+
+    cd_decode_fn decode[MAX_ATTRS];
+    cd_encode_fn encode[MAX_ATTRS];
+    cd_cmp_fn cmp[MAX_ATTRS];
+} codec;
+
+int cd_init(codec *cd, int col_cnt, int *types, int *lengths);
+codec *cd_create(schema *sch);
+void cd_free(codec *cd);
+
+cd_decode_fn cd_decode_for(int type, int length);
+cd_encode_fn cd_encode_for(int type, int length);
+cd_cmp_fn cd_cmp_for(int type, int length);
+
+void cd_decode(codec *cd, const byte *rows, int stride, int cnt, void **cols);
+void cd_encode(codec *cd, byte *rows, int stride, int cnt, void **cols);
+int cd_compare(codec *cd, const byte *a, const byte *b);
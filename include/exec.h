@@ -0,0 +1,112 @@
+/* exec.h
+ *
+ * A vectorized, batch-at-a-time query executor for the yahi-db project.
+ *
+ * Operators form a tree and are driven by pulling from the root with
+ * exec_next(). Rather than a single tuple, each call returns a batch of up
+ * to EXEC_BATCH_SIZE rows stored column-wise, so that the per-call overhead
+ * is amortized across the whole batch, and the per-column loops (see the
+ * tp_sel* kernels in types.h) are simple enough to be auto-vectorized.
+ *
+ * A batch returned by exec_next() belongs to the operator that produced it,
+ * and is only valid until the next call to exec_next() on that operator.
+ *
+ * An operator which fails (a page of its table can't be pinned, memory
+ * runs out, a spill file can't be written) returns NULL, just as it does
+ * at the end of its input, and marks itself failed. A caller which has
+ * drained a tree should check exec_failed() on its root before trusting
+ * the rows it got.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include "codec.h"
+#include "roaring.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define EXEC_BATCH_SIZE 1024
+
+typedef struct column {
+    int type;
+    int length;     // width of a single value, in bytes
+
+    // Only the array matching type is used. CHAR values are stored
+    // back-to-back, length bytes apiece, and are not null terminated.
+    int *ints;
+    double *floats;
+    char *chars;
+} column;
+
+
+typedef struct batch {
+    int count;
+    int col_cnt;
+    int owned;      // whether the column arrays belong to this batch
+    column cols[MAX_ATTRS];
+} batch;
+
+
+/*
+ * Operators which need to materialize their input (joins, sorts, etc.)
+ * store it row-wise, with the columns of a batch laid out back-to-back as
+ * described by a row_layout. This is simply the codec for those columns,
+ * so that rows are encoded and decoded with kernels specialized to them.
+ */
+typedef codec row_layout;
+
+
+typedef struct exec_op exec_op;
+
+struct exec_op {
+    const char *name;
+
+    batch *(*next)(exec_op *op);
+    void (*close)(exec_op *op);
+
+    exec_op *child;
+    exec_op *right;     // second input, for binary operators
+    void *state;
+
+    // Instrumentation, maintained by exec_next(). Elapsed time is
+    // inclusive of any time spent in the operator's inputs.
+    long rows;
+    long batches;
+    double elapsed;
+
+    int failed;         // set by the operator itself; see exec_failed()
+};
+
+
+batch *exec_next(exec_op *op);
+int exec_failed(exec_op *op);
+void exec_close(exec_op *op);
+void exec_report(exec_op *op, FILE *out);
+
+int exec_batch_init(batch *b, int col_cnt, int *types, int *lengths);
+void exec_batch_free(batch *b);
+int exec_batch_gather(batch *b, int *sel, int n);
+void exec_batch_copy_row(batch *dst, int dst_row, batch *src, int src_row);
+void exec_batch_copy(batch *dst, batch *src);
+void *exec_col_at(column *col, int row);
+
+void exec_layout_init(row_layout *l, batch *b);
+void exec_encode_rows(row_layout *l, batch *b, byte *rows);
+void exec_decode_rows(row_layout *l, byte *rows, int cnt, int stride, batch *out, int col_base);
+
+exec_op *exec_scan(table *tbl);
+exec_op *exec_scan_rows(table *tbl, roaring *rows);
+long exec_scan_skipped(exec_op *scan);
+exec_op *exec_filter_int(exec_op *child, int col, int cmp, int value);
+exec_op *exec_filter_float(exec_op *child, int col, int cmp, double value);
+exec_op *exec_filter_char(exec_op *child, int col, int cmp, char *value);
+exec_op *exec_project(exec_op *child, int col_cnt, int *cols);
+exec_op *exec_limit(exec_op *child, long limit);
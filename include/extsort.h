@@ -0,0 +1,47 @@
+/* extsort.h
+ *
+ * An external merge sort operator for the yahi-db executor, with bounded
+ * memory use.
+ *
+ * The input is accumulated, row-wise, into a buffer of at most
+ * mem_budget bytes. Each time the buffer fills, it is split into one slice
+ * per thread, the slices are sorted in parallel, and each is written out
+ * as a sorted run (a sequential block stream, see blkstream.h). The runs
+ * are then combined with a k-way merge driven by a loser tree; each run is
+ * read with readahead blocks of buffering. If there are more runs than can
+ * be merged at once within the budget, intermediate merge passes are made
+ * first. Inputs which fit within the budget are never written out: the
+ * sorted slices are merged directly in memory.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "blkstream.h"
+#include "exec.h"
+
+#define SORT_DEFAULT_MEM_BUDGET (64L * 1024 * 1024)
+#define SORT_DEFAULT_THREADS 4
+
+typedef struct sort_key {
+    int col;
+    int desc;
+} sort_key;
+
+typedef struct sort_opts {
+    long mem_budget;
+    int threads;
+    int readahead;      // blocks buffered per run during the merge
+} sort_opts;
+
+void sort_default_opts(sort_opts *opts);
+
+exec_op *exec_sort(exec_op *child, int key_cnt, sort_key *keys, sort_opts *opts);
+
+int exec_sort_runs(exec_op *op);
+int exec_sort_passes(exec_op *op);
@@ -0,0 +1,60 @@
+/* hashagg.h
+ *
+ * A parallel hash aggregation (GROUP BY) operator for the yahi-db
+ * executor.
+ *
+ * Input batches are handed out to a pool of worker threads, each of which
+ * pre-aggregates into its own hash table. When a thread's table outgrows
+ * its share of the memory budget, its partial aggregates are scattered to
+ * 2^radix_bits partitions on disk (through blkstream) and the table is
+ * emptied. Once the input is exhausted, the remaining partials are
+ * scattered in memory, and the partitions are merged, in parallel, into
+ * the final groups. A partition with more partials than a merging thread
+ * can hold groups for within its share of the budget (a skewed one, or
+ * one of too few partitions) is first split again on the next hash bits,
+ * through further temporary streams, as many times as it takes.
+ *
+ * Output rows contain the group columns followed by one column per
+ * aggregate. COUNT produces an INT, SUM and AVG a FLOAT, and MIN and MAX
+ * the type of their input. Aggregates may only be taken over INT and
+ * FLOAT columns; the grouping columns may be of any type.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "exec.h"
+
+#define AGG_COUNT 0
+#define AGG_SUM 1
+#define AGG_MIN 2
+#define AGG_MAX 3
+#define AGG_AVG 4
+
+#define AGG_DEFAULT_THREADS 4
+#define AGG_DEFAULT_RADIX_BITS 5
+#define AGG_DEFAULT_MEM_BUDGET (256L * 1024 * 1024)
+
+typedef struct agg_spec {
+    int func;
+    int col;        // ignored for COUNT
+} agg_spec;
+
+typedef struct agg_opts {
+    int threads;
+    int radix_bits;
+    long mem_budget;    // bytes of pre-aggregation tables, across all threads
+} agg_opts;
+
+void agg_default_opts(agg_opts *opts);
+
+exec_op *exec_hashagg(exec_op *child, int group_cnt, int *group_cols, int agg_cnt,
+        agg_spec *aggs, agg_opts *opts);
+
+long exec_hashagg_spills(exec_op *op);
+long exec_hashagg_splits(exec_op *op);
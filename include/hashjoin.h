@@ -0,0 +1,64 @@
+/* hashjoin.h
+ *
+ * A radix-partitioned, parallel, hash join operator for the yahi-db
+ * executor.
+ *
+ * Both inputs are drained and scattered into 2^radix_bits partitions on
+ * the low bits of a hash of the join key. Partitions are then joined
+ * independently by a pool of worker threads. Any partition whose build
+ * side is still larger than the target cache size is split again on the
+ * next hash bits, so that each hash table that is built and probed fits
+ * within L2.
+ *
+ * If the in-memory build side grows past the memory budget, the largest
+ * partitions are spilled, along with the matching probe partitions, to
+ * temporary block files through the blockio module. The probe side is
+ * held in memory only as far as the build side leaves room in the budget,
+ * and its largest partitions are spilled as it grows past that.
+ *
+ * During the join, probe partitions are read a chunk at a time, and a
+ * spilled build partition is read back whole only if it fits within a
+ * worker's share of the budget (mem_budget / threads). A larger one is
+ * split again, along with its probe partition, on the next hash bits, as
+ * often as it takes. One that can't be split any further, as its keys are
+ * all (or nearly all) the same, is joined a budget's worth of build tuples
+ * at a time, reading its probe partition through once for each.
+ *
+ * Output is streamed: workers hand their rows to the consumer through a
+ * small, fixed, number of batch-sized slots, and wait for it when those
+ * are full, so that the join's output is never held in memory as a whole.
+ * Rows come out in no particular order.
+ *
+ * The join keys must be INT columns. Output rows contain all of the build
+ * columns, followed by all of the probe columns.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "exec.h"
+
+#define HJ_DEFAULT_THREADS 4
+#define HJ_MAX_THREADS 64
+#define HJ_DEFAULT_RADIX_BITS 6
+#define HJ_DEFAULT_MEM_BUDGET (256L * 1024 * 1024)
+#define HJ_DEFAULT_CACHE_SIZE (256L * 1024)
+
+typedef struct hj_opts {
+    int threads;
+    int radix_bits;
+    long mem_budget;    // bytes of input tuples held in memory before spilling
+    long cache_size;    // target partition size, 0 to detect the L2 size
+} hj_opts;
+
+void hj_default_opts(hj_opts *opts);
+
+exec_op *exec_hashjoin(exec_op *build, exec_op *probe, int build_key, int probe_key,
+        hj_opts *opts);
+
+int exec_hashjoin_spilled(exec_op *op);
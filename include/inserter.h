@@ -0,0 +1,94 @@
+/* inserter.h
+ *
+ * Concurrent inserts into yahi-db heap tables.
+ *
+ * tbl_insert appends records one at a time at the end of the table, so
+ * threads inserting into a table at once would all fight over its last
+ * block, and over growing its file. Instead, a table may be opened for
+ * concurrent inserts with tbl_ins_begin, after which each inserting
+ * thread opens an inserter of its own (ins_open), and adds records
+ * through it (ins_insert).
+ *
+ * An inserter owns one block of the table at a time, its insert page,
+ * which it keeps pinned and fills without taking any lock. When the page
+ * is full it claims the next unclaimed block of the table with a single
+ * atomic increment, and pins a zeroed page for it without reading it. The
+ * table's file is grown ahead of the claims, INS_EXTENT_BLKS blocks at a
+ * time, with posix_fallocate, which never shrinks a file when two threads
+ * grow it at once, so that growing it takes no lock either. A record's id
+ * follows from the block and slot it is written to, so that ids are
+ * assigned without any shared counter.
+ *
+ * An inserter closed with its page part full hands the page back to the
+ * table, and the next inserter to need a block finishes it first (the
+ * table's last block, if it was part full when the session began, is
+ * handed out the same way). tbl_ins_end, called once every inserter is
+ * closed, fills any gaps left in part-full blocks by moving records from
+ * the end of the table into them, so that records are again packed one
+ * after another. It then brings the table's zone map, Bloom filter, views
+ * and bitmap indexes up to date with the new records, and makes them
+ * visible by advancing the record count. Record ids are only final once
+ * the session has ended, and so ins_insert doesn't return them.
+ *
+ * The table's unique index (see art.h), which is safe for concurrent use,
+ * is kept up to date as records are inserted, so that ins_insert refuses
+ * a record duplicating a key, as tbl_insert does.
+ *
+ * While a session is open, tbl_insert refuses records, and readers only
+ * see the records that were there when it began. Only uncompressed heap
+ * tables that are not memory-mapped take concurrent inserts. The pool
+ * must have a frame to spare for each open inserter's page.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "page.h"
+#include "table.h"
+#include "yahi.h"
+
+// Blocks the table's file is grown by at a time
+#define INS_EXTENT_BLKS 64
+
+// A block left part full by a closed inserter
+typedef struct ins_partial {
+    int blk_no;
+    int used;
+} ins_partial;
+
+typedef struct ins_session {
+    int start_cnt;              // the table's record count at the start
+    int first_blk;              // the first block inserted into
+    _Atomic int next_blk;       // the lowest block not yet claimed
+    _Atomic int file_blks;      // blocks the file is known to hold
+    _Atomic int open_cnt;
+    _Atomic long inserted;
+    int indexed;                // new records indexed by tbl_ins_end so far
+
+    pthread_mutex_t lock;       // guards the part-full blocks
+    ins_partial *partials;
+    _Atomic int partial_cnt;
+    int partial_cap;
+} ins_session;
+
+typedef struct inserter {
+    table *tbl;
+    page *pg;                   // the insert page, or NULL if there is none
+    int blk_no;
+    int used;                   // records in the insert page
+    long inserted;
+} inserter;
+
+int tbl_ins_begin(table *tbl);
+int tbl_ins_end(table *tbl);
+
+inserter *ins_open(table *tbl);
+int ins_insert(inserter *ins, byte *record);
+int ins_close(inserter *ins);
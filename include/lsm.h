@@ -0,0 +1,128 @@
+/* lsm.h
+ *
+ * A log-structured merge storage engine for write-heavy yahi-db tables.
+ *
+ * A table created with tbl_create_lsm keeps its records keyed on one INT
+ * column, rather than in a heap addressed by record id. Inserts go into an
+ * in-memory memtable, a skiplist ordered on the key, in which a later
+ * insert of a key replaces the earlier one. Once the memtable holds
+ * memtable_recs records it is frozen and a new one started, and a
+ * background thread writes the frozen memtable out as a sorted run: an
+ * immutable file of records in key order, written sequentially through
+ * blk_append. Inserts only wait on the disk if a second memtable fills
+ * before the first has been written, or if level 0 falls too far behind.
+ *
+ * Runs are arranged in levels. Level 0 holds the runs written from
+ * memtables, whose key ranges may overlap. Every other level holds runs
+ * with disjoint key ranges, and each level is allowed fanout times as many
+ * records as the one above it. When level 0 reaches l0_runs runs, the same
+ * background thread merges them, with the runs of level 1 that they
+ * overlap, into new level 1 runs; when any other level grows past its
+ * size, one of its runs (chosen round-robin through the key space) is
+ * merged into the next level in the same way. Merges keep only the newest
+ * version of each key, and write runs of at most memtable_recs records.
+ *
+ * Each run has a Bloom filter on the key (see bloom.h), and the first key
+ * of each of its blocks, so that a lookup reads at most one block of each
+ * run whose filter admits the key, checking the memtables, then level 0
+ * newest first, and then one run per deeper level. Run blocks are read
+ * directly from their files, not through the buffer pool. The filters and
+ * fence keys are rebuilt from the runs when the table is opened.
+ *
+ * The runs of table <name> live in <db>/<name>.<id>.run, and the list of
+ * runs making up each level in <db>/<name>.lsm, which is rewritten (to a
+ * temporary file, and renamed into place) each time a flush or merge
+ * finishes, before the runs it replaced are deleted. The memtable is
+ * written out when the table is closed. There are no deletes, and LSM
+ * tables can't be read by record id (nor scanned through exec_scan or
+ * ps_run); they are read by key with lsm_get.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+#include "table.h"
+#include "yahi.h"
+
+#define LSM_MAX_LEVELS 7
+#define LSM_MAX_L0_RUNS 32
+#define LSM_DEFAULT_MEMTABLE_RECS 8192
+#define LSM_DEFAULT_L0_RUNS 4
+#define LSM_DEFAULT_FANOUT 10
+
+typedef struct lsm_opts {
+    int memtable_recs;
+    int l0_runs;        // level 0 runs which trigger a merge into level 1
+    int fanout;         // size ratio between adjacent levels
+} lsm_opts;
+
+typedef struct lsm_stats {
+    long puts;
+    long flushes;
+    long merges;
+    long bytes_put;     // record bytes inserted
+    long bytes_written; // run bytes written, by flushes and merges
+    int runs[LSM_MAX_LEVELS];
+    long recs[LSM_MAX_LEVELS];
+} lsm_stats;
+
+struct bloom;
+struct lsm_memtable;
+
+typedef struct lsm_run {
+    int id;
+    int level;
+    long rec_cnt;
+    int blk_cnt;
+    int min_key;
+    int max_key;
+    int *fences;        // the first key of each block
+    struct bloom *bloom;
+
+    FILE *file;
+    pthread_mutex_t io_lock;
+    int refs;
+    int obsolete;
+} lsm_run;
+
+typedef struct lsm_tree {
+    table *tbl;
+    int key_col;
+    int key_offset;
+    lsm_opts opts;
+    int next_id;
+
+    struct lsm_memtable *active;
+    struct lsm_memtable *frozen;
+
+    lsm_run **runs[LSM_MAX_LEVELS];
+    int run_cnt[LSM_MAX_LEVELS];
+    int cursor[LSM_MAX_LEVELS];
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int busy;
+    int stop;
+    int failed;
+
+    lsm_stats stats;
+} lsm_tree;
+
+void lsm_default_opts(lsm_opts *opts);
+lsm_tree *lsm_create(table *tbl, int key_col, lsm_opts *opts);
+lsm_tree *lsm_open(table *tbl, int key_col);
+int lsm_close(lsm_tree *lsm);
+
+int lsm_put(lsm_tree *lsm, byte *record);
+int lsm_get(lsm_tree *lsm, int key, byte *record);
+int lsm_flush(lsm_tree *lsm);
+void lsm_stats_get(lsm_tree *lsm, lsm_stats *stats);
@@ -11,6 +11,10 @@
  * it. All client interactions with these components should be through the code
  * in pgbuffer.
  *
+ * A page's data normally points to a BLOCKSIZE buffer owned by its frame in
+ * the pool, but for tables opened with tbl_load_mmap it points directly into
+ * the (read-only) mapping of the table file.
+ *
  * Copyright 2021, Douglas B. Rumbaugh
  * This code is published under the BSD 3-Clause License,
  * see the LICENSE file in the main project directory
@@ -26,8 +30,10 @@
 #include "blockio.h"
 #include "yahi.h"
 
+struct arena;
+
 typedef struct page {
-    byte data[BLOCKSIZE];
+    byte *data;
     int blk_id;
     table* tbl;
     
@@ -37,7 +43,7 @@ typedef struct page {
 } page;
 
 int pg_getint(page *pg, int offset);
-char *pg_getchar(page *pg, int offset, int length);
+char *pg_getchar(page *pg, int offset, int length, struct arena *a);
 double pg_getfloat(page *pg, int offset);
 
 int pg_setint(page *pg, int offset, int value);
@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <semaphore.h>
 #include "table.h"
@@ -19,15 +21,100 @@
 #include "blockio.h"
 #include "yahi.h"
 
+// How the frame arena is backed, as reported by buff_pool_hugepages
+#define BUFF_HUGE_NONE 0
+#define BUFF_HUGE_TRANSPARENT 1
+#define BUFF_HUGE_EXPLICIT 2
+
+// Replacement policies
+#define BUFF_POLICY_FIRST 0     // first unpinned frame, local partition first
+#define BUFF_POLICY_CLOCK 1     // second-chance clock sweep
+
+#define BUFF_POOL_NAME 20
+#define BUFF_MAX_POOLS 16
+#define BUFF_MAX_NODES 64
+
+// Blocks read, and frames filled, per acquisition of the pool lock when
+// warming a pool from a dump
+#define BUFF_WARM_BATCH 32
+
+// Most consecutive blocks read with a single read by buff_pin_batch
+#define BUFF_PIN_RUN 32
+
+struct sc_cache;
+
+typedef struct frame_tag {
+    table *tbl;
+    int blk_id;
+} frame_tag;
+
+/*
+ * A buffer pool instance. Each pool owns its own frame arena, page
+ * descriptors and replacement state, so that the tables bound to one pool
+ * (see buff_pool_bind) can only ever evict each other's pages. Tables not
+ * bound to any pool use the default pool set up by buff_pool_init.
+ */
+typedef struct buff_pool {
+    char name[BUFF_POOL_NAME];
+    int size;
+    int policy;
+
+    page **pages;
+    page *frames;
+    frame_tag *tags;
+    byte *refs;
+
+    byte *arena;
+    size_t arena_len;
+    int huge;
+
+    int node_cnt;
+    int hands[BUFF_MAX_NODES];
+
+    struct sc_cache *cache;     // second tier, see buff_pool_set_cache
+
+    pthread_mutex_t lock;
+} buff_pool;
+
 int buff_pool_init(int pool_size);
 void buff_pool_destroy();
+int buff_pool_hugepages();
+int buff_pool_nodes();
+
+buff_pool *buff_pool_create(char *name, int pool_size, int policy);
+void buff_pool_free(buff_pool *pool);
+buff_pool *buff_pool_get(char *name);
+buff_pool *buff_pool_default();
+int buff_pool_bind(table *tbl, buff_pool *pool);
+int buff_pool_resident(buff_pool *pool, table *tbl);
+int buff_pool_set_cache(buff_pool *pool, struct sc_cache *cache);
+
+/*
+ * A background reload of a pool from a dump, started by
+ * buff_pool_warm_start. loaded counts the pages read so far.
+ */
+typedef struct buff_warmer {
+    buff_pool *pool;
+    char *path;
+    table **tbls;
+    int tbl_cnt;
+    pthread_t thread;
+    _Atomic int loaded;
+} buff_warmer;
+
+int buff_pool_dump(buff_pool *pool, char *path);
+int buff_pool_warm(buff_pool *pool, char *path, table **tbls, int tbl_cnt);
+buff_warmer *buff_pool_warm_start(buff_pool *pool, char *path, table **tbls, int tbl_cnt);
+int buff_pool_warm_finish(buff_warmer *warmer);
 
 page *buff_find_pg(table *tbl, int blk_no);
 page *buff_find_and_load_pg(table *tbl, int blk_no);
 page *buff_load(table *tbl, int blk_no);
 void buff_flush(page* pg);
+int buff_evict_tbl(table *tbl);
 
 page *buff_pin(table *tbl, int blk_no);
+page *buff_pin_new(table *tbl, int blk_no);
 int buff_unpin(table *tbl, int blk_no);
 
 int buff_lock(table *tbl, int blk_no);
@@ -35,8 +122,24 @@ int buff_unlock(table *tbl, int blk_no);
 
 int buff_modified(table *tbl, int blk_no);
 
+/*
+ * A page pinned by buff_pin_batch. The caller fills in tbl and blk_no, and
+ * the pin fills in pg, which stays valid until the handle is unpinned.
+ * Because the handle carries the page, unpinning it and marking it
+ * modified need not search the pool for it again.
+ */
+typedef struct buff_handle {
+    table *tbl;
+    int blk_no;
+    page *pg;
+} buff_handle;
+
+int buff_pin_batch(buff_handle *handles, int cnt);
+void buff_unpin_batch(buff_handle *handles, int cnt);
+int buff_modified_handle(buff_handle *handle);
+
 #ifdef UNITTEST
-int _POOL_SIZE;
-page **_PAGE_POOL;
-int _POOL_INIT;
+extern int _POOL_SIZE;
+extern page **_PAGE_POOL;
+extern int _POOL_INIT;
 #endif
@@ -0,0 +1,78 @@
+/* pgcompress.h
+ *
+ * Per-page compression for yahi-db tables.
+ *
+ * The compression scheme is chosen per table, when it is created:
+ *
+ *  PGC_NONE    pages are stored as-is, a block apiece.
+ *  PGC_LIGHT   each page is split into its columns, and each column is
+ *              stored with a lightweight encoding suited to its type:
+ *              frame-of-reference with bit-packing or run-length encoding
+ *              for INTs (whichever is smaller), and dictionary encoding
+ *              for CHARs. If that doesn't pay off for a page, LZ4 is
+ *              tried instead.
+ *  PGC_LZ4     each page is compressed with LZ4 (block format).
+ *
+ * Any page which doesn't compress is stored raw. Pages are compressed as
+ * they are written back by buff_flush, and decompressed by buff_load.
+ *
+ * Compressed pages are stored as variable-length extents in the table
+ * file, after the header block. A block map gives the extent for each
+ * logical block; a page which is rewritten reuses its extent if it still
+ * fits, and is otherwise appended to the file. The map is held in memory
+ * while the table is open, and each block's entry is written through to
+ * <db>/<name>.map as the block is written back, so that a table which
+ * isn't closed cleanly loses no flushed pages to a stale map.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include "blockio.h"
+#include "table.h"
+#include "yahi.h"
+
+#define PGC_NONE 0
+#define PGC_LIGHT 1
+#define PGC_LZ4 2
+
+// The worst case size of a compressed page (a tag byte plus the raw page)
+#define PGC_MAX_SIZE (BLOCKSIZE + 1)
+
+typedef struct pgc_extent {
+    off_t offset;       // -1 if the block has never been written
+    int length;
+    int capacity;
+} pgc_extent;
+
+typedef struct pgc_map {
+    int blk_cnt;
+    int cap;
+    pgc_extent *extents;
+
+    FILE *file;         // <db>/<name>.map
+    int saved;          // entries in the map file
+} pgc_map;
+
+int pgc_compress(table *tbl, byte *page, byte *out);
+int pgc_decompress(table *tbl, byte *in, int length, byte *page);
+
+int pgc_lz4_compress(byte *src, int length, byte *dst, int capacity);
+int pgc_lz4_decompress(byte *src, int length, byte *dst, int capacity);
+
+pgc_map *pgc_map_create(table *tbl);
+pgc_map *pgc_map_load(table *tbl);
+int pgc_map_save(table *tbl);
+void pgc_map_free(pgc_map *map);
+int pgc_map_extend(pgc_map *map, int blk_no);
+
+int pgc_read_blk(table *tbl, int blk_no, byte *data);
+int pgc_write_blk(table *tbl, int blk_no, byte *data);
+
+long pgc_stored_bytes(table *tbl);
@@ -0,0 +1,59 @@
+/* pscan.h
+ *
+ * Morsel-driven parallel table scans for the yahi-db project.
+ *
+ * The data blocks of a table are split into morsels of a few dozen
+ * consecutive blocks, and the morsels dealt out, in contiguous runs, to the
+ * deques of a set of worker threads. Each worker takes morsels from the
+ * front of its own deque, and once that is empty steals from the back of
+ * the others', so that a thread which falls behind (on slower blocks, a
+ * busier core, or a more expensive pipeline) has its remaining work picked
+ * up by the rest.
+ *
+ * A worker decodes the records of its morsels, through the table's codec,
+ * into batches, and hands each to the caller's pipeline function along
+ * with its thread number. The pipeline keeps whatever per-thread state it
+ * needs (a running aggregate, a local hash table, ...) indexed by that
+ * number, and the caller merges those states once ps_run returns. A batch
+ * never spans more than one morsel.
+ *
+ * The table's pages are read through the buffer pool (or its mapping), so
+ * the tables scanned must not be modified while a scan runs.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "exec.h"
+#include "table.h"
+
+#define PS_DEFAULT_THREADS 4
+#define PS_DEFAULT_MORSEL_BLKS 32
+#define PS_MAX_THREADS 64
+
+typedef struct ps_opts {
+    int threads;
+    int morsel_blks;
+} ps_opts;
+
+typedef struct ps_stats {
+    long morsels;       // morsels processed
+    long stolen;        // of those, taken from another thread's deque
+    long blocks;
+    long rows;
+} ps_stats;
+
+/*
+ * A per-thread pipeline, called with each batch of rows scanned by thread
+ * (0 .. threads-1). The batch is only valid for the duration of the call.
+ * Returning 0 stops the scan.
+ */
+typedef int (*ps_pipeline)(batch *b, int thread, void *ctx);
+
+void ps_default_opts(ps_opts *opts);
+int ps_run(table *tbl, ps_opts *opts, ps_pipeline fn, void *ctx, ps_stats *stats);
@@ -0,0 +1,83 @@
+/* roaring.h
+ *
+ * Compressed bitmaps of record ids for the yahi-db project.
+ *
+ * A roaring bitmap splits the 32-bit id space into chunks of 2^16 ids,
+ * keyed by the high 16 bits, and stores each non-empty chunk in the
+ * container best suited to its density: a sorted array of the low 16 bits
+ * while it holds at most RB_ARRAY_MAX ids, and a plain 2^16-bit bitmap
+ * beyond that. Containers are kept sorted by key, and changed from one
+ * kind to the other as ids are added and removed, so that a bitmap never
+ * takes much more than two bytes per id, nor more than one bit per id in
+ * its range.
+ *
+ * AND, OR and AND NOT are taken a container pair at a time. Pairs of
+ * bitmap containers are combined a vector of words at a time, using the
+ * compiler's vector extensions (which become SSE2 or AVX2 instructions,
+ * as the target allows); arrays are merged, and arrays paired with
+ * bitmaps are probed against them. The results are new bitmaps, and the
+ * operands are left unchanged.
+ *
+ * Bitmaps are not safe for concurrent modification.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "yahi.h"
+
+#define RB_ARRAY 0
+#define RB_BITMAP 1
+
+#define RB_ARRAY_MAX 4096
+#define RB_BITMAP_WORDS 1024
+
+typedef struct rb_container {
+    uint16_t key;       // the high 16 bits of the container's ids
+    uint16_t type;
+    int card;
+    int cap;            // of array, in values
+    union {
+        uint16_t *array;
+        uint64_t *bits;
+    };
+} rb_container;
+
+typedef struct roaring {
+    int cnt;
+    int cap;
+    rb_container *cs;
+} roaring;
+
+typedef struct rb_iter {
+    roaring *rb;
+    int c;
+    int pos;
+} rb_iter;
+
+roaring *rb_create();
+roaring *rb_copy(roaring *rb);
+void rb_free(roaring *rb);
+
+int rb_add(roaring *rb, uint32_t id);
+int rb_remove(roaring *rb, uint32_t id);
+int rb_contains(roaring *rb, uint32_t id);
+long rb_cardinality(roaring *rb);
+
+roaring *rb_and(roaring *a, roaring *b);
+roaring *rb_or(roaring *a, roaring *b);
+roaring *rb_andnot(roaring *a, roaring *b);
+roaring *rb_not(roaring *a, uint32_t n);
+
+void rb_iter_init(rb_iter *it, roaring *rb);
+int rb_iter_next(rb_iter *it, uint32_t *ids, int max);
+
+long rb_serialized_size(roaring *rb);
+void rb_serialize(roaring *rb, byte *buf);
+roaring *rb_deserialize(byte *buf, long len);
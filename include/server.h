@@ -0,0 +1,151 @@
+/* server.h
+ *
+ * A local database server for the yahi-db project.
+ *
+ * The server owns a database directory, the tables in it, and the buffer
+ * pool caching them, and serves those tables to any number of client
+ * processes over a Unix domain socket, so that the clients share one cache
+ * rather than each embedding its own (see client.h for the client side,
+ * and tools/yahid.c for the server program).
+ *
+ * The protocol is binary. A request is a srv_req header followed by len
+ * bytes of payload, and a response a srv_resp header followed by len bytes
+ * of payload. Integers are in host byte order, as both ends are on the
+ * same machine. Requests may be pipelined: a client may send any number of
+ * them without waiting for their responses, which come back in the order
+ * the requests were sent, each carrying its request's id (which the server
+ * echoes back without interpreting).
+ *
+ *   op          tbl      request payload       status, response payload
+ *   SRV_PING    -        -                     0
+ *   SRV_CREATE  -        srv_schema, name      handle, u32 record length
+ *   SRV_OPEN    -        name                  handle, u32 record length
+ *   SRV_INSERT  handle   record                rid
+ *   SRV_READ    handle   u32 rid               1, record; or 0
+ *   SRV_UPDATE  handle   u32 rid, record       1 or 0
+ *
+ * A failed operation has the status SRV_ERR, a malformed request or one of
+ * an unknown op SRV_EPROTO, and one naming a table which isn't open
+ * SRV_ENOTBL. A request with a payload longer than SRV_MAX_PAYLOAD closes
+ * the connection. Table handles are shared by all connections.
+ *
+ * One thread waits, with epoll, for connections with input, and hands each
+ * ready one to a pool of worker threads. Connections are registered
+ * one-shot, so that only one worker handles a connection at a time, and
+ * are re-armed once their worker is done with them. A worker reads all of
+ * the input available, executes every complete request in it, and sends
+ * all of their responses back in a single write, so that pipelined
+ * requests get batched responses. If the socket won't take all of the
+ * output, the rest is sent once it is writable, and no more of the
+ * connection's input is read until then.
+ *
+ * Each table has a reader-writer lock: its reads run concurrently, while
+ * its inserts and updates run one at a time. A table's file may still be
+ * written by a worker on another table, which evicts one of its dirty
+ * pages to make room, while its own writer extends it; blockio locks a
+ * file around each of its calls, so that the two don't interleave.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/un.h>
+#include "table.h"
+#include "yahi.h"
+
+#define SRV_DEFAULT_WORKERS 4
+#define SRV_MAX_WORKERS 64
+#define SRV_MAX_TABLES 64
+#define SRV_MAX_PAYLOAD (1 << 20)
+
+// Request ops
+#define SRV_PING 0
+#define SRV_CREATE 1
+#define SRV_OPEN 2
+#define SRV_INSERT 3
+#define SRV_READ 4
+#define SRV_UPDATE 5
+
+// Error statuses
+#define SRV_ERR -1
+#define SRV_EPROTO -2
+#define SRV_ENOTBL -3
+
+typedef struct srv_req {
+    uint32_t len;
+    uint32_t id;
+    uint16_t op;
+    uint16_t tbl;
+} srv_req;
+
+typedef struct srv_resp {
+    uint32_t len;
+    uint32_t id;
+    int32_t status;
+} srv_resp;
+
+// The schema of a table to create, as sent in a SRV_CREATE request
+typedef struct srv_schema {
+    uint8_t field_cnt;
+    uint8_t field_types[MAX_ATTRS];
+    uint16_t field_lengths[MAX_ATTRS];
+} srv_schema;
+
+typedef struct srv_opts {
+    int workers;
+} srv_opts;
+
+typedef struct srv_stats {
+    long connections;   // accepted since the server started
+    long requests;
+    long batches;       // writes of responses, each of one or more
+} srv_stats;
+
+typedef struct srv_table {
+    table *tbl;
+    pthread_rwlock_t lock;
+} srv_table;
+
+struct srv_conn;
+
+typedef struct server {
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    char db[MAX_DB_NAME];
+    srv_opts opts;
+
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;
+
+    pthread_t loop;
+    pthread_t workers[SRV_MAX_WORKERS];
+
+    // Connections ready to be handled, and all open connections
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cv;
+    struct srv_conn *ready_head;
+    struct srv_conn *ready_tail;
+    struct srv_conn *conns;
+    int stopping;
+
+    pthread_mutex_t tbl_lock;
+    srv_table tables[SRV_MAX_TABLES];
+    _Atomic int tbl_cnt;
+
+    _Atomic long connections;
+    _Atomic long requests;
+    _Atomic long batches;
+} server;
+
+void srv_default_opts(srv_opts *opts);
+server *srv_start(char *path, char *db, srv_opts *opts);
+void srv_stop(server *srv);
+void srv_stats_get(server *srv, srv_stats *stats);
@@ -0,0 +1,93 @@
+/* ssdcache.h
+ *
+ * A second-tier page cache for the yahi-db buffer pool, kept in a file on
+ * fast local storage.
+ *
+ * When a pool with a cache attached (see buff_pool_set_cache) evicts a
+ * clean page, the page may be copied into the cache file, and a later miss
+ * on it in the pool is served from there rather than from the table's own
+ * file. Only the directory (which table block each slot of the file holds)
+ * is kept in memory: an open-addressed hash table of slot numbers, and for
+ * each slot its tag and a reference bit, some 40 bytes per cached page.
+ *
+ * The cache is inclusive, and a cached block always has the same contents
+ * as the block in the table's file. A page that is read from the cache
+ * stays in it, so it need not be written again if it is evicted from the
+ * pool unchanged. A page that was modified while in the pool is written
+ * back to the table when it is evicted, and its copy in the cache is
+ * dropped at the same time. All of a table's blocks are dropped when its
+ * pages are released from the pool (buff_evict_tbl), which tbl_close
+ * does before the table's file is closed.
+ *
+ * Admission: while the cache has free slots, every clean page evicted from
+ * the pool is admitted. Once it is full, under SC_ADMIT_REPEAT a page is
+ * only admitted if it has already been turned away once recently, which
+ * the cache tracks with a small filter of the blocks it has refused. This
+ * keeps a single pass over a large table from flushing the cache. Under
+ * SC_ADMIT_ALL every evicted clean page is admitted.
+ *
+ * Eviction: a clock over the slots, where a slot's reference bit is set
+ * whenever it is read or admitted again.
+ *
+ * A cache serves one pool at a time, and is only used with that pool's
+ * lock held, so it has no lock of its own. Its file only means anything
+ * to the directory in memory, and is deleted when the cache is freed.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "table.h"
+#include "yahi.h"
+
+// Admission policies
+#define SC_ADMIT_ALL 0
+#define SC_ADMIT_REPEAT 1
+
+#define SC_PATH_LEN 256
+
+typedef struct sc_tag {
+    table *tbl;
+    int blk_no;
+} sc_tag;
+
+typedef struct sc_cache {
+    char path[SC_PATH_LEN];
+    int fd;
+    int slots;
+    int policy;
+
+    sc_tag *tags;           // the block held in each slot; tbl is NULL if free
+    byte *refs;
+    int *free;              // stack of free slots
+    int free_cnt;
+    int hand;
+
+    int32_t *dir;           // hash of (table, block) to slot, -1 if empty
+    int dir_mask;
+
+    uint32_t *ghosts;       // hashes of blocks recently turned away
+    int ghost_mask;
+
+    long hits;
+    long misses;
+    long admits;
+    long rejects;
+    long evictions;
+    long invalidations;
+} sc_cache;
+
+sc_cache *sc_create(char *path, int slots, int policy);
+void sc_free(sc_cache *cache);
+
+int sc_read(sc_cache *cache, table *tbl, int blk_no, byte *data);
+int sc_admit(sc_cache *cache, table *tbl, int blk_no, byte *data);
+void sc_invalidate(sc_cache *cache, table *tbl, int blk_no);
+int sc_invalidate_tbl(sc_cache *cache, table *tbl);
+int sc_contains(sc_cache *cache, table *tbl, int blk_no);
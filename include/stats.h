@@ -0,0 +1,167 @@
+/* stats.h
+ *
+ * Buffer pool and block I/O statistics for yahi-db.
+ *
+ * Counters and latency histograms are kept per thread, so that recording
+ * an event never contends with other threads, and are summed when a
+ * snapshot is taken. Counters for individual tables (hits, misses,
+ * evictions and write-backs of that table's pages) are kept in the table
+ * itself. Histograms are HDR-style: log-linear buckets with STAT_SUB_BITS
+ * bits of precision, so any recorded latency is within 1/16th of its
+ * bucket's bounds. stat_tiers breaks page requests down by the tier that
+ * served them: the pool, its second-tier cache, or the table's file.
+ *
+ * Building with -DYAHI_NO_STATS (make STATS=0) compiles all of the
+ * recording out; the query functions then report zeroes.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+// Counters. The first STAT_TBL_CNT are also tracked per table.
+#define STAT_HITS 0
+#define STAT_MISSES 1
+#define STAT_EVICTIONS 2
+#define STAT_WRITEBACKS 3
+#define STAT_BLK_READS 4
+#define STAT_BLK_WRITES 5
+#define STAT_BYTES_READ 6
+#define STAT_BYTES_WRITTEN 7
+#define STAT_CACHE_HITS 8
+#define STAT_CACHE_MISSES 9
+#define STAT_CACHE_ADMITS 10
+#define STAT_CNT 11
+#define STAT_TBL_CNT 4
+
+// Latency histograms, in nanoseconds
+#define STAT_HIST_READ 0
+#define STAT_HIST_WRITE 1
+#define STAT_HIST_PIN_WAIT 2
+#define STAT_HIST_CACHE_READ 3
+#define STAT_HIST_CACHE_WRITE 4
+#define STAT_HIST_CNT 5
+
+// Tiers a page request may be served from, as reported by stat_tiers
+#define STAT_TIER_POOL 0
+#define STAT_TIER_CACHE 1
+#define STAT_TIER_DISK 2
+#define STAT_TIER_CNT 3
+
+#define STAT_SUB_BITS 4
+#define STAT_MAX_EXP 40
+#define STAT_HIST_BUCKETS ((STAT_MAX_EXP - STAT_SUB_BITS + 2) << STAT_SUB_BITS)
+
+struct table;
+
+typedef struct stat_tbl {
+    _Atomic long counters[STAT_TBL_CNT];
+} stat_tbl;
+
+typedef struct stat_hist {
+    long counts[STAT_HIST_BUCKETS];
+    long total;
+    long sum;
+} stat_hist;
+
+typedef struct stat_snapshot {
+    long counters[STAT_CNT];
+    stat_hist hists[STAT_HIST_CNT];
+} stat_snapshot;
+
+typedef struct stat_tier {
+    long lookups;
+    long hits;
+    double hit_ratio;
+    double mean_ns;
+    long p99_ns;
+} stat_tier;
+
+/*
+ * A thread's private statistics. Only the owning thread writes to these,
+ * so updates are plain (relaxed) loads and stores rather than atomic
+ * read-modify-writes; the atomics just make concurrent snapshots safe.
+ */
+typedef struct stat_local {
+    _Atomic long counters[STAT_CNT];
+    _Atomic long hist_counts[STAT_HIST_CNT][STAT_HIST_BUCKETS];
+    _Atomic long hist_total[STAT_HIST_CNT];
+    _Atomic long hist_sum[STAT_HIST_CNT];
+    struct stat_local *next;
+} stat_local;
+
+extern __thread stat_local *_STAT_LOCAL;
+
+stat_local *stat_local_init();
+
+void stat_snapshot_get(stat_snapshot *snap);
+void stat_reset();
+void stat_tbl_get(struct table *tbl, long *counters);
+void stat_tbl_reset(struct table *tbl);
+
+int stat_hist_bucket(long value);
+long stat_hist_bucket_max(int bucket);
+long stat_hist_percentile(stat_hist *hist, double pct);
+double stat_hist_mean(stat_hist *hist);
+void stat_tiers(stat_snapshot *snap, stat_tier *tiers);
+void stat_print(FILE *out, stat_snapshot *snap);
+
+
+static inline long stat_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+static inline void stat_bump(_Atomic long *ctr, long n)
+{
+    atomic_store_explicit(ctr, atomic_load_explicit(ctr, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+
+static inline void stat_add(int ctr, long n)
+{
+    stat_local *local = _STAT_LOCAL ? _STAT_LOCAL : stat_local_init();
+    if (local) stat_bump(&local->counters[ctr], n);
+}
+
+
+static inline void stat_record(int hist, long ns)
+{
+    stat_local *local = _STAT_LOCAL ? _STAT_LOCAL : stat_local_init();
+    if (!local) return;
+
+    stat_bump(&local->hist_counts[hist][stat_hist_bucket(ns)], 1);
+    stat_bump(&local->hist_total[hist], 1);
+    stat_bump(&local->hist_sum[hist], ns);
+}
+
+
+static inline void stat_tbl_add(stat_tbl *stats, int ctr)
+{
+    atomic_fetch_add_explicit(&stats->counters[ctr], 1, memory_order_relaxed);
+}
+
+
+#ifdef YAHI_NO_STATS
+#define STAT_ADD(ctr, n) ((void) 0)
+#define STAT_TBL_ADD(tbl, ctr) ((void) 0)
+#define STAT_TIMER(t)
+#define STAT_RECORD(hist, t) ((void) 0)
+#else
+#define STAT_ADD(ctr, n) stat_add((ctr), (n))
+#define STAT_TBL_ADD(tbl, ctr) stat_tbl_add(&(tbl)->stats, (ctr))
+#define STAT_TIMER(t) long t = stat_clock()
+#define STAT_RECORD(hist, t) stat_record((hist), stat_clock() - (t))
+#endif
@@ -3,33 +3,136 @@
  *
  * yahi-db table operations.
  *
+ * A table is stored in a single file, <db>/<name>.tbl. Block 0 of the file
+ * is a header block containing the schema and record count. Records are
+ * fixed-length and are packed into the following blocks without spanning,
+ * so record rid lives in block 1 + rid / tbl_recs_per_blk().
+ *
+ * Tables may optionally be created with page compression (see
+ * pgcompress.h), in which case the data blocks are stored as compressed,
+ * variable-length extents following the header block, and are located
+ * through a block map kept in <db>/<name>.map.
+ *
+ * Each table also keeps a zone map of per-block column bounds, which scans
+ * use to skip blocks (see zonemap.h), and may have a Bloom filter on a key
+ * column, which lets lookups of absent keys avoid scanning (see bloom.h),
+ * and an in-memory unique index on a column (see art.h), and bitmap
+ * indexes on low-cardinality columns (see bmindex.h). Grouped
+ * aggregates over a table may be kept as views, maintained as the table
+ * is written (see aggview.h).
+ *
+ * The table's codec (see codec.h), specialized to its schema, is built
+ * when the table is created or opened.
+ *
+ * A table's pages are cached in the default buffer pool unless the table
+ * is bound to another pool instance with buff_pool_bind (see pgbuffer.h).
+ *
+ * Tables are stored as a heap of records, addressed by record id, unless
+ * created with tbl_create_lsm, which keys the records on an INT column and
+ * stores them in a log-structured merge tree instead (see lsm.h). Such
+ * tables are written through tbl_insert, and read by key with lsm_get.
+ *
+ * Many threads may insert into an uncompressed heap table at once through
+ * inserters, each filling blocks of its own (see inserter.h).
+ *
+ * Uncompressed tables may also be opened read-only with tbl_load_mmap, which
+ * maps the whole file into memory. Pins of such a table bypass the buffer
+ * pool entirely, and return pages whose data points into the mapping.
+ *
  */
 
 #pragma once
 
 #include <stdio.h>
+#include "stats.h"
+#include "yahi.h"
 
 #define MAX_ATTRS 20
 #define MAX_TBL_NAME 20
 #define MAX_DB_NAME 20
 #define MAX_TBL_CNT 100;
 
+#define TBL_HEADER_BLK 0
+#define TBL_FIRST_BLK 1
+
+// Storage engines
+#define TBL_ENGINE_HEAP 0
+#define TBL_ENGINE_LSM 1
+
+// Access pattern hints for memory-mapped tables
+#define TBL_ACCESS_NORMAL 0
+#define TBL_ACCESS_SEQUENTIAL 1
+#define TBL_ACCESS_RANDOM 2
+
 typedef struct schema {
+    int field_cnt;
     int record_length;
     int field_lengths[MAX_ATTRS];
     int field_types[MAX_ATTRS];
 } schema;
 
 
+struct pgc_map;
+struct page;
+struct zone_map;
+struct bloom;
+struct buff_pool;
+struct codec;
+struct lsm_tree;
+struct lsm_opts;
+struct art_tree;
+struct av_view;
+struct bm_index;
+struct ins_session;
+
 typedef struct table {
    FILE *file; 
    char name[MAX_TBL_NAME];
    char db[MAX_DB_NAME];
    int record_cnt;
    schema fields;
+   struct codec *codec;
+
+   int compression;
+   struct pgc_map *cmap;
+
+   byte *map;
+   size_t map_len;
+   int map_blks;
+   struct page *map_pages;
+
+   struct zone_map *zmap;
+   struct bloom *bloom;
+   struct art_tree *art;
+   struct av_view *views;
+   struct bm_index *bitmaps[MAX_ATTRS];
+
+   struct buff_pool *pool;
+   struct ins_session *ins;
+
+   int engine;
+   struct lsm_tree *lsm;
+
+   stat_tbl stats;
 } table;
 
 
-int tbl_load(char* name, char* database);
-table *tbl_create(char* name, char* database, void *schema);
+table *tbl_load(char* name, char* database);
+table *tbl_create(char* name, char* database, schema *schema);
+table *tbl_create_compressed(char* name, char* database, schema *schema, int compression);
+table *tbl_create_lsm(char* name, char* database, schema *schema, int key_col,
+                      struct lsm_opts *opts);
+table *tbl_load_mmap(char* name, char* database, int access);
+int tbl_advise(table *tbl, int access);
+int tbl_close(table *tbl);
+
+int tbl_field_offset(schema *schema, int field);
+int tbl_recs_per_blk(table *tbl);
+int tbl_rec_blk(table *tbl, int rid);
+int tbl_rec_offset(table *tbl, int rid);
+int tbl_blk_cnt(table *tbl);
 
+int tbl_insert(table *tbl, byte *record);
+void tbl_index_add(table *tbl, byte *record, int rid);
+int tbl_read(table *tbl, int rid, byte *record);
+int tbl_update(table *tbl, int rid, byte *record);
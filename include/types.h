@@ -9,10 +9,40 @@
 
 #include "yahi.h"
 
+struct arena;
+
 #define INT 0
 #define CHAR 1
 #define FLOAT 2
 
+// Comparison operators, for use in predicates over fields
+#define CMP_EQ 0
+#define CMP_NE 1
+#define CMP_LT 2
+#define CMP_LE 3
+#define CMP_GT 4
+#define CMP_GE 5
+
 int tp_getasint(byte* record, int offset);
 double tp_getasfloat(byte* record, int offset);
-char *tp_getaschar(byte* record, int offset);
+char *tp_getaschar(byte* record, int offset, int length, struct arena *a);
+
+void tp_setint(byte* record, int offset, int value);
+void tp_setfloat(byte* record, int offset, double value);
+void tp_setchar(byte* record, int offset, char *value, int length);
+
+int tp_size(int type, int length);
+
+int tp_keysize(int type, int length);
+void tp_intkey(int value, unsigned char *key);
+void tp_floatkey(double value, unsigned char *key);
+void tp_getaskey(byte* record, int offset, int type, int length, unsigned char *key);
+
+/*
+ * Column-at-a-time kernels. Each takes a dense array of n values and writes
+ * the indices of those satisfying (value <cmp> rhs) into sel, returning the
+ * number of qualifying values.
+ */
+int tp_selint(const int *values, int n, int cmp, int rhs, int *sel);
+int tp_selfloat(const double *values, int n, int cmp, double rhs, int *sel);
+int tp_selchar(const char *values, int n, int length, int cmp, const char *rhs, int *sel);
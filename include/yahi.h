@@ -9,7 +9,7 @@
  *
  */
 
-#define pragma once
+#pragma once
 
 #define TRUE 1
 #define FALSE 0
@@ -0,0 +1,56 @@
+/* zonemap.h
+ *
+ * Per-block zone maps for yahi-db tables.
+ *
+ * A zone map records, for each data block of a table, the minimum and
+ * maximum value of each INT and FLOAT column among the records in that
+ * block. Scans consult it to skip blocks which cannot contain a record
+ * satisfying a comparison, without loading them into the buffer pool.
+ *
+ * The map is maintained as records are written, by tbl_insert and
+ * tbl_update. Bounds are only ever widened, so that an update can leave
+ * them looser than necessary, but never wrong. The map is held in memory
+ * while the table is open, and saved to <db>/<name>.zm when it is closed.
+ * If the file is missing, or was saved for a different number of records
+ * than the table has, when the table is opened, the map is rebuilt by
+ * reading the table. A table whose map cannot be built has
+ * none (zmap is NULL), and its scans simply skip nothing.
+ *
+ * Writes made directly to pinned pages with the pg_set* functions bypass
+ * the map, and so must not be used on columns that are scanned with
+ * filters.
+ *
+ * yahi-db has no NULLs, so no null counts are kept. A NaN in a FLOAT
+ * column widens its block's bounds to the whole line, as NaN satisfies
+ * CMP_NE against any value.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#pragma once
+
+#include "table.h"
+#include "yahi.h"
+
+typedef struct zone_map {
+    int blk_cnt;
+    int cap;
+    int col_cnt;
+    int types[MAX_ATTRS];
+
+    // [block][column][min, max], indexed from TBL_FIRST_BLK
+    double *bounds;
+} zone_map;
+
+zone_map *zm_create(table *tbl);
+zone_map *zm_load(table *tbl);
+int zm_save(table *tbl);
+void zm_remove(table *tbl);
+void zm_free(zone_map *zm);
+
+int zm_update(table *tbl, int rid, byte *record);
+int zm_may_match(zone_map *zm, int blk_no, int col, int cmp, double value);
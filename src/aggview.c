@@ -0,0 +1,668 @@
+/*
+ * aggview.c
+ *
+ * Incrementally maintained aggregate views for the yahi-db project.
+ *
+ * Groups are kept in a chained hash table, keyed by the concatenated
+ * bytes of their group columns as they appear in the table's records.
+ * Each group is a single allocation, laid out as
+ *
+ *      [av_group][av_acc]*[group key]
+ *
+ * and is unlinked and freed as soon as its last record is retracted.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aggview.h"
+#include "blockio.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define AV_MIN_BUCKETS 64
+
+// Passes of av_scan_table
+#define AV_BUILD 0
+#define AV_BOUNDS 1
+
+
+static inline uint64_t av_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static uint64_t av_hash(byte *key, int len)
+{
+    uint64_t h = len;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, key + i, 8);
+        h = av_mix(h ^ w);
+    }
+
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, key + i, len - i);
+        h = av_mix(h ^ w);
+    }
+
+    return h;
+}
+
+
+static inline byte *av_key(av_view *v, av_group *g)
+{
+    return (byte *) (g->accs + v->agg_cnt);
+}
+
+
+static void av_record_key(av_view *v, byte *record, byte *key)
+{
+    schema *s = &v->tbl->fields;
+    for (int g=0; g<v->group_cnt; g++) {
+        int col = v->group_cols[g];
+        memcpy(key, record + tbl_field_offset(s, col), s->field_lengths[col]);
+        key += s->field_lengths[col];
+    }
+}
+
+
+static double av_value(av_view *v, byte *record, int a)
+{
+    schema *s = &v->tbl->fields;
+    int col = v->aggs[a].col;
+    int off = tbl_field_offset(s, col);
+
+    return (s->field_types[col] == INT) ? tp_getasint(record, off) : tp_getasfloat(record, off);
+}
+
+
+static av_group *av_find(av_view *v, uint64_t hash, byte *key)
+{
+    av_group *g = v->buckets[hash & (v->bucket_cnt - 1)];
+    while (g && (g->hash != hash || memcmp(av_key(v, g), key, v->key_len) != 0)) g = g->next;
+
+    return g;
+}
+
+
+static void av_clear(av_view *v)
+{
+    for (long b=0; b<v->bucket_cnt; b++) {
+        av_group *g = v->buckets[b];
+        while (g) {
+            av_group *next = g->next;
+            free(g);
+            g = next;
+        }
+
+        v->buckets[b] = NULL;
+    }
+
+    v->groups = 0;
+    v->stale = 0;
+}
+
+
+static int av_grow(av_view *v)
+{
+    long cnt = v->bucket_cnt * 2;
+    av_group **buckets = calloc(cnt, sizeof(av_group *));
+    if (!buckets) return 0;
+
+    for (long b=0; b<v->bucket_cnt; b++) {
+        av_group *g = v->buckets[b];
+        while (g) {
+            av_group *next = g->next;
+            g->next = buckets[g->hash & (cnt - 1)];
+            buckets[g->hash & (cnt - 1)] = g;
+            g = next;
+        }
+    }
+
+    free(v->buckets);
+    v->buckets = buckets;
+    v->bucket_cnt = cnt;
+
+    return 1;
+}
+
+
+static av_group *av_group_new(av_view *v, uint64_t hash, byte *key)
+{
+    if (v->groups >= v->bucket_cnt && !av_grow(v)) return NULL;
+
+    av_group *g = calloc(1, sizeof(av_group) + sizeof(av_acc) * v->agg_cnt + v->key_len);
+    if (!g) return NULL;
+
+    g->hash = hash;
+    memcpy(av_key(v, g), key, v->key_len);
+
+    long b = hash & (v->bucket_cnt - 1);
+    g->next = v->buckets[b];
+    v->buckets[b] = g;
+    v->groups++;
+
+    return g;
+}
+
+
+static void av_group_unlink(av_view *v, av_group *g)
+{
+    av_group **p = &v->buckets[g->hash & (v->bucket_cnt - 1)];
+    while (*p != g) p = &(*p)->next;
+    *p = g->next;
+
+    if (g->stale) v->stale--;
+    v->groups--;
+    free(g);
+}
+
+
+/*
+ * Fold x into the MIN and MAX bounds of acc.
+ */
+static inline void av_bound(av_acc *acc, double x)
+{
+    if (acc->min_cnt == 0 || x < acc->min) {
+        acc->min = x;
+        acc->min_cnt = 1;
+    } else if (x == acc->min) {
+        acc->min_cnt++;
+    }
+
+    if (acc->max_cnt == 0 || x > acc->max) {
+        acc->max = x;
+        acc->max_cnt = 1;
+    } else if (x == acc->max) {
+        acc->max_cnt++;
+    }
+}
+
+
+/*
+ * Add (sign 1) or retract (sign -1) one record. Returns 1 on success, and
+ * 0 if the view could not be changed, or the record wasn't in it, in
+ * which case the view is marked to be rebuilt.
+ */
+static int av_apply(av_view *v, byte *record, int sign)
+{
+    byte key[BLOCKSIZE];
+    av_record_key(v, record, key);
+    uint64_t hash = av_hash(key, v->key_len);
+
+    av_group *g = av_find(v, hash, key);
+    if (!g && sign > 0) g = av_group_new(v, hash, key);
+    if (!g) {
+        v->broken = TRUE;
+        return 0;
+    }
+
+    g->count += sign;
+    for (int a=0; a<v->agg_cnt; a++) {
+        if (v->aggs[a].func == AGG_COUNT) continue;
+
+        av_acc *acc = &g->accs[a];
+        double x = av_value(v, record, a);
+
+        if (v->tbl->fields.field_types[v->aggs[a].col] == INT) acc->isum += sign * (long) x;
+        else acc->sum += sign * x;
+
+        if (sign > 0) {
+            av_bound(acc, x);
+            continue;
+        }
+
+        // Retracting the last record holding a bound leaves it unknown
+        int lost = 0;
+        if (x == acc->min) lost |= --acc->min_cnt == 0;
+        if (x == acc->max) lost |= --acc->max_cnt == 0;
+
+        if (lost && !g->stale) {
+            g->stale = TRUE;
+            v->stale++;
+        }
+    }
+
+    if (g->count == 0) av_group_unlink(v, g);
+
+    return 1;
+}
+
+
+/*
+ * Read every record of the table. With AV_BUILD, each is added to the
+ * (empty) view; with AV_BOUNDS, each is folded into the MIN and MAX of
+ * its group if that group is stale. Returns 1 on success and 0 on error.
+ */
+static int av_scan_table(av_view *v, int pass)
+{
+    table *tbl = v->tbl;
+    int per_blk = tbl_recs_per_blk(tbl);
+    int blk_cnt = tbl_blk_cnt(tbl);
+    int rec_len = tbl->fields.record_length;
+    byte key[BLOCKSIZE];
+
+    for (int b=0; b<blk_cnt; b++) {
+        page *pg = buff_pin(tbl, TBL_FIRST_BLK + b);
+        if (!pg) return 0;
+
+        for (int i=0; i<per_blk && b * per_blk + i < tbl->record_cnt; i++) {
+            byte *record = pg->data + i * rec_len;
+
+            if (pass == AV_BUILD) {
+                if (!av_apply(v, record, 1)) {
+                    buff_unpin(tbl, TBL_FIRST_BLK + b);
+                    return 0;
+                }
+                continue;
+            }
+
+            av_record_key(v, record, key);
+            av_group *g = av_find(v, av_hash(key, v->key_len), key);
+            if (!g || !g->stale) continue;
+
+            for (int a=0; a<v->agg_cnt; a++) {
+                if (v->aggs[a].func != AGG_COUNT) av_bound(&g->accs[a], av_value(v, record, a));
+            }
+        }
+
+        buff_unpin(tbl, TBL_FIRST_BLK + b);
+    }
+
+    return 1;
+}
+
+
+static int av_rebuild(av_view *v)
+{
+    av_clear(v);
+    v->broken = FALSE;
+    v->rescans++;
+
+    if (av_scan_table(v, AV_BUILD)) return 1;
+
+    av_clear(v);
+    v->broken = TRUE;
+    return 0;
+}
+
+
+/*
+ * Recompute the MIN and MAX of every stale group, in one scan.
+ */
+static int av_refresh(av_view *v)
+{
+    for (long b=0; b<v->bucket_cnt; b++) {
+        for (av_group *g=v->buckets[b]; g; g=g->next) {
+            if (!g->stale) continue;
+
+            for (int a=0; a<v->agg_cnt; a++) {
+                g->accs[a].min_cnt = 0;
+                g->accs[a].max_cnt = 0;
+            }
+        }
+    }
+
+    v->rescans++;
+    if (!av_scan_table(v, AV_BOUNDS)) return 0;
+
+    for (long b=0; b<v->bucket_cnt; b++) {
+        for (av_group *g=v->buckets[b]; g; g=g->next) g->stale = FALSE;
+    }
+
+    v->stale = 0;
+    return 1;
+}
+
+
+static void av_apply_pending(av_view *v)
+{
+    int rec_len = v->tbl->fields.record_length;
+    for (int i=0; i<v->pending_cnt && !v->broken; i++) {
+        av_apply(v, v->pending + (long) i * rec_len, v->signs[i]);
+    }
+
+    v->applied += v->pending_cnt;
+    v->pending_cnt = 0;
+}
+
+
+/*
+ * Bring the view up to date with the table. Called with the view locked.
+ */
+static int av_sync(av_view *v)
+{
+    av_apply_pending(v);
+
+    if (v->broken) return av_rebuild(v);
+    if (v->stale) return av_refresh(v);
+
+    return 1;
+}
+
+
+/*
+ * Add or retract one record, as av_apply does, or defer it with a batch
+ * size above 1. Called with the view locked.
+ */
+static void av_change_locked(av_view *v, byte *record, int sign)
+{
+    if (v->batch > 1) {
+        int rec_len = v->tbl->fields.record_length;
+        memcpy(v->pending + (long) v->pending_cnt * rec_len, record, rec_len);
+        v->signs[v->pending_cnt++] = sign;
+
+        if (v->pending_cnt == v->batch) av_apply_pending(v);
+    } else if (!v->broken) {
+        av_apply(v, record, sign);
+        v->applied++;
+    }
+}
+
+
+static int av_change(av_view *v, byte *record, int sign)
+{
+    pthread_mutex_lock(&v->lock);
+
+    av_change_locked(v, record, sign);
+    int ok = !v->broken;
+    pthread_mutex_unlock(&v->lock);
+
+    return ok;
+}
+
+
+/*
+ * Add record, which has been written to the view's table, to the view.
+ * Returns 1 on success, and 0 if the view could not be updated, and will
+ * be rebuilt from the table when it is next read.
+ */
+int av_insert(av_view *view, byte *record)
+{
+    return av_change(view, record, 1);
+}
+
+
+/*
+ * Retract record, which has been removed from (or overwritten in) the
+ * view's table, from the view. Returns as av_insert.
+ */
+int av_remove(av_view *view, byte *record)
+{
+    return av_change(view, record, -1);
+}
+
+
+/*
+ * Apply any deferred changes, and recompute any stale bounds, now rather
+ * than at the next read. Returns 1 on success and 0 on error.
+ */
+int av_flush(av_view *view)
+{
+    pthread_mutex_lock(&view->lock);
+    int ok = av_sync(view);
+    pthread_mutex_unlock(&view->lock);
+
+    return ok;
+}
+
+
+static void av_row(av_view *v, av_group *g, byte *row)
+{
+    memcpy(row, av_key(v, g), v->key_len);
+
+    schema *s = &v->tbl->fields;
+    int off = v->key_len;
+    for (int a=0; a<v->agg_cnt; a++) {
+        av_acc *acc = &g->accs[a];
+        int is_int = v->aggs[a].func != AGG_COUNT && s->field_types[v->aggs[a].col] == INT;
+        double sum = is_int ? (double) acc->isum : acc->sum;
+
+        switch (v->aggs[a].func) {
+            case AGG_COUNT: tp_setint(row, off, g->count); break;
+            case AGG_SUM: tp_setfloat(row, off, sum); break;
+            case AGG_AVG: tp_setfloat(row, off, sum / g->count); break;
+            case AGG_MIN:
+                if (is_int) tp_setint(row, off, acc->min);
+                else tp_setfloat(row, off, acc->min);
+                break;
+            case AGG_MAX:
+                if (is_int) tp_setint(row, off, acc->max);
+                else tp_setfloat(row, off, acc->max);
+                break;
+        }
+
+        off += v->out.field_lengths[v->group_cnt + a];
+    }
+}
+
+
+/*
+ * Find the group whose columns match those of record (a record of the
+ * view's table, of which only the group columns are read), and write its
+ * row of the view to row. Returns 1 if the group was found, 0 if it has
+ * no records, and -1 on error.
+ */
+int av_lookup(av_view *view, byte *record, byte *row)
+{
+    byte key[BLOCKSIZE];
+    av_record_key(view, record, key);
+    uint64_t hash = av_hash(key, view->key_len);
+
+    pthread_mutex_lock(&view->lock);
+    if (!av_sync(view)) {
+        pthread_mutex_unlock(&view->lock);
+        return -1;
+    }
+
+    av_group *g = av_find(view, hash, key);
+    if (g) av_row(view, g, row);
+    pthread_mutex_unlock(&view->lock);
+
+    return g != NULL;
+}
+
+
+/*
+ * Call fn with each row of the view, in no particular order. Returns the
+ * number of rows visited, or -1 on error. The view is locked during the
+ * scan, so fn must not write to the view's table.
+ */
+long av_scan(av_view *view, av_scan_fn fn, void *ctx)
+{
+    byte row[BLOCKSIZE];
+    long cnt = 0;
+
+    pthread_mutex_lock(&view->lock);
+    if (!av_sync(view)) {
+        pthread_mutex_unlock(&view->lock);
+        return -1;
+    }
+
+    for (long b=0; b<view->bucket_cnt; b++) {
+        for (av_group *g=view->buckets[b]; g; g=g->next) {
+            av_row(view, g, row);
+            cnt++;
+            if (!fn(row, ctx)) goto done;
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&view->lock);
+    return cnt;
+}
+
+
+void av_free(av_view *view)
+{
+    if (!view) return;
+
+    av_clear(view);
+    free(view->buckets);
+    free(view->pending);
+    free(view->signs);
+    pthread_mutex_destroy(&view->lock);
+    free(view);
+}
+
+
+static int av_init_out(av_view *v)
+{
+    schema *s = &v->tbl->fields;
+    schema *out = &v->out;
+
+    out->field_cnt = v->group_cnt + v->agg_cnt;
+    for (int g=0; g<v->group_cnt; g++) {
+        out->field_types[g] = s->field_types[v->group_cols[g]];
+        out->field_lengths[g] = s->field_lengths[v->group_cols[g]];
+        v->key_len += out->field_lengths[g];
+    }
+
+    for (int a=0; a<v->agg_cnt; a++) {
+        int func = v->aggs[a].func;
+        int type = INT;
+
+        if (func < AGG_COUNT || func > AGG_AVG) return 0;
+        if (func != AGG_COUNT) {
+            int col = v->aggs[a].col;
+            if (col < 0 || col >= s->field_cnt) return 0;
+            if (s->field_types[col] != INT && s->field_types[col] != FLOAT) return 0;
+
+            type = (func == AGG_SUM || func == AGG_AVG) ? FLOAT : s->field_types[col];
+        }
+
+        out->field_types[v->group_cnt + a] = type;
+        out->field_lengths[v->group_cnt + a] = tp_size(type, 0);
+    }
+
+    out->record_length = 0;
+    for (int i=0; i<out->field_cnt; i++) out->record_length += out->field_lengths[i];
+
+    return out->record_length <= BLOCKSIZE;
+}
+
+
+/*
+ * Create a view of tbl, grouped on the group_cnt columns group_cols (none
+ * giving a single group over the whole table), with the agg_cnt
+ * aggregates aggs, and build it from the table's records. Changes are
+ * applied batch at a time; a batch of 0 or 1 applies each as it is made.
+ * Returns NULL if the view is invalid or cannot be built, or the table is
+ * an LSM table.
+ */
+av_view *tbl_view_create(table *tbl, int group_cnt, int *group_cols, int agg_cnt,
+                         agg_spec *aggs, int batch)
+{
+    if (tbl->lsm || group_cnt < 0 || agg_cnt <= 0 || group_cnt + agg_cnt > MAX_ATTRS) {
+        return NULL;
+    }
+
+    for (int g=0; g<group_cnt; g++) {
+        if (group_cols[g] < 0 || group_cols[g] >= tbl->fields.field_cnt) return NULL;
+    }
+
+    av_view *v = calloc(1, sizeof(av_view));
+    if (!v) return NULL;
+
+    v->tbl = tbl;
+    v->group_cnt = group_cnt;
+    v->agg_cnt = agg_cnt;
+    if (group_cnt) memcpy(v->group_cols, group_cols, sizeof(int) * group_cnt);
+    memcpy(v->aggs, aggs, sizeof(agg_spec) * agg_cnt);
+    v->batch = (batch > 1) ? batch : 1;
+    pthread_mutex_init(&v->lock, NULL);
+
+    v->bucket_cnt = AV_MIN_BUCKETS;
+    v->buckets = calloc(v->bucket_cnt, sizeof(av_group *));
+    if (!v->buckets || !av_init_out(v)) goto error;
+
+    if (v->batch > 1) {
+        v->pending = malloc((long) v->batch * tbl->fields.record_length);
+        v->signs = malloc(v->batch);
+        if (!v->pending || !v->signs) goto error;
+    }
+
+    if (!av_rebuild(v)) goto error;
+    v->rescans = 0;
+
+    v->next = tbl->views;
+    tbl->views = v;
+
+    return v;
+
+error:
+    av_free(v);
+    return NULL;
+}
+
+
+/*
+ * Remove view from tbl and free it. Returns 1 on success, and 0 if it is
+ * not one of the table's views.
+ */
+int tbl_view_drop(table *tbl, av_view *view)
+{
+    av_view **p = &tbl->views;
+    while (*p && *p != view) p = &(*p)->next;
+    if (!*p) return 0;
+
+    *p = view->next;
+    av_free(view);
+
+    return 1;
+}
+
+
+/*
+ * Add a newly inserted record to each of the table's views.
+ */
+void tbl_view_add(table *tbl, byte *record)
+{
+    for (av_view *v=tbl->views; v; v=v->next) av_insert(v, record);
+}
+
+
+/*
+ * Overwrite stored, the copy of an updated record in its (pinned) page,
+ * with record, and replace the old version with the new one in each of
+ * the table's views. The page is written with every view locked, as a
+ * view's bounds are refreshed by a scan of the table made with it locked,
+ * which must not see the old version once it has been retracted, nor the
+ * new one before it has been added.
+ */
+void tbl_view_replace(table *tbl, byte *stored, byte *record)
+{
+    int rec_len = tbl->fields.record_length;
+    byte old[BLOCKSIZE];
+    memcpy(old, stored, rec_len);
+
+    for (av_view *v=tbl->views; v; v=v->next) pthread_mutex_lock(&v->lock);
+
+    memcpy(stored, record, rec_len);
+    for (av_view *v=tbl->views; v; v=v->next) {
+        av_change_locked(v, old, -1);
+        av_change_locked(v, record, 1);
+    }
+
+    for (av_view *v=tbl->views; v; v=v->next) pthread_mutex_unlock(&v->lock);
+}
@@ -0,0 +1,177 @@
+/*
+ * arena.c
+ *
+ * Region allocators for the yahi-db project.
+ *
+ * A thread's chunk for an arena is remembered in a small direct-mapped
+ * cache, keyed by the arena's id. Ids are never reused, neither by a
+ * reset nor by a new arena at the address of a freed one, so a stale
+ * entry can never match, and is simply overwritten.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "yahi.h"
+
+#define ARENA_TLS_SLOTS 4
+
+typedef struct arena_tls {
+    uint64_t id;
+    arena_chunk *chunk;
+} arena_tls;
+
+static _Thread_local arena_tls _TLS[ARENA_TLS_SLOTS];
+static _Atomic uint64_t _NEXT_ID = 1;
+
+
+/*
+ * Create an arena whose chunks hold chunk_size bytes each, or
+ * ARENA_DEFAULT_CHUNK if chunk_size is 0. Returns NULL on failure.
+ */
+arena *arena_create(size_t chunk_size)
+{
+    arena *a = calloc(1, sizeof(arena));
+    if (!a) return NULL;
+
+    a->id = atomic_fetch_add(&_NEXT_ID, 1);
+    a->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+    pthread_mutex_init(&a->lock, NULL);
+
+    return a;
+}
+
+
+static void arena_free_chunks(arena_chunk *c)
+{
+    while (c) {
+        arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+
+void arena_free(arena *a)
+{
+    if (!a) return;
+
+    arena_free_chunks(a->chunks);
+    arena_free_chunks(a->spare);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+
+/*
+ * Release everything allocated from the arena. Chunks of the standard
+ * size are kept for the allocations that follow; larger ones are freed.
+ */
+void arena_reset(arena *a)
+{
+    pthread_mutex_lock(&a->lock);
+
+    arena_chunk *c = a->chunks;
+    while (c) {
+        arena_chunk *next = c->next;
+        if (c->cap == a->chunk_size) {
+            c->next = a->spare;
+            a->spare = c;
+        } else {
+            free(c);
+        }
+        c = next;
+    }
+
+    a->chunks = NULL;
+    a->id = atomic_fetch_add(&_NEXT_ID, 1);
+
+    pthread_mutex_unlock(&a->lock);
+}
+
+
+/*
+ * Take a chunk with room for at least need bytes, reusing a spare one if
+ * it is big enough, with the arena's lock held.
+ */
+static arena_chunk *arena_chunk_get(arena *a, size_t need)
+{
+    arena_chunk *c;
+
+    if (need <= a->chunk_size && a->spare) {
+        c = a->spare;
+        a->spare = c->next;
+    } else {
+        size_t cap = (need > a->chunk_size) ? need : a->chunk_size;
+        c = malloc(sizeof(arena_chunk) + cap);
+        if (!c) return NULL;
+
+        c->cap = cap;
+        a->mallocs++;
+    }
+
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+
+    return c;
+}
+
+
+/*
+ * Allocate size bytes, aligned to ARENA_ALIGN, which stay valid until the
+ * arena is reset or freed. Returns NULL on failure.
+ */
+void *arena_alloc(arena *a, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (size == 0) size = ARENA_ALIGN;
+
+    arena_tls *t = &_TLS[a->id % ARENA_TLS_SLOTS];
+    if (t->id == a->id && t->chunk->cap - t->chunk->used >= size) {
+        void *p = t->chunk->data + t->chunk->used;
+        t->chunk->used += size;
+        return p;
+    }
+
+    int large = size > a->chunk_size / 4;
+
+    pthread_mutex_lock(&a->lock);
+    arena_chunk *c = arena_chunk_get(a, large ? size : a->chunk_size);
+    pthread_mutex_unlock(&a->lock);
+
+    if (!c) return NULL;
+    c->used = size;
+
+    // A large allocation leaves the thread's current chunk in place
+    if (!large) {
+        t->id = a->id;
+        t->chunk = c;
+    }
+
+    return c->data;
+}
+
+
+/*
+ * Copy len bytes of src into the arena, with a null terminator.
+ */
+char *arena_strndup(arena *a, const char *src, size_t len)
+{
+    char *dst = arena_alloc(a, len + 1);
+    if (!dst) return NULL;
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+
+    return dst;
+}
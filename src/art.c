@@ -0,0 +1,1252 @@
+/*
+ * art.c
+ *
+ * Adaptive radix tree indexes for the yahi-db project.
+ *
+ * Leaves are not nodes: a child pointer with its low bit set points to a
+ * leaf holding a full key and its record id. Keys are all the same length,
+ * so a leaf is always reached by the time the key runs out. Each inner
+ * node's prefix is stored in full, in the key_len bytes following the
+ * node, so that it can be checked without visiting a leaf.
+ *
+ * The locking follows Leis et al., "The ART of Practical Synchronization":
+ * a writer read-locks its way down as a reader does, and then upgrades the
+ * one or two nodes it changes (the node, and its parent if the node is
+ * replaced) to write locks, with a compare-and-swap on the version that
+ * fails if anything has changed since it was read. Readers see nodes in
+ * the middle of being changed, so anything read from a node is only used
+ * once its version has been checked, and lengths read from one are
+ * clamped so that a torn read can't take a reader out of bounds.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "art.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ART_OBSOLETE 1
+#define ART_LOCKED 2
+
+#define ART_SCAN_CONTINUE 0
+#define ART_SCAN_END 1
+#define ART_SCAN_RESTART 2
+
+typedef struct art_node4 {
+    art_node n;
+    unsigned char keys[4];
+    art_node *children[4];
+} art_node4;
+
+typedef struct art_node16 {
+    art_node n;
+    unsigned char keys[16];
+    art_node *children[16];
+} art_node16;
+
+// index[b] is one more than the slot of byte b's child, or 0 if it has none
+typedef struct art_node48 {
+    art_node n;
+    unsigned char index[256];
+    art_node *children[48];
+} art_node48;
+
+typedef struct art_node256 {
+    art_node n;
+    art_node *children[256];
+} art_node256;
+
+typedef struct art_leaf {
+    _Atomic int rid;
+    unsigned char key[];
+} art_leaf;
+
+static const size_t art_sizes[] = {
+    sizeof(art_node4), sizeof(art_node16), sizeof(art_node48), sizeof(art_node256)
+};
+
+static const int art_capacity[] = {4, 16, 48, 256};
+
+
+static inline int art_is_leaf(art_node *n)
+{
+    return ((uintptr_t) n & 1) != 0;
+}
+
+
+static inline art_leaf *art_leaf_of(art_node *n)
+{
+    return (art_leaf *) ((uintptr_t) n & ~(uintptr_t) 1);
+}
+
+
+static inline art_node *art_leaf_ptr(art_leaf *leaf)
+{
+    return (art_node *) ((uintptr_t) leaf | 1);
+}
+
+
+static inline unsigned char *art_prefix(art_node *n)
+{
+    return (unsigned char *) n + art_sizes[n->type];
+}
+
+
+static inline art_node *art_load(art_node **slot)
+{
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+
+static inline void art_store(art_node **slot, art_node *child)
+{
+    __atomic_store_n(slot, child, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Versions
+ */
+static uint64_t art_read_lock(art_node *n, int *restart)
+{
+    uint64_t v = atomic_load_explicit(&n->version, memory_order_acquire);
+    while (v & ART_LOCKED) {
+        sched_yield();
+        v = atomic_load_explicit(&n->version, memory_order_acquire);
+    }
+
+    if (v & ART_OBSOLETE) *restart = TRUE;
+    return v;
+}
+
+
+static void art_check(art_node *n, uint64_t v, int *restart)
+{
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&n->version, memory_order_relaxed) != v) *restart = TRUE;
+}
+
+
+static void art_upgrade(art_node *n, uint64_t v, int *restart)
+{
+    if (!atomic_compare_exchange_strong(&n->version, &v, v + ART_LOCKED)) *restart = TRUE;
+}
+
+
+static void art_write_unlock(art_node *n)
+{
+    atomic_fetch_add(&n->version, ART_LOCKED);
+}
+
+
+static void art_write_unlock_obsolete(art_node *n)
+{
+    atomic_fetch_add(&n->version, ART_LOCKED + ART_OBSOLETE);
+}
+
+
+/*
+ * Nodes
+ */
+static art_node *art_node_new(art_tree *art, int type, const unsigned char *prefix, int prefix_len)
+{
+    art_node *n = calloc(1, art_sizes[type] + art->key_len);
+    if (!n) return NULL;
+
+    n->type = type;
+    n->prefix_len = prefix_len;
+    if (prefix_len > 0) memcpy(art_prefix(n), prefix, prefix_len);
+
+    return n;
+}
+
+
+static art_leaf *art_leaf_new(art_tree *art, const unsigned char *key, int rid)
+{
+    art_leaf *leaf = malloc(sizeof(art_leaf) + art->key_len);
+    if (!leaf) return NULL;
+
+    atomic_init(&leaf->rid, rid);
+    memcpy(leaf->key, key, art->key_len);
+
+    return leaf;
+}
+
+
+/*
+ * Keep a node or leaf which has been unlinked from the tree until the
+ * tree is freed, as readers may still hold it.
+ */
+static void art_retire(art_tree *art, void *ptr)
+{
+    pthread_mutex_lock(&art->retire_lock);
+
+    if (art->retired_cnt == art->retired_cap) {
+        long cap = art->retired_cap ? art->retired_cap * 2 : 64;
+        void **retired = realloc(art->retired, sizeof(void *) * cap);
+
+        if (!retired) {
+            // Better to leak it than to free it under a reader
+            pthread_mutex_unlock(&art->retire_lock);
+            return;
+        }
+
+        art->retired = retired;
+        art->retired_cap = cap;
+    }
+
+    art->retired[art->retired_cnt++] = ptr;
+    pthread_mutex_unlock(&art->retire_lock);
+}
+
+
+static art_node *art_find_child(art_node *n, unsigned char b)
+{
+    switch (n->type) {
+        case ART_NODE4: {
+            art_node4 *n4 = (art_node4 *) n;
+            int cnt = n->count < 4 ? n->count : 4;
+            for (int i=0; i<cnt; i++) {
+                if (n4->keys[i] == b) return art_load(&n4->children[i]);
+            }
+            return NULL;
+        }
+
+        case ART_NODE16: {
+            art_node16 *n16 = (art_node16 *) n;
+            int cnt = n->count < 16 ? n->count : 16;
+#ifdef __SSE2__
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(b), _mm_loadu_si128((__m128i *) n16->keys));
+            unsigned int mask = _mm_movemask_epi8(cmp) & ((1u << cnt) - 1);
+            return mask ? art_load(&n16->children[__builtin_ctz(mask)]) : NULL;
+#else
+            for (int i=0; i<cnt; i++) {
+                if (n16->keys[i] == b) return art_load(&n16->children[i]);
+            }
+            return NULL;
+#endif
+        }
+
+        case ART_NODE48: {
+            art_node48 *n48 = (art_node48 *) n;
+            int slot = n48->index[b];
+            return (slot > 0 && slot <= 48) ? art_load(&n48->children[slot - 1]) : NULL;
+        }
+
+        case ART_NODE256:
+            return art_load(&((art_node256 *) n)->children[b]);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Add a child to a node with room for it, which the caller has locked.
+ * The keys of Node4 and Node16 are kept sorted, for range scans.
+ */
+static void art_add_child(art_node *n, unsigned char b, art_node *child)
+{
+    switch (n->type) {
+        case ART_NODE4:
+        case ART_NODE16: {
+            unsigned char *keys = (n->type == ART_NODE4) ? ((art_node4 *) n)->keys
+                                                         : ((art_node16 *) n)->keys;
+            art_node **children = (n->type == ART_NODE4) ? ((art_node4 *) n)->children
+                                                         : ((art_node16 *) n)->children;
+            int pos = 0;
+            while (pos < n->count && keys[pos] < b) pos++;
+
+            for (int i=n->count; i>pos; i--) {
+                keys[i] = keys[i - 1];
+                art_store(&children[i], children[i - 1]);
+            }
+
+            keys[pos] = b;
+            art_store(&children[pos], child);
+            break;
+        }
+
+        case ART_NODE48: {
+            art_node48 *n48 = (art_node48 *) n;
+            int slot = 0;
+            while (n48->children[slot]) slot++;
+
+            art_store(&n48->children[slot], child);
+            n48->index[b] = slot + 1;
+            break;
+        }
+
+        case ART_NODE256:
+            art_store(&((art_node256 *) n)->children[b], child);
+            break;
+    }
+
+    n->count++;
+}
+
+
+static void art_replace_child(art_node *n, unsigned char b, art_node *child)
+{
+    switch (n->type) {
+        case ART_NODE4:
+        case ART_NODE16: {
+            unsigned char *keys = (n->type == ART_NODE4) ? ((art_node4 *) n)->keys
+                                                         : ((art_node16 *) n)->keys;
+            art_node **children = (n->type == ART_NODE4) ? ((art_node4 *) n)->children
+                                                         : ((art_node16 *) n)->children;
+            for (int i=0; i<n->count; i++) {
+                if (keys[i] == b) art_store(&children[i], child);
+            }
+            break;
+        }
+
+        case ART_NODE48: {
+            art_node48 *n48 = (art_node48 *) n;
+            art_store(&n48->children[n48->index[b] - 1], child);
+            break;
+        }
+
+        case ART_NODE256:
+            art_store(&((art_node256 *) n)->children[b], child);
+            break;
+    }
+}
+
+
+static void art_remove_child(art_node *n, unsigned char b)
+{
+    switch (n->type) {
+        case ART_NODE4:
+        case ART_NODE16: {
+            unsigned char *keys = (n->type == ART_NODE4) ? ((art_node4 *) n)->keys
+                                                         : ((art_node16 *) n)->keys;
+            art_node **children = (n->type == ART_NODE4) ? ((art_node4 *) n)->children
+                                                         : ((art_node16 *) n)->children;
+            int pos = 0;
+            while (pos < n->count && keys[pos] != b) pos++;
+            if (pos == n->count) return;
+
+            for (int i=pos; i<n->count - 1; i++) {
+                keys[i] = keys[i + 1];
+                art_store(&children[i], children[i + 1]);
+            }
+            break;
+        }
+
+        case ART_NODE48: {
+            art_node48 *n48 = (art_node48 *) n;
+            if (!n48->index[b]) return;
+
+            art_store(&n48->children[n48->index[b] - 1], NULL);
+            n48->index[b] = 0;
+            break;
+        }
+
+        case ART_NODE256: {
+            art_node256 *n256 = (art_node256 *) n;
+            if (!n256->children[b]) return;
+
+            art_store(&n256->children[b], NULL);
+            break;
+        }
+    }
+
+    n->count--;
+}
+
+
+/*
+ * Collect a node's children, in key order, into bytes and children.
+ * Returns the number collected.
+ */
+static int art_children(art_node *n, unsigned char *bytes, art_node **children)
+{
+    int cnt = 0;
+
+    switch (n->type) {
+        case ART_NODE4:
+        case ART_NODE16: {
+            int cap = art_capacity[n->type];
+            unsigned char *keys = (n->type == ART_NODE4) ? ((art_node4 *) n)->keys
+                                                         : ((art_node16 *) n)->keys;
+            art_node **kids = (n->type == ART_NODE4) ? ((art_node4 *) n)->children
+                                                     : ((art_node16 *) n)->children;
+            cnt = n->count < cap ? n->count : cap;
+            for (int i=0; i<cnt; i++) {
+                bytes[i] = keys[i];
+                children[i] = art_load(&kids[i]);
+            }
+            break;
+        }
+
+        case ART_NODE48: {
+            art_node48 *n48 = (art_node48 *) n;
+            for (int b=0; b<256; b++) {
+                int slot = n48->index[b];
+                art_node *child = (slot > 0 && slot <= 48) ? art_load(&n48->children[slot - 1]) : NULL;
+                if (child) {
+                    bytes[cnt] = b;
+                    children[cnt++] = child;
+                }
+            }
+            break;
+        }
+
+        case ART_NODE256: {
+            art_node256 *n256 = (art_node256 *) n;
+            for (int b=0; b<256; b++) {
+                art_node *child = art_load(&n256->children[b]);
+                if (child) {
+                    bytes[cnt] = b;
+                    children[cnt++] = child;
+                }
+            }
+            break;
+        }
+    }
+
+    // A torn read may have produced a child pointer that is NULL
+    int j = 0;
+    for (int i=0; i<cnt; i++) {
+        if (children[i]) {
+            bytes[j] = bytes[i];
+            children[j++] = children[i];
+        }
+    }
+
+    return j;
+}
+
+
+/*
+ * A copy of n one size up, with b added. The caller has n locked.
+ */
+static art_node *art_grow(art_tree *art, art_node *n, unsigned char b, art_node *child)
+{
+    art_node *big = art_node_new(art, n->type + 1, art_prefix(n), n->prefix_len);
+    if (!big) return NULL;
+
+    unsigned char bytes[256];
+    art_node *children[256];
+    int cnt = art_children(n, bytes, children);
+
+    for (int i=0; i<cnt; i++) art_add_child(big, bytes[i], children[i]);
+    art_add_child(big, b, child);
+
+    return big;
+}
+
+
+/*
+ * The number of bytes of the node's prefix matching the key from level,
+ * which is the whole prefix if it matches. The prefix length is clamped to
+ * the key, in case it is read mid-change.
+ */
+static int art_prefix_match(art_tree *art, art_node *n, const unsigned char *key, int level,
+                            int *prefix_len)
+{
+    int len = n->prefix_len;
+    if (len > art->key_len - level - 1) len = art->key_len - level - 1;
+    if (len < 0) len = 0;
+
+    unsigned char *prefix = art_prefix(n);
+    int i = 0;
+    while (i < len && prefix[i] == key[level + i]) i++;
+
+    *prefix_len = len;
+    return i;
+}
+
+
+/*
+ * Operations
+ */
+
+/*
+ * Create an empty tree for keys of key_len bytes. Returns NULL on error.
+ */
+art_tree *art_create(int key_len)
+{
+    if (key_len <= 0) return NULL;
+
+    art_tree *art = calloc(1, sizeof(art_tree));
+    if (!art) return NULL;
+
+    art->key_len = key_len;
+    art->col = -1;
+    pthread_mutex_init(&art->retire_lock, NULL);
+
+    // The root is never replaced, so it is made large enough not to grow
+    if (!(art->root = art_node_new(art, ART_NODE256, NULL, 0))) {
+        free(art);
+        return NULL;
+    }
+
+    return art;
+}
+
+
+static void art_free_node(art_node *n)
+{
+    if (art_is_leaf(n)) {
+        free(art_leaf_of(n));
+        return;
+    }
+
+    unsigned char bytes[256];
+    art_node *children[256];
+    int cnt = art_children(n, bytes, children);
+
+    for (int i=0; i<cnt; i++) art_free_node(children[i]);
+    free(n);
+}
+
+
+/*
+ * Free the tree, which must no longer be in use by any thread.
+ */
+void art_free(art_tree *art)
+{
+    if (!art) return;
+
+    art_free_node(art->root);
+    for (long i=0; i<art->retired_cnt; i++) free(art->retired[i]);
+
+    free(art->retired);
+    pthread_mutex_destroy(&art->retire_lock);
+    free(art);
+}
+
+
+/*
+ * Insert key, mapping it to rid. Returns 1 if the key was added, 0 if it
+ * was already present (in which case its record id is left alone), and
+ * -1 on error.
+ */
+int art_insert(art_tree *art, const unsigned char *key, int rid)
+{
+    art_leaf *leaf = art_leaf_new(art, key, rid);
+    if (!leaf) return -1;
+
+restart:;
+    int restart = FALSE;
+    art_node *node = NULL, *next = art->root, *parent = NULL;
+    unsigned char parent_b = 0, node_b = 0;
+    uint64_t v = 0, parent_v = 0;
+    int level = 0;
+
+    while (TRUE) {
+        parent = node;
+        parent_b = node_b;
+        node = next;
+
+        v = art_read_lock(node, &restart);
+        if (restart) goto restart;
+
+        int prefix_len;
+        int match = art_prefix_match(art, node, key, level, &prefix_len);
+
+        if (match < prefix_len) {
+            // The key leaves the node's prefix part-way through: put a new
+            // node, holding the shared part, between the node and its
+            // parent
+            art_upgrade(parent, parent_v, &restart);
+            if (restart) goto restart;
+
+            art_upgrade(node, v, &restart);
+            if (restart) {
+                art_write_unlock(parent);
+                goto restart;
+            }
+
+            unsigned char *prefix = art_prefix(node);
+            art_node *split = art_node_new(art, ART_NODE4, prefix, match);
+            if (!split) {
+                art_write_unlock(node);
+                art_write_unlock(parent);
+                free(leaf);
+                return -1;
+            }
+
+            art_add_child(split, key[level + match], art_leaf_ptr(leaf));
+            art_add_child(split, prefix[match], node);
+            art_replace_child(parent, parent_b, split);
+            art_write_unlock(parent);
+
+            node->prefix_len = prefix_len - match - 1;
+            memmove(prefix, prefix + match + 1, node->prefix_len);
+            art_write_unlock(node);
+
+            atomic_fetch_add(&art->size, 1);
+            return 1;
+        }
+
+        level += prefix_len;
+        node_b = key[level];
+        next = art_find_child(node, node_b);
+
+        art_check(node, v, &restart);
+        if (restart) goto restart;
+
+        if (!next) {
+            if (node->count < art_capacity[node->type]) {
+                art_upgrade(node, v, &restart);
+                if (restart) goto restart;
+
+                if (parent) {
+                    art_check(parent, parent_v, &restart);
+                    if (restart) {
+                        art_write_unlock(node);
+                        goto restart;
+                    }
+                }
+
+                art_add_child(node, node_b, art_leaf_ptr(leaf));
+                art_write_unlock(node);
+            } else {
+                // Full: replace the node with a larger copy
+                art_upgrade(parent, parent_v, &restart);
+                if (restart) goto restart;
+
+                art_upgrade(node, v, &restart);
+                if (restart) {
+                    art_write_unlock(parent);
+                    goto restart;
+                }
+
+                art_node *big = art_grow(art, node, node_b, art_leaf_ptr(leaf));
+                if (!big) {
+                    art_write_unlock(node);
+                    art_write_unlock(parent);
+                    free(leaf);
+                    return -1;
+                }
+
+                art_replace_child(parent, parent_b, big);
+                art_write_unlock_obsolete(node);
+                art_retire(art, node);
+                art_write_unlock(parent);
+            }
+
+            atomic_fetch_add(&art->size, 1);
+            return 1;
+        }
+
+        if (parent) {
+            art_check(parent, parent_v, &restart);
+            if (restart) goto restart;
+        }
+
+        if (art_is_leaf(next)) {
+            art_leaf *other = art_leaf_of(next);
+
+            if (memcmp(other->key, key, art->key_len) == 0) {
+                art_check(node, v, &restart);
+                if (restart) goto restart;
+
+                free(leaf);
+                return 0;
+            }
+
+            // Two keys now share this slot: replace the leaf with a node
+            // holding both, below whatever further bytes they share
+            art_upgrade(node, v, &restart);
+            if (restart) goto restart;
+
+            int shared = 0;
+            while (other->key[level + 1 + shared] == key[level + 1 + shared]) shared++;
+
+            art_node *split = art_node_new(art, ART_NODE4, key + level + 1, shared);
+            if (!split) {
+                art_write_unlock(node);
+                free(leaf);
+                return -1;
+            }
+
+            art_add_child(split, key[level + 1 + shared], art_leaf_ptr(leaf));
+            art_add_child(split, other->key[level + 1 + shared], next);
+            art_replace_child(node, node_b, split);
+            art_write_unlock(node);
+
+            atomic_fetch_add(&art->size, 1);
+            return 1;
+        }
+
+        level++;
+        parent_v = v;
+    }
+}
+
+
+/*
+ * Returns the leaf holding key, or NULL if it is not in the tree. The leaf
+ * stays readable, but may have been removed by the time it is used.
+ */
+static art_leaf *art_find_leaf(art_tree *art, const unsigned char *key)
+{
+restart:;
+    int restart = FALSE;
+    art_node *node = art->root;
+    uint64_t v = art_read_lock(node, &restart);
+    if (restart) goto restart;
+
+    int level = 0;
+    while (TRUE) {
+        int prefix_len;
+        if (art_prefix_match(art, node, key, level, &prefix_len) < prefix_len) {
+            art_check(node, v, &restart);
+            if (restart) goto restart;
+            return NULL;
+        }
+
+        level += prefix_len;
+        art_node *next = art_find_child(node, key[level]);
+        art_check(node, v, &restart);
+        if (restart) goto restart;
+
+        if (!next) return NULL;
+
+        if (art_is_leaf(next)) {
+            art_leaf *leaf = art_leaf_of(next);
+            int found = memcmp(leaf->key, key, art->key_len) == 0;
+
+            art_check(node, v, &restart);
+            if (restart) goto restart;
+            return found ? leaf : NULL;
+        }
+
+        uint64_t next_v = art_read_lock(next, &restart);
+        if (restart) goto restart;
+
+        art_check(node, v, &restart);
+        if (restart) goto restart;
+
+        node = next;
+        v = next_v;
+        level++;
+    }
+}
+
+
+/*
+ * Returns the record id of key, or -1 if it is not in the tree.
+ */
+int art_lookup(art_tree *art, const unsigned char *key)
+{
+    art_leaf *leaf = art_find_leaf(art, key);
+    return leaf ? atomic_load(&leaf->rid) : -1;
+}
+
+
+/*
+ * Change the record id of key, which stays in the tree throughout, so
+ * that concurrent lookups see either the old id or the new one. Returns 1
+ * on success, and 0 if key is not in the tree.
+ */
+int art_update(art_tree *art, const unsigned char *key, int rid)
+{
+    art_leaf *leaf = art_find_leaf(art, key);
+    if (!leaf) return 0;
+
+    atomic_store(&leaf->rid, rid);
+    return 1;
+}
+
+
+/*
+ * Batched lookups
+ *
+ * Each lookup in a batch is a probe, a search suspended between levels:
+ * the node it has read-locked, and the child of that node it will visit
+ * next, which was prefetched when the probe was suspended. A step of a
+ * probe visits that child and finds the one after. By the time a probe's
+ * turn comes round again the child is (with luck) in cache, the misses
+ * having been taken alongside those of the other probes.
+ */
+typedef struct art_probe {
+    const unsigned char *key;
+    art_node *node;
+    uint64_t v;
+    art_node *next;
+    int level;
+} art_probe;
+
+
+static void art_probe_start(art_tree *art, art_probe *p)
+{
+    int restart;
+    do {
+        restart = FALSE;
+        p->node = art->root;
+        p->v = art_read_lock(p->node, &restart);
+    } while (restart);
+
+    p->next = NULL;
+    p->level = 0;
+}
+
+
+/*
+ * Advance the probe by a level. Returns TRUE, with the record id (or -1)
+ * in rid, once the search is over, and FALSE if it has a child to visit.
+ */
+static int art_probe_step(art_tree *art, art_probe *p, int *rid)
+{
+    int restart = FALSE;
+
+    if (p->next) {
+        art_node *next = p->next;
+        p->next = NULL;
+
+        if (art_is_leaf(next)) {
+            art_leaf *leaf = art_leaf_of(next);
+            int leaf_rid = atomic_load(&leaf->rid);
+            int found = memcmp(leaf->key, p->key, art->key_len) == 0;
+
+            art_check(p->node, p->v, &restart);
+            if (restart) goto restart;
+
+            *rid = found ? leaf_rid : -1;
+            return TRUE;
+        }
+
+        uint64_t next_v = art_read_lock(next, &restart);
+        if (restart) goto restart;
+
+        art_check(p->node, p->v, &restart);
+        if (restart) goto restart;
+
+        p->node = next;
+        p->v = next_v;
+        p->level++;
+    }
+
+    int prefix_len;
+    if (art_prefix_match(art, p->node, p->key, p->level, &prefix_len) < prefix_len) {
+        art_check(p->node, p->v, &restart);
+        if (restart) goto restart;
+
+        *rid = -1;
+        return TRUE;
+    }
+
+    p->level += prefix_len;
+    art_node *next = art_find_child(p->node, p->key[p->level]);
+    art_check(p->node, p->v, &restart);
+    if (restart) goto restart;
+
+    if (!next) {
+        *rid = -1;
+        return TRUE;
+    }
+
+    p->next = next;
+    __builtin_prefetch(art_is_leaf(next) ? (void *) art_leaf_of(next) : (void *) next);
+    return FALSE;
+
+restart:
+    art_probe_start(art, p);
+    return FALSE;
+}
+
+
+/*
+ * Look up cnt keys, stored one after another in keys, setting rids[i] to
+ * the record id of the ith, or -1 if it is not in the tree, as art_lookup
+ * would. Returns the number of keys found.
+ */
+int art_lookup_batch(art_tree *art, const unsigned char *keys, int cnt, int *rids)
+{
+    art_probe probes[ART_BATCH_MAX];
+    int live[ART_BATCH_MAX];
+    int found = 0;
+
+    for (int base=0; base<cnt; base+=ART_BATCH_MAX) {
+        int n = (cnt - base < ART_BATCH_MAX) ? cnt - base : ART_BATCH_MAX;
+
+        // A lone key has nothing to interleave with
+        if (n == 1) {
+            rids[base] = art_lookup(art, keys + (size_t) base * art->key_len);
+            found += rids[base] >= 0;
+            break;
+        }
+
+        for (int i=0; i<n; i++) {
+            probes[i].key = keys + (size_t) (base + i) * art->key_len;
+            art_probe_start(art, &probes[i]);
+            live[i] = i;
+        }
+
+        // Step every unfinished probe in turn, dropping those that finish
+        while (n > 0) {
+            int left = 0;
+            for (int j=0; j<n; j++) {
+                int i = live[j];
+                if (!art_probe_step(art, &probes[i], &rids[base + i])) {
+                    live[left++] = i;
+                } else if (rids[base + i] >= 0) {
+                    found++;
+                }
+            }
+
+            n = left;
+        }
+    }
+
+    return found;
+}
+
+
+/*
+ * Remove key from the tree. Returns 1 if it was removed and 0 if it was
+ * not there.
+ */
+int art_remove(art_tree *art, const unsigned char *key)
+{
+restart:;
+    int restart = FALSE;
+    art_node *node = art->root;
+    uint64_t v = art_read_lock(node, &restart);
+    if (restart) goto restart;
+
+    int level = 0;
+    while (TRUE) {
+        int prefix_len;
+        if (art_prefix_match(art, node, key, level, &prefix_len) < prefix_len) {
+            art_check(node, v, &restart);
+            if (restart) goto restart;
+            return 0;
+        }
+
+        level += prefix_len;
+        unsigned char b = key[level];
+        art_node *next = art_find_child(node, b);
+        art_check(node, v, &restart);
+        if (restart) goto restart;
+
+        if (!next) return 0;
+
+        if (art_is_leaf(next)) {
+            art_leaf *leaf = art_leaf_of(next);
+            if (memcmp(leaf->key, key, art->key_len) != 0) {
+                art_check(node, v, &restart);
+                if (restart) goto restart;
+                return 0;
+            }
+
+            art_upgrade(node, v, &restart);
+            if (restart) goto restart;
+
+            art_remove_child(node, b);
+            art_write_unlock(node);
+            art_retire(art, leaf);
+
+            atomic_fetch_sub(&art->size, 1);
+            return 1;
+        }
+
+        uint64_t next_v = art_read_lock(next, &restart);
+        if (restart) goto restart;
+
+        art_check(node, v, &restart);
+        if (restart) goto restart;
+
+        node = next;
+        v = next_v;
+        level++;
+    }
+}
+
+
+/*
+ * Range scans
+ *
+ * A scan walks the tree depth first, taking a copy of each node's children
+ * and checking the node's version before descending into them. If a node
+ * turns out to have changed, the scan starts over from the root, resuming
+ * just after the last key it passed on. tight_lo (tight_hi) is set while
+ * the path to a node still matches the lower (upper) bound, so that
+ * subtrees wholly outside the range are skipped.
+ */
+typedef struct art_scan_state {
+    art_tree *art;
+    unsigned char *from;
+    int inclusive;
+    const unsigned char *hi;
+    art_scan_fn fn;
+    void *ctx;
+    long cnt;
+} art_scan_state;
+
+
+static int art_scan_node(art_scan_state *st, art_node *node, int level, int tight_lo,
+                         int tight_hi)
+{
+    art_tree *art = st->art;
+    unsigned char bytes[256];
+    art_node *children[256];
+    int restart = FALSE;
+
+    uint64_t v = art_read_lock(node, &restart);
+    if (restart) return ART_SCAN_RESTART;
+
+    int prefix_len = node->prefix_len;
+    if (prefix_len > art->key_len - level - 1) prefix_len = art->key_len - level - 1;
+
+    unsigned char *prefix = art_prefix(node);
+    int below = FALSE, above = FALSE;
+    for (int i=0; i<prefix_len && (tight_lo || tight_hi) && !below && !above; i++) {
+        if (tight_lo) {
+            below = prefix[i] < st->from[level + i];
+            tight_lo = prefix[i] == st->from[level + i];
+        }
+
+        if (tight_hi) {
+            above = prefix[i] > st->hi[level + i];
+            tight_hi = prefix[i] == st->hi[level + i];
+        }
+    }
+
+    int cnt = art_children(node, bytes, children);
+
+    art_check(node, v, &restart);
+    if (restart) return ART_SCAN_RESTART;
+
+    if (above) return ART_SCAN_END;
+    if (below) return ART_SCAN_CONTINUE;
+
+    level += prefix_len;
+    for (int i=0; i<cnt; i++) {
+        unsigned char b = bytes[i];
+        if (tight_lo && b < st->from[level]) continue;
+        if (tight_hi && b > st->hi[level]) return ART_SCAN_END;
+
+        if (art_is_leaf(children[i])) {
+            art_leaf *leaf = art_leaf_of(children[i]);
+            int cmp = memcmp(leaf->key, st->from, art->key_len);
+            if (cmp < 0 || (cmp == 0 && !st->inclusive)) continue;
+            if (memcmp(leaf->key, st->hi, art->key_len) > 0) return ART_SCAN_END;
+
+            memcpy(st->from, leaf->key, art->key_len);
+            st->inclusive = FALSE;
+            st->cnt++;
+
+            if (!st->fn(leaf->key, atomic_load(&leaf->rid), st->ctx)) return ART_SCAN_END;
+            continue;
+        }
+
+        int resp = art_scan_node(st, children[i], level + 1, tight_lo && b == st->from[level],
+                                 tight_hi && b == st->hi[level]);
+        if (resp != ART_SCAN_CONTINUE) return resp;
+    }
+
+    return ART_SCAN_CONTINUE;
+}
+
+
+/*
+ * Pass each key in [lo, hi], in order, to fn along with its record id.
+ * A NULL lo or hi leaves that end of the range open. Returns the number of
+ * keys passed to fn, or -1 on error.
+ */
+long art_scan(art_tree *art, const unsigned char *lo, const unsigned char *hi, art_scan_fn fn,
+              void *ctx)
+{
+    art_scan_state st = {.art = art, .inclusive = TRUE, .fn = fn, .ctx = ctx};
+
+    st.from = malloc(art->key_len);
+    unsigned char *top = malloc(art->key_len);
+    if (!st.from || !top) {
+        free(st.from);
+        free(top);
+        return -1;
+    }
+
+    if (lo) memcpy(st.from, lo, art->key_len);
+    else memset(st.from, 0, art->key_len);
+
+    memset(top, 0xff, art->key_len);
+    st.hi = hi ? hi : top;
+
+    while (art_scan_node(&st, art->root, 0, TRUE, TRUE) == ART_SCAN_RESTART);
+
+    free(st.from);
+    free(top);
+    return st.cnt;
+}
+
+
+/*
+ * Table indexes
+ */
+static void art_record_key(table *tbl, byte *record, unsigned char *key)
+{
+    int col = tbl->art->col;
+    tp_getaskey(record, tbl_field_offset(&tbl->fields, col), tbl->fields.field_types[col],
+                tbl->fields.field_lengths[col], key);
+}
+
+
+/*
+ * Build an index on column col of tbl, replacing any it already has, from
+ * the records already in the table. Returns 1 on success, and 0 if the
+ * index cannot be built, or would have duplicate keys.
+ */
+int tbl_art_create(table *tbl, int col)
+{
+    if (tbl->lsm || col < 0 || col >= tbl->fields.field_cnt) return 0;
+
+    art_tree *art = art_create(tp_keysize(tbl->fields.field_types[col],
+                                          tbl->fields.field_lengths[col]));
+    if (!art) return 0;
+
+    art->col = col;
+
+    art_tree *old = tbl->art;
+    tbl->art = art;
+
+    int per_blk = tbl_recs_per_blk(tbl);
+    int blk_cnt = tbl_blk_cnt(tbl);
+    int rec_len = tbl->fields.record_length;
+    unsigned char key[BLOCKSIZE];
+
+    for (int b=0; b<blk_cnt; b++) {
+        page *pg = buff_pin(tbl, TBL_FIRST_BLK + b);
+        if (!pg) goto error;
+
+        for (int i=0; i<per_blk && b * per_blk + i < tbl->record_cnt; i++) {
+            art_record_key(tbl, pg->data + i * rec_len, key);
+            if (art_insert(art, key, b * per_blk + i) != 1) {
+                buff_unpin(tbl, TBL_FIRST_BLK + b);
+                goto error;
+            }
+        }
+
+        buff_unpin(tbl, TBL_FIRST_BLK + b);
+    }
+
+    art_free(old);
+    return 1;
+
+error:
+    tbl->art = old;
+    art_free(art);
+    return 0;
+}
+
+
+/*
+ * Add the key of record, which has id rid, to the table's index. Returns
+ * 1 on success, 0 if the key is already indexed, and -1 on error.
+ */
+int tbl_art_add(table *tbl, byte *record, int rid)
+{
+    unsigned char key[BLOCKSIZE];
+    art_record_key(tbl, record, key);
+
+    return art_insert(tbl->art, key, rid);
+}
+
+
+/*
+ * Point the index entry for record's key, which must be indexed already,
+ * at rid, the record's new id. Returns 1 on success, and 0 on error.
+ */
+int tbl_art_set(table *tbl, byte *record, int rid)
+{
+    unsigned char key[BLOCKSIZE];
+    art_record_key(tbl, record, key);
+
+    return art_update(tbl->art, key, rid);
+}
+
+
+/*
+ * Returns the id of the record with the same key as record, or -1 if
+ * there is none.
+ */
+int tbl_art_find(table *tbl, byte *record)
+{
+    unsigned char key[BLOCKSIZE];
+    art_record_key(tbl, record, key);
+
+    return art_lookup(tbl->art, key);
+}
+
+
+/*
+ * Read the records whose keys match those of the cnt records in probes,
+ * into the matching slots of records, setting rids[i] to the id of the
+ * ith, or to -1 (leaving its slot of records alone) if there is none.
+ * The keys are looked up with art_lookup_batch, and then the blocks
+ * holding the records found are pinned together with buff_pin_batch, so
+ * that the reads of those not in the pool overlap.
+ * Returns the number of records read, or -1 on error.
+ */
+int tbl_art_read_batch(table *tbl, byte *probes, int cnt, byte *records, int *rids)
+{
+    if (!tbl->art || cnt < 0) return -1;
+
+    int rec_len = tbl->fields.record_length;
+    int key_len = tbl->art->key_len;
+
+    unsigned char *keys = calloc((size_t) cnt * key_len + 1, 1);
+    buff_handle *handles = malloc(sizeof(buff_handle) * cnt + 1);
+    if (!keys || !handles) {
+        free(keys);
+        free(handles);
+        return -1;
+    }
+
+    for (int i=0; i<cnt; i++) {
+        art_record_key(tbl, probes + (size_t) i * rec_len, keys + (size_t) i * key_len);
+    }
+
+    int found = art_lookup_batch(tbl->art, keys, cnt, rids);
+
+    int h = 0;
+    for (int i=0; i<cnt; i++) {
+        if (rids[i] < 0) continue;
+        handles[h++] = (buff_handle) {.tbl = tbl, .blk_no = tbl_rec_blk(tbl, rids[i])};
+    }
+
+    if (h > 0 && buff_pin_batch(handles, h)) {
+        for (int i=0, k=0; i<cnt; i++) {
+            if (rids[i] < 0) continue;
+            memcpy(records + (size_t) i * rec_len,
+                   handles[k++].pg->data + tbl_rec_offset(tbl, rids[i]), rec_len);
+        }
+
+        buff_unpin_batch(handles, h);
+    } else {
+        // Too many blocks to pin at once; read them one at a time
+        for (int i=0; i<cnt; i++) {
+            if (rids[i] < 0 || tbl_read(tbl, rids[i], records + (size_t) i * rec_len)) continue;
+
+            rids[i] = -1;
+            found--;
+        }
+    }
+
+    free(keys);
+    free(handles);
+    return found;
+}
@@ -0,0 +1,175 @@
+/* blkstream.c
+ *
+ * Sequential byte streams stored as consecutive blocks of a file, for the
+ * yahi-db project.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blkstream.h"
+#include "blockio.h"
+#include "yahi.h"
+
+
+/*
+ * Open a new, empty, stream backed by an anonymous temporary file, which
+ * is removed when the stream is closed. Returns 1 on success.
+ */
+int bs_open(bstream *s)
+{
+    memset(s, 0, sizeof(bstream));
+    s->file = tmpfile();
+
+    return s->file != NULL;
+}
+
+
+static int bs_write_tail(bstream *s)
+{
+    int blk_cnt = (s->tail_len + BLOCKSIZE - 1) / BLOCKSIZE;
+    memset(s->tail + s->tail_len, 0, (long) blk_cnt * BLOCKSIZE - s->tail_len);
+
+    if (blk_append(s->file, s->tail, blk_cnt) < 0) return 0;
+
+    s->tail_len = 0;
+    return 1;
+}
+
+
+/*
+ * Append len bytes to the end of the stream. Returns 1 on success.
+ */
+int bs_write(bstream *s, byte *src, long len)
+{
+    while (len > 0) {
+        long n = sizeof(s->tail) - s->tail_len;
+        if (n > len) n = len;
+
+        memcpy(s->tail + s->tail_len, src, n);
+        s->tail_len += n;
+        s->size += n;
+        src += n;
+        len -= n;
+
+        if (s->tail_len == sizeof(s->tail)) {
+            if (!bs_write_tail(s)) return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Finish writing the stream, and position it for reading from the start,
+ * buffering readahead blocks at a time. Once rewound, the stream may not
+ * be written to again.
+ */
+int bs_rewind(bstream *s, int readahead)
+{
+    if (!s->flushed && s->tail_len > 0) {
+        if (!bs_write_tail(s)) return 0;
+    }
+    s->flushed = TRUE;
+
+    if (readahead < 1) readahead = 1;
+    if (readahead != s->buf_blks) {
+        free(s->buf);
+        s->buf = malloc((long) readahead * BLOCKSIZE);
+        if (!s->buf) return 0;
+        s->buf_blks = readahead;
+    }
+
+    s->buf_start = 0;
+    s->buf_len = 0;
+    s->pos = 0;
+
+    return 1;
+}
+
+
+static int bs_fill(bstream *s)
+{
+    long first_blk = s->pos / BLOCKSIZE;
+    long blk_cnt = (s->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    long n = blk_cnt - first_blk;
+    if (n > s->buf_blks) n = s->buf_blks;
+    if (n <= 0) return 0;
+
+    if (blk_read_n(s->file, first_blk, s->buf, n) != n * BLOCKSIZE) return 0;
+
+    s->buf_start = first_blk * BLOCKSIZE;
+    s->buf_len = n * BLOCKSIZE;
+    if (s->buf_start + s->buf_len > s->size) s->buf_len = s->size - s->buf_start;
+
+    // Let the kernel start on the following chunk while this one is
+    // consumed.
+    fflush(s->file);
+    posix_fadvise(fileno(s->file), blk_offset(first_blk + n), (off_t) s->buf_blks * BLOCKSIZE,
+            POSIX_FADV_WILLNEED);
+
+    return 1;
+}
+
+
+/*
+ * Read up to len bytes from the current position of a rewound stream.
+ * Returns the number of bytes read, which is less than len only at the
+ * end of the stream.
+ */
+long bs_read(bstream *s, byte *dst, long len)
+{
+    long read = 0;
+
+    while (read < len && s->pos < s->size) {
+        if (s->pos >= s->buf_start + s->buf_len) {
+            if (!bs_fill(s)) break;
+        }
+
+        long avail = s->buf_start + s->buf_len - s->pos;
+        long n = len - read;
+        if (n > avail) n = avail;
+
+        memcpy(dst + read, s->buf + (s->pos - s->buf_start), n);
+        s->pos += n;
+        read += n;
+    }
+
+    return read;
+}
+
+
+/*
+ * Read the entire stream into a newly allocated buffer of s->size bytes,
+ * which the caller must free. Returns NULL on error.
+ */
+byte *bs_load(bstream *s)
+{
+    if (!bs_rewind(s, BS_DEFAULT_READAHEAD)) return NULL;
+
+    byte *data = malloc(s->size + 1);
+    if (!data) return NULL;
+
+    if (bs_read(s, data, s->size) != s->size) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+void bs_close(bstream *s)
+{
+    if (s->file) fclose(s->file);
+    free(s->buf);
+    memset(s, 0, sizeof(bstream));
+}
@@ -10,11 +10,28 @@
  *
  */
 #include "blockio.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "stats.h"
 #include "yahi.h"
 #include <sys/stat.h>
 
+
+// Count a completed read or write of bytes bytes, which began at start
+#define BLK_STAT_READ(start, bytes) do { \
+    STAT_RECORD(STAT_HIST_READ, start); \
+    STAT_ADD(STAT_BLK_READS, 1); \
+    STAT_ADD(STAT_BYTES_READ, bytes); \
+} while (0)
+
+#define BLK_STAT_WRITE(start, bytes) do { \
+    STAT_RECORD(STAT_HIST_WRITE, start); \
+    STAT_ADD(STAT_BLK_WRITES, 1); \
+    STAT_ADD(STAT_BYTES_WRITTEN, bytes); \
+} while (0)
+
+
 /*
  * Calculate and return the appropriate offset,
  * from the beginning of the file, to use for
@@ -35,10 +52,18 @@ int blk_offset(int blk_no)
  *
  */
 
+/*
+ * Each function below makes its seeks and transfers with the file locked
+ * (flockfile is recursive, and is the lock stdio itself takes), so that
+ * calls on one file from several threads, such as a table being extended
+ * by one while another evicts one of its pages, can't interleave.
+ */
 off_t blk_flen(FILE *file)
 {
+    flockfile(file);
     fseeko(file, 0, SEEK_END);
     off_t len = ftello(file);
+    funlockfile(file);
 
     return len;
 }
@@ -55,10 +80,17 @@ int blk_write(FILE *file, int blk_no, byte* data)
 
     int w_offset = blk_offset(blk_no);
 
-    if (w_offset >= blk_flen(file)) return 0;
+    flockfile(file);
+    if (w_offset >= blk_flen(file)) {
+        funlockfile(file);
+        return 0;
+    }
 
+    STAT_TIMER(start);
     fseeko(file, w_offset, SEEK_SET);
     int written = fwrite(data, sizeof(byte), BLOCKSIZE, file);
+    BLK_STAT_WRITE(start, written);
+    funlockfile(file);
     //TODO: Modify this to ensure that all bytes are
     //      written.
 
@@ -75,8 +107,12 @@ int blk_write(FILE *file, int blk_no, byte* data)
 int blk_read(FILE *file, int blk_no, byte* data)
 {
     int r_offset = blk_offset(blk_no);
+    STAT_TIMER(start);
+    flockfile(file);
     fseek(file, r_offset, SEEK_SET);
     int read = fread(data, sizeof(byte), BLOCKSIZE, file);
+    funlockfile(file);
+    BLK_STAT_READ(start, read);
     //TODO: Modify this to ensure that all bytes are
     //      read.
 
@@ -100,11 +136,15 @@ int blk_new(FILE *file)
         exit(-1);
     }
       
+    flockfile(file);
     off_t length = blk_flen(file);
     int new_blk_no = length / BLOCKSIZE;
 
+    STAT_TIMER(start);
     fseeko(file, 0, SEEK_END);
     int written = fwrite(blk, sizeof(byte), BLOCKSIZE, file);
+    BLK_STAT_WRITE(start, written);
+    funlockfile(file);
 
     if (written == BLOCKSIZE) {
         return new_blk_no;
@@ -114,10 +154,122 @@ int blk_new(FILE *file)
 }
 
 
+/*
+ * Write cnt blocks of data (cnt * BLOCKSIZE bytes) to the end of file, in a
+ * single write. Returns the ID of the first of the new blocks, or -1 on
+ * error. This is intended for sequentially written files (runs, spill
+ * partitions, etc.), where going through blk_new and blk_write a block at
+ * a time would write each block twice.
+ */
+int blk_append(FILE *file, byte *data, int cnt)
+{
+    flockfile(file);
+    off_t length = blk_flen(file);
+    int first_blk_no = length / BLOCKSIZE;
+
+    STAT_TIMER(start);
+    int written = fwrite(data, BLOCKSIZE, cnt, file);
+    BLK_STAT_WRITE(start, (long) written * BLOCKSIZE);
+    funlockfile(file);
+
+    if (written == cnt) {
+        return first_blk_no;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Read cnt consecutive blocks, starting at blk_no, into data in a single
+ * read. Returns the number of bytes read.
+ */
+int blk_read_n(FILE *file, int blk_no, byte *data, int cnt)
+{
+    off_t r_offset = (off_t) blk_no * BLOCKSIZE;
+    STAT_TIMER(start);
+    flockfile(file);
+    fseeko(file, r_offset, SEEK_SET);
+    int read = fread(data, sizeof(byte), (size_t) cnt * BLOCKSIZE, file);
+    funlockfile(file);
+    BLK_STAT_READ(start, read);
+
+    return read;
+}
+
+
+/*
+ * Tell the operating system that the cnt blocks from blk_no will be read
+ * soon, so that it can start reading them in the background, and the
+ * blk_read of each finds it already in memory. Returns 1 if the hint was
+ * taken, and 0 if not, which is harmless.
+ */
+int blk_prefetch(FILE *file, int blk_no, int cnt)
+{
+    fflush(file);
+    return posix_fadvise(fileno(file), (off_t) blk_no * BLOCKSIZE, (off_t) cnt * BLOCKSIZE,
+                         POSIX_FADV_WILLNEED) == 0;
+}
+
+
+/*
+ * Extents are variable-length byte ranges within a file, addressed by
+ * their offset rather than by block number. They are used to store pages
+ * that have been compressed, and so no longer fill a whole block.
+ *
+ * blk_ext_append writes length bytes of data to the end of the file,
+ * returning the offset at which they were written, or -1 on error.
+ */
+off_t blk_ext_append(FILE *file, byte *data, int length)
+{
+    flockfile(file);
+    off_t offset = blk_flen(file);
+
+    STAT_TIMER(start);
+    int written = fwrite(data, sizeof(byte), length, file);
+    BLK_STAT_WRITE(start, written);
+    funlockfile(file);
+
+    if (written != length) return -1;
 
+    return offset;
+}
 
 
+/*
+ * Overwrite length bytes at offset, which must lie within the file.
+ * Returns the number of bytes written.
+ */
+int blk_ext_write(FILE *file, off_t offset, byte *data, int length)
+{
+    flockfile(file);
+    if (offset + length > blk_flen(file)) {
+        funlockfile(file);
+        return 0;
+    }
 
+    STAT_TIMER(start);
+    fseeko(file, offset, SEEK_SET);
+    int written = fwrite(data, sizeof(byte), length, file);
+    BLK_STAT_WRITE(start, written);
+    funlockfile(file);
 
+    return written;
+}
 
 
+/*
+ * Read length bytes from offset into data. Returns the number of bytes
+ * read.
+ */
+int blk_ext_read(FILE *file, off_t offset, byte *data, int length)
+{
+    STAT_TIMER(start);
+    flockfile(file);
+    fseeko(file, offset, SEEK_SET);
+    int read = fread(data, sizeof(byte), length, file);
+    funlockfile(file);
+    BLK_STAT_READ(start, read);
+
+    return read;
+}
@@ -0,0 +1,313 @@
+/* bloom.c
+ *
+ * Blocked Bloom filters on a key column of a yahi-db table.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockio.h"
+#include "bloom.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define BF_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 5)
+#define BF_MIN_CAPACITY 1024
+
+typedef uint64_t bf_vec __attribute__((vector_size(64)));
+
+static const bf_vec bf_salts = {
+    0x47b6137b44974d91ULL, 0x8824ad5ba2b7289dULL, 0x705495c72df1424bULL, 0x9efc49475c6bfb31ULL,
+    0x2df1424b8824ad5bULL, 0x5c6bfb31a2b7289dULL, 0x44974d91705495c7ULL, 0x9efc4947e3c1a2b5ULL,
+};
+
+
+static inline uint64_t bf_hash(int key)
+{
+    // The 64-bit finalizer of MurmurHash3
+    uint64_t h = (uint32_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/*
+ * The block for a hash is chosen by its high 32 bits (scaled onto the
+ * block count, rather than taken modulo it), and the bits set within the
+ * block by its low 32 bits: one bit in each word, at the top 6 bits of
+ * the low bits times that word's salt.
+ */
+static inline bf_block *bf_block_for(bloom *bf, uint64_t h)
+{
+    return &bf->blocks[((h >> 32) * (uint64_t) bf->blk_cnt) >> 32];
+}
+
+
+static inline void bf_mask(uint64_t h, bf_vec *mask)
+{
+    bf_vec lo = {0};
+    lo += (uint32_t) h;
+    bf_vec pos = (lo * bf_salts) >> 58;
+
+    bf_vec one = {0};
+    one += 1;
+    *mask = one << pos;
+}
+
+
+/*
+ * Create an empty filter on column col, sized for capacity keys at
+ * bits_per_key bits each.
+ */
+bloom *bf_create(int col, long capacity, int bits_per_key)
+{
+    if (bits_per_key <= 0) bits_per_key = BF_DEFAULT_BITS_PER_KEY;
+    if (capacity < BF_MIN_CAPACITY) capacity = BF_MIN_CAPACITY;
+
+    bloom *bf = calloc(1, sizeof(bloom));
+    if (!bf) return NULL;
+
+    bf->col = col;
+    bf->bits_per_key = bits_per_key;
+    bf->capacity = capacity;
+    bf->blk_cnt = (capacity * bits_per_key + sizeof(bf_block) * 8 - 1) / (sizeof(bf_block) * 8);
+    bf->blocks = aligned_alloc(sizeof(bf_block), bf->blk_cnt * sizeof(bf_block));
+
+    if (!bf->blocks) {
+        free(bf);
+        return NULL;
+    }
+
+    memset(bf->blocks, 0, bf->blk_cnt * sizeof(bf_block));
+    return bf;
+}
+
+
+void bf_free(bloom *bf)
+{
+    if (!bf) return;
+
+    free(bf->blocks);
+    free(bf);
+}
+
+
+void bf_add(bloom *bf, int key)
+{
+    uint64_t h = bf_hash(key);
+    bf_vec *blk = (bf_vec *) bf_block_for(bf, h);
+    bf_vec mask;
+
+    bf_mask(h, &mask);
+    *blk |= mask;
+    bf->keys++;
+}
+
+
+/*
+ * Returns FALSE if key has definitely not been added to the filter, and
+ * TRUE if it may have been.
+ */
+int bf_may_contain(bloom *bf, int key)
+{
+    uint64_t h = bf_hash(key);
+    bf_vec *blk = (bf_vec *) bf_block_for(bf, h);
+    bf_vec mask;
+
+    bf_mask(h, &mask);
+    bf_vec missing = mask & ~*blk;
+
+    uint64_t any = 0;
+    for (int i=0; i<BF_BLOCK_WORDS; i++) any |= missing[i];
+
+    return any == 0;
+}
+
+
+static int bf_key_offset(table *tbl, int col)
+{
+    return tbl_field_offset(&tbl->fields, col);
+}
+
+
+/*
+ * Build a filter of capacity keys on col from the table's records.
+ */
+static bloom *bf_build(table *tbl, int col, long capacity, int bits_per_key)
+{
+    bloom *bf = bf_create(col, capacity, bits_per_key);
+    if (!bf) return NULL;
+
+    int offset = bf_key_offset(tbl, col);
+    byte record[BLOCKSIZE];
+
+    for (int rid=0; rid<tbl->record_cnt; rid++) {
+        if (!tbl_read(tbl, rid, record)) {
+            bf_free(bf);
+            return NULL;
+        }
+
+        bf_add(bf, tp_getasint(record, offset));
+    }
+
+    return bf;
+}
+
+
+/*
+ * Create a Bloom filter on INT column col of tbl, with bits_per_key bits
+ * per key (or the default, if 0), replacing any existing filter. The
+ * table's current records are added to it. Returns 1 on success and 0 on
+ * failure.
+ */
+int tbl_bloom_create(table *tbl, int col, int bits_per_key)
+{
+    if (col < 0 || col >= tbl->fields.field_cnt || tbl->fields.field_types[col] != INT) {
+        return 0;
+    }
+
+    bloom *bf = bf_build(tbl, col, 2L * tbl->record_cnt, bits_per_key);
+    if (!bf) return 0;
+
+    bf_free(tbl->bloom);
+    tbl->bloom = bf;
+    return 1;
+}
+
+
+/*
+ * Add record's key to the table's filter, growing the filter if it has
+ * taken twice the keys it was sized for. Called on each write to the
+ * table. Returns 0 if the filter needed growing but couldn't be; the key
+ * is added all the same.
+ */
+int tbl_bloom_add(table *tbl, byte *record)
+{
+    bloom *bf = tbl->bloom;
+
+    int ok = TRUE;
+
+    // If the filter can't be grown, the key still goes into the old one,
+    // which only costs false positives
+    if (bf->keys >= 2 * bf->capacity) {
+        bloom *grown = bf_build(tbl, bf->col, 4 * bf->capacity, bf->bits_per_key);
+
+        if (grown) {
+            bf_free(bf);
+            tbl->bloom = bf = grown;
+        } else {
+            ok = FALSE;
+        }
+    }
+
+    bf_add(bf, tp_getasint(record, bf_key_offset(tbl, bf->col)));
+    return ok;
+}
+
+
+/*
+ * Returns FALSE if no record of tbl can have key in column col, and TRUE
+ * otherwise (including when there is no filter on col).
+ */
+int tbl_may_contain(table *tbl, int col, int key)
+{
+    if (!tbl->bloom || tbl->bloom->col != col) return TRUE;
+
+    return bf_may_contain(tbl->bloom, key);
+}
+
+
+static void bf_path(table *tbl, char *path)
+{
+    snprintf(path, BF_PATH_LEN, "%s/%s.bf", tbl->db, tbl->name);
+}
+
+
+/*
+ * Load the table's filter, if it has one, rebuilding it if it was saved
+ * for a different number of records than the table has. Returns NULL if
+ * there is no filter, or it can be neither read nor rebuilt.
+ */
+bloom *bf_load(table *tbl)
+{
+    char path[BF_PATH_LEN];
+    bf_path(tbl, path);
+
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
+
+    int col, bits_per_key, record_cnt;
+    long capacity, keys;
+    bloom *bf = NULL;
+
+    int ok = fread(&col, sizeof(int), 1, file) == 1 &&
+        fread(&bits_per_key, sizeof(int), 1, file) == 1 &&
+        fread(&capacity, sizeof(long), 1, file) == 1 &&
+        fread(&keys, sizeof(long), 1, file) == 1 &&
+        fread(&record_cnt, sizeof(int), 1, file) == 1 &&
+        col >= 0 && col < tbl->fields.field_cnt && tbl->fields.field_types[col] == INT;
+
+    if (ok && record_cnt == tbl->record_cnt) {
+        bf = bf_create(col, capacity, bits_per_key);
+    }
+
+    if (bf && fread(bf->blocks, sizeof(bf_block), bf->blk_cnt, file) != (size_t) bf->blk_cnt) {
+        bf_free(bf);
+        bf = NULL;
+    }
+
+    fclose(file);
+
+    if (bf) {
+        bf->keys = keys;
+    } else if (ok && !tbl->lsm) {
+        // Records were written after the filter was saved, whose keys
+        // it may be missing
+        long rebuilt = 2L * tbl->record_cnt;
+        bf = bf_build(tbl, col, (rebuilt > capacity) ? rebuilt : capacity, bits_per_key);
+    }
+
+    return bf;
+}
+
+
+/*
+ * Delete the table's saved filter, if any.
+ */
+void bf_remove(table *tbl)
+{
+    char path[BF_PATH_LEN];
+    bf_path(tbl, path);
+    remove(path);
+}
+
+
+int bf_save(table *tbl)
+{
+    char path[BF_PATH_LEN];
+    bf_path(tbl, path);
+
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+
+    bloom *bf = tbl->bloom;
+    int ok = fwrite(&bf->col, sizeof(int), 1, file) == 1 &&
+        fwrite(&bf->bits_per_key, sizeof(int), 1, file) == 1 &&
+        fwrite(&bf->capacity, sizeof(long), 1, file) == 1 &&
+        fwrite(&bf->keys, sizeof(long), 1, file) == 1 &&
+        fwrite(&tbl->record_cnt, sizeof(int), 1, file) == 1 &&
+        fwrite(bf->blocks, sizeof(bf_block), bf->blk_cnt, file) == (size_t) bf->blk_cnt;
+
+    return (fclose(file) == 0) && ok;
+}
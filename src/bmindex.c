@@ -0,0 +1,521 @@
+/*
+ * bmindex.c
+ *
+ * Bitmap indexes on low-cardinality columns of yahi-db tables.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockio.h"
+#include "bmindex.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "roaring.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define BMI_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 8)
+#define BMI_MAGIC 0x31494d42
+
+/*
+ * A saved index is a single stream of bytes, laid over consecutive
+ * blocks of its file: this header, then the keys, and then each value's
+ * bitmap, preceded by its serialized length.
+ */
+typedef struct bmi_header {
+    uint32_t magic;
+    int col;
+    int record_cnt;
+    int key_len;
+    int value_cnt;
+    long len;           // of the whole stream, header included
+} bmi_header;
+
+
+static bm_index *bmi_create(int col, int key_len)
+{
+    bm_index *bmi = calloc(1, sizeof(bm_index));
+    if (!bmi) return NULL;
+
+    bmi->col = col;
+    bmi->key_len = key_len;
+    bmi->keys = malloc((long) key_len * BMI_MAX_VALUES);
+    bmi->rows = calloc(BMI_MAX_VALUES, sizeof(roaring *));
+
+    if (!bmi->keys || !bmi->rows) {
+        bmi_free(bmi);
+        return NULL;
+    }
+
+    return bmi;
+}
+
+
+void bmi_free(bm_index *bmi)
+{
+    if (!bmi) return;
+
+    if (bmi->rows) {
+        for (int v=0; v<bmi->value_cnt; v++) rb_free(bmi->rows[v]);
+    }
+
+    free(bmi->rows);
+    free(bmi->keys);
+    free(bmi);
+}
+
+
+/*
+ * The position of key among the index's values, or -(i + 1) if it isn't
+ * one and would be inserted at i.
+ */
+static int bmi_find(bm_index *bmi, unsigned char *key)
+{
+    int lo = 0, hi = bmi->value_cnt;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = memcmp(bmi->keys + (long) mid * bmi->key_len, key, bmi->key_len);
+
+        if (cmp == 0) return mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return -(lo + 1);
+}
+
+
+static void bmi_record_key(table *tbl, int col, byte *record, unsigned char *key)
+{
+    tp_getaskey(record, tbl_field_offset(&tbl->fields, col), tbl->fields.field_types[col],
+                tbl->fields.field_lengths[col], key);
+}
+
+
+/*
+ * Add rid to the bitmap of key, adding key to the index's values if it
+ * isn't already one. Returns 1 on success, and 0 on failure or if the
+ * index already has BMI_MAX_VALUES values.
+ */
+static int bmi_add(bm_index *bmi, unsigned char *key, int rid)
+{
+    int v = bmi_find(bmi, key);
+
+    if (v < 0) {
+        if (bmi->value_cnt == BMI_MAX_VALUES) return 0;
+
+        roaring *rows = rb_create();
+        if (!rows) return 0;
+
+        v = -v - 1;
+        int kl = bmi->key_len;
+        memmove(bmi->keys + (long) (v + 1) * kl, bmi->keys + (long) v * kl,
+                (long) (bmi->value_cnt - v) * kl);
+        memmove(&bmi->rows[v + 1], &bmi->rows[v], sizeof(roaring *) * (bmi->value_cnt - v));
+
+        memcpy(bmi->keys + (long) v * kl, key, kl);
+        bmi->rows[v] = rows;
+        bmi->value_cnt++;
+    }
+
+    return rb_add(bmi->rows[v], rid);
+}
+
+
+/*
+ * Remove rid from the bitmap of key, and key from the index's values if
+ * no other record holds it.
+ */
+static void bmi_remove_rid(bm_index *bmi, unsigned char *key, int rid)
+{
+    int v = bmi_find(bmi, key);
+    if (v < 0) return;
+
+    rb_remove(bmi->rows[v], rid);
+    if (rb_cardinality(bmi->rows[v]) > 0) return;
+
+    int kl = bmi->key_len;
+    rb_free(bmi->rows[v]);
+    memmove(bmi->keys + (long) v * kl, bmi->keys + (long) (v + 1) * kl,
+            (long) (bmi->value_cnt - v - 1) * kl);
+    memmove(&bmi->rows[v], &bmi->rows[v + 1], sizeof(roaring *) * (bmi->value_cnt - v - 1));
+    bmi->value_cnt--;
+}
+
+
+/*
+ * Build an index on column col of tbl from its records.
+ */
+static bm_index *bmi_build(table *tbl, int col)
+{
+    bm_index *bmi = bmi_create(col, tp_keysize(tbl->fields.field_types[col],
+                                               tbl->fields.field_lengths[col]));
+    if (!bmi) return NULL;
+
+    int per_blk = tbl_recs_per_blk(tbl);
+    int blk_cnt = tbl_blk_cnt(tbl);
+    int rec_len = tbl->fields.record_length;
+    unsigned char key[BLOCKSIZE];
+
+    for (int b=0; b<blk_cnt; b++) {
+        page *pg = buff_pin(tbl, TBL_FIRST_BLK + b);
+        if (!pg) goto error;
+
+        for (int i=0; i<per_blk && b * per_blk + i < tbl->record_cnt; i++) {
+            bmi_record_key(tbl, col, pg->data + i * rec_len, key);
+            if (!bmi_add(bmi, key, b * per_blk + i)) {
+                buff_unpin(tbl, TBL_FIRST_BLK + b);
+                goto error;
+            }
+        }
+
+        buff_unpin(tbl, TBL_FIRST_BLK + b);
+    }
+
+    return bmi;
+
+error:
+    bmi_free(bmi);
+    return NULL;
+}
+
+
+/*
+ * Build a bitmap index on column col of tbl, replacing any it already
+ * has, from the records already in the table. Returns 1 on success, and
+ * 0 if the index cannot be built, or the column has more than
+ * BMI_MAX_VALUES distinct values.
+ */
+int tbl_bitmap_create(table *tbl, int col)
+{
+    if (tbl->lsm || col < 0 || col >= tbl->fields.field_cnt) return 0;
+
+    bm_index *bmi = bmi_build(tbl, col);
+    if (!bmi) return 0;
+
+    bmi_free(tbl->bitmaps[col]);
+    tbl->bitmaps[col] = bmi;
+
+    return 1;
+}
+
+
+void tbl_bitmap_drop(table *tbl, int col)
+{
+    if (col < 0 || col >= tbl->fields.field_cnt) return;
+
+    bmi_free(tbl->bitmaps[col]);
+    tbl->bitmaps[col] = NULL;
+}
+
+
+/*
+ * Add record, which has id rid, to each of the table's bitmap indexes.
+ * An index which cannot take it is dropped. Returns 1 on success, and 0
+ * if any index was dropped.
+ */
+int tbl_bitmap_add(table *tbl, byte *record, int rid)
+{
+    unsigned char key[BLOCKSIZE];
+    int ok = 1;
+
+    for (int c=0; c<tbl->fields.field_cnt; c++) {
+        if (!tbl->bitmaps[c]) continue;
+
+        bmi_record_key(tbl, c, record, key);
+        if (!bmi_add(tbl->bitmaps[c], key, rid)) {
+            tbl_bitmap_drop(tbl, c);
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
+
+
+/*
+ * Move record rid, whose contents change from old to record, between the
+ * bitmaps of its old and new values. Returns as tbl_bitmap_add.
+ */
+int tbl_bitmap_replace(table *tbl, byte *old, byte *record, int rid)
+{
+    unsigned char key[BLOCKSIZE], old_key[BLOCKSIZE];
+    int ok = 1;
+
+    for (int c=0; c<tbl->fields.field_cnt; c++) {
+        bm_index *bmi = tbl->bitmaps[c];
+        if (!bmi) continue;
+
+        bmi_record_key(tbl, c, old, old_key);
+        bmi_record_key(tbl, c, record, key);
+        if (memcmp(key, old_key, bmi->key_len) == 0) continue;
+
+        bmi_remove_rid(bmi, old_key, rid);
+        if (!bmi_add(bmi, key, rid)) {
+            tbl_bitmap_drop(tbl, c);
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
+
+
+/*
+ * The ids of the records whose value in column col is the same as that
+ * of record, as a new bitmap which the caller must free. Returns NULL if
+ * the column has no bitmap index, or on error.
+ */
+roaring *tbl_bitmap_eq(table *tbl, int col, byte *record)
+{
+    if (col < 0 || col >= tbl->fields.field_cnt || !tbl->bitmaps[col]) return NULL;
+
+    unsigned char key[BLOCKSIZE];
+    bmi_record_key(tbl, col, record, key);
+
+    int v = bmi_find(tbl->bitmaps[col], key);
+    return (v >= 0) ? rb_copy(tbl->bitmaps[col]->rows[v]) : rb_create();
+}
+
+
+/*
+ * As tbl_bitmap_eq, for INT column col and value.
+ */
+roaring *tbl_bitmap_int(table *tbl, int col, int value)
+{
+    if (col < 0 || col >= tbl->fields.field_cnt || tbl->fields.field_types[col] != INT) {
+        return NULL;
+    }
+
+    byte record[BLOCKSIZE];
+    tp_setint(record, tbl_field_offset(&tbl->fields, col), value);
+
+    return tbl_bitmap_eq(tbl, col, record);
+}
+
+
+/*
+ * As tbl_bitmap_eq, for CHAR column col and value.
+ */
+roaring *tbl_bitmap_char(table *tbl, int col, char *value)
+{
+    if (col < 0 || col >= tbl->fields.field_cnt || tbl->fields.field_types[col] != CHAR) {
+        return NULL;
+    }
+
+    byte record[BLOCKSIZE];
+    tp_setchar(record, tbl_field_offset(&tbl->fields, col), value, tbl->fields.field_lengths[col]);
+
+    return tbl_bitmap_eq(tbl, col, record);
+}
+
+
+static void bmi_path(table *tbl, int col, char *path)
+{
+    snprintf(path, BMI_PATH_LEN, "%s/%s.bm%d", tbl->db, tbl->name, col);
+}
+
+
+/*
+ * Open the file of the index on col as a table of its own, bound to
+ * tbl's buffer pool, so that its blocks can be pinned. The handle has no
+ * name, so that it is never mistaken for a real table.
+ */
+static table *bmi_file_open(table *tbl, int col, char *mode)
+{
+    char path[BMI_PATH_LEN];
+    bmi_path(tbl, col, path);
+
+    table *file = calloc(1, sizeof(table));
+    if (!file) return NULL;
+
+    if (!(file->file = fopen(path, mode))) {
+        free(file);
+        return NULL;
+    }
+
+    strcpy(file->db, tbl->db);
+    file->pool = tbl->pool;
+
+    return file;
+}
+
+
+static int bmi_file_close(table *file)
+{
+    int ok = buff_evict_tbl(file) >= 0;
+    ok = (fclose(file->file) == 0) && ok;
+    free(file);
+
+    return ok;
+}
+
+
+static int bmi_save_one(table *tbl, bm_index *bmi)
+{
+    bmi_header hdr = {.magic = BMI_MAGIC, .col = bmi->col, .record_cnt = tbl->record_cnt,
+                      .key_len = bmi->key_len, .value_cnt = bmi->value_cnt};
+
+    hdr.len = sizeof(bmi_header) + (long) bmi->value_cnt * bmi->key_len;
+    for (int v=0; v<bmi->value_cnt; v++) hdr.len += sizeof(long) + rb_serialized_size(bmi->rows[v]);
+
+    long blk_cnt = (hdr.len + BLOCKSIZE - 1) / BLOCKSIZE;
+    byte *stream = calloc(blk_cnt, BLOCKSIZE);
+    table *file = bmi_file_open(tbl, bmi->col, "w+");
+    if (!stream || !file) {
+        free(stream);
+        if (file) bmi_file_close(file);
+        return 0;
+    }
+
+    byte *p = stream;
+    memcpy(p, &hdr, sizeof(bmi_header));
+    p += sizeof(bmi_header);
+    memcpy(p, bmi->keys, (long) bmi->value_cnt * bmi->key_len);
+    p += (long) bmi->value_cnt * bmi->key_len;
+
+    for (int v=0; v<bmi->value_cnt; v++) {
+        long size = rb_serialized_size(bmi->rows[v]);
+        memcpy(p, &size, sizeof(long));
+        rb_serialize(bmi->rows[v], p + sizeof(long));
+        p += sizeof(long) + size;
+    }
+
+    int ok = 1;
+    for (long b=0; b<blk_cnt && ok; b++) {
+        page *pg;
+        if (blk_new(file->file) != b || !(pg = buff_pin(file, b))) {
+            ok = 0;
+            break;
+        }
+
+        memcpy(pg->data, stream + b * BLOCKSIZE, BLOCKSIZE);
+        pg->modified = TRUE;
+        buff_unpin(file, b);
+    }
+
+    free(stream);
+    return bmi_file_close(file) && ok;
+}
+
+
+/*
+ * Save each of the table's bitmap indexes, and delete the files of any
+ * columns which no longer have one. Returns 1 on success and 0 if any
+ * could not be saved.
+ */
+int bmi_save(table *tbl)
+{
+    int ok = 1;
+
+    for (int c=0; c<MAX_ATTRS; c++) {
+        if (c < tbl->fields.field_cnt && tbl->bitmaps[c]) {
+            ok = bmi_save_one(tbl, tbl->bitmaps[c]) && ok;
+        } else {
+            char path[BMI_PATH_LEN];
+            bmi_path(tbl, c, path);
+            remove(path);
+        }
+    }
+
+    return ok;
+}
+
+
+/*
+ * Read the saved index on col back through the pool. Returns NULL if it
+ * is unreadable, or out of date.
+ */
+static bm_index *bmi_load_one(table *tbl, table *file, int col)
+{
+    bmi_header hdr;
+    page *pg = buff_pin(file, 0);
+    if (!pg) return NULL;
+
+    memcpy(&hdr, pg->data, sizeof(bmi_header));
+    buff_unpin(file, 0);
+
+    int key_len = tp_keysize(tbl->fields.field_types[col], tbl->fields.field_lengths[col]);
+    if (hdr.magic != BMI_MAGIC || hdr.col != col || hdr.record_cnt != tbl->record_cnt ||
+            hdr.key_len != key_len || hdr.value_cnt < 0 || hdr.value_cnt > BMI_MAX_VALUES ||
+            hdr.len < (long) sizeof(bmi_header) || hdr.len > blk_flen(file->file)) {
+        return NULL;
+    }
+
+    long blk_cnt = (hdr.len + BLOCKSIZE - 1) / BLOCKSIZE;
+    byte *stream = malloc(blk_cnt * BLOCKSIZE);
+    bm_index *bmi = bmi_create(col, key_len);
+    if (!stream || !bmi) goto error;
+
+    for (long b=0; b<blk_cnt; b++) {
+        if (!(pg = buff_pin(file, b))) goto error;
+        memcpy(stream + b * BLOCKSIZE, pg->data, BLOCKSIZE);
+        buff_unpin(file, b);
+    }
+
+    long off = sizeof(bmi_header);
+    if (off + (long) hdr.value_cnt * key_len > hdr.len) goto error;
+    memcpy(bmi->keys, stream + off, (long) hdr.value_cnt * key_len);
+    off += (long) hdr.value_cnt * key_len;
+
+    for (int v=0; v<hdr.value_cnt; v++) {
+        long size;
+        if (off + (long) sizeof(long) > hdr.len) goto error;
+        memcpy(&size, stream + off, sizeof(long));
+        off += sizeof(long);
+
+        if (size < 0 || off + size > hdr.len) goto error;
+        if (!(bmi->rows[v] = rb_deserialize(stream + off, size))) goto error;
+        bmi->value_cnt++;
+        off += size;
+    }
+
+    free(stream);
+    return bmi;
+
+error:
+    free(stream);
+    bmi_free(bmi);
+    return NULL;
+}
+
+
+/*
+ * Load each of the table's saved bitmap indexes, rebuilding those which
+ * are out of date. Indexes which can be neither loaded nor rebuilt are
+ * dropped.
+ */
+void bmi_load(table *tbl)
+{
+    for (int c=0; c<tbl->fields.field_cnt; c++) {
+        table *file = bmi_file_open(tbl, c, "r");
+        if (!file) continue;
+
+        tbl->bitmaps[c] = bmi_load_one(tbl, file, c);
+        bmi_file_close(file);
+
+        if (!tbl->bitmaps[c] && !tbl->lsm) tbl->bitmaps[c] = bmi_build(tbl, c);
+    }
+}
+
+
+/*
+ * Delete any saved bitmap indexes of the table.
+ */
+void bmi_remove(table *tbl)
+{
+    char path[BMI_PATH_LEN];
+    for (int c=0; c<MAX_ATTRS; c++) {
+        bmi_path(tbl, c, path);
+        remove(path);
+    }
+}
@@ -0,0 +1,286 @@
+/*
+ * client.c
+ *
+ * The client side of the yahi-db server protocol.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "client.h"
+#include "server.h"
+#include "table.h"
+#include "yahi.h"
+
+#define CLI_BUF_SIZE (64 * 1024)
+
+
+static int cli_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap) return 1;
+
+    size_t new_cap = *cap ? *cap : CLI_BUF_SIZE;
+    while (new_cap < need) new_cap *= 2;
+
+    char *grown = realloc(*buf, new_cap);
+    if (!grown) return 0;
+
+    *buf = grown;
+    *cap = new_cap;
+    return 1;
+}
+
+
+/*
+ * Connect to the server listening on the Unix socket path. Returns NULL
+ * on failure.
+ */
+srv_client *cli_connect(char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+    strcpy(addr.sun_path, path);
+
+    srv_client *cli = calloc(1, sizeof(srv_client));
+    if (!cli) return NULL;
+
+    cli->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (cli->fd < 0 || connect(cli->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        if (cli->fd >= 0) close(cli->fd);
+        free(cli);
+        return NULL;
+    }
+
+    return cli;
+}
+
+
+void cli_close(srv_client *cli)
+{
+    close(cli->fd);
+    free(cli->out);
+    free(cli->in);
+    free(cli);
+}
+
+
+/*
+ * Queue a request whose payload is a followed by b (either of which may
+ * be empty), to be sent by the next cli_flush. Returns the request's id,
+ * or 0 if it could not be queued.
+ */
+uint32_t cli_queue(srv_client *cli, int op, int tbl, const void *a, uint32_t a_len, const void *b,
+                   uint32_t b_len)
+{
+    if (!cli_reserve(&cli->out, &cli->out_cap, cli->out_len + sizeof(srv_req) + a_len + b_len)) {
+        return 0;
+    }
+
+    // Ids start at 1, so that 0 can signal failure
+    srv_req req = {.len = a_len + b_len, .id = ++cli->next_id, .op = op, .tbl = tbl};
+    if (req.id == 0) req.id = cli->next_id = 1;
+
+    char *pos = cli->out + cli->out_len;
+    memcpy(pos, &req, sizeof(srv_req));
+    if (a_len) memcpy(pos + sizeof(srv_req), a, a_len);
+    if (b_len) memcpy(pos + sizeof(srv_req) + a_len, b, b_len);
+    cli->out_len += sizeof(srv_req) + a_len + b_len;
+
+    return req.id;
+}
+
+
+/*
+ * Send all of the queued requests. Returns 1 on success and 0 on failure.
+ */
+int cli_flush(srv_client *cli)
+{
+    size_t sent = 0;
+    while (sent < cli->out_len) {
+        ssize_t n = send(cli->fd, cli->out + sent, cli->out_len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+
+        sent += n;
+    }
+
+    cli->out_len = 0;
+    return 1;
+}
+
+
+/*
+ * Returns TRUE if the next response has already been read from the socket,
+ * so that cli_recv won't block.
+ */
+int cli_buffered(srv_client *cli)
+{
+    size_t avail = cli->in_len - cli->in_pos;
+    if (avail < sizeof(srv_resp)) return FALSE;
+
+    srv_resp resp;
+    memcpy(&resp, cli->in + cli->in_pos, sizeof(srv_resp));
+    return avail >= sizeof(srv_resp) + resp.len;
+}
+
+
+/*
+ * Take the next response, waiting for it if need be. Its payload is left
+ * in *payload, valid until the next call. Returns 1 on success and 0 if
+ * the connection failed.
+ */
+int cli_recv(srv_client *cli, srv_resp *resp, char **payload)
+{
+    while (!cli_buffered(cli)) {
+        // Make room at the end of the buffer for the rest of the response
+        if (cli->in_pos > 0) {
+            memmove(cli->in, cli->in + cli->in_pos, cli->in_len - cli->in_pos);
+            cli->in_len -= cli->in_pos;
+            cli->in_pos = 0;
+        }
+
+        size_t need = cli->in_len + CLI_BUF_SIZE;
+        if (cli->in_len >= sizeof(srv_resp)) {
+            srv_resp next;
+            memcpy(&next, cli->in, sizeof(srv_resp));
+            if (next.len > SRV_MAX_PAYLOAD) return 0;
+            if (sizeof(srv_resp) + next.len > need) need = sizeof(srv_resp) + next.len;
+        }
+
+        if (!cli_reserve(&cli->in, &cli->in_cap, need)) return 0;
+
+        ssize_t n = recv(cli->fd, cli->in + cli->in_len, cli->in_cap - cli->in_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+
+        cli->in_len += n;
+    }
+
+    memcpy(resp, cli->in + cli->in_pos, sizeof(srv_resp));
+    *payload = cli->in + cli->in_pos + sizeof(srv_resp);
+    cli->in_pos += sizeof(srv_resp) + resp->len;
+
+    return 1;
+}
+
+
+/*
+ * Send a single request and wait for its response, which is told apart by
+ * its id from those of any requests queued or sent before it; those are
+ * taken and dropped. Returns the response's status, or SRV_ERR if the
+ * connection failed.
+ */
+static int cli_call(srv_client *cli, int op, int tbl, const void *a, uint32_t a_len,
+                    const void *b, uint32_t b_len, char **payload, uint32_t *len)
+{
+    srv_resp resp;
+    char *data;
+
+    uint32_t id = cli_queue(cli, op, tbl, a, a_len, b, b_len);
+    if (!id || !cli_flush(cli)) return SRV_ERR;
+
+    do {
+        if (!cli_recv(cli, &resp, &data)) return SRV_ERR;
+    } while (resp.id != id);
+
+    if (payload) *payload = data;
+    if (len) *len = resp.len;
+    return resp.status;
+}
+
+
+static int cli_handle(srv_client *cli, int op, const void *a, uint32_t a_len, char *name,
+                      int *record_length)
+{
+    char *payload;
+    uint32_t len;
+
+    int handle = cli_call(cli, op, 0, a, a_len, name, strlen(name), &payload, &len);
+    if (handle >= 0 && record_length && len == sizeof(uint32_t)) {
+        uint32_t rec_len;
+        memcpy(&rec_len, payload, sizeof(uint32_t));
+        *record_length = rec_len;
+    }
+
+    return handle;
+}
+
+
+/*
+ * Create a table on the server, returning its handle and, if
+ * record_length isn't NULL, its record length. Returns a negative status
+ * on failure.
+ */
+int cli_create(srv_client *cli, char *name, schema *schema, int *record_length)
+{
+    if (schema->field_cnt <= 0 || schema->field_cnt > MAX_ATTRS) return SRV_EPROTO;
+
+    srv_schema wire = {.field_cnt = schema->field_cnt};
+    for (int i=0; i<schema->field_cnt; i++) {
+        wire.field_types[i] = schema->field_types[i];
+        wire.field_lengths[i] = schema->field_lengths[i];
+    }
+
+    return cli_handle(cli, SRV_CREATE, &wire, sizeof(srv_schema), name, record_length);
+}
+
+
+/*
+ * Open a table on the server, as cli_create.
+ */
+int cli_open(srv_client *cli, char *name, int *record_length)
+{
+    return cli_handle(cli, SRV_OPEN, NULL, 0, name, record_length);
+}
+
+
+/*
+ * Insert a record, returning its record id, or a negative status on
+ * failure.
+ */
+int cli_insert(srv_client *cli, int tbl, byte *record, int record_length)
+{
+    return cli_call(cli, SRV_INSERT, tbl, record, record_length, NULL, 0, NULL, NULL);
+}
+
+
+/*
+ * Read the record rid into record. Returns 1 on success, 0 if there is no
+ * such record, and a negative status on failure.
+ */
+int cli_read(srv_client *cli, int tbl, int rid, byte *record)
+{
+    char *payload;
+    uint32_t len;
+    uint32_t wire_rid = rid;
+
+    int res = cli_call(cli, SRV_READ, tbl, &wire_rid, sizeof(uint32_t), NULL, 0, &payload, &len);
+    if (res == 1) memcpy(record, payload, len);
+
+    return res;
+}
+
+
+/*
+ * Overwrite the record rid. Returns 1 on success, 0 if there is no such
+ * record (or the table refused the update), and a negative status on
+ * failure.
+ */
+int cli_update(srv_client *cli, int tbl, int rid, byte *record, int record_length)
+{
+    uint32_t wire_rid = rid;
+    return cli_call(cli, SRV_UPDATE, tbl, &wire_rid, sizeof(uint32_t), record, record_length,
+                    NULL, NULL);
+}
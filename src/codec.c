@@ -0,0 +1,253 @@
+/*
+ * codec.c
+ *
+ * Schema-specialized record codecs for yahi-db.
+ *
+ * The kernels are generated by macro for each fixed field width that has
+ * its own entry in the tables below. With the width a compile-time
+ * constant, each value is moved by a single load and store (or a short
+ * fixed sequence of them) rather than a call to memcpy, and the loops are
+ * simple enough for the compiler to unroll. CHAR fields of any other width
+ * fall back to the generic kernels, which take the width at runtime.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License, see the LICENSE
+ * file in the main project directory for details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "codec.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+
+#define CD_COPY_KERNELS(name, w)                                                    \
+static void cd_decode_##name(const byte *src, int stride, int cnt, int length,      \
+                             void *dst)                                             \
+{                                                                                   \
+    byte *out = dst;                                                                \
+    (void) length;                                                                  \
+    for (int i=0; i<cnt; i++) {                                                     \
+        memcpy(out + (size_t) i * (w), src + (size_t) i * stride, (w));             \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+static void cd_encode_##name(byte *dst, int stride, int cnt, int length,            \
+                             const void *src)                                       \
+{                                                                                   \
+    const byte *in = src;                                                           \
+    (void) length;                                                                  \
+    for (int i=0; i<cnt; i++) {                                                     \
+        memcpy(dst + (size_t) i * stride, in + (size_t) i * (w), (w));              \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+static int cd_cmp_##name(const byte *a, const byte *b, int length)                  \
+{                                                                                   \
+    (void) length;                                                                  \
+    return memcmp(a, b, (w));                                                       \
+}
+
+CD_COPY_KERNELS(w1, 1)
+CD_COPY_KERNELS(w2, 2)
+CD_COPY_KERNELS(w4, 4)
+CD_COPY_KERNELS(w8, 8)
+CD_COPY_KERNELS(w16, 16)
+CD_COPY_KERNELS(w32, 32)
+CD_COPY_KERNELS(w64, 64)
+
+
+static void cd_decode_any(const byte *src, int stride, int cnt, int length, void *dst)
+{
+    byte *out = dst;
+    for (int i=0; i<cnt; i++) {
+        memcpy(out + (size_t) i * length, src + (size_t) i * stride, length);
+    }
+}
+
+
+static void cd_encode_any(byte *dst, int stride, int cnt, int length, const void *src)
+{
+    const byte *in = src;
+    for (int i=0; i<cnt; i++) {
+        memcpy(dst + (size_t) i * stride, in + (size_t) i * length, length);
+    }
+}
+
+
+static int cd_cmp_any(const byte *a, const byte *b, int length)
+{
+    return memcmp(a, b, length);
+}
+
+
+/*
+ * Numeric fields are compared by value rather than by their bytes.
+ */
+#define CD_NUM_CMP(name, type)                                                      \
+static int cd_cmp_##name(const byte *a, const byte *b, int length)                  \
+{                                                                                   \
+    type x, y;                                                                      \
+    (void) length;                                                                  \
+    memcpy(&x, a, sizeof(type));                                                    \
+    memcpy(&y, b, sizeof(type));                                                    \
+    return (x > y) - (x < y);                                                       \
+}
+
+CD_NUM_CMP(int, int)
+CD_NUM_CMP(float, double)
+
+
+typedef struct cd_kernels {
+    int length;
+    cd_decode_fn decode;
+    cd_encode_fn encode;
+    cd_cmp_fn cmp;
+} cd_kernels;
+
+static const cd_kernels _CHAR_KERNELS[] = {
+    {1, cd_decode_w1, cd_encode_w1, cd_cmp_w1},
+    {2, cd_decode_w2, cd_encode_w2, cd_cmp_w2},
+    {4, cd_decode_w4, cd_encode_w4, cd_cmp_w4},
+    {8, cd_decode_w8, cd_encode_w8, cd_cmp_w8},
+    {16, cd_decode_w16, cd_encode_w16, cd_cmp_w16},
+    {32, cd_decode_w32, cd_encode_w32, cd_cmp_w32},
+    {64, cd_decode_w64, cd_encode_w64, cd_cmp_w64},
+};
+
+static const cd_kernels _CHAR_ANY = {0, cd_decode_any, cd_encode_any, cd_cmp_any};
+static const cd_kernels _INT_KERNELS = {sizeof(int), cd_decode_w4, cd_encode_w4, cd_cmp_int};
+static const cd_kernels _FLOAT_KERNELS = {sizeof(double), cd_decode_w8, cd_encode_w8, cd_cmp_float};
+
+
+static const cd_kernels *cd_kernels_for(int type, int length)
+{
+    switch (type) {
+        case INT:
+            return &_INT_KERNELS;
+        case FLOAT:
+            return &_FLOAT_KERNELS;
+        case CHAR:
+            for (size_t i=0; i<sizeof(_CHAR_KERNELS) / sizeof(_CHAR_KERNELS[0]); i++) {
+                if (_CHAR_KERNELS[i].length == length) return &_CHAR_KERNELS[i];
+            }
+            return &_CHAR_ANY;
+    }
+
+    return NULL;
+}
+
+
+cd_decode_fn cd_decode_for(int type, int length)
+{
+    const cd_kernels *k = cd_kernels_for(type, length);
+    return k ? k->decode : NULL;
+}
+
+
+cd_encode_fn cd_encode_for(int type, int length)
+{
+    const cd_kernels *k = cd_kernels_for(type, length);
+    return k ? k->encode : NULL;
+}
+
+
+cd_cmp_fn cd_cmp_for(int type, int length)
+{
+    const cd_kernels *k = cd_kernels_for(type, length);
+    return k ? k->cmp : NULL;
+}
+
+
+/*
+ * Build the codec for records made up of col_cnt fields of the given types
+ * and lengths, laid out back-to-back. The lengths of INT and FLOAT fields
+ * are taken from their types. Returns 0 if a type is not recognized.
+ */
+int cd_init(codec *cd, int col_cnt, int *types, int *lengths)
+{
+    if (col_cnt < 0 || col_cnt > MAX_ATTRS) return 0;
+
+    cd->col_cnt = col_cnt;
+    cd->width = 0;
+
+    for (int i=0; i<col_cnt; i++) {
+        int len = tp_size(types[i], lengths[i]);
+        const cd_kernels *k = cd_kernels_for(types[i], len);
+        if (!k) return 0;
+
+        cd->types[i] = types[i];
+        cd->lengths[i] = len;
+        cd->offsets[i] = cd->width;
+        cd->decode[i] = k->decode;
+        cd->encode[i] = k->encode;
+        cd->cmp[i] = k->cmp;
+        cd->width += len;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Allocate and build the codec for a table schema. Returns NULL on error.
+ */
+codec *cd_create(schema *sch)
+{
+    codec *cd = malloc(sizeof(codec));
+    if (!cd) return NULL;
+
+    if (!cd_init(cd, sch->field_cnt, sch->field_types, sch->field_lengths)) {
+        free(cd);
+        return NULL;
+    }
+
+    return cd;
+}
+
+
+void cd_free(codec *cd)
+{
+    free(cd);
+}
+
+
+/*
+ * Decode cnt records, stride bytes apart starting at rows, into the dense
+ * arrays cols[0 .. col_cnt-1], one per field.
+ */
+void cd_decode(codec *cd, const byte *rows, int stride, int cnt, void **cols)
+{
+    for (int c=0; c<cd->col_cnt; c++) {
+        cd->decode[c](rows + cd->offsets[c], stride, cnt, cd->lengths[c], cols[c]);
+    }
+}
+
+
+/*
+ * Encode cnt records from the dense arrays cols, one per field, into rows,
+ * stride bytes apart.
+ */
+void cd_encode(codec *cd, byte *rows, int stride, int cnt, void **cols)
+{
+    for (int c=0; c<cd->col_cnt; c++) {
+        cd->encode[c](rows + cd->offsets[c], stride, cnt, cd->lengths[c], cols[c]);
+    }
+}
+
+
+/*
+ * Compare two records field by field, in order.
+ */
+int cd_compare(codec *cd, const byte *a, const byte *b)
+{
+    for (int c=0; c<cd->col_cnt; c++) {
+        int r = cd->cmp[c](a + cd->offsets[c], b + cd->offsets[c], cd->lengths[c]);
+        if (r != 0) return r;
+    }
+
+    return 0;
+}
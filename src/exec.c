@@ -0,0 +1,803 @@
+/* exec.c
+ *
+ * A vectorized, batch-at-a-time query executor for the yahi-db project.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bloom.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+#include "zonemap.h"
+
+
+static double exec_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static exec_op *exec_op_create(const char *name, exec_op *child, void *state)
+{
+    exec_op *op = calloc(1, sizeof(exec_op));
+    if (!op) return NULL;
+
+    op->name = name;
+    op->child = child;
+    op->state = state;
+
+    return op;
+}
+
+
+/*
+ * Pull the next batch from op, returning NULL once op is exhausted. All
+ * operators should pull from their inputs through this, rather than
+ * calling op->next directly, so that the per-operator statistics are
+ * kept.
+ */
+batch *exec_next(exec_op *op)
+{
+    double start = exec_now();
+    batch *b = op->next(op);
+    op->elapsed += exec_now() - start;
+
+    if (b) {
+        op->rows += b->count;
+        op->batches++;
+    }
+
+    return b;
+}
+
+
+/*
+ * Whether op, or any operator below it, has failed, in which case the
+ * rows it returned may be incomplete.
+ */
+int exec_failed(exec_op *op)
+{
+    if (!op) return FALSE;
+    return op->failed || exec_failed(op->child) || exec_failed(op->right);
+}
+
+
+void exec_close(exec_op *op)
+{
+    if (!op) return;
+
+    exec_close(op->child);
+    exec_close(op->right);
+
+    if (op->close) {
+        op->close(op);
+    }
+
+    free(op);
+}
+
+
+static void exec_report_op(exec_op *op, FILE *out, int depth)
+{
+    if (!op) return;
+
+    double self = op->elapsed;
+    if (op->child) self -= op->child->elapsed;
+    if (op->right) self -= op->right->elapsed;
+
+    fprintf(out, "%*s%-*s rows=%-10ld batches=%-8ld total=%.3fms self=%.3fms\n",
+            depth * 2, "", 16 - depth * 2, op->name, op->rows, op->batches,
+            op->elapsed * 1000, self * 1000);
+
+    exec_report_op(op->child, out, depth + 1);
+    exec_report_op(op->right, out, depth + 1);
+}
+
+
+/*
+ * Print the per-operator statistics for the tree rooted at op. Self time
+ * excludes the time spent waiting on the operator's inputs.
+ */
+void exec_report(exec_op *op, FILE *out)
+{
+    exec_report_op(op, out, 0);
+}
+
+
+/*
+ * Allocate the column arrays for a batch with the given column types and
+ * lengths (lengths are only used for CHAR columns). Returns 1 on success
+ * and 0 on allocation failure.
+ */
+int exec_batch_init(batch *b, int col_cnt, int *types, int *lengths)
+{
+    memset(b, 0, sizeof(batch));
+    b->col_cnt = col_cnt;
+    b->owned = TRUE;
+
+    for (int i=0; i<col_cnt; i++) {
+        column *col = &b->cols[i];
+        col->type = types[i];
+        col->length = tp_size(types[i], lengths[i]);
+
+        switch (col->type) {
+            case INT:
+                col->ints = malloc(sizeof(int) * EXEC_BATCH_SIZE);
+                if (!col->ints) goto error;
+                break;
+            case FLOAT:
+                col->floats = malloc(sizeof(double) * EXEC_BATCH_SIZE);
+                if (!col->floats) goto error;
+                break;
+            case CHAR:
+                col->chars = malloc(col->length * EXEC_BATCH_SIZE);
+                if (!col->chars) goto error;
+                break;
+        }
+    }
+
+    return 1;
+
+    error:
+        exec_batch_free(b);
+        return 0;
+}
+
+
+void exec_batch_free(batch *b)
+{
+    if (b->owned) {
+        for (int i=0; i<b->col_cnt; i++) {
+            free(b->cols[i].ints);
+            free(b->cols[i].floats);
+            free(b->cols[i].chars);
+        }
+    }
+
+    memset(b, 0, sizeof(batch));
+}
+
+
+/*
+ * Compact the batch in place so that it contains only the n rows listed in
+ * sel. The indices in sel must be in ascending order.
+ */
+int exec_batch_gather(batch *b, int *sel, int n)
+{
+    for (int c=0; c<b->col_cnt; c++) {
+        column *col = &b->cols[c];
+        switch (col->type) {
+            case INT:
+                for (int i=0; i<n; i++) col->ints[i] = col->ints[sel[i]];
+                break;
+            case FLOAT:
+                for (int i=0; i<n; i++) col->floats[i] = col->floats[sel[i]];
+                break;
+            case CHAR:
+                for (int i=0; i<n; i++) {
+                    memmove(col->chars + i*col->length,
+                            col->chars + sel[i]*col->length, col->length);
+                }
+                break;
+        }
+    }
+
+    b->count = n;
+    return n;
+}
+
+
+/*
+ * Copy a single row of src into row dst_row of dst. The two batches must
+ * have matching column types.
+ */
+void exec_batch_copy_row(batch *dst, int dst_row, batch *src, int src_row)
+{
+    for (int c=0; c<src->col_cnt; c++) {
+        column *d = &dst->cols[c];
+        column *s = &src->cols[c];
+        switch (s->type) {
+            case INT:
+                d->ints[dst_row] = s->ints[src_row];
+                break;
+            case FLOAT:
+                d->floats[dst_row] = s->floats[src_row];
+                break;
+            case CHAR:
+                memcpy(d->chars + dst_row*d->length, s->chars + src_row*s->length, s->length);
+                break;
+        }
+    }
+}
+
+
+/*
+ * Copy all of the rows of src into dst, which must have been initialized
+ * with matching column types.
+ */
+void exec_batch_copy(batch *dst, batch *src)
+{
+    for (int c=0; c<src->col_cnt; c++) {
+        column *d = &dst->cols[c];
+        column *s = &src->cols[c];
+        switch (s->type) {
+            case INT:
+                memcpy(d->ints, s->ints, sizeof(int) * src->count);
+                break;
+            case FLOAT:
+                memcpy(d->floats, s->floats, sizeof(double) * src->count);
+                break;
+            case CHAR:
+                memcpy(d->chars, s->chars, (long) s->length * src->count);
+                break;
+        }
+    }
+
+    dst->count = src->count;
+}
+
+
+void exec_layout_init(row_layout *l, batch *b)
+{
+    int types[MAX_ATTRS], lengths[MAX_ATTRS];
+
+    for (int i=0; i<b->col_cnt; i++) {
+        types[i] = b->cols[i].type;
+        lengths[i] = b->cols[i].length;
+    }
+
+    cd_init(l, b->col_cnt, types, lengths);
+}
+
+
+/*
+ * The address of the value in row of a column's array.
+ */
+void *exec_col_at(column *col, int row)
+{
+    switch (col->type) {
+        case INT:
+            return col->ints + row;
+        case FLOAT:
+            return col->floats + row;
+        default:
+            return col->chars + (size_t) row * col->length;
+    }
+}
+
+
+/*
+ * Write the rows of b, column at a time, into rows (which must have room
+ * for b->count rows of l->width bytes).
+ */
+void exec_encode_rows(row_layout *l, batch *b, byte *rows)
+{
+    for (int c=0; c<l->col_cnt; c++) {
+        l->encode[c](rows + l->offsets[c], l->width, b->count, l->lengths[c],
+                     exec_col_at(&b->cols[c], 0));
+    }
+}
+
+
+/*
+ * Decode cnt rows, each stride bytes apart, into the first cnt rows of the
+ * columns of out, starting with column col_base.
+ */
+void exec_decode_rows(row_layout *l, byte *rows, int cnt, int stride, batch *out, int col_base)
+{
+    for (int c=0; c<l->col_cnt; c++) {
+        l->decode[c](rows + l->offsets[c], stride, cnt, l->lengths[c],
+                     exec_col_at(&out->cols[col_base + c], 0));
+    }
+}
+
+
+/*
+ * Scan
+ *
+ * Reads the records of a table, through the buffer pool, in rid order. Each
+ * block is pinned once, and its records are decoded a column at a time
+ * by the table's codec.
+ *
+ * Numeric filters placed directly over a scan (possibly stacked) also
+ * register their predicates with it, and the scan skips any block whose
+ * zone map shows that no record in it can pass them all, without loading
+ * the block. If the table has a Bloom filter, an equality predicate on its
+ * key column which the filter rules out ends the scan before it starts.
+ * The filters still apply the predicates to the rows of the blocks which
+ * are read.
+ *
+ * A scan may instead be given a bitmap of the records to read, in which
+ * case it reads only those, taking their ids from the bitmap a batch at
+ * a time.
+ */
+typedef struct scan_pred {
+    int col;
+    int cmp;
+    double value;
+} scan_pred;
+
+typedef struct scan_state {
+    table *tbl;
+    int next_rid;
+    int pred_cnt;
+    scan_pred preds[MAX_ATTRS];
+    long skipped;
+    batch out;
+
+    // Scans of the rows of a bitmap only
+    roaring *rows;
+    rb_iter iter;
+    uint32_t *rids;
+} scan_state;
+
+
+static int scan_bloom_may_match(scan_state *st)
+{
+    for (int p=0; p<st->pred_cnt; p++) {
+        scan_pred *pred = &st->preds[p];
+        if (pred->cmp == CMP_EQ && !tbl_may_contain(st->tbl, pred->col, pred->value)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int scan_blk_may_match(scan_state *st, int blk_no)
+{
+    for (int p=0; p<st->pred_cnt; p++) {
+        scan_pred *pred = &st->preds[p];
+        if (!zm_may_match(st->tbl->zmap, blk_no, pred->col, pred->cmp, pred->value)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static void scan_decode(scan_state *st, byte *data, int first, int cnt, int row)
+{
+    codec *cd = st->tbl->codec;
+    void *cols[MAX_ATTRS];
+
+    for (int c=0; c<cd->col_cnt; c++) cols[c] = exec_col_at(&st->out.cols[c], row);
+    cd_decode(cd, data + first * cd->width, cd->width, cnt, cols);
+}
+
+
+static batch *scan_next(exec_op *op)
+{
+    scan_state *st = op->state;
+    table *tbl = st->tbl;
+    int per_blk = tbl_recs_per_blk(tbl);
+    int row = 0;
+
+    // The rows of a batch which failed part way are lost, so a failed
+    // scan stays failed
+    if (op->failed) return NULL;
+
+    if (st->next_rid == 0 && st->pred_cnt > 0 && tbl->bloom && !scan_bloom_may_match(st)) {
+        st->skipped += tbl_blk_cnt(tbl);
+        st->next_rid = tbl->record_cnt;
+    }
+
+    while (row < EXEC_BATCH_SIZE && st->next_rid < tbl->record_cnt) {
+        int blk_no = tbl_rec_blk(tbl, st->next_rid);
+        int first = st->next_rid % per_blk;
+
+        int cnt = per_blk - first;
+        if (cnt > tbl->record_cnt - st->next_rid) cnt = tbl->record_cnt - st->next_rid;
+
+        if (first == 0 && st->pred_cnt > 0 && !scan_blk_may_match(st, blk_no)) {
+            st->next_rid += cnt;
+            st->skipped++;
+            continue;
+        }
+
+        if (cnt > EXEC_BATCH_SIZE - row) cnt = EXEC_BATCH_SIZE - row;
+
+        page *pg = buff_pin(tbl, blk_no);
+        if (!pg) {
+            op->failed = TRUE;
+            return NULL;
+        }
+
+        scan_decode(st, pg->data, first, cnt, row);
+        buff_unpin(tbl, blk_no);
+
+        st->next_rid += cnt;
+        row += cnt;
+    }
+
+    if (row == 0) return NULL;
+
+    st->out.count = row;
+    return &st->out;
+}
+
+
+/*
+ * Take the next batch of ids from the bitmap, and read those records,
+ * pinning each block they fall in once, and decoding each run of
+ * consecutive records in a block together.
+ */
+static batch *scan_rows_next(exec_op *op)
+{
+    scan_state *st = op->state;
+    table *tbl = st->tbl;
+    int per_blk = tbl_recs_per_blk(tbl);
+
+    if (op->failed) return NULL;
+
+    int cnt = rb_iter_next(&st->iter, st->rids, EXEC_BATCH_SIZE);
+    while (cnt > 0 && st->rids[cnt - 1] >= (uint32_t) tbl->record_cnt) cnt--;
+
+    int row = 0;
+    for (int i=0; i<cnt; ) {
+        int blk_no = tbl_rec_blk(tbl, st->rids[i]);
+        page *pg = buff_pin(tbl, blk_no);
+        if (!pg) {
+            op->failed = TRUE;
+            return NULL;
+        }
+
+        while (i < cnt && tbl_rec_blk(tbl, st->rids[i]) == blk_no) {
+            int run = 1;
+            while (i + run < cnt && st->rids[i + run] == st->rids[i] + run &&
+                    (int) st->rids[i + run] % per_blk != 0) {
+                run++;
+            }
+
+            scan_decode(st, pg->data, st->rids[i] % per_blk, run, row);
+            row += run;
+            i += run;
+        }
+
+        buff_unpin(tbl, blk_no);
+    }
+
+    if (row == 0) return NULL;
+
+    st->out.count = row;
+    return &st->out;
+}
+
+
+static void scan_close(exec_op *op)
+{
+    scan_state *st = op->state;
+    exec_batch_free(&st->out);
+    free(st->rids);
+    free(st);
+}
+
+
+exec_op *exec_scan(table *tbl)
+{
+    scan_state *st = calloc(1, sizeof(scan_state));
+    if (!st) return NULL;
+
+    st->tbl = tbl;
+
+    if (!exec_batch_init(&st->out, tbl->fields.field_cnt, tbl->fields.field_types,
+                tbl->fields.field_lengths)) {
+        free(st);
+        return NULL;
+    }
+
+    exec_op *op = exec_op_create("scan", NULL, st);
+    if (!op) {
+        exec_batch_free(&st->out);
+        free(st);
+        return NULL;
+    }
+
+    op->next = scan_next;
+    op->close = scan_close;
+    return op;
+}
+
+
+/*
+ * A scan of only the records of tbl whose ids are in rows (such as the
+ * result of combining bitmap indexes; see bmindex.h), in rid order. Only
+ * the blocks holding those records are read. The bitmap must not be
+ * changed or freed until the scan is closed.
+ */
+exec_op *exec_scan_rows(table *tbl, roaring *rows)
+{
+    exec_op *op = exec_scan(tbl);
+    if (!op) return NULL;
+
+    scan_state *st = op->state;
+    if (!(st->rids = malloc(sizeof(uint32_t) * EXEC_BATCH_SIZE))) {
+        exec_close(op);
+        return NULL;
+    }
+
+    st->rows = rows;
+    rb_iter_init(&st->iter, rows);
+    op->name = "scan_rows";
+    op->next = scan_rows_next;
+
+    return op;
+}
+
+
+/*
+ * The number of blocks a scan has skipped using its table's zone map.
+ */
+long exec_scan_skipped(exec_op *scan)
+{
+    if (!scan || scan->next != scan_next) return 0;
+
+    scan_state *st = scan->state;
+    return st->skipped;
+}
+
+
+/*
+ * Filter
+ *
+ * Applies a single comparison against a constant to one column, and
+ * compacts the qualifying rows of the input batch in place. Conjunctions
+ * are expressed by stacking filters.
+ */
+typedef struct filter_state {
+    int col;
+    int cmp;
+    int ival;
+    double fval;
+    char *cval;
+    int sel[EXEC_BATCH_SIZE];
+} filter_state;
+
+
+static batch *filter_next(exec_op *op)
+{
+    filter_state *st = op->state;
+    batch *b;
+
+    while ((b = exec_next(op->child))) {
+        column *col = &b->cols[st->col];
+        int n = 0;
+
+        switch (col->type) {
+            case INT:
+                n = tp_selint(col->ints, b->count, st->cmp, st->ival, st->sel);
+                break;
+            case FLOAT:
+                n = tp_selfloat(col->floats, b->count, st->cmp, st->fval, st->sel);
+                break;
+            case CHAR:
+                n = tp_selchar(col->chars, b->count, col->length, st->cmp, st->cval, st->sel);
+                break;
+        }
+
+        if (n == 0) continue;
+        if (n < b->count) exec_batch_gather(b, st->sel, n);
+
+        return b;
+    }
+
+    return NULL;
+}
+
+
+static void filter_close(exec_op *op)
+{
+    filter_state *st = op->state;
+    free(st->cval);
+    free(st);
+}
+
+
+static batch *filter_next(exec_op *op);
+
+
+/*
+ * If child is a scan, or a stack of filters over one, pass the filter's
+ * predicate down to the scan for block skipping.
+ */
+static void filter_push_down(exec_op *child, int col, int cmp, double value)
+{
+    while (child && child->next == filter_next) child = child->child;
+    if (!child || child->next != scan_next) return;
+
+    scan_state *scan = child->state;
+    if (scan->pred_cnt == MAX_ATTRS) return;
+
+    scan->preds[scan->pred_cnt++] = (scan_pred) {.col = col, .cmp = cmp, .value = value};
+}
+
+
+static exec_op *exec_filter(exec_op *child, filter_state *st)
+{
+    exec_op *op = exec_op_create("filter", child, st);
+    if (!op) {
+        free(st->cval);
+        free(st);
+        return NULL;
+    }
+
+    op->next = filter_next;
+    op->close = filter_close;
+    return op;
+}
+
+
+exec_op *exec_filter_int(exec_op *child, int col, int cmp, int value)
+{
+    filter_state *st = calloc(1, sizeof(filter_state));
+    if (!st) return NULL;
+
+    st->col = col;
+    st->cmp = cmp;
+    st->ival = value;
+
+    exec_op *op = exec_filter(child, st);
+    if (op) filter_push_down(child, col, cmp, value);
+
+    return op;
+}
+
+
+exec_op *exec_filter_float(exec_op *child, int col, int cmp, double value)
+{
+    filter_state *st = calloc(1, sizeof(filter_state));
+    if (!st) return NULL;
+
+    st->col = col;
+    st->cmp = cmp;
+    st->fval = value;
+
+    exec_op *op = exec_filter(child, st);
+    if (op) filter_push_down(child, col, cmp, value);
+
+    return op;
+}
+
+
+exec_op *exec_filter_char(exec_op *child, int col, int cmp, char *value)
+{
+    filter_state *st = calloc(1, sizeof(filter_state));
+    if (!st) return NULL;
+
+    st->col = col;
+    st->cmp = cmp;
+    st->cval = strdup(value);
+    if (!st->cval) {
+        free(st);
+        return NULL;
+    }
+
+    return exec_filter(child, st);
+}
+
+
+/*
+ * Project
+ *
+ * Selects (and possibly reorders or duplicates) columns of its input. The
+ * output batch shares the input's column arrays, so no data is copied.
+ */
+typedef struct project_state {
+    int col_cnt;
+    int cols[MAX_ATTRS];
+    batch out;
+} project_state;
+
+
+static batch *project_next(exec_op *op)
+{
+    project_state *st = op->state;
+    batch *b = exec_next(op->child);
+    if (!b) return NULL;
+
+    for (int i=0; i<st->col_cnt; i++) {
+        st->out.cols[i] = b->cols[st->cols[i]];
+    }
+
+    st->out.count = b->count;
+    return &st->out;
+}
+
+
+static void project_close(exec_op *op)
+{
+    free(op->state);
+}
+
+
+exec_op *exec_project(exec_op *child, int col_cnt, int *cols)
+{
+    if (col_cnt <= 0 || col_cnt > MAX_ATTRS) return NULL;
+
+    project_state *st = calloc(1, sizeof(project_state));
+    if (!st) return NULL;
+
+    st->col_cnt = col_cnt;
+    st->out.col_cnt = col_cnt;
+    st->out.owned = FALSE;
+    memcpy(st->cols, cols, sizeof(int) * col_cnt);
+
+    exec_op *op = exec_op_create("project", child, st);
+    if (!op) {
+        free(st);
+        return NULL;
+    }
+
+    op->next = project_next;
+    op->close = project_close;
+    return op;
+}
+
+
+/*
+ * Limit
+ *
+ * Passes through at most limit rows, truncating the final batch, and stops
+ * pulling from its input once the limit is reached.
+ */
+typedef struct limit_state {
+    long limit;
+    long seen;
+} limit_state;
+
+
+static batch *limit_next(exec_op *op)
+{
+    limit_state *st = op->state;
+    if (st->seen >= st->limit) return NULL;
+
+    batch *b = exec_next(op->child);
+    if (!b) return NULL;
+
+    if (st->seen + b->count > st->limit) {
+        b->count = st->limit - st->seen;
+    }
+
+    st->seen += b->count;
+    return b;
+}
+
+
+static void limit_close(exec_op *op)
+{
+    free(op->state);
+}
+
+
+exec_op *exec_limit(exec_op *child, long limit)
+{
+    limit_state *st = calloc(1, sizeof(limit_state));
+    if (!st) return NULL;
+
+    st->limit = limit;
+
+    exec_op *op = exec_op_create("limit", child, st);
+    if (!op) {
+        free(st);
+        return NULL;
+    }
+
+    op->next = limit_next;
+    op->close = limit_close;
+    return op;
+}
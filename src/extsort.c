@@ -0,0 +1,657 @@
+/* extsort.c
+ *
+ * An external merge sort operator for the yahi-db executor, with bounded
+ * memory use.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blkstream.h"
+#include "exec.h"
+#include "extsort.h"
+#include "types.h"
+#include "yahi.h"
+
+typedef struct sort_cmp {
+    int key_cnt;
+    cd_cmp_fn fns[MAX_ATTRS];
+    int offsets[MAX_ATTRS];
+    int lengths[MAX_ATTRS];
+    int desc[MAX_ATTRS];
+} sort_cmp;
+
+
+/*
+ * A single input to the merge: either a sorted slice of the in-memory
+ * buffer, or a run on disk. cur points to the current (smallest
+ * remaining) row of the source, or is NULL once it is exhausted.
+ */
+typedef struct sort_src {
+    byte **ptrs;
+    long n;
+    long i;
+
+    bstream *run;
+    byte *row;
+
+    byte *cur;
+} sort_src;
+
+
+typedef struct sort_merge {
+    sort_cmp *cmp;
+    int k;
+    sort_src *srcs;
+    int *tree;
+} sort_merge;
+
+
+typedef struct sort_state {
+    sort_cmp cmp;
+    sort_key keys[MAX_ATTRS];
+    sort_opts opts;
+    row_layout layout;
+
+    byte *rows;
+    byte **ptrs;
+    long row_cnt;
+    long row_cap;
+
+    bstream **runs;
+    int run_cnt;
+    int run_cap;
+    int total_runs;
+    int passes;
+
+    int started;
+    sort_merge merge;
+    byte *stage;
+    batch out;
+} sort_state;
+
+
+void sort_default_opts(sort_opts *opts)
+{
+    opts->mem_budget = SORT_DEFAULT_MEM_BUDGET;
+    opts->threads = SORT_DEFAULT_THREADS;
+    opts->readahead = BS_DEFAULT_READAHEAD;
+}
+
+
+static int sort_compare(sort_cmp *cmp, byte *a, byte *b)
+{
+    for (int k=0; k<cmp->key_cnt; k++) {
+        int off = cmp->offsets[k];
+        int r = cmp->fns[k](a + off, b + off, cmp->lengths[k]);
+
+        if (r != 0) return cmp->desc[k] ? -r : r;
+    }
+
+    return 0;
+}
+
+
+static int sort_qsort_cmp(const void *a, const void *b, void *ctx)
+{
+    return sort_compare(ctx, *(byte **) a, *(byte **) b);
+}
+
+
+/*
+ * Loser tree
+ *
+ * The k sources are the leaves, at (implicit) positions k..2k-1, and each
+ * internal node 1..k-1 records the loser of the match played there, with
+ * the overall winner kept in tree[0]. Replacing the winner's row then only
+ * requires replaying the matches on the path from its leaf to the root.
+ * Exhausted sources compare greater than everything else, and ties go to
+ * the lower-numbered source.
+ */
+static int lt_less(sort_merge *m, int a, int b)
+{
+    byte *x = m->srcs[a].cur;
+    byte *y = m->srcs[b].cur;
+
+    if (!x) return FALSE;
+    if (!y) return TRUE;
+
+    int r = sort_compare(m->cmp, x, y);
+    return (r < 0) || (r == 0 && a < b);
+}
+
+
+static int lt_build(sort_merge *m, int node)
+{
+    if (node >= m->k) return node - m->k;
+
+    int a = lt_build(m, 2 * node);
+    int b = lt_build(m, 2 * node + 1);
+
+    if (lt_less(m, a, b)) {
+        m->tree[node] = b;
+        return a;
+    }
+
+    m->tree[node] = a;
+    return b;
+}
+
+
+static void lt_replay(sort_merge *m, int winner)
+{
+    for (int node = (winner + m->k) / 2; node >= 1; node /= 2) {
+        if (lt_less(m, m->tree[node], winner)) {
+            int t = m->tree[node];
+            m->tree[node] = winner;
+            winner = t;
+        }
+    }
+
+    m->tree[0] = winner;
+}
+
+
+static void src_advance(sort_src *src, int width)
+{
+    if (src->run) {
+        src->cur = (bs_read(src->run, src->row, width) == width) ? src->row : NULL;
+    } else {
+        src->cur = (src->i < src->n) ? src->ptrs[src->i++] : NULL;
+    }
+}
+
+
+static int merge_init(sort_merge *m, sort_cmp *cmp, sort_src *srcs, int k, int width)
+{
+    m->cmp = cmp;
+    m->k = k;
+    m->srcs = srcs;
+    m->tree = malloc(sizeof(int) * (k + 1));
+    if (!m->tree) return 0;
+
+    for (int i=0; i<k; i++) {
+        src_advance(&srcs[i], width);
+    }
+
+    m->tree[0] = (k == 1) ? 0 : lt_build(m, 1);
+    return 1;
+}
+
+
+/*
+ * Return the next row in sorted order (valid until the following call),
+ * or NULL once all sources are exhausted.
+ */
+static byte *merge_next(sort_merge *m, int width, byte *dst)
+{
+    int w = m->tree[0];
+    sort_src *src = &m->srcs[w];
+    if (!src->cur) return NULL;
+
+    memcpy(dst, src->cur, width);
+    src_advance(src, width);
+
+    if (m->k > 1) lt_replay(m, w);
+    return dst;
+}
+
+
+/*
+ * Whether every run being merged has been read to its end. A run which
+ * couldn't be read ends the merge early, just as an exhausted one does,
+ * so this tells the two apart once merge_next has returned NULL.
+ */
+static int merge_drained(sort_merge *m)
+{
+    for (int i=0; i<m->k; i++) {
+        bstream *run = m->srcs[i].run;
+        if (run && run->pos < run->size) return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void merge_free(sort_merge *m)
+{
+    if (m->srcs) {
+        for (int i=0; i<m->k; i++) {
+            free(m->srcs[i].row);
+        }
+    }
+
+    free(m->srcs);
+    free(m->tree);
+    memset(m, 0, sizeof(sort_merge));
+}
+
+
+/*
+ * Create merge sources reading from the given runs.
+ */
+static sort_src *merge_run_srcs(sort_state *st, bstream **runs, int cnt)
+{
+    sort_src *srcs = calloc(cnt, sizeof(sort_src));
+    if (!srcs) return NULL;
+
+    for (int i=0; i<cnt; i++) {
+        srcs[i].run = runs[i];
+        srcs[i].row = malloc(st->layout.width);
+
+        if (!srcs[i].row || !bs_rewind(runs[i], st->opts.readahead)) {
+            for (int j=0; j<=i; j++) free(srcs[j].row);
+            free(srcs);
+            return NULL;
+        }
+    }
+
+    return srcs;
+}
+
+
+static int sort_add_run(sort_state *st, bstream *run)
+{
+    if (st->run_cnt == st->run_cap) {
+        int cap = st->run_cap ? st->run_cap * 2 : 16;
+        bstream **runs = realloc(st->runs, sizeof(bstream *) * cap);
+        if (!runs) return 0;
+
+        st->runs = runs;
+        st->run_cap = cap;
+    }
+
+    st->runs[st->run_cnt++] = run;
+    st->total_runs++;
+    return 1;
+}
+
+
+/*
+ * Run generation
+ *
+ * The buffered rows are split into one contiguous slice of ptrs per
+ * thread. Each thread sorts its slice, and (if spill is set) writes it out
+ * as a run.
+ */
+typedef struct sort_slice {
+    sort_state *st;
+    byte **ptrs;
+    long n;
+    int spill;
+    bstream *run;
+    int ok;
+} sort_slice;
+
+
+static void *sort_slice_main(void *arg)
+{
+    sort_slice *sl = arg;
+    sort_state *st = sl->st;
+
+    qsort_r(sl->ptrs, sl->n, sizeof(byte *), sort_qsort_cmp, &st->cmp);
+    sl->ok = 1;
+
+    if (sl->spill) {
+        sl->run = malloc(sizeof(bstream));
+        sl->ok = sl->run && bs_open(sl->run);
+
+        for (long i=0; sl->ok && i<sl->n; i++) {
+            sl->ok = bs_write(sl->run, sl->ptrs[i], st->layout.width);
+        }
+    }
+
+    return NULL;
+}
+
+
+static int sort_slices(sort_state *st, sort_slice *slices, int spill)
+{
+    int threads = st->opts.threads;
+    if (threads > st->row_cnt) threads = st->row_cnt;
+    if (threads < 1) threads = 1;
+
+    long per = (st->row_cnt + threads - 1) / threads;
+    pthread_t tids[threads];
+    int started[threads];
+    int ok = 1;
+
+    for (int i=0; i<threads; i++) {
+        long first = i * per;
+        long last = (first + per < st->row_cnt) ? first + per : st->row_cnt;
+
+        slices[i] = (sort_slice) {.st = st, .ptrs = st->ptrs + first, .n = last - first,
+            .spill = spill};
+
+        // A slice whose thread can't be started is sorted by this one
+        started[i] = pthread_create(&tids[i], NULL, sort_slice_main, &slices[i]) == 0;
+        if (!started[i]) sort_slice_main(&slices[i]);
+    }
+
+    for (int i=0; i<threads; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+        ok = ok && slices[i].ok;
+    }
+
+    return ok ? threads : -1;
+}
+
+
+static int sort_spill_buffer(sort_state *st)
+{
+    if (st->row_cnt == 0) return 1;
+
+    sort_slice slices[st->opts.threads];
+    int cnt = sort_slices(st, slices, TRUE);
+    int ok = cnt > 0;
+
+    for (int i=0; i<cnt; i++) {
+        if (ok && slices[i].run) {
+            ok = sort_add_run(st, slices[i].run);
+        } else if (slices[i].run) {
+            bs_close(slices[i].run);
+            free(slices[i].run);
+        }
+    }
+
+    st->row_cnt = 0;
+    return ok;
+}
+
+
+static int sort_buffer_row(sort_state *st, long needed)
+{
+    if (st->row_cnt + needed <= st->row_cap) return 1;
+
+    long limit = st->opts.mem_budget / (st->layout.width + sizeof(byte *));
+    if (limit < EXEC_BATCH_SIZE) limit = EXEC_BATCH_SIZE;
+
+    // Grow the buffer towards the budget, and only once it is at the
+    // limit start spilling.
+    if (st->row_cap < limit) {
+        long cap = st->row_cap ? st->row_cap * 2 : EXEC_BATCH_SIZE * 4;
+        if (cap > limit) cap = limit;
+
+        byte *rows = realloc(st->rows, cap * st->layout.width);
+        if (!rows) return 0;
+        st->rows = rows;
+
+        byte **ptrs = realloc(st->ptrs, cap * sizeof(byte *));
+        if (!ptrs) return 0;
+        st->ptrs = ptrs;
+
+        // The rows have not been sorted yet, so the pointers can simply
+        // be rebuilt against the moved buffer.
+        for (long i=0; i<st->row_cnt; i++) {
+            st->ptrs[i] = st->rows + i * st->layout.width;
+        }
+
+        st->row_cap = cap;
+        if (st->row_cnt + needed <= st->row_cap) return 1;
+    }
+
+    return sort_spill_buffer(st);
+}
+
+
+/*
+ * Merge the first fan_in runs into a single new run, until at most fan_in
+ * runs remain.
+ */
+static int sort_reduce_runs(sort_state *st, int fan_in)
+{
+    byte *row = malloc(st->layout.width);
+    if (!row) return 0;
+
+    while (st->run_cnt > fan_in) {
+        sort_merge m;
+        sort_src *srcs = merge_run_srcs(st, st->runs, fan_in);
+        bstream *out = malloc(sizeof(bstream));
+
+        if (!srcs || !out || !bs_open(out) || !merge_init(&m, &st->cmp, srcs, fan_in,
+                    st->layout.width)) {
+            free(srcs);
+            free(out);
+            free(row);
+            return 0;
+        }
+
+        int ok = TRUE;
+        while (ok && merge_next(&m, st->layout.width, row)) {
+            ok = bs_write(out, row, st->layout.width);
+        }
+
+        ok = ok && merge_drained(&m);
+        merge_free(&m);
+
+        if (!ok) {
+            bs_close(out);
+            free(out);
+            free(row);
+            return 0;
+        }
+
+        for (int i=0; i<fan_in; i++) {
+            bs_close(st->runs[i]);
+            free(st->runs[i]);
+        }
+
+        memmove(st->runs, st->runs + fan_in, sizeof(bstream *) * (st->run_cnt - fan_in));
+        st->run_cnt -= fan_in;
+        st->runs[st->run_cnt++] = out;
+        st->total_runs++;
+        st->passes++;
+    }
+
+    free(row);
+    return 1;
+}
+
+
+static int sort_start(exec_op *op)
+{
+    sort_state *st = op->state;
+    batch *b;
+    int have_layout = FALSE;
+
+    while ((b = exec_next(op->child))) {
+        if (!have_layout) {
+            exec_layout_init(&st->layout, b);
+            for (int k=0; k<st->cmp.key_cnt; k++) {
+                int col = st->keys[k].col;
+                if (col < 0 || col >= b->col_cnt) return 0;
+
+                st->cmp.fns[k] = st->layout.cmp[col];
+                st->cmp.offsets[k] = st->layout.offsets[col];
+                st->cmp.lengths[k] = b->cols[col].length;
+                st->cmp.desc[k] = st->keys[k].desc;
+            }
+
+            if (!exec_batch_init(&st->out, st->layout.col_cnt, st->layout.types,
+                        st->layout.lengths)) {
+                return 0;
+            }
+
+            st->stage = malloc((long) st->layout.width * EXEC_BATCH_SIZE);
+            if (!st->stage) return 0;
+            have_layout = TRUE;
+        }
+
+        if (!sort_buffer_row(st, b->count)) return 0;
+
+        byte *dst = st->rows + st->row_cnt * st->layout.width;
+        exec_encode_rows(&st->layout, b, dst);
+        for (int i=0; i<b->count; i++) {
+            st->ptrs[st->row_cnt + i] = dst + (long) i * st->layout.width;
+        }
+        st->row_cnt += b->count;
+    }
+
+    // An empty input (or a failed one, which exec_failed reports) sorts
+    // to nothing
+    if (!have_layout) return 1;
+
+    if (st->run_cnt == 0) {
+        // Everything fit within the budget, so merge the sorted slices
+        // directly from memory.
+        sort_slice slices[st->opts.threads];
+        int cnt = sort_slices(st, slices, FALSE);
+        if (cnt < 0) return 0;
+
+        sort_src *srcs = calloc(cnt, sizeof(sort_src));
+        if (!srcs) return 0;
+
+        for (int i=0; i<cnt; i++) {
+            srcs[i].ptrs = slices[i].ptrs;
+            srcs[i].n = slices[i].n;
+        }
+
+        return merge_init(&st->merge, &st->cmp, srcs, cnt, st->layout.width);
+    }
+
+    // Otherwise, spill the remainder as well, and release the buffer
+    // so that the budget is available to the merge.
+    if (!sort_spill_buffer(st)) return 0;
+
+    free(st->rows);
+    free(st->ptrs);
+    st->rows = NULL;
+    st->ptrs = NULL;
+    st->row_cap = 0;
+
+    long per_run = (long) st->opts.readahead * BLOCKSIZE + st->layout.width;
+    int fan_in = st->opts.mem_budget / per_run;
+    if (fan_in < 2) fan_in = 2;
+
+    if (!sort_reduce_runs(st, fan_in)) return 0;
+
+    sort_src *srcs = merge_run_srcs(st, st->runs, st->run_cnt);
+    if (!srcs) return 0;
+
+    st->passes++;
+    return merge_init(&st->merge, &st->cmp, srcs, st->run_cnt, st->layout.width);
+}
+
+
+static batch *sort_next(exec_op *op)
+{
+    sort_state *st = op->state;
+
+    if (!st->started) {
+        st->started = TRUE;
+        if (!sort_start(op)) {
+            merge_free(&st->merge);
+            op->failed = TRUE;
+            return NULL;
+        }
+    }
+
+    if (!st->merge.tree) return NULL;
+
+    int width = st->layout.width;
+    int cnt = 0;
+    while (cnt < EXEC_BATCH_SIZE && merge_next(&st->merge, width, st->stage + cnt * width)) {
+        cnt++;
+    }
+
+    if (cnt < EXEC_BATCH_SIZE && !merge_drained(&st->merge)) {
+        merge_free(&st->merge);
+        op->failed = TRUE;
+        return NULL;
+    }
+
+    if (cnt == 0) return NULL;
+
+    exec_decode_rows(&st->layout, st->stage, cnt, width, &st->out, 0);
+    st->out.count = cnt;
+    return &st->out;
+}
+
+
+static void sort_close(exec_op *op)
+{
+    sort_state *st = op->state;
+
+    merge_free(&st->merge);
+    for (int i=0; i<st->run_cnt; i++) {
+        bs_close(st->runs[i]);
+        free(st->runs[i]);
+    }
+
+    exec_batch_free(&st->out);
+    free(st->runs);
+    free(st->rows);
+    free(st->ptrs);
+    free(st->stage);
+    free(st);
+}
+
+
+/*
+ * Create a sort of child's output on the given keys (with earlier keys
+ * taking precedence). If opts is NULL, the defaults from
+ * sort_default_opts() are used.
+ */
+exec_op *exec_sort(exec_op *child, int key_cnt, sort_key *keys, sort_opts *opts)
+{
+    if (key_cnt <= 0 || key_cnt > MAX_ATTRS) return NULL;
+
+    sort_state *st = calloc(1, sizeof(sort_state));
+    if (!st) return NULL;
+
+    if (opts) {
+        st->opts = *opts;
+    } else {
+        sort_default_opts(&st->opts);
+    }
+
+    if (st->opts.threads < 1) st->opts.threads = 1;
+    if (st->opts.readahead < 1) st->opts.readahead = 1;
+
+    st->cmp.key_cnt = key_cnt;
+    memcpy(st->keys, keys, sizeof(sort_key) * key_cnt);
+
+    exec_op *op = calloc(1, sizeof(exec_op));
+    if (!op) {
+        free(st);
+        return NULL;
+    }
+
+    op->name = "sort";
+    op->child = child;
+    op->state = st;
+    op->next = sort_next;
+    op->close = sort_close;
+
+    return op;
+}
+
+
+/*
+ * The number of sorted runs written to disk, including those produced by
+ * intermediate merges.
+ */
+int exec_sort_runs(exec_op *op)
+{
+    sort_state *st = op->state;
+    return st->total_runs;
+}
+
+
+/*
+ * The number of merge passes made over the spilled runs.
+ */
+int exec_sort_passes(exec_op *op)
+{
+    sort_state *st = op->state;
+    return st->passes;
+}
@@ -0,0 +1,1137 @@
+/* hashagg.c
+ *
+ * A parallel hash aggregation (GROUP BY) operator for the yahi-db
+ * executor.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <float.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blkstream.h"
+#include "exec.h"
+#include "hashagg.h"
+#include "types.h"
+#include "yahi.h"
+
+#define AGG_MIN_TABLE 64
+#define AGG_REPART_BITS 3
+#define AGG_MAX_SHIFT 32
+
+/*
+ * The running state of one aggregate for one group. MIN and MAX of INT
+ * columns are kept as doubles, which represent every int exactly.
+ */
+typedef struct agg_val {
+    double d;
+    long n;
+} agg_val;
+
+
+/*
+ * Hash table entries (and the partial aggregates that are written to
+ * partitions) are laid out as
+ *
+ *      [hash (8 bytes)][group key, padded to 8 bytes][agg_val]*
+ *
+ * A hash of 0 marks an empty slot; stored hashes always have their top
+ * bit set.
+ */
+typedef struct agg_table {
+    byte *slots;
+    long cap;
+    long cnt;
+    int shift;      // hash bits already used to partition the entries
+} agg_table;
+
+
+typedef struct agg_buf {
+    byte *data;
+    long len;
+    long cap;
+} agg_buf;
+
+
+typedef struct agg_local {
+    agg_table tbl;
+    agg_buf *parts;
+    byte *keys;
+    uint64_t *hashes;
+    long spills;
+    int ok;
+} agg_local;
+
+
+typedef struct agg_part {
+    pthread_mutex_t lock;
+    int spilled;
+    bstream spill;
+} agg_part;
+
+
+typedef struct agg_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    batch *slots;
+    int slot_cnt;
+    int *full;
+    int full_head;
+    int full_cnt;
+    int *free;
+    int free_cnt;
+    int done;
+} agg_queue;
+
+
+typedef struct agg_state {
+    int group_cnt;
+    int group_cols[MAX_ATTRS];
+    int agg_cnt;
+    agg_spec aggs[MAX_ATTRS];
+    int agg_types[MAX_ATTRS];
+    agg_opts opts;
+
+    row_layout key_layout;
+    int key_width;
+    int entry_size;
+    long table_limit;
+
+    int part_cnt;
+    agg_part *parts;
+    agg_local *locals;
+    agg_queue queue;
+
+    atomic_int next_part;
+    atomic_long splits;
+    agg_buf *results;
+    int result_idx;
+    long result_off;
+
+    int started;
+    batch out;
+} agg_state;
+
+
+void agg_default_opts(agg_opts *opts)
+{
+    opts->threads = AGG_DEFAULT_THREADS;
+    opts->radix_bits = AGG_DEFAULT_RADIX_BITS;
+    opts->mem_budget = AGG_DEFAULT_MEM_BUDGET;
+}
+
+
+static inline uint64_t agg_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static uint64_t agg_hash(byte *key, int len)
+{
+    uint64_t h = len;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, key + i, 8);
+        h = agg_mix(h ^ w);
+    }
+
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, key + i, len - i);
+        h = agg_mix(h ^ w);
+    }
+
+    return h | (1ULL << 63);
+}
+
+
+static int agg_buf_append(agg_buf *buf, byte *src, long len)
+{
+    if (buf->len + len > buf->cap) {
+        long cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) cap *= 2;
+
+        byte *data = realloc(buf->data, cap);
+        if (!data) return 0;
+
+        buf->data = data;
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
+    return 1;
+}
+
+
+static void agg_buf_free(agg_buf *buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(agg_buf));
+}
+
+
+static inline agg_val *agg_vals(agg_state *st, byte *entry)
+{
+    return (agg_val *) (entry + sizeof(uint64_t) + st->key_width);
+}
+
+
+static int agg_table_init(agg_state *st, agg_table *tbl, long cap)
+{
+    tbl->slots = calloc(cap, st->entry_size);
+    tbl->cap = cap;
+    tbl->cnt = 0;
+    tbl->shift = st->opts.radix_bits;
+
+    return tbl->slots != NULL;
+}
+
+
+static void agg_table_clear(agg_state *st, agg_table *tbl)
+{
+    memset(tbl->slots, 0, tbl->cap * st->entry_size);
+    tbl->cnt = 0;
+}
+
+
+static void agg_table_free(agg_table *tbl)
+{
+    free(tbl->slots);
+    memset(tbl, 0, sizeof(agg_table));
+}
+
+
+static byte *agg_table_probe(agg_state *st, agg_table *tbl, uint64_t hash, byte *key)
+{
+    long mask = tbl->cap - 1;
+    long i = (hash >> tbl->shift) & mask;
+
+    while (TRUE) {
+        byte *slot = tbl->slots + i * st->entry_size;
+        uint64_t h;
+        memcpy(&h, slot, sizeof(uint64_t));
+
+        if (h == 0) return slot;
+        if (h == hash && memcmp(slot + sizeof(uint64_t), key, st->key_layout.width) == 0) {
+            return slot;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+
+static int agg_table_grow(agg_state *st, agg_table *tbl)
+{
+    agg_table bigger;
+    if (!agg_table_init(st, &bigger, tbl->cap * 2)) return 0;
+    bigger.shift = tbl->shift;
+
+    for (long i=0; i<tbl->cap; i++) {
+        byte *slot = tbl->slots + i * st->entry_size;
+        uint64_t h;
+        memcpy(&h, slot, sizeof(uint64_t));
+        if (h == 0) continue;
+
+        memcpy(agg_table_probe(st, &bigger, h, slot + sizeof(uint64_t)), slot, st->entry_size);
+    }
+
+    bigger.cnt = tbl->cnt;
+    free(tbl->slots);
+    *tbl = bigger;
+
+    return 1;
+}
+
+
+/*
+ * Return the entry for the given group, creating (and initializing) it
+ * if it isn't already present. Returns NULL on allocation failure.
+ */
+static byte *agg_table_get(agg_state *st, agg_table *tbl, uint64_t hash, byte *key)
+{
+    byte *slot = agg_table_probe(st, tbl, hash, key);
+    uint64_t h;
+    memcpy(&h, slot, sizeof(uint64_t));
+    if (h != 0) return slot;
+
+    if ((tbl->cnt + 1) * 2 > tbl->cap) {
+        if (!agg_table_grow(st, tbl)) return NULL;
+        slot = agg_table_probe(st, tbl, hash, key);
+    }
+
+    memcpy(slot, &hash, sizeof(uint64_t));
+    memcpy(slot + sizeof(uint64_t), key, st->key_layout.width);
+
+    agg_val *vals = agg_vals(st, slot);
+    for (int a=0; a<st->agg_cnt; a++) {
+        vals[a].n = 0;
+        vals[a].d = (st->aggs[a].func == AGG_MIN) ? DBL_MAX :
+                    (st->aggs[a].func == AGG_MAX) ? -DBL_MAX : 0.0;
+    }
+
+    tbl->cnt++;
+    return slot;
+}
+
+
+static inline void agg_update(int func, agg_val *val, double v)
+{
+    switch (func) {
+        case AGG_SUM:
+        case AGG_AVG:
+            val->d += v;
+            break;
+        case AGG_MIN:
+            if (v < val->d) val->d = v;
+            break;
+        case AGG_MAX:
+            if (v > val->d) val->d = v;
+            break;
+    }
+
+    val->n++;
+}
+
+
+static inline void agg_combine(int func, agg_val *val, agg_val *partial)
+{
+    switch (func) {
+        case AGG_SUM:
+        case AGG_AVG:
+            val->d += partial->d;
+            break;
+        case AGG_MIN:
+            if (partial->d < val->d) val->d = partial->d;
+            break;
+        case AGG_MAX:
+            if (partial->d > val->d) val->d = partial->d;
+            break;
+    }
+
+    val->n += partial->n;
+}
+
+
+/*
+ * Scatter every entry of a thread's table into its per-partition buffers,
+ * and empty the table.
+ */
+static int agg_scatter(agg_state *st, agg_local *loc)
+{
+    int mask = st->part_cnt - 1;
+
+    for (long i=0; i<loc->tbl.cap; i++) {
+        byte *slot = loc->tbl.slots + i * st->entry_size;
+        uint64_t h;
+        memcpy(&h, slot, sizeof(uint64_t));
+        if (h == 0) continue;
+
+        if (!agg_buf_append(&loc->parts[h & mask], slot, st->entry_size)) return 0;
+    }
+
+    agg_table_clear(st, &loc->tbl);
+    return 1;
+}
+
+
+/*
+ * Write a thread's partial aggregates out to the partitions' streams,
+ * freeing up its table.
+ */
+static int agg_spill(agg_state *st, agg_local *loc)
+{
+    if (!agg_scatter(st, loc)) return 0;
+
+    for (int p=0; p<st->part_cnt; p++) {
+        agg_buf *buf = &loc->parts[p];
+        if (buf->len == 0) continue;
+
+        agg_part *part = &st->parts[p];
+        pthread_mutex_lock(&part->lock);
+
+        int ok = TRUE;
+        if (!part->spilled) {
+            ok = bs_open(&part->spill);
+            part->spilled = ok;
+        }
+        ok = ok && bs_write(&part->spill, buf->data, buf->len);
+
+        pthread_mutex_unlock(&part->lock);
+        if (!ok) return 0;
+
+        buf->len = 0;
+    }
+
+    loc->spills++;
+    return 1;
+}
+
+
+static void agg_consume(agg_state *st, agg_local *loc, batch *b)
+{
+    int kw = st->key_layout.width;
+
+    for (int g=0; g<st->group_cnt; g++) {
+        column *col = &b->cols[st->group_cols[g]];
+        byte *dst = loc->keys + st->key_layout.offsets[g];
+
+        st->key_layout.encode[g](dst, kw, b->count, col->length, exec_col_at(col, 0));
+    }
+
+    for (int i=0; i<b->count; i++) {
+        loc->hashes[i] = agg_hash(loc->keys + i*kw, kw);
+    }
+
+    for (int i=0; i<b->count && loc->ok; i++) {
+        // Rather than growing the table past its share of the budget,
+        // spill its contents and start over.
+        if ((loc->tbl.cnt + 1) * 2 > loc->tbl.cap &&
+                loc->tbl.cap * 2 * st->entry_size > st->table_limit) {
+            if (!(loc->ok = agg_spill(st, loc))) break;
+        }
+
+        byte *entry = agg_table_get(st, &loc->tbl, loc->hashes[i], loc->keys + i*kw);
+        if (!entry) {
+            loc->ok = FALSE;
+            break;
+        }
+
+        agg_val *vals = agg_vals(st, entry);
+        for (int a=0; a<st->agg_cnt; a++) {
+            double v = 0;
+            if (st->aggs[a].func != AGG_COUNT) {
+                column *col = &b->cols[st->aggs[a].col];
+                v = (col->type == INT) ? col->ints[i] : col->floats[i];
+            }
+
+            agg_update(st->aggs[a].func, &vals[a], v);
+        }
+    }
+}
+
+
+typedef struct agg_worker {
+    agg_state *st;
+    agg_local *loc;
+} agg_worker;
+
+
+static void *agg_consumer_main(void *arg)
+{
+    agg_worker *w = arg;
+    agg_state *st = w->st;
+    agg_queue *q = &st->queue;
+
+    while (TRUE) {
+        pthread_mutex_lock(&q->lock);
+        while (q->full_cnt == 0 && !q->done) {
+            pthread_cond_wait(&q->changed, &q->lock);
+        }
+
+        if (q->full_cnt == 0) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+
+        int idx = q->full[q->full_head];
+        q->full_head = (q->full_head + 1) % q->slot_cnt;
+        q->full_cnt--;
+        pthread_mutex_unlock(&q->lock);
+
+        if (w->loc->ok) {
+            agg_consume(st, w->loc, &q->slots[idx]);
+        }
+
+        pthread_mutex_lock(&q->lock);
+        q->free[q->free_cnt++] = idx;
+        pthread_cond_broadcast(&q->changed);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    if (w->loc->ok) {
+        w->loc->ok = agg_scatter(st, w->loc);
+    }
+
+    return NULL;
+}
+
+
+static int agg_queue_init(agg_queue *q, int slot_cnt, batch *proto)
+{
+    int types[MAX_ATTRS], lengths[MAX_ATTRS];
+    for (int c=0; c<proto->col_cnt; c++) {
+        types[c] = proto->cols[c].type;
+        lengths[c] = proto->cols[c].length;
+    }
+
+    q->slot_cnt = slot_cnt;
+    q->slots = calloc(slot_cnt, sizeof(batch));
+    q->full = malloc(sizeof(int) * slot_cnt);
+    q->free = malloc(sizeof(int) * slot_cnt);
+    if (!q->slots || !q->full || !q->free) return 0;
+
+    for (int i=0; i<slot_cnt; i++) {
+        if (!exec_batch_init(&q->slots[i], proto->col_cnt, types, lengths)) return 0;
+        q->free[q->free_cnt++] = i;
+    }
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return 1;
+}
+
+
+static void agg_queue_free(agg_queue *q)
+{
+    if (q->slots) {
+        for (int i=0; i<q->slot_cnt; i++) {
+            exec_batch_free(&q->slots[i]);
+        }
+
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->changed);
+    }
+
+    free(q->slots);
+    free(q->full);
+    free(q->free);
+    memset(q, 0, sizeof(agg_queue));
+}
+
+
+static void agg_queue_push(agg_queue *q, batch *b)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->free_cnt == 0) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    int idx = q->free[--q->free_cnt];
+    pthread_mutex_unlock(&q->lock);
+
+    exec_batch_copy(&q->slots[idx], b);
+
+    pthread_mutex_lock(&q->lock);
+    q->full[(q->full_head + q->full_cnt) % q->slot_cnt] = idx;
+    q->full_cnt++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static void agg_queue_finish(agg_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->done = TRUE;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ * Set up the key layout, the output batch, and the per-thread state,
+ * based upon the column types of the first input batch.
+ */
+static int agg_setup(agg_state *st, batch *b)
+{
+    int key_types[MAX_ATTRS], key_lengths[MAX_ATTRS];
+    for (int g=0; g<st->group_cnt; g++) {
+        int col = st->group_cols[g];
+        if (col < 0 || col >= b->col_cnt) return 0;
+
+        key_types[g] = b->cols[col].type;
+        key_lengths[g] = b->cols[col].length;
+    }
+
+    if (!cd_init(&st->key_layout, st->group_cnt, key_types, key_lengths)) return 0;
+
+    int out_types[MAX_ATTRS], out_lengths[MAX_ATTRS];
+    memcpy(out_types, st->key_layout.types, sizeof(int) * st->group_cnt);
+    memcpy(out_lengths, st->key_layout.lengths, sizeof(int) * st->group_cnt);
+
+    for (int a=0; a<st->agg_cnt; a++) {
+        int func = st->aggs[a].func;
+        int type = INT;
+
+        if (func != AGG_COUNT) {
+            int col = st->aggs[a].col;
+            if (col < 0 || col >= b->col_cnt || b->cols[col].type == CHAR) return 0;
+            st->agg_types[a] = b->cols[col].type;
+            type = (func == AGG_MIN || func == AGG_MAX) ? b->cols[col].type : FLOAT;
+        }
+
+        out_types[st->group_cnt + a] = type;
+        out_lengths[st->group_cnt + a] = 0;
+    }
+
+    st->key_width = (st->key_layout.width + 7) & ~7;
+    st->entry_size = sizeof(uint64_t) + st->key_width + sizeof(agg_val) * st->agg_cnt;
+
+    st->table_limit = st->opts.mem_budget / st->opts.threads;
+    if (st->table_limit < AGG_MIN_TABLE * 2 * st->entry_size) {
+        st->table_limit = AGG_MIN_TABLE * 2 * st->entry_size;
+    }
+
+    if (!exec_batch_init(&st->out, st->group_cnt + st->agg_cnt, out_types, out_lengths)) {
+        return 0;
+    }
+
+    st->locals = calloc(st->opts.threads, sizeof(agg_local));
+    if (!st->locals) return 0;
+
+    for (int t=0; t<st->opts.threads; t++) {
+        agg_local *loc = &st->locals[t];
+        loc->ok = TRUE;
+        loc->parts = calloc(st->part_cnt, sizeof(agg_buf));
+        loc->keys = malloc((long) (st->key_layout.width + 1) * EXEC_BATCH_SIZE);
+        loc->hashes = malloc(sizeof(uint64_t) * EXEC_BATCH_SIZE);
+
+        if (!loc->parts || !loc->keys || !loc->hashes) return 0;
+        if (!agg_table_init(st, &loc->tbl, AGG_MIN_TABLE)) return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Pre-aggregation: feed the input to the threads' local tables.
+ */
+static int agg_preaggregate(exec_op *op)
+{
+    agg_state *st = op->state;
+    batch *b = exec_next(op->child);
+
+    // An empty input leaves nothing to set up, or to merge
+    if (!b) return 1;
+    if (!agg_setup(st, b)) return 0;
+
+    int threads = st->opts.threads;
+    if (threads == 1) {
+        // No point in copying batches through the queue.
+        do {
+            agg_consume(st, &st->locals[0], b);
+        } while (st->locals[0].ok && (b = exec_next(op->child)));
+
+        return st->locals[0].ok && agg_scatter(st, &st->locals[0]);
+    }
+
+    if (!agg_queue_init(&st->queue, threads * 2, b)) return 0;
+
+    pthread_t tids[threads];
+    agg_worker workers[threads];
+    int started = 0;
+    for (int t=0; t<threads; t++) {
+        workers[started] = (agg_worker) {.st = st, .loc = &st->locals[started]};
+        if (pthread_create(&tids[started], NULL, agg_consumer_main, &workers[started]) == 0) {
+            started++;
+        }
+    }
+
+    // With no consumer threads at all, this thread aggregates the input
+    // itself, as for a single thread
+    if (started == 0) {
+        agg_queue_free(&st->queue);
+        do {
+            agg_consume(st, &st->locals[0], b);
+        } while (st->locals[0].ok && (b = exec_next(op->child)));
+
+        return st->locals[0].ok && agg_scatter(st, &st->locals[0]);
+    }
+
+    do {
+        agg_queue_push(&st->queue, b);
+    } while ((b = exec_next(op->child)));
+
+    agg_queue_finish(&st->queue);
+
+    int ok = TRUE;
+    for (int t=0; t<started; t++) {
+        pthread_join(tids[t], NULL);
+        ok = ok && st->locals[t].ok;
+    }
+
+    agg_queue_free(&st->queue);
+    return ok;
+}
+
+
+/*
+ * Fold a partial aggregate into the matching group of tbl.
+ */
+static int agg_merge_entry(agg_state *st, agg_table *tbl, byte *entry)
+{
+    uint64_t h;
+    memcpy(&h, entry, sizeof(uint64_t));
+
+    byte *dst = agg_table_get(st, tbl, h, entry + sizeof(uint64_t));
+    if (!dst) return 0;
+
+    for (int a=0; a<st->agg_cnt; a++) {
+        agg_combine(st->aggs[a].func, &agg_vals(st, dst)[a], &agg_vals(st, entry)[a]);
+    }
+
+    return 1;
+}
+
+
+/*
+ * Fold all of the partial aggregates in a spilled stream into tbl.
+ */
+static int agg_merge_stream(agg_state *st, agg_table *tbl, bstream *s, byte *entry)
+{
+    if (!bs_rewind(s, BS_DEFAULT_READAHEAD)) return 0;
+
+    while (bs_read(s, entry, st->entry_size) == st->entry_size) {
+        if (!agg_merge_entry(st, tbl, entry)) return 0;
+    }
+
+    return s->pos == s->size;
+}
+
+
+static int agg_emit(agg_state *st, agg_table *tbl, agg_buf *out)
+{
+    for (long i=0; i<tbl->cap; i++) {
+        byte *slot = tbl->slots + i * st->entry_size;
+        uint64_t h;
+        memcpy(&h, slot, sizeof(uint64_t));
+
+        if (h != 0 && !agg_buf_append(out, slot, st->entry_size)) return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Scatter len bytes of partial aggregates to the 2^AGG_REPART_BITS streams
+ * of subs, on the hash bits above shift.
+ */
+static int agg_split(agg_state *st, byte *entries, long len, int shift, bstream *subs)
+{
+    long mask = (1L << AGG_REPART_BITS) - 1;
+
+    for (long off=0; off<len; off += st->entry_size) {
+        uint64_t h;
+        memcpy(&h, entries + off, sizeof(uint64_t));
+        if (!bs_write(&subs[(h >> shift) & mask], entries + off, st->entry_size)) return 0;
+    }
+
+    return 1;
+}
+
+
+static int agg_split_stream(agg_state *st, bstream *s, int shift, bstream *subs, byte *entry)
+{
+    if (!bs_rewind(s, BS_DEFAULT_READAHEAD)) return 0;
+
+    while (bs_read(s, entry, st->entry_size) == st->entry_size) {
+        if (!agg_split(st, entry, st->entry_size, shift, subs)) return 0;
+    }
+
+    return s->pos == s->size;
+}
+
+
+static bstream *agg_subs_open()
+{
+    int fanout = 1 << AGG_REPART_BITS;
+    bstream *subs = malloc(sizeof(bstream) * fanout);
+    if (!subs) return NULL;
+
+    for (int s=0; s<fanout; s++) {
+        if (!bs_open(&subs[s])) {
+            for (int k=0; k<s; k++) bs_close(&subs[k]);
+            free(subs);
+            return NULL;
+        }
+    }
+
+    return subs;
+}
+
+
+static void agg_subs_close(bstream *subs)
+{
+    for (int s=0; s<(1 << AGG_REPART_BITS); s++) bs_close(&subs[s]);
+    free(subs);
+}
+
+
+static int agg_merge_split(agg_state *st, bstream *subs, long size, int shift, agg_buf *out,
+        byte *entry);
+
+
+/*
+ * Merge the partial aggregates of one piece of a split partition. A piece
+ * whose partials could hold more groups than a merge table may take is
+ * split again, on the next hash bits, unless the split that made it
+ * didn't shrink it (when its partials are all of a few groups, and it
+ * merges to a small table anyway).
+ */
+static int agg_merge_run(agg_state *st, bstream *run, int shift, agg_buf *out, int can_split,
+        byte *entry)
+{
+    if (can_split && run->size > st->table_limit / 2 && shift + AGG_REPART_BITS <= AGG_MAX_SHIFT) {
+        long size = run->size;
+        bstream *subs = agg_subs_open();
+        int ok = subs && agg_split_stream(st, run, shift, subs, entry);
+        bs_close(run);
+
+        ok = ok && agg_merge_split(st, subs, size, shift + AGG_REPART_BITS, out, entry);
+        if (subs) agg_subs_close(subs);
+        return ok;
+    }
+
+    agg_table tbl;
+    if (!agg_table_init(st, &tbl, AGG_MIN_TABLE)) return 0;
+    tbl.shift = shift;
+
+    int ok = agg_merge_stream(st, &tbl, run, entry) && agg_emit(st, &tbl, out);
+    agg_table_free(&tbl);
+    return ok;
+}
+
+
+static int agg_merge_split(agg_state *st, bstream *subs, long size, int shift, agg_buf *out,
+        byte *entry)
+{
+    atomic_fetch_add(&st->splits, 1);
+
+    int ok = TRUE;
+    for (int s=0; ok && s<(1 << AGG_REPART_BITS); s++) {
+        long sub_size = subs[s].size;
+        ok = agg_merge_run(st, &subs[s], shift, out, sub_size < size, entry);
+    }
+
+    return ok;
+}
+
+
+/*
+ * Merge all of the partial aggregates for partition p, from each thread's
+ * in-memory buffer and from the partition's spill stream, and append the
+ * final groups to out. A partition with more partials than a merge table
+ * should hold groups (its share of the memory budget) is split again on
+ * the hash bits above those which chose it, and merged a piece at a time.
+ */
+static int agg_merge_part(agg_state *st, int p, agg_buf *out)
+{
+    agg_part *part = &st->parts[p];
+    byte *entry = malloc(st->entry_size);
+    if (!entry) return 0;
+
+    long size = part->spilled ? part->spill.size : 0;
+    for (int t=0; t<st->opts.threads; t++) {
+        size += st->locals[t].parts[p].len;
+    }
+
+    int ok = TRUE;
+    if (size > st->table_limit / 2) {
+        bstream *subs = agg_subs_open();
+        ok = subs != NULL;
+
+        for (int t=0; t<st->opts.threads; t++) {
+            agg_buf *buf = &st->locals[t].parts[p];
+            ok = ok && agg_split(st, buf->data, buf->len, st->opts.radix_bits, subs);
+            agg_buf_free(buf);
+        }
+
+        if (part->spilled) {
+            ok = ok && agg_split_stream(st, &part->spill, st->opts.radix_bits, subs, entry);
+            bs_close(&part->spill);
+            part->spilled = FALSE;
+        }
+
+        ok = ok && agg_merge_split(st, subs, size, st->opts.radix_bits + AGG_REPART_BITS, out,
+                entry);
+        if (subs) agg_subs_close(subs);
+
+        free(entry);
+        return ok;
+    }
+
+    agg_table tbl;
+    if (!agg_table_init(st, &tbl, AGG_MIN_TABLE)) {
+        free(entry);
+        return 0;
+    }
+
+    for (int t=0; t<st->opts.threads; t++) {
+        agg_buf *buf = &st->locals[t].parts[p];
+
+        for (long off=0; ok && off<buf->len; off += st->entry_size) {
+            ok = agg_merge_entry(st, &tbl, buf->data + off);
+        }
+
+        agg_buf_free(buf);
+    }
+
+    if (part->spilled) {
+        ok = ok && agg_merge_stream(st, &tbl, &part->spill, entry);
+        bs_close(&part->spill);
+        part->spilled = FALSE;
+    }
+
+    ok = ok && agg_emit(st, &tbl, out);
+
+    free(entry);
+    agg_table_free(&tbl);
+    return ok;
+}
+
+
+typedef struct agg_merger {
+    agg_state *st;
+    agg_buf *out;
+    int ok;
+} agg_merger;
+
+
+static void *agg_merger_main(void *arg)
+{
+    agg_merger *m = arg;
+    agg_state *st = m->st;
+    int p;
+
+    m->ok = TRUE;
+    while (m->ok && (p = atomic_fetch_add(&st->next_part, 1)) < st->part_cnt) {
+        m->ok = agg_merge_part(st, p, m->out);
+    }
+
+    return NULL;
+}
+
+
+static int agg_merge(agg_state *st)
+{
+    int threads = st->opts.threads;
+
+    // The pre-aggregation tables are no longer needed.
+    for (int t=0; t<threads; t++) {
+        agg_table_free(&st->locals[t].tbl);
+    }
+
+    st->results = calloc((unsigned int) threads, sizeof(agg_buf));
+    if (!st->results) return 0;
+
+    pthread_t tids[threads];
+    agg_merger mergers[threads];
+    atomic_store(&st->next_part, 0);
+
+    // The mergers share out the partitions between them, and this thread
+    // stands in for any which can't be started
+    int started[threads];
+    for (int t=0; t<threads; t++) {
+        mergers[t] = (agg_merger) {.st = st, .out = &st->results[t]};
+        started[t] = pthread_create(&tids[t], NULL, agg_merger_main, &mergers[t]) == 0;
+    }
+
+    for (int t=0; t<threads; t++) {
+        if (!started[t]) agg_merger_main(&mergers[t]);
+    }
+
+    int ok = TRUE;
+    for (int t=0; t<threads; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+        ok = ok && mergers[t].ok;
+    }
+
+    return ok;
+}
+
+
+static batch *agg_next(exec_op *op)
+{
+    agg_state *st = op->state;
+
+    if (!st->started) {
+        st->started = TRUE;
+        if (!agg_preaggregate(op) || (st->locals && !agg_merge(st))) {
+            st->result_idx = st->opts.threads;
+            op->failed = TRUE;
+            return NULL;
+        }
+    }
+
+    while (st->results && st->result_idx < st->opts.threads) {
+        agg_buf *res = &st->results[st->result_idx];
+        long remaining = (res->len - st->result_off) / st->entry_size;
+
+        if (remaining == 0) {
+            agg_buf_free(res);
+            st->result_idx++;
+            st->result_off = 0;
+            continue;
+        }
+
+        int cnt = (remaining > EXEC_BATCH_SIZE) ? EXEC_BATCH_SIZE : remaining;
+        byte *entries = res->data + st->result_off;
+
+        exec_decode_rows(&st->key_layout, entries + sizeof(uint64_t), cnt, st->entry_size,
+                &st->out, 0);
+
+        for (int a=0; a<st->agg_cnt; a++) {
+            column *col = &st->out.cols[st->group_cnt + a];
+            int func = st->aggs[a].func;
+
+            for (int i=0; i<cnt; i++) {
+                agg_val *val = &agg_vals(st, entries + (long) i * st->entry_size)[a];
+
+                switch (func) {
+                    case AGG_COUNT:
+                        col->ints[i] = val->n;
+                        break;
+                    case AGG_SUM:
+                        col->floats[i] = val->d;
+                        break;
+                    case AGG_AVG:
+                        col->floats[i] = val->d / val->n;
+                        break;
+                    case AGG_MIN:
+                    case AGG_MAX:
+                        if (col->type == INT) col->ints[i] = (int) val->d;
+                        else col->floats[i] = val->d;
+                        break;
+                }
+            }
+        }
+
+        st->result_off += (long) cnt * st->entry_size;
+        st->out.count = cnt;
+        return &st->out;
+    }
+
+    return NULL;
+}
+
+
+static void agg_close(exec_op *op)
+{
+    agg_state *st = op->state;
+
+    if (st->locals) {
+        for (int t=0; t<st->opts.threads; t++) {
+            agg_local *loc = &st->locals[t];
+            agg_table_free(&loc->tbl);
+            if (loc->parts) {
+                for (int p=0; p<st->part_cnt; p++) agg_buf_free(&loc->parts[p]);
+            }
+            free(loc->parts);
+            free(loc->keys);
+            free(loc->hashes);
+        }
+    }
+
+    if (st->results) {
+        for (int t=0; t<st->opts.threads; t++) agg_buf_free(&st->results[t]);
+    }
+
+    for (int p=0; p<st->part_cnt; p++) {
+        if (st->parts[p].spilled) bs_close(&st->parts[p].spill);
+        pthread_mutex_destroy(&st->parts[p].lock);
+    }
+
+    exec_batch_free(&st->out);
+    free(st->locals);
+    free(st->results);
+    free(st->parts);
+    free(st);
+}
+
+
+/*
+ * Create an aggregation of child's output, grouped on the group_cnt
+ * columns listed in group_cols, computing each of the aggs. If opts is
+ * NULL, the defaults from agg_default_opts() are used.
+ */
+exec_op *exec_hashagg(exec_op *child, int group_cnt, int *group_cols, int agg_cnt,
+        agg_spec *aggs, agg_opts *opts)
+{
+    if (group_cnt < 1 || agg_cnt < 1 || group_cnt + agg_cnt > MAX_ATTRS) return NULL;
+
+    agg_state *st = calloc(1, sizeof(agg_state));
+    if (!st) return NULL;
+
+    if (opts) {
+        st->opts = *opts;
+    } else {
+        agg_default_opts(&st->opts);
+    }
+
+    if (st->opts.threads < 1) st->opts.threads = 1;
+    if (st->opts.radix_bits < 0) st->opts.radix_bits = 0;
+    if (st->opts.radix_bits > 12) st->opts.radix_bits = 12;
+
+    st->group_cnt = group_cnt;
+    st->agg_cnt = agg_cnt;
+    memcpy(st->group_cols, group_cols, sizeof(int) * group_cnt);
+    memcpy(st->aggs, aggs, sizeof(agg_spec) * agg_cnt);
+
+    st->part_cnt = 1 << st->opts.radix_bits;
+    st->parts = calloc(st->part_cnt, sizeof(agg_part));
+    exec_op *op = st->parts ? calloc(1, sizeof(exec_op)) : NULL;
+
+    if (!op) {
+        free(st->parts);
+        free(st);
+        return NULL;
+    }
+
+    for (int p=0; p<st->part_cnt; p++) {
+        pthread_mutex_init(&st->parts[p].lock, NULL);
+    }
+
+    op->name = "hashagg";
+    op->child = child;
+    op->state = st;
+    op->next = agg_next;
+    op->close = agg_close;
+
+    return op;
+}
+
+
+/*
+ * The number of times a partition, or a piece of one, was split again
+ * while merging, because it was too large to merge within the budget.
+ */
+long exec_hashagg_splits(exec_op *op)
+{
+    agg_state *st = op->state;
+    return atomic_load(&st->splits);
+}
+
+
+/*
+ * The number of times a pre-aggregation table was spilled to disk.
+ */
+long exec_hashagg_spills(exec_op *op)
+{
+    agg_state *st = op->state;
+    long spills = 0;
+
+    if (st->locals) {
+        for (int t=0; t<st->opts.threads; t++) spills += st->locals[t].spills;
+    }
+
+    return spills;
+}
@@ -0,0 +1,1035 @@
+/* hashjoin.c
+ *
+ * A radix-partitioned, parallel, hash join operator for the yahi-db
+ * executor.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "blkstream.h"
+#include "exec.h"
+#include "hashjoin.h"
+#include "types.h"
+#include "yahi.h"
+
+#define HJ_MAX_SUB_BITS 12
+#define HJ_REPART_BITS 3
+#define HJ_MAX_SHIFT 32
+
+// Tuples read from a partition, and probed, at a time
+#define HJ_CHUNK 16384
+
+typedef struct hj_buf {
+    byte *data;
+    long len;
+    long cap;
+} hj_buf;
+
+
+/*
+ * A partition is held in memory until it is spilled, after which all of
+ * its tuples (past and future) live in a temporary block stream.
+ */
+typedef struct hj_part {
+    hj_buf mem;
+    int spilled;
+    bstream spill;
+} hj_part;
+
+
+/*
+ * Output rows are handed from the workers to hj_next through a fixed set
+ * of slots, each holding up to EXEC_BATCH_SIZE encoded rows, so that
+ * workers wait for the consumer rather than buffering the join's output.
+ */
+typedef struct hj_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    hj_buf *slots;
+    int slot_cnt;
+    int *full;
+    int full_head;
+    int full_cnt;
+    int *free;
+    int free_cnt;
+    int running;        // workers still joining
+    int failed;
+    atomic_int stop;    // set on failure, or when the join is closed early
+} hj_queue;
+
+
+typedef struct hj_worker {
+    struct hj_state *st;
+    pthread_t tid;
+    int slot;           // output slot being filled, or -1
+    int ok;
+
+    byte *chunk;        // HJ_CHUNK tuples read from a spilled partition
+    byte *scatter;      // a chunk of probe tuples, grouped by sub-partition
+    long *bounds;
+    long *cursor;
+} hj_worker;
+
+
+typedef struct hj_state {
+    int build_key;
+    int probe_key;
+    hj_opts opts;
+
+    int part_cnt;
+    row_layout build_layout;
+    row_layout probe_layout;
+    int build_key_off;
+    int probe_key_off;
+    hj_part *build_parts;
+    hj_part *probe_parts;
+    long build_mem;
+    long probe_mem;
+    long part_limit;
+    int spilled;
+
+    int started;
+    atomic_int next_part;
+    hj_queue queue;
+    hj_worker *workers;
+    int worker_cnt;
+
+    batch out;
+} hj_state;
+
+
+void hj_default_opts(hj_opts *opts)
+{
+    opts->threads = HJ_DEFAULT_THREADS;
+    opts->radix_bits = HJ_DEFAULT_RADIX_BITS;
+    opts->mem_budget = HJ_DEFAULT_MEM_BUDGET;
+    opts->cache_size = 0;
+}
+
+
+static inline uint64_t hj_hash(int key)
+{
+    // murmur3 64-bit finalizer
+    uint64_t h = (uint32_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static inline int hj_key(int key_off, byte *tuple)
+{
+    int key;
+    memcpy(&key, tuple + key_off, sizeof(int));
+    return key;
+}
+
+
+static int hj_buf_append(hj_buf *buf, byte *src, long len)
+{
+    if (buf->len + len > buf->cap) {
+        long cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) cap *= 2;
+
+        byte *data = realloc(buf->data, cap);
+        if (!data) return 0;
+
+        buf->data = data;
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
+    return 1;
+}
+
+
+static void hj_buf_free(hj_buf *buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(hj_buf));
+}
+
+
+static int hj_part_spill(hj_part *part)
+{
+    if (!bs_open(&part->spill)) return 0;
+    part->spilled = TRUE;
+
+    int ok = bs_write(&part->spill, part->mem.data, part->mem.len);
+    hj_buf_free(&part->mem);
+
+    return ok;
+}
+
+
+static int hj_part_append(hj_part *part, byte *src, long len)
+{
+    if (part->spilled) {
+        return bs_write(&part->spill, src, len);
+    }
+
+    return hj_buf_append(&part->mem, src, len);
+}
+
+
+static long hj_part_size(hj_part *part)
+{
+    return part->spilled ? part->spill.size : part->mem.len;
+}
+
+
+/*
+ * Position a partition for reading its tuples from the start, with
+ * hj_part_read. Returns 1 on success.
+ */
+static int hj_part_rewind(hj_part *part, long *off)
+{
+    *off = 0;
+    return !part->spilled || bs_rewind(&part->spill, BS_DEFAULT_READAHEAD);
+}
+
+
+/*
+ * Read up to max tuples, of width bytes, from a rewound partition, setting
+ * *rows to point at them: into the partition itself if it is in memory,
+ * and otherwise into buf, which must have room for max tuples. Returns the
+ * number of tuples read, 0 at the end of the partition, or -1 on error.
+ */
+static long hj_part_read(hj_part *part, long *off, int width, byte *buf, long max, byte **rows)
+{
+    long len = hj_part_size(part) - *off;
+    if (len > max * width) len = max * width;
+    if (len <= 0) return 0;
+
+    if (part->spilled) {
+        if (bs_read(&part->spill, buf, len) != len) return -1;
+        *rows = buf;
+    } else {
+        *rows = part->mem.data + *off;
+    }
+
+    *off += len;
+    return len / width;
+}
+
+
+/*
+ * Make the contents of a partition available in memory. For a spilled
+ * partition, this reads the partition back into a new buffer, which the
+ * caller must free; otherwise, buf borrows the partition's in-memory
+ * tuples. Returns whether buf must be freed.
+ */
+static int hj_part_load(hj_part *part, hj_buf *buf)
+{
+    if (!part->spilled) {
+        *buf = part->mem;
+        return FALSE;
+    }
+
+    buf->data = bs_load(&part->spill);
+    buf->len = buf->data ? part->spill.size : 0;
+    buf->cap = buf->len;
+
+    return buf->data != NULL;
+}
+
+
+static void hj_part_free(hj_part *part)
+{
+    hj_buf_free(&part->mem);
+    if (part->spilled) {
+        bs_close(&part->spill);
+        part->spilled = FALSE;
+    }
+}
+
+
+/*
+ * Spill partitions, largest first, until the tuples of parts held in
+ * memory (*mem bytes), along with other bytes from elsewhere, fit within
+ * the budget. Spills are counted in *spilled, if it isn't NULL.
+ */
+static int hj_enforce_budget(hj_state *st, hj_part *parts, long *mem, long other, int *spilled)
+{
+    while (*mem + other > st->opts.mem_budget) {
+        int victim = -1;
+        for (int p=0; p<st->part_cnt; p++) {
+            if (parts[p].spilled) continue;
+            if (victim < 0 || parts[p].mem.len > parts[victim].mem.len) {
+                victim = p;
+            }
+        }
+
+        if (victim < 0 || parts[victim].mem.len == 0) break;
+
+        *mem -= parts[victim].mem.len;
+        if (!hj_part_spill(&parts[victim])) return 0;
+        if (spilled) (*spilled)++;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Drain an input into its partitions. Returns the number of tuples read,
+ * or -1 on error.
+ */
+static long hj_partition_input(hj_state *st, exec_op *in, int key, row_layout *l,
+        int *key_off, hj_part *parts, int is_build)
+{
+    byte *rows = NULL;
+    int *pids = malloc(sizeof(int) * EXEC_BATCH_SIZE);
+    long total = 0;
+    int mask = st->part_cnt - 1;
+    long *mem = is_build ? &st->build_mem : &st->probe_mem;
+    batch *b;
+
+    if (!pids) return -1;
+
+    while ((b = exec_next(in))) {
+        if (!rows) {
+            if (key < 0 || key >= b->col_cnt || b->cols[key].type != INT) goto error;
+
+            exec_layout_init(l, b);
+            *key_off = l->offsets[key];
+            rows = malloc((long) l->width * EXEC_BATCH_SIZE);
+            if (!rows) goto error;
+        }
+
+        exec_encode_rows(l, b, rows);
+
+        int *keys = b->cols[key].ints;
+        for (int i=0; i<b->count; i++) {
+            pids[i] = hj_hash(keys[i]) & mask;
+        }
+
+        for (int i=0; i<b->count; i++) {
+            hj_part *part = &parts[pids[i]];
+            if (!part->spilled) *mem += l->width;
+            if (!hj_part_append(part, rows + (long) i * l->width, l->width)) goto error;
+        }
+
+        // The probe side has whatever of the budget the build side leaves
+        if (is_build) {
+            if (!hj_enforce_budget(st, parts, mem, 0, &st->spilled)) goto error;
+        } else {
+            if (!hj_enforce_budget(st, parts, mem, st->build_mem, NULL)) goto error;
+        }
+
+        total += b->count;
+    }
+
+    free(rows);
+    free(pids);
+    return exec_failed(in) ? -1 : total;
+
+    error:
+        free(rows);
+        free(pids);
+        return -1;
+}
+
+
+/*
+ * Reorder n tuples by (hash >> shift) & (2^bits - 1), with a counting
+ * sort, into out. The start of each group in out is recorded in bounds,
+ * which must have room for 2^bits + 1 entries, and cursor (2^bits
+ * entries) is used as scratch space.
+ */
+static void hj_scatter(row_layout *l, int key_off, byte *data, long n, int shift, int bits,
+        long *bounds, long *cursor, byte *out)
+{
+    long fanout = 1L << bits;
+    long mask = fanout - 1;
+
+    memset(bounds, 0, sizeof(long) * (fanout + 1));
+    for (long i=0; i<n; i++) {
+        bounds[((hj_hash(hj_key(key_off, data + i * l->width)) >> shift) & mask) + 1]++;
+    }
+
+    for (long i=0; i<fanout; i++) {
+        bounds[i + 1] += bounds[i];
+    }
+
+    memcpy(cursor, bounds, sizeof(long) * fanout);
+
+    for (long i=0; i<n; i++) {
+        byte *t = data + i * l->width;
+        long g = (hj_hash(hj_key(key_off, t)) >> shift) & mask;
+        memcpy(out + cursor[g]++ * l->width, t, l->width);
+    }
+}
+
+
+/*
+ * Output queue
+ */
+static int hj_queue_init(hj_queue *q, int slot_cnt, long slot_size)
+{
+    q->slot_cnt = slot_cnt;
+    q->slots = calloc(slot_cnt, sizeof(hj_buf));
+    q->full = malloc(sizeof(int) * slot_cnt);
+    q->free = malloc(sizeof(int) * slot_cnt);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    if (!q->slots || !q->full || !q->free) return 0;
+
+    for (int i=0; i<slot_cnt; i++) {
+        if (!(q->slots[i].data = malloc(slot_size))) return 0;
+        q->slots[i].cap = slot_size;
+        q->free[q->free_cnt++] = i;
+    }
+
+    return 1;
+}
+
+
+static void hj_queue_free(hj_queue *q)
+{
+    if (q->slot_cnt > 0) {
+        for (int i=0; q->slots && i<q->slot_cnt; i++) {
+            hj_buf_free(&q->slots[i]);
+        }
+
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->changed);
+    }
+
+    free(q->slots);
+    free(q->full);
+    free(q->free);
+    memset(q, 0, sizeof(hj_queue));
+}
+
+
+/*
+ * Take an empty slot to write output rows to, waiting for one to be
+ * consumed if there are none. Returns 0 if the join has been stopped.
+ */
+static int hj_queue_take(hj_queue *q, int *slot)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->free_cnt == 0 && !atomic_load(&q->stop)) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+
+    int ok = !atomic_load(&q->stop);
+    if (ok) *slot = q->free[--q->free_cnt];
+    pthread_mutex_unlock(&q->lock);
+
+    if (ok) q->slots[*slot].len = 0;
+    return ok;
+}
+
+
+static void hj_queue_put(hj_queue *q, int slot)
+{
+    pthread_mutex_lock(&q->lock);
+    q->full[(q->full_head + q->full_cnt) % q->slot_cnt] = slot;
+    q->full_cnt++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static void hj_queue_release(hj_queue *q, int slot)
+{
+    pthread_mutex_lock(&q->lock);
+    q->free[q->free_cnt++] = slot;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ * Take the next slot of output rows, waiting for the workers to produce
+ * one. Returns -1 once they are all done, or if one of them failed.
+ */
+static int hj_queue_next(hj_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->full_cnt == 0 && q->running > 0 && !q->failed) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+
+    int slot = -1;
+    if (q->full_cnt > 0 && !q->failed) {
+        slot = q->full[q->full_head];
+        q->full_head = (q->full_head + 1) % q->slot_cnt;
+        q->full_cnt--;
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return slot;
+}
+
+
+static void hj_queue_stop(hj_queue *q, int failed)
+{
+    pthread_mutex_lock(&q->lock);
+    atomic_store(&q->stop, TRUE);
+    if (failed) q->failed = TRUE;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ * A hash table over a set of build tuples. Tuples larger, together, than
+ * the target cache size are split on the hash bits above shift into 2^bits
+ * sub-partitions, each with a chained table of its own on the bits above
+ * those, so that each table that is built and probed fits in cache.
+ */
+typedef struct hj_table {
+    int shift;
+    int bits;
+    byte *rows;         // the build tuples, grouped by sub-partition
+    byte *owned;        // rows, if they had to be reordered
+    long bounds[(1 << HJ_MAX_SUB_BITS) + 1];
+    long base[(1 << HJ_MAX_SUB_BITS) + 1];      // the first bucket of each
+    int *heads;
+    int *next;
+    int *keys;
+} hj_table;
+
+
+static void hj_table_free(hj_table *t)
+{
+    free(t->owned);
+    free(t->heads);
+    free(t->next);
+    free(t->keys);
+    free(t);
+}
+
+
+static hj_table *hj_table_build(hj_state *st, hj_worker *w, byte *build, long nb, int shift)
+{
+    row_layout *bl = &st->build_layout;
+    hj_table *t = calloc(1, sizeof(hj_table));
+    if (!t) return NULL;
+
+    int bits = 0;
+    while (bits < HJ_MAX_SUB_BITS && ((nb * bl->width) >> bits) > st->opts.cache_size) bits++;
+
+    long fanout = 1L << bits;
+    t->shift = shift;
+    t->bits = bits;
+
+    if (bits == 0) {
+        t->rows = build;
+        t->bounds[0] = 0;
+        t->bounds[1] = nb;
+    } else {
+        if (!(t->owned = malloc(nb * bl->width))) goto error;
+        hj_scatter(bl, st->build_key_off, build, nb, shift, bits, t->bounds, w->cursor, t->owned);
+        t->rows = t->owned;
+    }
+
+    for (long g=0; g<fanout; g++) {
+        long buckets = 1;
+        while (buckets < t->bounds[g + 1] - t->bounds[g]) buckets <<= 1;
+        t->base[g + 1] = t->base[g] + buckets;
+    }
+
+    t->heads = malloc(sizeof(int) * t->base[fanout]);
+    t->next = malloc(sizeof(int) * nb);
+    t->keys = malloc(sizeof(int) * nb);
+    if (!t->heads || !t->next || !t->keys) goto error;
+
+    memset(t->heads, -1, sizeof(int) * t->base[fanout]);
+    for (long g=0; g<fanout; g++) {
+        long mask = t->base[g + 1] - t->base[g] - 1;
+        int *heads = t->heads + t->base[g];
+
+        for (long i=t->bounds[g]; i<t->bounds[g + 1]; i++) {
+            t->keys[i] = hj_key(st->build_key_off, t->rows + i * bl->width);
+            long h = (hj_hash(t->keys[i]) >> (shift + bits)) & mask;
+            t->next[i] = heads[h];
+            heads[h] = i;
+        }
+    }
+
+    return t;
+
+    error:
+        hj_table_free(t);
+        return NULL;
+}
+
+
+/*
+ * Append the concatenation of a build and a probe tuple to the worker's
+ * output slot, handing the slot over once it is full. Returns 0 if the
+ * join has been stopped.
+ */
+static inline int hj_emit(hj_state *st, hj_worker *w, byte *bt, byte *pt)
+{
+    int bw = st->build_layout.width;
+    int pw = st->probe_layout.width;
+
+    if (w->slot < 0 && !hj_queue_take(&st->queue, &w->slot)) return 0;
+
+    hj_buf *out = &st->queue.slots[w->slot];
+    memcpy(out->data + out->len, bt, bw);
+    memcpy(out->data + out->len + bw, pt, pw);
+    out->len += bw + pw;
+
+    if (out->len == out->cap) {
+        hj_queue_put(&st->queue, w->slot);
+        w->slot = -1;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Probe sub-partition g of the table with the probe tuples of n rows.
+ */
+static int hj_probe_group(hj_state *st, hj_worker *w, hj_table *t, long g, byte *rows, long n)
+{
+    int bw = st->build_layout.width;
+    int pw = st->probe_layout.width;
+    long mask = t->base[g + 1] - t->base[g] - 1;
+    int *heads = t->heads + t->base[g];
+
+    for (long j=0; j<n; j++) {
+        byte *pt = rows + j * pw;
+        int key = hj_key(st->probe_key_off, pt);
+        long h = (hj_hash(key) >> (t->shift + t->bits)) & mask;
+
+        for (int i=heads[h]; i >= 0; i=t->next[i]) {
+            if (t->keys[i] == key && !hj_emit(st, w, t->rows + (long) i * bw, pt)) return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Join nb build tuples, which are all in memory, with the tuples of a
+ * probe partition, which are read a chunk at a time.
+ */
+static int hj_join_chunk(hj_state *st, hj_worker *w, byte *build, long nb, hj_part *probe,
+        int shift)
+{
+    row_layout *pl = &st->probe_layout;
+    hj_table *t = hj_table_build(st, w, build, nb, shift);
+    if (!t) return 0;
+
+    long off, n;
+    byte *rows;
+    int ok = hj_part_rewind(probe, &off);
+
+    while (ok && (n = hj_part_read(probe, &off, pl->width, w->chunk, HJ_CHUNK, &rows)) != 0) {
+        if (n < 0 || atomic_load(&st->queue.stop)) {
+            ok = 0;
+        } else if (t->bits == 0) {
+            ok = hj_probe_group(st, w, t, 0, rows, n);
+        } else {
+            hj_scatter(pl, st->probe_key_off, rows, n, t->shift, t->bits, w->bounds, w->cursor,
+                    w->scatter);
+            for (long g=0; ok && g<(1L << t->bits); g++) {
+                ok = hj_probe_group(st, w, t, g, w->scatter + w->bounds[g] * pl->width,
+                        w->bounds[g + 1] - w->bounds[g]);
+            }
+        }
+    }
+
+    hj_table_free(t);
+    return ok;
+}
+
+
+/*
+ * Scatter the tuples of a partition into 2^HJ_REPART_BITS new, spilled,
+ * partitions, on the hash bits above shift.
+ */
+static int hj_repartition(hj_worker *w, hj_part *part, row_layout *l, int key_off, int shift,
+        hj_part *subs)
+{
+    long mask = (1L << HJ_REPART_BITS) - 1;
+
+    for (long s=0; s<=mask; s++) {
+        if (!bs_open(&subs[s].spill)) return 0;
+        subs[s].spilled = TRUE;
+    }
+
+    long off, n;
+    byte *rows;
+    if (!hj_part_rewind(part, &off)) return 0;
+
+    while ((n = hj_part_read(part, &off, l->width, w->chunk, HJ_CHUNK, &rows)) > 0) {
+        for (long i=0; i<n; i++) {
+            byte *t = rows + i * l->width;
+            long s = (hj_hash(hj_key(key_off, t)) >> shift) & mask;
+            if (!bs_write(&subs[s].spill, t, l->width)) return 0;
+        }
+    }
+
+    return n == 0;
+}
+
+
+static int hj_join_part(hj_state *st, hj_worker *w, hj_part *build, hj_part *probe,
+        int shift, int can_split);
+
+
+/*
+ * Join a spilled partition too large to load by splitting both of its
+ * sides again, on the next hash bits, and joining the pieces one by one.
+ */
+static int hj_join_split(hj_state *st, hj_worker *w, hj_part *build, hj_part *probe, int shift)
+{
+    int fanout = 1 << HJ_REPART_BITS;
+    long size = hj_part_size(build);
+    hj_part *bsubs = calloc(fanout, sizeof(hj_part));
+    hj_part *psubs = calloc(fanout, sizeof(hj_part));
+
+    int ok = bsubs && psubs &&
+        hj_repartition(w, build, &st->build_layout, st->build_key_off, shift, bsubs) &&
+        hj_repartition(w, probe, &st->probe_layout, st->probe_key_off, shift, psubs);
+
+    hj_part_free(build);
+    hj_part_free(probe);
+
+    // A piece no smaller than the partition it came from can't be split
+    // by hashing any further (its tuples all share a key, or nearly so)
+    for (int s=0; ok && s<fanout; s++) {
+        ok = hj_join_part(st, w, &bsubs[s], &psubs[s], shift + HJ_REPART_BITS,
+                hj_part_size(&bsubs[s]) < size);
+    }
+
+    for (int s=0; s<fanout; s++) {
+        if (bsubs) hj_part_free(&bsubs[s]);
+        if (psubs) hj_part_free(&psubs[s]);
+    }
+
+    free(bsubs);
+    free(psubs);
+    return ok;
+}
+
+
+/*
+ * Join a build partition with the matching probe partition. A spilled
+ * build side is loaded only if it fits within the worker's share of the
+ * memory budget. Otherwise it is split again if it can be, and if not, it
+ * is read a budget's worth at a time, with the probe side read through
+ * once for each piece.
+ */
+static int hj_join_part(hj_state *st, hj_worker *w, hj_part *build, hj_part *probe,
+        int shift, int can_split)
+{
+    int bw = st->build_layout.width;
+    long size = hj_part_size(build);
+    if (size == 0 || hj_part_size(probe) == 0) return 1;
+
+    if (!build->spilled || size <= st->part_limit) {
+        hj_buf buf;
+        int owned = hj_part_load(build, &buf);
+        if (!buf.data) return 0;
+
+        int ok = hj_join_chunk(st, w, buf.data, size / bw, probe, shift);
+        if (owned) free(buf.data);
+        return ok;
+    }
+
+    if (can_split && shift + HJ_REPART_BITS <= HJ_MAX_SHIFT) {
+        return hj_join_split(st, w, build, probe, shift);
+    }
+
+    long max = st->part_limit / bw;
+    if (max < 1) max = 1;
+
+    byte *piece = malloc(max * bw);
+    long off, n;
+    byte *rows;
+    int ok = piece && hj_part_rewind(build, &off);
+
+    while (ok && (n = hj_part_read(build, &off, bw, piece, max, &rows)) != 0) {
+        ok = n > 0 && hj_join_chunk(st, w, rows, n, probe, shift);
+    }
+
+    free(piece);
+    return ok;
+}
+
+
+static void *hj_worker_main(void *arg)
+{
+    hj_worker *w = arg;
+    hj_state *st = w->st;
+    hj_queue *q = &st->queue;
+    int p;
+
+    w->ok = 1;
+    while (w->ok && !atomic_load(&q->stop) &&
+            (p = atomic_fetch_add(&st->next_part, 1)) < st->part_cnt) {
+        w->ok = hj_join_part(st, w, &st->build_parts[p], &st->probe_parts[p],
+                st->opts.radix_bits, TRUE);
+
+        // Each partition is freed as soon as it has been joined
+        hj_part_free(&st->build_parts[p]);
+        hj_part_free(&st->probe_parts[p]);
+    }
+
+    if (w->slot >= 0) {
+        if (st->queue.slots[w->slot].len > 0) hj_queue_put(q, w->slot);
+        else hj_queue_release(q, w->slot);
+        w->slot = -1;
+    }
+
+    // A worker stopped by the join being closed, or by another worker's
+    // failure, hasn't failed itself
+    int failed = !w->ok && !atomic_load(&q->stop);
+
+    pthread_mutex_lock(&q->lock);
+    q->running--;
+    if (failed) {
+        q->failed = TRUE;
+        atomic_store(&q->stop, TRUE);
+    }
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+
+static void hj_workers_free(hj_state *st)
+{
+    for (int i=0; i<st->opts.threads; i++) {
+        hj_worker *w = &st->workers[i];
+        free(w->chunk);
+        free(w->scatter);
+        free(w->bounds);
+        free(w->cursor);
+    }
+
+    free(st->workers);
+    st->workers = NULL;
+}
+
+
+/*
+ * Partition both inputs, and start the workers joining the partitions.
+ * Returns 1 on success, with no workers started if either input is
+ * empty, and 0 on error.
+ */
+static int hj_start(exec_op *op)
+{
+    hj_state *st = op->state;
+
+    long built = hj_partition_input(st, op->child, st->build_key, &st->build_layout,
+            &st->build_key_off, st->build_parts, TRUE);
+    if (built <= 0) return built == 0;
+
+    // Any probe tuples which match a spilled build partition are spilled
+    // as well.
+    for (int p=0; p<st->part_cnt; p++) {
+        if (st->build_parts[p].spilled && !hj_part_spill(&st->probe_parts[p])) return 0;
+    }
+
+    long probed = hj_partition_input(st, op->right, st->probe_key, &st->probe_layout,
+            &st->probe_key_off, st->probe_parts, FALSE);
+    if (probed <= 0) return probed == 0;
+
+    int bw = st->build_layout.width;
+    int pw = st->probe_layout.width;
+    int col_cnt = st->build_layout.col_cnt + st->probe_layout.col_cnt;
+    if (col_cnt > MAX_ATTRS) return 0;
+
+    int types[MAX_ATTRS], lengths[MAX_ATTRS];
+    memcpy(types, st->build_layout.types, sizeof(int) * st->build_layout.col_cnt);
+    memcpy(types + st->build_layout.col_cnt, st->probe_layout.types,
+            sizeof(int) * st->probe_layout.col_cnt);
+    memcpy(lengths, st->build_layout.lengths, sizeof(int) * st->build_layout.col_cnt);
+    memcpy(lengths + st->build_layout.col_cnt, st->probe_layout.lengths,
+            sizeof(int) * st->probe_layout.col_cnt);
+
+    if (!exec_batch_init(&st->out, col_cnt, types, lengths)) return 0;
+
+    // Clamped by exec_hashjoin; checked again to bound the allocations
+    int threads = st->opts.threads;
+    if (threads < 1 || threads > HJ_MAX_THREADS) return 0;
+
+    st->part_limit = st->opts.mem_budget / threads;
+    if (!hj_queue_init(&st->queue, threads * 2, (long) EXEC_BATCH_SIZE * (bw + pw))) return 0;
+
+    st->workers = calloc(threads, sizeof(hj_worker));
+    if (!st->workers) return 0;
+
+    long fanout = 1L << HJ_MAX_SUB_BITS;
+    for (int i=0; i<threads; i++) {
+        hj_worker *w = &st->workers[i];
+        w->st = st;
+        w->slot = -1;
+        w->chunk = malloc((long) HJ_CHUNK * (bw > pw ? bw : pw));
+        w->scatter = malloc((long) HJ_CHUNK * pw);
+        w->bounds = malloc(sizeof(long) * (fanout + 1));
+        w->cursor = malloc(sizeof(long) * fanout);
+        if (!w->chunk || !w->scatter || !w->bounds || !w->cursor) return 0;
+    }
+
+    // The workers share out the partitions between them, so a join can go
+    // ahead with fewer of them if not all can be started
+    atomic_store(&st->next_part, 0);
+    st->queue.running = threads;
+    for (int i=0; i<threads; i++) {
+        if (pthread_create(&st->workers[i].tid, NULL, hj_worker_main, &st->workers[i]) != 0) {
+            pthread_mutex_lock(&st->queue.lock);
+            st->queue.running -= threads - i;
+            pthread_mutex_unlock(&st->queue.lock);
+            break;
+        }
+
+        st->worker_cnt++;
+    }
+
+    return st->worker_cnt > 0;
+}
+
+
+static batch *hj_next(exec_op *op)
+{
+    hj_state *st = op->state;
+
+    if (!st->started) {
+        st->started = TRUE;
+        if (!hj_start(op)) {
+            op->failed = TRUE;
+            return NULL;
+        }
+    }
+
+    if (st->worker_cnt == 0) return NULL;
+
+    int slot = hj_queue_next(&st->queue);
+    if (slot < 0) {
+        op->failed = st->queue.failed;
+        return NULL;
+    }
+
+    int width = st->build_layout.width + st->probe_layout.width;
+    hj_buf *res = &st->queue.slots[slot];
+    int cnt = res->len / width;
+
+    exec_decode_rows(&st->build_layout, res->data, cnt, width, &st->out, 0);
+    exec_decode_rows(&st->probe_layout, res->data + st->build_layout.width, cnt, width,
+            &st->out, st->build_layout.col_cnt);
+    hj_queue_release(&st->queue, slot);
+
+    st->out.count = cnt;
+    return &st->out;
+}
+
+
+static void hj_close(exec_op *op)
+{
+    hj_state *st = op->state;
+
+    // Workers still running (the join was closed before it was drained)
+    // are stopped before anything is freed
+    if (st->worker_cnt > 0) {
+        hj_queue_stop(&st->queue, FALSE);
+        for (int i=0; i<st->worker_cnt; i++) {
+            pthread_join(st->workers[i].tid, NULL);
+        }
+    }
+
+    for (int p=0; p<st->part_cnt; p++) {
+        hj_part_free(&st->build_parts[p]);
+        hj_part_free(&st->probe_parts[p]);
+    }
+
+    if (st->workers) hj_workers_free(st);
+    hj_queue_free(&st->queue);
+    exec_batch_free(&st->out);
+    free(st->build_parts);
+    free(st->probe_parts);
+    free(st);
+}
+
+
+/*
+ * Create a hash join of build and probe on build.build_key = probe.probe_key.
+ * If opts is NULL, the defaults from hj_default_opts() are used.
+ */
+exec_op *exec_hashjoin(exec_op *build, exec_op *probe, int build_key, int probe_key,
+        hj_opts *opts)
+{
+    hj_state *st = calloc(1, sizeof(hj_state));
+    if (!st) return NULL;
+
+    if (opts) {
+        st->opts = *opts;
+    } else {
+        hj_default_opts(&st->opts);
+    }
+
+    if (st->opts.threads < 1) st->opts.threads = 1;
+    if (st->opts.threads > HJ_MAX_THREADS) st->opts.threads = HJ_MAX_THREADS;
+    if (st->opts.radix_bits < 0) st->opts.radix_bits = 0;
+    if (st->opts.radix_bits > 16) st->opts.radix_bits = 16;
+
+    if (st->opts.cache_size <= 0) {
+        long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        st->opts.cache_size = (l2 > 0) ? l2 : HJ_DEFAULT_CACHE_SIZE;
+    }
+
+    st->build_key = build_key;
+    st->probe_key = probe_key;
+    st->part_cnt = 1 << st->opts.radix_bits;
+    st->build_parts = calloc(st->part_cnt, sizeof(hj_part));
+    st->probe_parts = calloc(st->part_cnt, sizeof(hj_part));
+
+    exec_op *op = NULL;
+    if (st->build_parts && st->probe_parts) {
+        op = calloc(1, sizeof(exec_op));
+    }
+
+    if (!op) {
+        free(st->build_parts);
+        free(st->probe_parts);
+        free(st);
+        return NULL;
+    }
+
+    op->name = "hashjoin";
+    op->child = build;
+    op->right = probe;
+    op->state = st;
+    op->next = hj_next;
+    op->close = hj_close;
+
+    return op;
+}
+
+
+/*
+ * The number of build partitions that were spilled to disk.
+ */
+int exec_hashjoin_spilled(exec_op *op)
+{
+    hj_state *st = op->state;
+    return st->spilled;
+}
@@ -0,0 +1,354 @@
+/*
+ * inserter.c
+ *
+ * Concurrent inserts into yahi-db heap tables.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "art.h"
+#include "blockio.h"
+#include "inserter.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "yahi.h"
+
+
+/*
+ * Make sure that the table's file holds block blk_no, growing it to the
+ * end of the extent the block falls in if it doesn't. Returns 1 on
+ * success and 0 if the file could not be grown.
+ */
+static int ins_grow(table *tbl, int blk_no)
+{
+    ins_session *s = tbl->ins;
+    int have = atomic_load(&s->file_blks);
+    if (blk_no < have) return 1;
+
+    int want = (blk_no / INS_EXTENT_BLKS + 1) * INS_EXTENT_BLKS;
+    if (posix_fallocate(fileno(tbl->file), (off_t) have * BLOCKSIZE,
+                        (off_t) (want - have) * BLOCKSIZE) != 0) {
+        return 0;
+    }
+
+    // Another thread may have grown the file further in the meantime
+    while (have < want && !atomic_compare_exchange_weak(&s->file_blks, &have, want));
+    return 1;
+}
+
+
+/*
+ * Hand block blk_no, which holds used records and has room for more, back
+ * to the table. Returns 1 on success and 0 on error.
+ */
+static int ins_put_partial(ins_session *s, int blk_no, int used)
+{
+    pthread_mutex_lock(&s->lock);
+
+    int cnt = atomic_load(&s->partial_cnt);
+    if (cnt == s->partial_cap) {
+        int cap = s->partial_cap ? 2 * s->partial_cap : 16;
+        ins_partial *grown = realloc(s->partials, sizeof(ins_partial) * cap);
+        if (!grown) {
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+
+        s->partials = grown;
+        s->partial_cap = cap;
+    }
+
+    s->partials[cnt] = (ins_partial) {.blk_no = blk_no, .used = used};
+    atomic_store(&s->partial_cnt, cnt + 1);
+
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+}
+
+
+/*
+ * Take one of the part-full blocks handed back to the table, if there are
+ * any. The lock is only taken when there appear to be some.
+ */
+static int ins_take_partial(ins_session *s, ins_partial *p)
+{
+    if (atomic_load(&s->partial_cnt) == 0) return 0;
+
+    int taken = FALSE;
+    pthread_mutex_lock(&s->lock);
+
+    int cnt = atomic_load(&s->partial_cnt);
+    if (cnt > 0) {
+        *p = s->partials[cnt - 1];
+        atomic_store(&s->partial_cnt, cnt - 1);
+        taken = TRUE;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return taken;
+}
+
+
+/*
+ * Pin a new insert page for ins: a part-full block if there is one, and
+ * otherwise the next unclaimed block of the table. Returns 1 on success
+ * and 0 on error.
+ */
+static int ins_next_page(inserter *ins)
+{
+    table *tbl = ins->tbl;
+    ins_session *s = tbl->ins;
+    ins_partial p;
+
+    if (ins_take_partial(s, &p)) {
+        page *pg = buff_pin(tbl, p.blk_no);
+        if (!pg) {
+            ins_put_partial(s, p.blk_no, p.used);
+            return 0;
+        }
+
+        ins->pg = pg;
+        ins->blk_no = p.blk_no;
+        ins->used = p.used;
+        return 1;
+    }
+
+    int blk_no = atomic_fetch_add(&s->next_blk, 1);
+    page *pg = ins_grow(tbl, blk_no) ? buff_pin_new(tbl, blk_no) : NULL;
+
+    // The block is claimed either way, so it is handed back, empty, on error
+    if (!pg) {
+        ins_put_partial(s, blk_no, 0);
+        return 0;
+    }
+
+    ins->pg = pg;
+    ins->blk_no = blk_no;
+    ins->used = 0;
+    return 1;
+}
+
+
+/*
+ * Open tbl for concurrent inserts. Returns 1 on success, and 0 if the
+ * table doesn't take concurrent inserts, is already open for them, or on
+ * error.
+ */
+int tbl_ins_begin(table *tbl)
+{
+    if (tbl->ins || tbl->lsm || tbl->map || tbl->cmap) return 0;
+
+    ins_session *s = calloc(1, sizeof(ins_session));
+    if (!s) return 0;
+
+    int per_blk = tbl_recs_per_blk(tbl);
+    s->start_cnt = tbl->record_cnt;
+    s->first_blk = TBL_FIRST_BLK + tbl->record_cnt / per_blk;
+    atomic_init(&s->next_blk, TBL_FIRST_BLK + tbl_blk_cnt(tbl));
+    atomic_init(&s->file_blks, blk_flen(tbl->file) / BLOCKSIZE);
+    pthread_mutex_init(&s->lock, NULL);
+
+    // The last block may have room left, which is used first
+    int tail = tbl->record_cnt % per_blk;
+    if (tail > 0 && !ins_put_partial(s, s->first_blk, tail)) {
+        pthread_mutex_destroy(&s->lock);
+        free(s);
+        return 0;
+    }
+
+    tbl->ins = s;
+    return 1;
+}
+
+
+/*
+ * Open an inserter on tbl, which must be open for concurrent inserts, for
+ * use by one thread. Returns NULL on error.
+ */
+inserter *ins_open(table *tbl)
+{
+    if (!tbl->ins) return NULL;
+
+    inserter *ins = calloc(1, sizeof(inserter));
+    if (!ins) return NULL;
+
+    ins->tbl = tbl;
+    ins->blk_no = -1;
+    atomic_fetch_add(&tbl->ins->open_cnt, 1);
+
+    return ins;
+}
+
+
+/*
+ * Add record (of the table's record_length) to the table. Returns 1 on
+ * success, 0 if the record's key is already in the table's index, and -1
+ * on error.
+ */
+int ins_insert(inserter *ins, byte *record)
+{
+    table *tbl = ins->tbl;
+    int per_blk = tbl_recs_per_blk(tbl);
+
+    if (!ins->pg && !ins_next_page(ins)) return -1;
+
+    // The index is updated first, as it decides whether the key is taken
+    int rid = (ins->blk_no - TBL_FIRST_BLK) * per_blk + ins->used;
+    if (tbl->art) {
+        int added = tbl_art_add(tbl, record, rid);
+        if (added != 1) return added;
+    }
+
+    memcpy(ins->pg->data + tbl_rec_offset(tbl, rid), record, tbl->fields.record_length);
+    ins->pg->modified = TRUE;
+    ins->used++;
+    ins->inserted++;
+
+    if (ins->used == per_blk) {
+        buff_unpin(tbl, ins->blk_no);
+        ins->pg = NULL;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Close and free the inserter, handing its page back to the table if it
+ * has room left. Returns 1 on success and 0 if the page could not be
+ * handed back.
+ */
+int ins_close(inserter *ins)
+{
+    ins_session *s = ins->tbl->ins;
+    int ok = 1;
+
+    if (ins->pg) {
+        buff_unpin(ins->tbl, ins->blk_no);
+        ok = ins_put_partial(s, ins->blk_no, ins->used);
+    }
+
+    atomic_fetch_add(&s->inserted, ins->inserted);
+    atomic_fetch_sub(&s->open_cnt, 1);
+    free(ins);
+
+    return ok;
+}
+
+
+static inline int ins_occupied(ins_session *s, int *used, int per_blk, int rid)
+{
+    return rid % per_blk < used[TBL_FIRST_BLK + rid / per_blk - s->first_blk];
+}
+
+
+/*
+ * Move the record with id from to the empty slot of id to.
+ */
+static int ins_move(table *tbl, int from, int to)
+{
+    int from_blk = tbl_rec_blk(tbl, from);
+    int to_blk = tbl_rec_blk(tbl, to);
+
+    page *src = buff_pin(tbl, from_blk);
+    page *dst = src ? buff_pin(tbl, to_blk) : NULL;
+    if (!dst) {
+        if (src) buff_unpin(tbl, from_blk);
+        return 0;
+    }
+
+    byte *record = src->data + tbl_rec_offset(tbl, from);
+    memcpy(dst->data + tbl_rec_offset(tbl, to), record, tbl->fields.record_length);
+    dst->modified = TRUE;
+
+    int ok = !tbl->art || tbl_art_set(tbl, record, to);
+
+    buff_unpin(tbl, to_blk);
+    buff_unpin(tbl, from_blk);
+    return ok;
+}
+
+
+/*
+ * End the table's concurrent insert session, once all of its inserters
+ * are closed, packing, indexing and counting the records added. Returns
+ * the number of records added, or -1 if inserters are still open, or on
+ * error, in which case the session is left open and the call may be
+ * repeated.
+ */
+int tbl_ins_end(table *tbl)
+{
+    ins_session *s = tbl->ins;
+    if (!s || atomic_load(&s->open_cnt) > 0) return -1;
+
+    int per_blk = tbl_recs_per_blk(tbl);
+    int final_cnt = s->start_cnt + (int) atomic_load(&s->inserted);
+    int blk_cnt = atomic_load(&s->next_blk) - s->first_blk;
+
+    // Every block claimed is full, unless it was handed back part full
+    int *used = malloc(sizeof(int) * blk_cnt + 1);
+    if (!used) return -1;
+
+    for (int b=0; b<blk_cnt; b++) used[b] = per_blk;
+    for (int p=0; p<s->partial_cnt; p++) {
+        used[s->partials[p].blk_no - s->first_blk] = s->partials[p].used;
+    }
+
+    // Fill each empty slot below the final count with the last record
+    // above it. The moves are worked out from the blocks as they were, so
+    // that a repeated call makes them over again.
+    if (final_cnt > 0 && !ins_grow(tbl, tbl_rec_blk(tbl, final_cnt - 1))) goto error;
+
+    int hi = (s->first_blk + blk_cnt - TBL_FIRST_BLK) * per_blk - 1;
+    for (int lo=s->start_cnt; lo<final_cnt; lo++) {
+        if (ins_occupied(s, used, per_blk, lo)) continue;
+
+        while (!ins_occupied(s, used, per_blk, hi)) hi--;
+        if (!ins_move(tbl, hi--, lo)) goto error;
+    }
+
+    // Index the new records, picking up where a failed call left off.
+    // Each is counted as it is indexed, as tbl_insert does, so that an
+    // index rebuilt from the table along the way (a Bloom filter being
+    // grown) takes in the records before it.
+    for (int rid=s->start_cnt + s->indexed; rid<final_cnt; ) {
+        int blk_no = tbl_rec_blk(tbl, rid);
+        page *pg = buff_pin(tbl, blk_no);
+        if (!pg) goto error;
+
+        for (; rid<final_cnt && tbl_rec_blk(tbl, rid) == blk_no; rid++) {
+            tbl_index_add(tbl, pg->data + tbl_rec_offset(tbl, rid), rid);
+            tbl->record_cnt = rid + 1;
+        }
+
+        s->indexed = rid - s->start_cnt;
+        buff_unpin(tbl, blk_no);
+    }
+
+    free(used);
+
+    int added = final_cnt - s->start_cnt;
+    tbl->record_cnt = final_cnt;
+    tbl->ins = NULL;
+
+    pthread_mutex_destroy(&s->lock);
+    free(s->partials);
+    free(s);
+
+    return added;
+
+error:
+    free(used);
+    return -1;
+}
@@ -0,0 +1,1200 @@
+/*
+ * lsm.c
+ *
+ * A log-structured merge storage engine for write-heavy yahi-db tables.
+ *
+ * The tree's lock protects the memtables, the levels, and the statistics.
+ * Only the background thread changes the levels, so it reads them without
+ * the lock while it writes a run or merges, and takes the lock only to
+ * install the result. Lookups take the lock to search the memtables and
+ * find the runs which may hold their key, and take a reference on each of
+ * those runs, so that a merge which replaces one of them in the meantime
+ * leaves its file in place until the last reader has let go. A merge reads
+ * its inputs through streams of its own, so as not to disturb the file
+ * positions used by lookups.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockio.h"
+#include "bloom.h"
+#include "lsm.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define LSM_MAGIC 0x59484c53
+#define LSM_SKIP_HEIGHT 12
+#define LSM_ARENA_CHUNK (64 * 1024)
+#define LSM_IO_BLKS 32
+#define LSM_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 24)
+
+
+/*
+ * Memtables
+ *
+ * A skiplist whose nodes, each holding a key and a copy of its record, are
+ * carved out of large chunks, so that a memtable is freed in a few calls
+ * however many records it holds.
+ */
+typedef struct lsm_node {
+    int key;
+    byte *rec;
+    struct lsm_node *next[];
+} lsm_node;
+
+typedef struct lsm_chunk {
+    struct lsm_chunk *prev;
+    size_t used;
+    size_t cap;
+    char data[];
+} lsm_chunk;
+
+typedef struct lsm_memtable {
+    lsm_node *head;
+    int height;
+    long count;
+    int rec_len;
+    uint64_t seed;
+    lsm_chunk *chunks;
+} lsm_memtable;
+
+
+static void *lsm_arena_alloc(lsm_memtable *mt, size_t size)
+{
+    size = (size + 7) & ~(size_t) 7;
+
+    lsm_chunk *c = mt->chunks;
+    if (!c || c->used + size > c->cap) {
+        size_t cap = (size > LSM_ARENA_CHUNK) ? size : LSM_ARENA_CHUNK;
+        if (!(c = malloc(sizeof(lsm_chunk) + cap))) return NULL;
+
+        c->prev = mt->chunks;
+        c->used = 0;
+        c->cap = cap;
+        mt->chunks = c;
+    }
+
+    void *ptr = c->data + c->used;
+    c->used += size;
+    return ptr;
+}
+
+
+static lsm_node *lsm_node_new(lsm_memtable *mt, int key, int height)
+{
+    lsm_node *node = lsm_arena_alloc(mt, sizeof(lsm_node) + height * sizeof(lsm_node *) +
+                                     mt->rec_len);
+    if (!node) return NULL;
+
+    node->key = key;
+    node->rec = (byte *) &node->next[height];
+    for (int l=0; l<height; l++) node->next[l] = NULL;
+
+    return node;
+}
+
+
+static void lsm_memtable_free(lsm_memtable *mt)
+{
+    if (!mt) return;
+
+    while (mt->chunks) {
+        lsm_chunk *prev = mt->chunks->prev;
+        free(mt->chunks);
+        mt->chunks = prev;
+    }
+
+    free(mt);
+}
+
+
+static lsm_memtable *lsm_memtable_create(int rec_len, uint64_t seed)
+{
+    lsm_memtable *mt = calloc(1, sizeof(lsm_memtable));
+    if (!mt) return NULL;
+
+    mt->rec_len = rec_len;
+    mt->height = 1;
+    mt->seed = seed | 1;
+
+    if (!(mt->head = lsm_node_new(mt, 0, LSM_SKIP_HEIGHT))) {
+        lsm_memtable_free(mt);
+        return NULL;
+    }
+
+    return mt;
+}
+
+
+// Each level holds a quarter of the nodes of the one below it
+static int lsm_random_height(lsm_memtable *mt)
+{
+    mt->seed ^= mt->seed << 13;
+    mt->seed ^= mt->seed >> 7;
+    mt->seed ^= mt->seed << 17;
+
+    uint64_t r = mt->seed;
+    int height = 1;
+    while (height < LSM_SKIP_HEIGHT && (r & 3) == 0) {
+        height++;
+        r >>= 2;
+    }
+
+    return height;
+}
+
+
+static lsm_node *lsm_memtable_find(lsm_memtable *mt, int key)
+{
+    lsm_node *x = mt->head;
+    for (int l=mt->height - 1; l>=0; l--) {
+        while (x->next[l] && x->next[l]->key < key) x = x->next[l];
+    }
+
+    x = x->next[0];
+    return (x && x->key == key) ? x : NULL;
+}
+
+
+/*
+ * Insert record under key, replacing the record of an earlier insert of
+ * the same key. Returns 1 on success and 0 if memory runs out.
+ */
+static int lsm_memtable_put(lsm_memtable *mt, int key, byte *record)
+{
+    lsm_node *preds[LSM_SKIP_HEIGHT];
+    lsm_node *x = mt->head;
+
+    for (int l=mt->height - 1; l>=0; l--) {
+        while (x->next[l] && x->next[l]->key < key) x = x->next[l];
+        preds[l] = x;
+    }
+
+    x = x->next[0];
+    if (x && x->key == key) {
+        memcpy(x->rec, record, mt->rec_len);
+        return 1;
+    }
+
+    int height = lsm_random_height(mt);
+    lsm_node *node = lsm_node_new(mt, key, height);
+    if (!node) return 0;
+
+    memcpy(node->rec, record, mt->rec_len);
+
+    for (int l=mt->height; l<height; l++) preds[l] = mt->head;
+    if (height > mt->height) mt->height = height;
+
+    for (int l=0; l<height; l++) {
+        node->next[l] = preds[l]->next[l];
+        preds[l]->next[l] = node;
+    }
+
+    mt->count++;
+    return 1;
+}
+
+
+/*
+ * Runs
+ */
+static inline int lsm_key(lsm_tree *lsm, byte *record)
+{
+    int key;
+    memcpy(&key, record + lsm->key_offset, sizeof(int));
+    return key;
+}
+
+
+static void lsm_run_path(lsm_tree *lsm, int id, char *path)
+{
+    snprintf(path, LSM_PATH_LEN, "%s/%s.%d.run", lsm->tbl->db, lsm->tbl->name, id);
+}
+
+
+static void lsm_run_free(lsm_tree *lsm, lsm_run *run)
+{
+    if (!run) return;
+
+    if (run->file) fclose(run->file);
+
+    if (run->obsolete) {
+        char path[LSM_PATH_LEN];
+        lsm_run_path(lsm, run->id, path);
+        remove(path);
+    }
+
+    pthread_mutex_destroy(&run->io_lock);
+    bf_free(run->bloom);
+    free(run->fences);
+    free(run);
+}
+
+
+static lsm_run *lsm_run_alloc(lsm_tree *lsm, int id, int level, long capacity, char *mode)
+{
+    int per_blk = tbl_recs_per_blk(lsm->tbl);
+    lsm_run *run = calloc(1, sizeof(lsm_run));
+    if (!run) return NULL;
+
+    run->id = id;
+    run->level = level;
+    pthread_mutex_init(&run->io_lock, NULL);
+
+    char path[LSM_PATH_LEN];
+    lsm_run_path(lsm, id, path);
+
+    run->file = fopen(path, mode);
+    run->fences = malloc(sizeof(int) * ((capacity + per_blk - 1) / per_blk + 1));
+    run->bloom = bf_create(lsm->key_col, capacity, BF_DEFAULT_BITS_PER_KEY);
+
+    if (!run->file || !run->fences || !run->bloom) {
+        lsm_run_free(lsm, run);
+        return NULL;
+    }
+
+    return run;
+}
+
+
+/*
+ * Open an existing run of rec_cnt records, and rebuild its fence keys and
+ * filter by reading it through once.
+ */
+static lsm_run *lsm_run_load(lsm_tree *lsm, int id, int level, long rec_cnt)
+{
+    int per_blk = tbl_recs_per_blk(lsm->tbl);
+    int rec_len = lsm->tbl->fields.record_length;
+
+    lsm_run *run = lsm_run_alloc(lsm, id, level, rec_cnt, "r");
+    if (!run) return NULL;
+
+    run->rec_cnt = rec_cnt;
+    run->blk_cnt = (rec_cnt + per_blk - 1) / per_blk;
+
+    byte *buf = malloc((size_t) LSM_IO_BLKS * BLOCKSIZE);
+    if (!buf || rec_cnt <= 0 || blk_flen(run->file) < (off_t) run->blk_cnt * BLOCKSIZE) {
+        free(buf);
+        lsm_run_free(lsm, run);
+        return NULL;
+    }
+
+    for (int first=0; first<run->blk_cnt; first+=LSM_IO_BLKS) {
+        int cnt = run->blk_cnt - first;
+        if (cnt > LSM_IO_BLKS) cnt = LSM_IO_BLKS;
+
+        if (blk_read_n(run->file, first, buf, cnt) != cnt * BLOCKSIZE) {
+            free(buf);
+            lsm_run_free(lsm, run);
+            return NULL;
+        }
+
+        for (long i=(long) first * per_blk; i<rec_cnt && i<(long) (first + cnt) * per_blk; i++) {
+            byte *rec = buf + (i / per_blk - first) * BLOCKSIZE + (i % per_blk) * rec_len;
+            int key = lsm_key(lsm, rec);
+
+            if (i % per_blk == 0) run->fences[i / per_blk] = key;
+            if (i == 0) run->min_key = key;
+            run->max_key = key;
+            bf_add(run->bloom, key);
+        }
+    }
+
+    free(buf);
+    return run;
+}
+
+
+/*
+ * Look key up in a run, copying its record into record if it is found.
+ * The fence keys locate the one block which could hold the key, and the
+ * block is then binary searched. Returns 1 if the key was found, 0 if not,
+ * and -1 if the block could not be read.
+ */
+static int lsm_run_get(lsm_tree *lsm, lsm_run *run, int key, byte *record)
+{
+    int per_blk = tbl_recs_per_blk(lsm->tbl);
+    int rec_len = lsm->tbl->fields.record_length;
+    byte blk[BLOCKSIZE];
+
+    int lo = 0, hi = run->blk_cnt - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (run->fences[mid] <= key) lo = mid;
+        else hi = mid - 1;
+    }
+
+    pthread_mutex_lock(&run->io_lock);
+    int ok = blk_read(run->file, lo, blk) == BLOCKSIZE;
+    pthread_mutex_unlock(&run->io_lock);
+    if (!ok) return -1;
+
+    long cnt = run->rec_cnt - (long) lo * per_blk;
+    if (cnt > per_blk) cnt = per_blk;
+
+    int l = 0, h = cnt - 1;
+    while (l <= h) {
+        int mid = (l + h) / 2;
+        int k = lsm_key(lsm, blk + mid * rec_len);
+
+        if (k == key) {
+            memcpy(record, blk + mid * rec_len, rec_len);
+            return 1;
+        }
+
+        if (k < key) l = mid + 1;
+        else h = mid - 1;
+    }
+
+    return 0;
+}
+
+
+static void lsm_run_unref(lsm_tree *lsm, lsm_run *run)
+{
+    if (--run->refs == 0 && run->obsolete) lsm_run_free(lsm, run);
+}
+
+
+/*
+ * Writing runs
+ *
+ * Records are added to a writer in key order. They are packed into blocks
+ * as in a heap table, and the blocks appended to the run's file
+ * LSM_IO_BLKS at a time. Once a run holds max_recs records, the writer
+ * moves on to a new one.
+ */
+typedef struct lsm_writer {
+    lsm_tree *lsm;
+    int level;
+    long max_recs;
+    int next_id;
+
+    lsm_run *run;
+    byte *buf;
+    int buf_blks;
+    long bytes;
+
+    lsm_run **out;
+    int out_cnt;
+} lsm_writer;
+
+
+static int lsm_write_out(lsm_writer *w)
+{
+    if (w->buf_blks == 0) return 1;
+
+    if (blk_append(w->run->file, w->buf, w->buf_blks) < 0) return 0;
+
+    w->bytes += (long) w->buf_blks * BLOCKSIZE;
+    w->buf_blks = 0;
+    return 1;
+}
+
+
+static int lsm_write_end(lsm_writer *w)
+{
+    if (!w->run) return 1;
+
+    lsm_run *run = w->run;
+    int ok = lsm_write_out(w) && fflush(run->file) == 0;
+    w->run = NULL;
+
+    if (!ok) {
+        run->obsolete = TRUE;
+        lsm_run_free(w->lsm, run);
+        return 0;
+    }
+
+    w->out[w->out_cnt++] = run;
+    return 1;
+}
+
+
+static int lsm_write_add(lsm_writer *w, byte *record)
+{
+    lsm_tree *lsm = w->lsm;
+    int per_blk = tbl_recs_per_blk(lsm->tbl);
+    int rec_len = lsm->tbl->fields.record_length;
+    int key = lsm_key(lsm, record);
+
+    if (w->run && w->run->rec_cnt == w->max_recs && !lsm_write_end(w)) return 0;
+
+    if (!w->run) {
+        lsm_run **out = realloc(w->out, sizeof(lsm_run *) * (w->out_cnt + 1));
+        if (!out) return 0;
+        w->out = out;
+
+        if (!(w->run = lsm_run_alloc(lsm, w->next_id++, w->level, w->max_recs, "w+"))) return 0;
+        w->run->min_key = key;
+    }
+
+    lsm_run *run = w->run;
+    int slot = run->rec_cnt % per_blk;
+
+    if (slot == 0) {
+        if (w->buf_blks == LSM_IO_BLKS && !lsm_write_out(w)) return 0;
+
+        memset(w->buf + (size_t) w->buf_blks * BLOCKSIZE, 0, BLOCKSIZE);
+        run->fences[run->blk_cnt++] = key;
+        w->buf_blks++;
+    }
+
+    memcpy(w->buf + (size_t) (w->buf_blks - 1) * BLOCKSIZE + slot * rec_len, record, rec_len);
+    run->max_key = key;
+    run->rec_cnt++;
+    bf_add(run->bloom, key);
+
+    return 1;
+}
+
+
+static int lsm_writer_init(lsm_writer *w, lsm_tree *lsm, int level)
+{
+    *w = (lsm_writer) {.lsm = lsm, .level = level, .max_recs = lsm->opts.memtable_recs,
+                       .next_id = lsm->next_id};
+
+    w->buf = malloc((size_t) LSM_IO_BLKS * BLOCKSIZE);
+    return w->buf != NULL;
+}
+
+
+/*
+ * Finish writing. If the writes failed, the runs written are deleted.
+ */
+static int lsm_writer_finish(lsm_writer *w, int ok)
+{
+    ok = lsm_write_end(w) && ok;
+
+    if (!ok) {
+        for (int i=0; i<w->out_cnt; i++) {
+            w->out[i]->obsolete = TRUE;
+            lsm_run_free(w->lsm, w->out[i]);
+        }
+        w->out_cnt = 0;
+    }
+
+    free(w->buf);
+    return ok;
+}
+
+
+/*
+ * The manifest: a header of ints (magic, memtable_recs, l0_runs, fanout,
+ * next_id, run count), followed by (id, level, rec_cnt) for each run, with
+ * the runs of level 0 oldest first.
+ */
+static void lsm_manifest_path(table *tbl, char *path)
+{
+    snprintf(path, LSM_PATH_LEN, "%s/%s.lsm", tbl->db, tbl->name);
+}
+
+
+static int lsm_manifest_save(lsm_tree *lsm)
+{
+    char path[LSM_PATH_LEN], tmp[LSM_PATH_LEN + 4];
+    lsm_manifest_path(lsm->tbl, path);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *file = fopen(tmp, "w");
+    if (!file) return 0;
+
+    int cnt = 0;
+    for (int l=0; l<LSM_MAX_LEVELS; l++) cnt += lsm->run_cnt[l];
+
+    int header[] = {LSM_MAGIC, lsm->opts.memtable_recs, lsm->opts.l0_runs, lsm->opts.fanout,
+                    lsm->next_id, cnt};
+    int ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    for (int l=0; ok && l<LSM_MAX_LEVELS; l++) {
+        for (int i=0; ok && i<lsm->run_cnt[l]; i++) {
+            lsm_run *run = lsm->runs[l][i];
+            ok = fwrite(&run->id, sizeof(int), 1, file) == 1 &&
+                 fwrite(&run->level, sizeof(int), 1, file) == 1 &&
+                 fwrite(&run->rec_cnt, sizeof(long), 1, file) == 1;
+        }
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+
+/*
+ * Levels
+ */
+static int lsm_run_cmp(const void *a, const void *b)
+{
+    const lsm_run *x = *(lsm_run **) a, *y = *(lsm_run **) b;
+    return (x->min_key > y->min_key) - (x->min_key < y->min_key);
+}
+
+
+static int lsm_level_add(lsm_tree *lsm, int level, lsm_run *run)
+{
+    lsm_run **runs = realloc(lsm->runs[level], sizeof(lsm_run *) * (lsm->run_cnt[level] + 1));
+    if (!runs) return 0;
+
+    run->level = level;
+    runs[lsm->run_cnt[level]++] = run;
+    lsm->runs[level] = runs;
+
+    if (level > 0) qsort(runs, lsm->run_cnt[level], sizeof(lsm_run *), lsm_run_cmp);
+    return 1;
+}
+
+
+static void lsm_level_remove(lsm_tree *lsm, int level, lsm_run *run)
+{
+    int j = 0;
+    for (int i=0; i<lsm->run_cnt[level]; i++) {
+        if (lsm->runs[level][i] != run) lsm->runs[level][j++] = lsm->runs[level][i];
+    }
+
+    lsm->run_cnt[level] = j;
+}
+
+
+static long lsm_level_recs(lsm_tree *lsm, int level)
+{
+    long recs = 0;
+    for (int i=0; i<lsm->run_cnt[level]; i++) recs += lsm->runs[level][i]->rec_cnt;
+
+    return recs;
+}
+
+
+/*
+ * The level which most needs merging into the one below it, or -1 if none
+ * is over its size. Level 0 is limited to l0_runs runs, level 1 to the
+ * records in that many memtables times fanout, and each level below to
+ * fanout times the one above. The last level is unlimited.
+ */
+static int lsm_pick(lsm_tree *lsm)
+{
+    if (lsm->run_cnt[0] >= lsm->opts.l0_runs) return 0;
+
+    long limit = (long) lsm->opts.l0_runs * lsm->opts.memtable_recs;
+    for (int l=1; l<LSM_MAX_LEVELS - 1; l++) {
+        limit *= lsm->opts.fanout;
+        if (lsm_level_recs(lsm, l) > limit) return l;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Merging
+ *
+ * A merge input reads a sequence of runs with disjoint, ascending key
+ * ranges (a single run, or the overlapping stretch of a level) as one
+ * sorted stream.
+ */
+typedef struct lsm_input {
+    lsm_tree *lsm;
+    lsm_run **runs;
+    int run_cnt;
+
+    int cur;
+    long pos;
+    FILE *file;
+    byte *buf;
+    int buf_first;
+    int buf_blks;
+
+    byte *rec;
+    int key;
+} lsm_input;
+
+
+/*
+ * Point in->rec at the record at the input's position, reading ahead if
+ * it isn't buffered, or at NULL once the input is exhausted. Returns 0 on
+ * a read error.
+ */
+static int lsm_input_fill(lsm_input *in)
+{
+    lsm_tree *lsm = in->lsm;
+    int per_blk = tbl_recs_per_blk(lsm->tbl);
+    int rec_len = lsm->tbl->fields.record_length;
+
+    while (in->cur < in->run_cnt) {
+        lsm_run *run = in->runs[in->cur];
+
+        if (in->pos < run->rec_cnt) {
+            int blk = in->pos / per_blk;
+
+            if (!in->file) {
+                char path[LSM_PATH_LEN];
+                lsm_run_path(lsm, run->id, path);
+                if (!(in->file = fopen(path, "r"))) return 0;
+                in->buf_first = in->buf_blks = 0;
+            }
+
+            if (blk >= in->buf_first + in->buf_blks) {
+                int cnt = run->blk_cnt - blk;
+                if (cnt > LSM_IO_BLKS) cnt = LSM_IO_BLKS;
+
+                if (blk_read_n(in->file, blk, in->buf, cnt) != cnt * BLOCKSIZE) return 0;
+                in->buf_first = blk;
+                in->buf_blks = cnt;
+            }
+
+            in->rec = in->buf + (size_t) (blk - in->buf_first) * BLOCKSIZE +
+                      (in->pos % per_blk) * rec_len;
+            in->key = lsm_key(lsm, in->rec);
+            return 1;
+        }
+
+        if (in->file) fclose(in->file);
+        in->file = NULL;
+        in->cur++;
+        in->pos = 0;
+    }
+
+    in->rec = NULL;
+    return 1;
+}
+
+
+static int lsm_input_init(lsm_input *in, lsm_tree *lsm, lsm_run **runs, int run_cnt)
+{
+    *in = (lsm_input) {.lsm = lsm, .runs = runs, .run_cnt = run_cnt};
+
+    in->buf = malloc((size_t) LSM_IO_BLKS * BLOCKSIZE);
+    return in->buf && lsm_input_fill(in);
+}
+
+
+static void lsm_input_close(lsm_input *in)
+{
+    if (in->file) fclose(in->file);
+    free(in->buf);
+}
+
+
+/*
+ * Merge the inputs, which are ordered newest first, into new runs written
+ * by w, keeping only the newest record of each key.
+ */
+static int lsm_merge(lsm_input *ins, int in_cnt, lsm_writer *w)
+{
+    while (TRUE) {
+        int min = -1;
+        for (int i=0; i<in_cnt; i++) {
+            if (ins[i].rec && (min < 0 || ins[i].key < ins[min].key)) min = i;
+        }
+
+        if (min < 0) return 1;
+        if (!lsm_write_add(w, ins[min].rec)) return 0;
+
+        int key = ins[min].key;
+        for (int i=0; i<in_cnt; i++) {
+            if (ins[i].rec && ins[i].key == key) {
+                ins[i].pos++;
+                if (!lsm_input_fill(&ins[i])) return 0;
+            }
+        }
+    }
+}
+
+
+/*
+ * Replace the inputs of a flush or merge with its outputs, save the
+ * manifest, and drop the inputs (whose files are deleted once no lookup is
+ * using them). Called with the lock held.
+ */
+static int lsm_install(lsm_tree *lsm, lsm_run **olds, int old_cnt, lsm_writer *w)
+{
+    for (int i=0; i<old_cnt; i++) lsm_level_remove(lsm, olds[i]->level, olds[i]);
+
+    int ok = TRUE;
+    for (int i=0; i<w->out_cnt; i++) ok = ok && lsm_level_add(lsm, w->level, w->out[i]);
+
+    lsm->next_id = w->next_id;
+    lsm->stats.bytes_written += w->bytes;
+    ok = ok && lsm_manifest_save(lsm);
+
+    for (int i=0; i<old_cnt; i++) {
+        olds[i]->obsolete = TRUE;
+        if (olds[i]->refs == 0) lsm_run_free(lsm, olds[i]);
+    }
+
+    return ok;
+}
+
+
+/*
+ * Merge level into the next. From level 0, all of its runs are merged
+ * together; from any other level, the run following the one last merged
+ * from it. The merged runs are combined with the runs of the next level
+ * which overlap them, or, if there are none, simply moved down.
+ */
+static int lsm_compact(lsm_tree *lsm, int level)
+{
+    lsm_run *top[LSM_MAX_L0_RUNS];
+    int top_cnt = 0;
+
+    if (level == 0) {
+        for (int i=lsm->run_cnt[0] - 1; i>=0 && top_cnt<LSM_MAX_L0_RUNS; i--) {
+            top[top_cnt++] = lsm->runs[0][i];
+        }
+    } else {
+        int pick = 0;
+        for (int i=0; i<lsm->run_cnt[level]; i++) {
+            if (lsm->runs[level][i]->min_key > lsm->cursor[level]) {
+                pick = i;
+                break;
+            }
+        }
+
+        top[top_cnt++] = lsm->runs[level][pick];
+        lsm->cursor[level] = lsm->runs[level][pick]->max_key;
+    }
+
+    if (top_cnt == 0) return 1;
+
+    int lo = top[0]->min_key, hi = top[0]->max_key;
+    for (int i=1; i<top_cnt; i++) {
+        if (top[i]->min_key < lo) lo = top[i]->min_key;
+        if (top[i]->max_key > hi) hi = top[i]->max_key;
+    }
+
+    // The overlapping runs of the next level are contiguous, as it is
+    // sorted and disjoint
+    int next = level + 1, first = 0, cnt = 0;
+    while (first < lsm->run_cnt[next] && lsm->runs[next][first]->max_key < lo) first++;
+    while (first + cnt < lsm->run_cnt[next] && lsm->runs[next][first + cnt]->min_key <= hi) cnt++;
+
+    if (level > 0 && cnt == 0) {
+        pthread_mutex_lock(&lsm->lock);
+        lsm_level_remove(lsm, level, top[0]);
+        int ok = lsm_level_add(lsm, next, top[0]) && lsm_manifest_save(lsm);
+        lsm->stats.merges++;
+        pthread_mutex_unlock(&lsm->lock);
+
+        return ok;
+    }
+
+    // Everything merged is replaced by the merge's output
+    lsm_run **olds = malloc(sizeof(lsm_run *) * (top_cnt + cnt));
+    if (!olds) return 0;
+
+    memcpy(olds, top, sizeof(lsm_run *) * top_cnt);
+    if (cnt > 0) memcpy(olds + top_cnt, &lsm->runs[next][first], sizeof(lsm_run *) * cnt);
+
+    lsm_input ins[LSM_MAX_L0_RUNS + 1];
+    lsm_writer w;
+    int in_cnt = 0, ok = lsm_writer_init(&w, lsm, next);
+
+    for (int i=0; ok && i<top_cnt; i++) {
+        ok = lsm_input_init(&ins[in_cnt++], lsm, &top[i], 1);
+    }
+
+    if (ok && cnt > 0) ok = lsm_input_init(&ins[in_cnt++], lsm, olds + top_cnt, cnt);
+
+    ok = ok && lsm_merge(ins, in_cnt, &w);
+    for (int i=0; i<in_cnt; i++) lsm_input_close(&ins[i]);
+
+    if (lsm_writer_finish(&w, ok)) {
+        pthread_mutex_lock(&lsm->lock);
+        ok = lsm_install(lsm, olds, top_cnt + cnt, &w);
+        lsm->stats.merges++;
+        pthread_mutex_unlock(&lsm->lock);
+    } else {
+        ok = FALSE;
+    }
+
+    free(olds);
+    free(w.out);
+    return ok;
+}
+
+
+/*
+ * Write a frozen memtable out as a level 0 run.
+ */
+static int lsm_flush_memtable(lsm_tree *lsm, lsm_memtable *mt)
+{
+    lsm_writer w;
+    int ok = lsm_writer_init(&w, lsm, 0);
+    w.max_recs = mt->count;
+
+    for (lsm_node *x=mt->head->next[0]; ok && x; x=x->next[0]) ok = lsm_write_add(&w, x->rec);
+
+    if (!lsm_writer_finish(&w, ok)) {
+        free(w.out);
+        return 0;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+    ok = lsm_install(lsm, NULL, 0, &w);
+    lsm->frozen = NULL;
+    lsm->stats.flushes++;
+    lsm_memtable_free(mt);
+    pthread_mutex_unlock(&lsm->lock);
+
+    free(w.out);
+    return ok;
+}
+
+
+static void *lsm_main(void *arg)
+{
+    lsm_tree *lsm = arg;
+    int level;
+
+    pthread_mutex_lock(&lsm->lock);
+    while (TRUE) {
+        if (lsm->frozen && !lsm->failed) {
+            lsm_memtable *mt = lsm->frozen;
+            lsm->busy = TRUE;
+            pthread_mutex_unlock(&lsm->lock);
+            int ok = lsm_flush_memtable(lsm, mt);
+            pthread_mutex_lock(&lsm->lock);
+            if (!ok) lsm->failed = TRUE;
+        } else if (lsm->stop) {
+            break;
+        } else if (!lsm->failed && (level = lsm_pick(lsm)) >= 0) {
+            lsm->busy = TRUE;
+            pthread_mutex_unlock(&lsm->lock);
+            int ok = lsm_compact(lsm, level);
+            pthread_mutex_lock(&lsm->lock);
+            if (!ok) lsm->failed = TRUE;
+        } else {
+            lsm->busy = FALSE;
+            pthread_cond_broadcast(&lsm->done);
+            pthread_cond_wait(&lsm->work, &lsm->lock);
+            continue;
+        }
+
+        pthread_cond_broadcast(&lsm->done);
+    }
+
+    lsm->busy = FALSE;
+    pthread_cond_broadcast(&lsm->done);
+    pthread_mutex_unlock(&lsm->lock);
+
+    return NULL;
+}
+
+
+/*
+ * Hand the active memtable to the background thread and start a new one,
+ * first waiting for the previous one to be written, and for level 0 to be
+ * merged down if it has twice as many runs as it should. Called with the
+ * lock held.
+ */
+static int lsm_rotate(lsm_tree *lsm)
+{
+    while ((lsm->frozen || lsm->run_cnt[0] >= 2 * lsm->opts.l0_runs) && !lsm->failed) {
+        pthread_cond_wait(&lsm->done, &lsm->lock);
+    }
+
+    if (lsm->failed) return 0;
+
+    lsm_memtable *mt = lsm_memtable_create(lsm->tbl->fields.record_length,
+                                           lsm->active->seed + lsm->stats.flushes);
+    if (!mt) return 0;
+
+    lsm->frozen = lsm->active;
+    lsm->active = mt;
+    pthread_cond_signal(&lsm->work);
+
+    return 1;
+}
+
+
+/*
+ * Setup and teardown
+ */
+void lsm_default_opts(lsm_opts *opts)
+{
+    opts->memtable_recs = LSM_DEFAULT_MEMTABLE_RECS;
+    opts->l0_runs = LSM_DEFAULT_L0_RUNS;
+    opts->fanout = LSM_DEFAULT_FANOUT;
+}
+
+
+static void lsm_free(lsm_tree *lsm)
+{
+    for (int l=0; l<LSM_MAX_LEVELS; l++) {
+        for (int i=0; i<lsm->run_cnt[l]; i++) lsm_run_free(lsm, lsm->runs[l][i]);
+        free(lsm->runs[l]);
+    }
+
+    lsm_memtable_free(lsm->active);
+    lsm_memtable_free(lsm->frozen);
+    pthread_cond_destroy(&lsm->work);
+    pthread_cond_destroy(&lsm->done);
+    pthread_mutex_destroy(&lsm->lock);
+    free(lsm);
+}
+
+
+static lsm_tree *lsm_alloc(table *tbl, int key_col)
+{
+    if (key_col < 0 || key_col >= tbl->fields.field_cnt || tbl->fields.field_types[key_col] != INT) {
+        return NULL;
+    }
+
+    lsm_tree *lsm = calloc(1, sizeof(lsm_tree));
+    if (!lsm) return NULL;
+
+    lsm->tbl = tbl;
+    lsm->key_col = key_col;
+    lsm->key_offset = tbl_field_offset(&tbl->fields, key_col);
+    lsm_default_opts(&lsm->opts);
+
+    pthread_mutex_init(&lsm->lock, NULL);
+    pthread_cond_init(&lsm->work, NULL);
+    pthread_cond_init(&lsm->done, NULL);
+
+    for (int l=0; l<LSM_MAX_LEVELS; l++) lsm->cursor[l] = INT_MIN;
+
+    return lsm;
+}
+
+
+static lsm_tree *lsm_start(lsm_tree *lsm)
+{
+    lsm->active = lsm_memtable_create(lsm->tbl->fields.record_length, 0x9e3779b97f4a7c15ULL);
+
+    if (!lsm->active || pthread_create(&lsm->thread, NULL, lsm_main, lsm) != 0) {
+        lsm_free(lsm);
+        return NULL;
+    }
+
+    return lsm;
+}
+
+
+/*
+ * Set up an empty tree for tbl, keyed on column key_col (which must be an
+ * INT column), and start its background thread. If opts is NULL, the
+ * defaults from lsm_default_opts() are used. Returns NULL on error.
+ */
+lsm_tree *lsm_create(table *tbl, int key_col, lsm_opts *opts)
+{
+    lsm_tree *lsm = lsm_alloc(tbl, key_col);
+    if (!lsm) return NULL;
+
+    if (opts) lsm->opts = *opts;
+
+    if (lsm->opts.memtable_recs < 1 || lsm->opts.l0_runs < 1 || lsm->opts.fanout < 2 ||
+            lsm->opts.l0_runs > LSM_MAX_L0_RUNS / 2 || !lsm_manifest_save(lsm)) {
+        lsm_free(lsm);
+        return NULL;
+    }
+
+    return lsm_start(lsm);
+}
+
+
+/*
+ * Open the existing tree of tbl from its manifest, and start its
+ * background thread. Returns NULL if the manifest or any of the runs it
+ * lists cannot be read.
+ */
+lsm_tree *lsm_open(table *tbl, int key_col)
+{
+    lsm_tree *lsm = lsm_alloc(tbl, key_col);
+    if (!lsm) return NULL;
+
+    char path[LSM_PATH_LEN];
+    lsm_manifest_path(tbl, path);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        lsm_free(lsm);
+        return NULL;
+    }
+
+    int header[6];
+    int ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == LSM_MAGIC;
+
+    if (ok) {
+        lsm->opts = (lsm_opts) {.memtable_recs = header[1], .l0_runs = header[2],
+                                .fanout = header[3]};
+        lsm->next_id = header[4];
+    }
+
+    for (int i=0; ok && i<header[5]; i++) {
+        int id, level;
+        long rec_cnt;
+        lsm_run *run = NULL;
+
+        ok = fread(&id, sizeof(int), 1, file) == 1 && fread(&level, sizeof(int), 1, file) == 1 &&
+             fread(&rec_cnt, sizeof(long), 1, file) == 1 && level >= 0 &&
+             level < LSM_MAX_LEVELS && (run = lsm_run_load(lsm, id, level, rec_cnt)) &&
+             lsm_level_add(lsm, level, run);
+
+        if (!ok) lsm_run_free(lsm, run);
+    }
+
+    fclose(file);
+
+    if (!ok) {
+        lsm_free(lsm);
+        return NULL;
+    }
+
+    return lsm_start(lsm);
+}
+
+
+/*
+ * Write the memtable out, stop the background thread (leaving any merges
+ * it has yet to do for the next time the table is opened), and free the
+ * tree. Returns 1 on success and 0 if any of the tree's writes failed.
+ */
+int lsm_close(lsm_tree *lsm)
+{
+    pthread_mutex_lock(&lsm->lock);
+    int ok = lsm->active->count == 0 || lsm_rotate(lsm);
+    lsm->stop = TRUE;
+    pthread_cond_signal(&lsm->work);
+    pthread_mutex_unlock(&lsm->lock);
+
+    pthread_join(lsm->thread, NULL);
+
+    ok = ok && !lsm->failed && lsm_manifest_save(lsm);
+    lsm_free(lsm);
+
+    return ok;
+}
+
+
+/*
+ * Operations
+ */
+
+/*
+ * Insert a record (of the table's record_length), replacing any earlier
+ * record with the same key. Returns 1 on success and 0 on error.
+ */
+int lsm_put(lsm_tree *lsm, byte *record)
+{
+    pthread_mutex_lock(&lsm->lock);
+
+    int ok = !lsm->failed && lsm_memtable_put(lsm->active, lsm_key(lsm, record), record);
+    if (ok) {
+        lsm->stats.puts++;
+        lsm->stats.bytes_put += lsm->tbl->fields.record_length;
+    }
+
+    if (ok && lsm->active->count >= lsm->opts.memtable_recs) ok = lsm_rotate(lsm);
+
+    pthread_mutex_unlock(&lsm->lock);
+    return ok;
+}
+
+
+/*
+ * Copy the newest record with the given key into record. Returns 1 if
+ * there is one, and 0 if not (or it couldn't be read).
+ */
+int lsm_get(lsm_tree *lsm, int key, byte *record)
+{
+    lsm_run *cands[LSM_MAX_L0_RUNS + LSM_MAX_LEVELS];
+    int cand_cnt = 0;
+
+    pthread_mutex_lock(&lsm->lock);
+
+    lsm_node *node = lsm_memtable_find(lsm->active, key);
+    if (!node && lsm->frozen) node = lsm_memtable_find(lsm->frozen, key);
+
+    if (node) {
+        memcpy(record, node->rec, lsm->tbl->fields.record_length);
+        pthread_mutex_unlock(&lsm->lock);
+        return 1;
+    }
+
+    for (int i=lsm->run_cnt[0] - 1; i>=0 && cand_cnt<LSM_MAX_L0_RUNS; i--) {
+        lsm_run *run = lsm->runs[0][i];
+        if (key >= run->min_key && key <= run->max_key && bf_may_contain(run->bloom, key)) {
+            cands[cand_cnt++] = run;
+        }
+    }
+
+    for (int l=1; l<LSM_MAX_LEVELS; l++) {
+        // The last run of the level starting at or before key
+        int lo = 0, hi = lsm->run_cnt[l] - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (lsm->runs[l][mid]->min_key <= key) lo = mid;
+            else hi = mid - 1;
+        }
+
+        if (lsm->run_cnt[l] == 0) continue;
+
+        lsm_run *run = lsm->runs[l][lo];
+        if (key >= run->min_key && key <= run->max_key && bf_may_contain(run->bloom, key)) {
+            cands[cand_cnt++] = run;
+        }
+    }
+
+    for (int i=0; i<cand_cnt; i++) cands[i]->refs++;
+    pthread_mutex_unlock(&lsm->lock);
+
+    int found = 0;
+    for (int i=0; i<cand_cnt && found == 0; i++) found = lsm_run_get(lsm, cands[i], key, record);
+
+    pthread_mutex_lock(&lsm->lock);
+    for (int i=0; i<cand_cnt; i++) lsm_run_unref(lsm, cands[i]);
+    pthread_mutex_unlock(&lsm->lock);
+
+    return found == 1;
+}
+
+
+/*
+ * Write the memtable out, and wait for the background thread to finish
+ * any merges it needs to do. Returns 1 on success and 0 if any of the
+ * tree's writes have failed.
+ */
+int lsm_flush(lsm_tree *lsm)
+{
+    pthread_mutex_lock(&lsm->lock);
+
+    int ok = lsm->active->count == 0 || lsm_rotate(lsm);
+    pthread_cond_signal(&lsm->work);
+
+    while (ok && !lsm->failed && (lsm->frozen || lsm->busy || lsm_pick(lsm) >= 0)) {
+        pthread_cond_wait(&lsm->done, &lsm->lock);
+    }
+
+    ok = ok && !lsm->failed;
+    pthread_mutex_unlock(&lsm->lock);
+
+    return ok;
+}
+
+
+void lsm_stats_get(lsm_tree *lsm, lsm_stats *stats)
+{
+    pthread_mutex_lock(&lsm->lock);
+
+    *stats = lsm->stats;
+    for (int l=0; l<LSM_MAX_LEVELS; l++) {
+        stats->runs[l] = lsm->run_cnt[l];
+        stats->recs[l] = lsm_level_recs(lsm, l);
+    }
+
+    pthread_mutex_unlock(&lsm->lock);
+}
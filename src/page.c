@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
 #include "blockio.h"
 #include "page.h"
 #include "yahi.h"
@@ -30,14 +31,15 @@
 // must fit within the bounds of a single block.
 int pg_boundscheck(int offset, int length)
 {
-    return (offset + length < BLOCKSIZE) ? TRUE : FALSE;
+    return (offset >= 0 && offset + length <= BLOCKSIZE) ? TRUE : FALSE;
 }
 
 
 int pg_getint(page *pg, int offset)
 {
     if (pg_boundscheck(offset, sizeof(int))) {
-        int result = (int) pg->data[offset];
+        int result;
+        memcpy(&result, &(pg->data[offset]), sizeof(int));
         return result;
     }
 
@@ -48,7 +50,12 @@ int pg_getint(page *pg, int offset)
 
 
 
-char *pg_getchar(page *pg, int offset, int length)
+/*
+ * Returns a null-terminated copy of length bytes of the page, allocated
+ * from the arena a (see arena.h), or, if a is NULL, with malloc, in which
+ * case the caller frees it.
+ */
+char *pg_getchar(page *pg, int offset, int length, struct arena *a)
 {
     // better create a copy and return it, at least until
     // I have a better idea of how concurrency will be managed.
@@ -57,8 +64,12 @@ char *pg_getchar(page *pg, int offset, int length)
     // underneath me!
     
     if (pg_boundscheck(offset, length)) {
+        if (a) return arena_strndup(a, &(pg->data[offset]), length);
+
         char *result = malloc(sizeof(char) * (length + 1)); // include null term.
+        if (!result) return NULL;
         memcpy(result, &(pg->data[offset]), length);
+        result[length] = '\0';
 
         return result;
     }
@@ -70,7 +81,8 @@ char *pg_getchar(page *pg, int offset, int length)
 double pg_getfloat(page *pg, int offset)
 {
     if (pg_boundscheck(offset, sizeof(double))) {
-        double result = (double) pg->data[offset];
+        double result;
+        memcpy(&result, &(pg->data[offset]), sizeof(double));
 
         return result;
     }
@@ -82,7 +94,7 @@ double pg_getfloat(page *pg, int offset)
 int pg_setint(page *pg, int offset, int value)
 {
     if (pg_boundscheck(offset, sizeof(int))) {
-        pg->data[offset] = value;
+        memcpy(&(pg->data[offset]), &value, sizeof(int));
         pg->modified = TRUE;
 
         return 1;
@@ -108,7 +120,7 @@ int pg_setchar(page *pg, int offset, char *value, int length)
 int pg_setfloat(page *pg, int offset, double value)
 {
     if (pg_boundscheck(offset, sizeof(double))) {
-        pg->data[offset] = value;
+        memcpy(&(pg->data[offset]), &value, sizeof(double));
         pg->modified = TRUE;
 
         return 1;
@@ -2,12 +2,42 @@
  *
  * A simple buffer management library for the yahi-db project.
  *
- * FIXME: I'm ignoring it for now, but there will be some major work that needs
- * to be done in here for concurrency controls. We'll need to make sure that
- * between when find_pg finds the page in the buffer, and the page gets pinned,
- * it doesn't get flushed out and replaced. That'd be... bad. I'm sure there
- * are other concurrency problems too--that's just the first one to spring to
- * my mind.
+ * The pool is an object (buff_pool) rather than a set of globals, and any
+ * number of named pools may exist at once, each with its own size and
+ * replacement policy. Every table is cached in exactly one pool: the
+ * default pool created by buff_pool_init, unless it has been bound to
+ * another with buff_pool_bind. Because a pool only ever evicts its own
+ * frames, a table scanning through a pool of its own cannot push another
+ * tenant's pages out.
+ *
+ * Each pool has a mutex, held across the lookup, load and pin count update
+ * of buff_pin, so that a page cannot be evicted between being found and
+ * being pinned. Page contents are not protected by it; that is what the
+ * per-page lock is for.
+ *
+ * Within a pool, frame data lives in a single arena, backed by huge pages where the system
+ * allows it, with each frame aligned to a cache line. The page descriptors
+ * (pin count, dirty flag, lock) are kept in their own contiguous array, and
+ * the (table, block) tags used for lookups in a further compact array, so
+ * that searching the pool does not touch the frames themselves. On NUMA
+ * systems the arena is split into one partition per node, each first
+ * touched by a thread running on that node, and loads prefer frames from
+ * the partition local to the calling thread.
+ *
+ * The set of pages resident in a pool can be saved with buff_pool_dump, and
+ * read back into an empty pool after a restart with buff_pool_warm (or in
+ * the background with buff_pool_warm_start), so that the pool is hot
+ * before traffic arrives rather than warming up through misses. See the
+ * notes above buff_pool_dump for details.
+ *
+ * A pool may have a second-tier cache on fast local storage attached with
+ * buff_pool_set_cache. Clean pages the pool evicts are offered to it, and
+ * misses are looked up in it before the table's file is read. See
+ * ssdcache.h.
+ *
+ * Pages of memory-mapped tables (see tbl_load_mmap) are not held in the pool;
+ * each such table carries its own array of page descriptors pointing into
+ * its mapping, which buff_find_pg returns directly.
  *
  * Copyright 2021, Douglas B. Rumbaugh 
  * This code is published under the BSD 3-Clause License, see the LICENSE file 
@@ -15,36 +45,382 @@
  *
  */
 
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "blockio.h"
 #include "pgbuffer.h"
 #include "page.h"
+#include "pgcompress.h"
+#include "ssdcache.h"
+#include "stats.h"
 #include "table.h"
 #include "yahi.h"
 
+#define BUFF_HUGE_PAGE (2 * 1024 * 1024)
+#define BUFF_FRAME_ALIGN 64
+#define BUFF_FRAME_STRIDE ((BLOCKSIZE + BUFF_FRAME_ALIGN - 1) / BUFF_FRAME_ALIGN * BUFF_FRAME_ALIGN)
+
+typedef struct buff_node {
+    cpu_set_t cpus;
+} buff_node;
+
+typedef struct buff_touch {
+    buff_pool *pool;
+    int node;
+} buff_touch;
+
+// Views of the default pool, kept for the unit tests
 page **_PAGE_POOL = NULL;
 int _POOL_SIZE = 0;
 int _POOL_INIT = FALSE;
 
+static buff_pool *_DEFAULT_POOL = NULL;
+static buff_pool *_POOLS[BUFF_MAX_POOLS];
+static pthread_mutex_t _POOLS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static buff_node _NODES[BUFF_MAX_NODES];
+static int _NODE_CNT = 0;
+static int _CPU_NODE[CPU_SETSIZE];
+static pthread_once_t _NODES_ONCE = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Allocate a zeroed arena of at least len bytes, aligned to a huge page.
+ * Explicit (hugetlbfs) huge pages are used if any are reserved, and
+ * otherwise transparent huge pages are requested for a normal mapping.
+ */
+static byte *buff_arena_alloc(buff_pool *pool, size_t len)
+{
+    pool->arena_len = (len + BUFF_HUGE_PAGE - 1) / BUFF_HUGE_PAGE * BUFF_HUGE_PAGE;
+
+    byte *arena = mmap(NULL, pool->arena_len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena != MAP_FAILED) {
+        pool->huge = BUFF_HUGE_EXPLICIT;
+        return arena;
+    }
+
+    // Over-allocate so that the arena can be trimmed to a huge page boundary
+    size_t map_len = pool->arena_len + BUFF_HUGE_PAGE;
+    byte *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    arena = (byte *) (((size_t) map + BUFF_HUGE_PAGE - 1) / BUFF_HUGE_PAGE * BUFF_HUGE_PAGE);
+    if (arena > map) munmap(map, arena - map);
+    if (map + map_len > arena + pool->arena_len) {
+        munmap(arena + pool->arena_len, (map + map_len) - (arena + pool->arena_len));
+    }
+
+    pool->huge = (madvise(arena, pool->arena_len, MADV_HUGEPAGE) == 0) ? BUFF_HUGE_TRANSPARENT : BUFF_HUGE_NONE;
+    return arena;
+}
+
+
+/*
+ * Parse a sysfs cpu list (e.g. "0-3,8-11") into a cpu set.
+ */
+static int buff_parse_cpulist(const char *path, cpu_set_t *cpus)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+
+    CPU_ZERO(cpus);
+
+    int lo, hi;
+    char sep;
+    while (fscanf(file, "%d", &lo) == 1) {
+        hi = lo;
+        if (fscanf(file, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(file, "%d", &hi) != 1) break;
+            if (fscanf(file, "%c", &sep) != 1) sep = 0;
+        }
+
+        for (int c=lo; c<=hi && c<CPU_SETSIZE; c++) CPU_SET(c, cpus);
+        if (sep != ',') break;
+    }
+
+    fclose(file);
+    return CPU_COUNT(cpus) > 0;
+}
+
+
+/*
+ * Discover the NUMA nodes with cpus attached. Systems without NUMA
+ * information are treated as a single node. This is done once per process,
+ * and shared by all pools.
+ */
+static void buff_numa_discover()
+{
+    char path[64];
+
+    _NODE_CNT = 0;
+    memset(_CPU_NODE, 0, sizeof(_CPU_NODE));
+
+    for (int n=0; n<BUFF_MAX_NODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        if (buff_parse_cpulist(path, &_NODES[_NODE_CNT].cpus)) {
+            for (int c=0; c<CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &_NODES[_NODE_CNT].cpus)) _CPU_NODE[c] = _NODE_CNT;
+            }
+            _NODE_CNT++;
+        }
+    }
+
+    if (_NODE_CNT == 0) {
+        _NODE_CNT = 1;
+        memset(_CPU_NODE, 0, sizeof(_CPU_NODE));
+    }
+}
+
+
+/*
+ * The frames of a pool are split into one contiguous partition per node;
+ * partition n covers [buff_node_first(n), buff_node_first(n+1)).
+ */
+static inline int buff_node_first(buff_pool *pool, int node)
+{
+    return (long) pool->size * node / pool->node_cnt;
+}
+
+
+/*
+ * The partition local to the calling thread.
+ */
+static int buff_local_node(buff_pool *pool)
+{
+    if (pool->node_cnt < 2) return 0;
+
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return 0;
+
+    return _CPU_NODE[cpu];
+}
+
+
+static void *buff_first_touch(void *arg)
+{
+    buff_touch *touch = arg;
+    buff_pool *pool = touch->pool;
+    int first = buff_node_first(pool, touch->node);
+    int last = buff_node_first(pool, touch->node + 1);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &_NODES[touch->node].cpus);
+    memset(pool->arena + (size_t) first * BUFF_FRAME_STRIDE, 0,
+           (size_t) (last - first) * BUFF_FRAME_STRIDE);
+
+    return NULL;
+}
+
+
+/*
+ * Fault in each node's partition of the arena from a thread bound to that
+ * node, so that the kernel's first-touch policy places it in local memory.
+ */
+static void buff_numa_place(buff_pool *pool)
+{
+    if (pool->node_cnt < 2) return;
+
+    pthread_t threads[BUFF_MAX_NODES];
+    buff_touch touch[BUFF_MAX_NODES];
+    int started[BUFF_MAX_NODES] = {0};
+
+    for (int n=0; n<pool->node_cnt; n++) {
+        touch[n].pool = pool;
+        touch[n].node = n;
+        started[n] = pthread_create(&threads[n], NULL, buff_first_touch, &touch[n]) == 0;
+    }
+
+    for (int n=0; n<pool->node_cnt; n++) {
+        if (started[n]) pthread_join(threads[n], NULL);
+    }
+}
+
+
+static void buff_pool_release(buff_pool *pool)
+{
+    if (pool->arena) munmap(pool->arena, pool->arena_len);
+    free(pool->pages);
+    free(pool->frames);
+    free(pool->tags);
+    free(pool->refs);
+    free(pool);
+}
+
+
+/*
+ * Create a buffer pool of pool_size frames, using the given replacement
+ * policy (one of the BUFF_POLICY_* constants), and register it under name.
+ * Returns NULL if the arguments are invalid, a pool of that name already
+ * exists, or memory could not be allocated.
+ */
+buff_pool *buff_pool_create(char *name, int pool_size, int policy)
+{
+    if (!name || pool_size <= 0 || strlen(name) >= BUFF_POOL_NAME) return NULL;
+    if (policy != BUFF_POLICY_FIRST && policy != BUFF_POLICY_CLOCK) return NULL;
+
+    pthread_once(&_NODES_ONCE, buff_numa_discover);
+
+    buff_pool *pool = calloc(1, sizeof(buff_pool));
+    if (!pool) return NULL;
+
+    strcpy(pool->name, name);
+    pool->size = pool_size;
+    pool->policy = policy;
+    pool->node_cnt = (pool_size < _NODE_CNT) ? 1 : _NODE_CNT;
+
+    pool->pages = calloc(pool_size, sizeof(page *));
+    pool->frames = calloc(pool_size, sizeof(page));
+    pool->tags = calloc(pool_size, sizeof(frame_tag));
+    pool->refs = calloc(pool_size, sizeof(byte));
+    pool->arena = buff_arena_alloc(pool, (size_t) pool_size * BUFF_FRAME_STRIDE);
+
+    if (!pool->pages || !pool->frames || !pool->tags || !pool->refs || !pool->arena) {
+        buff_pool_release(pool);
+        return NULL;
+    }
+
+    // Register the pool, failing if the name is taken or there is no room
+    pthread_mutex_lock(&_POOLS_LOCK);
+    int slot = -1;
+    for (int i=0; i<BUFF_MAX_POOLS; i++) {
+        if (_POOLS[i] && strcmp(_POOLS[i]->name, name) == 0) {
+            slot = -1;
+            break;
+        }
+        if (!_POOLS[i] && slot < 0) slot = i;
+    }
+    if (slot >= 0) _POOLS[slot] = pool;
+    pthread_mutex_unlock(&_POOLS_LOCK);
+
+    if (slot < 0) {
+        buff_pool_release(pool);
+        return NULL;
+    }
+
+    buff_numa_place(pool);
+
+    for (int i=0; i<pool_size; i++) {
+        pool->pages[i] = &pool->frames[i];
+        pool->pages[i]->data = pool->arena + (size_t) i * BUFF_FRAME_STRIDE;
+        sem_init(&(pool->pages[i]->locked), FALSE, 1);
+    }
+
+    for (int n=0; n<pool->node_cnt; n++) pool->hands[n] = buff_node_first(pool, n);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+
+/*
+ * Write pg back to its table's file if it has been modified, dropping any
+ * copy of it in the pool's cache, which the write leaves out of date.
+ * Called with the pool locked; pool is NULL for a page of a mapped table.
+ */
+static void buff_pool_write(buff_pool *pool, page *pg)
+{
+    if (!pg->modified) return;
+
+    STAT_ADD(STAT_WRITEBACKS, 1);
+    STAT_TBL_ADD(pg->tbl, STAT_WRITEBACKS);
+
+    if (pool && pool->cache) sc_invalidate(pool->cache, pg->tbl, pg->blk_id);
+
+    if (pg->tbl->cmap) {
+        pgc_write_blk(pg->tbl, pg->blk_id, pg->data);
+    } else {
+        blk_write(pg->tbl->file, pg->blk_id, pg->data);
+    }
+    pg->modified = FALSE;
+}
+
+
+/*
+ * Write back every modified page held in pool, and release it. Any tables
+ * bound to the pool must have been closed, or bound to another pool,
+ * beforehand.
+ */
+void buff_pool_free(buff_pool *pool)
+{
+    if (!pool) return;
+
+    pthread_mutex_lock(&_POOLS_LOCK);
+    for (int i=0; i<BUFF_MAX_POOLS; i++) {
+        if (_POOLS[i] == pool) _POOLS[i] = NULL;
+    }
+    pthread_mutex_unlock(&_POOLS_LOCK);
+
+    for (int i=0; i<pool->size; i++) {
+        buff_pool_write(pool, pool->pages[i]);
+        sem_destroy(&pool->pages[i]->locked);
+    }
+
+    if (pool == _DEFAULT_POOL) {
+        _DEFAULT_POOL = NULL;
+        _PAGE_POOL = NULL;
+        _POOL_SIZE = 0;
+        _POOL_INIT = FALSE;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    buff_pool_release(pool);
+}
+
+
+/*
+ * Look up a pool by the name it was created with.
+ */
+buff_pool *buff_pool_get(char *name)
+{
+    buff_pool *pool = NULL;
+
+    pthread_mutex_lock(&_POOLS_LOCK);
+    for (int i=0; i<BUFF_MAX_POOLS; i++) {
+        if (_POOLS[i] && strcmp(_POOLS[i]->name, name) == 0) {
+            pool = _POOLS[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_POOLS_LOCK);
+
+    return pool;
+}
+
+
+/*
+ * The pool used by tables that have not been bound to one, or NULL if
+ * buff_pool_init has not been called.
+ */
+buff_pool *buff_pool_default()
+{
+    return _DEFAULT_POOL;
+}
+
+
+/*
+ * Set up the default pool, named "default", with pool_size frames and
+ * clock replacement. The default pool can only be initialized once until
+ * it is destroyed.
+ */
 int buff_pool_init(int pool_size) 
 {
     // You can only initialize the pool once.
-    if (_POOL_INIT) {
+    if (_POOL_INIT || pool_size <= 0) {
         return 0;
     }
 
-    _PAGE_POOL = calloc(pool_size, sizeof(size_t));
-    if (!_PAGE_POOL) return 0;
+    _DEFAULT_POOL = buff_pool_create("default", pool_size, BUFF_POLICY_CLOCK);
+    if (!_DEFAULT_POOL) return 0;
 
+    _PAGE_POOL = _DEFAULT_POOL->pages;
     _POOL_SIZE = pool_size;
-
-    for (int i=0; i<_POOL_SIZE; i++) {
-        _PAGE_POOL[i] = calloc(1, sizeof(page));
-        sem_init(&(_PAGE_POOL[i]->locked), FALSE, 1);
-    }
-
     _POOL_INIT = TRUE;
     return 1;
 }
@@ -52,98 +428,402 @@ int buff_pool_init(int pool_size)
 
 void buff_pool_destroy()
 {
-    for (int i=0; i<_POOL_SIZE; i++) {
-        buff_flush(_PAGE_POOL[i]);
-        free(_PAGE_POOL[i]);
+    buff_pool_free(_DEFAULT_POOL);
+}
+
+
+/*
+ * How the default pool's frame arena is backed: one of the BUFF_HUGE_*
+ * constants.
+ */
+int buff_pool_hugepages()
+{
+    return _DEFAULT_POOL ? _DEFAULT_POOL->huge : BUFF_HUGE_NONE;
+}
+
+
+/*
+ * The number of NUMA partitions the default pool is split into.
+ */
+int buff_pool_nodes()
+{
+    return _DEFAULT_POOL ? _DEFAULT_POOL->node_cnt : 0;
+}
+
+
+static inline buff_pool *buff_pool_of(table *tbl)
+{
+    return (tbl && tbl->pool) ? tbl->pool : _DEFAULT_POOL;
+}
+
+
+static void buff_set_tag(buff_pool *pool, int frame, table *tbl, int blk_no)
+{
+    pool->pages[frame]->tbl = tbl;
+    pool->pages[frame]->blk_id = blk_no;
+    pool->tags[frame].tbl = tbl;
+    pool->tags[frame].blk_id = blk_no;
+}
+
+
+/*
+ * Release all of tbl's frames in its current pool, and cache its pages in
+ * pool from now on (or in the default pool, if pool is NULL). Returns 1 on
+ * success, and 0 if one of the table's pages is still pinned.
+ */
+int buff_pool_bind(table *tbl, buff_pool *pool)
+{
+    if (buff_evict_tbl(tbl) < 0) return 0;
+
+    tbl->pool = pool;
+    return 1;
+}
+
+
+/*
+ * The number of frames of pool currently holding pages of tbl, or, if tbl
+ * is NULL, the number of free frames.
+ */
+int buff_pool_resident(buff_pool *pool, table *tbl)
+{
+    int cnt = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (int i=0; i<pool->size; i++) {
+        if (pool->tags[i].tbl == tbl) cnt++;
     }
+    pthread_mutex_unlock(&pool->lock);
+
+    return cnt;
+}
+
+
+/*
+ * Attach cache to pool as its second tier, replacing any cache it already
+ * has (which is left for the caller to free), or detach it if cache is
+ * NULL. The cache must be newly created: one which has held pages may no
+ * longer match the tables' files. Returns 1 on success, and 0 if cache has
+ * held pages.
+ */
+int buff_pool_set_cache(buff_pool *pool, sc_cache *cache)
+{
+    if (cache && (cache->admits > 0 || cache->free_cnt < cache->slots)) return 0;
 
-    free(_PAGE_POOL);
+    pthread_mutex_lock(&pool->lock);
+    pool->cache = cache;
+    pthread_mutex_unlock(&pool->lock);
 
-    _PAGE_POOL = NULL;
-    _POOL_INIT = FALSE;
+    return 1;
 }
 
 
-page *buff_find_pg(table *tbl, int blk_no)
+static int buff_pool_find(buff_pool *pool, table *tbl, int blk_no)
 {
-    // search through page pool to see if it is in the buffer,
     // TODO: Replace the page_pool with a better data structure
     //       than array. Maybe a treemap or a hashmap?
+    for (int i=0; i<pool->size; i++) {
+        if (pool->tags[i].tbl == tbl && pool->tags[i].blk_id == blk_no) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 
-    page *pg = NULL;
-    for (int i=0; i<_POOL_SIZE; i++) {
+/*
+ * Choose an unpinned frame to evict, starting from the partition local to
+ * the calling thread and moving on to the others only if every frame in it
+ * is pinned. Under the clock policy each partition is swept from where its
+ * hand last stopped, passing over (and clearing the reference bit of) any
+ * frame referenced since the last sweep. Returns -1 if every frame is
+ * pinned.
+ */
+static int buff_pool_victim(buff_pool *pool)
+{
+    int local = buff_local_node(pool);
 
-        if (_PAGE_POOL[i]->tbl->name == tbl->name &&
-                _PAGE_POOL[i]->blk_id == blk_no) {
-            pg = _PAGE_POOL[i];
-            return pg;
+    for (int k=0; k<pool->node_cnt; k++) {
+        int n = (local + k) % pool->node_cnt;
+        int first = buff_node_first(pool, n);
+        int len = buff_node_first(pool, n + 1) - first;
+
+        if (pool->policy == BUFF_POLICY_FIRST) {
+            for (int i=first; i<first + len; i++) {
+                if (!pool->pages[i]->pinned) return i;
+            }
+            continue;
+        }
+
+        // Two sweeps are enough to find any unpinned frame
+        for (int s=0; s<2 * len; s++) {
+            int i = pool->hands[n];
+            pool->hands[n] = (i + 1 < first + len) ? i + 1 : first;
+
+            if (pool->pages[i]->pinned) continue;
+            if (pool->refs[i]) {
+                pool->refs[i] = 0;
+                continue;
+            }
+
+            return i;
         }
     }
 
-    return NULL;
+    return -1;
 }
 
 
-page *buff_find_and_load_pg(table *tbl, int blk_no)
+/*
+ * Evict the page in frame i, offering it to the pool's cache if it is
+ * clean, and writing it back to disk if not.
+ */
+static void buff_pool_evict(buff_pool *pool, int i)
 {
-    page *pg = buff_find_pg(tbl, blk_no);
+    page *pg = pool->pages[i];
+    if (!pg->tbl) return;
+
+    STAT_ADD(STAT_EVICTIONS, 1);
+    STAT_TBL_ADD(pg->tbl, STAT_EVICTIONS);
+
+    if (pool->cache && !pg->modified) sc_admit(pool->cache, pg->tbl, pg->blk_id, pg->data);
+
+    buff_pool_write(pool, pg);
+}
+
+
+/*
+ * Read block blk_no of tbl into data, from the pool's cache if it is
+ * there, and from the table's file if not.
+ */
+static void buff_pool_read(buff_pool *pool, table *tbl, int blk_no, byte *data)
+{
+    if (pool->cache && sc_read(pool->cache, tbl, blk_no, data)) return;
 
-    if (!pg) {
-        pg = buff_load(tbl, blk_no);
+    if (tbl->cmap) {
+        pgc_read_blk(tbl, blk_no, data);
+    } else {
+        blk_read(tbl->file, blk_no, data);
     }
+}
 
-    return pg;
+
+/*
+ * Evict a page to make room for block blk_no of tbl, and give its frame
+ * to the block, without filling in the data. Returns NULL if every frame
+ * is pinned.
+ */
+static page *buff_pool_claim(buff_pool *pool, table *tbl, int blk_no)
+{
+    int i = buff_pool_victim(pool);
+    if (i < 0) return NULL;
+
+    buff_pool_evict(pool, i);
+
+    buff_set_tag(pool, i, tbl, blk_no);
+    pool->pages[i]->pinned = 0;
+    sem_init(&pool->pages[i]->locked, 0, 1);
+    pool->pages[i]->modified = FALSE;
+    pool->refs[i] = 1;
+
+    return pool->pages[i];
 }
 
 
+static page *buff_pool_load(buff_pool *pool, table *tbl, int blk_no)
+{
+    page *pg = buff_pool_claim(pool, tbl, blk_no);
+    if (pg) buff_pool_read(pool, tbl, blk_no, pg->data);
 
-page *buff_load(table *tbl, int blk_no)
+    return pg;
+}
+
+
+static page *buff_pool_find_and_load(buff_pool *pool, table *tbl, int blk_no)
 {
-    // Find an unpinned page to evict
-    int loaded = FALSE;
+    int i = buff_pool_find(pool, tbl, blk_no);
 
-    while (!loaded) {
-        for (int i=0; !loaded && i<_POOL_SIZE; i++) {
-            if (!_PAGE_POOL[i]->pinned) {
+    if (i >= 0) {
+        STAT_ADD(STAT_HITS, 1);
+        STAT_TBL_ADD(tbl, STAT_HITS);
+        pool->refs[i] = 1;
+        return pool->pages[i];
+    }
 
-                // Write the contents of the evicted page back to disk
-                buff_flush(_PAGE_POOL[i]);
+    STAT_ADD(STAT_MISSES, 1);
+    STAT_TBL_ADD(tbl, STAT_MISSES);
 
-                // Read the new data, and initialize the page
-                blk_read(tbl->file, blk_no, _PAGE_POOL[i]->data);
-                _PAGE_POOL[i]->blk_id = blk_no;
-                _PAGE_POOL[i]->pinned = 0;
-                sem_init(&_PAGE_POOL[i]->locked, 0, 1);
-                _PAGE_POOL[i]->tbl = tbl;
-                _PAGE_POOL[i]->modified = FALSE;
+    STAT_TIMER(start);
+    page *pg = buff_pool_load(pool, tbl, blk_no);
+    STAT_RECORD(STAT_HIST_PIN_WAIT, start);
 
-                return _PAGE_POOL[i];
-            }
-        }
+    return pg;
+}
+
+
+page *buff_find_pg(table *tbl, int blk_no)
+{
+    if (tbl && tbl->map) {
+        if (blk_no < 0 || blk_no >= tbl->map_blks) return NULL;
+        return &tbl->map_pages[blk_no];
     }
 
-    return NULL;
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    int i = buff_pool_find(pool, tbl, blk_no);
+    pthread_mutex_unlock(&pool->lock);
+
+    return (i >= 0) ? pool->pages[i] : NULL;
+}
+
+
+page *buff_find_and_load_pg(table *tbl, int blk_no)
+{
+    if (tbl->map) return buff_find_pg(tbl, blk_no);
+
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    page *pg = buff_pool_find_and_load(pool, tbl, blk_no);
+    pthread_mutex_unlock(&pool->lock);
+
+    return pg;
 }
 
 
+/*
+ * Read block blk_no of tbl into a frame of the table's pool, evicting an
+ * unpinned page to make room. Returns NULL if every frame is pinned.
+ */
+page *buff_load(table *tbl, int blk_no)
+{
+    // Mapped tables have every page resident already
+    if (tbl->map) return buff_find_pg(tbl, blk_no);
+
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    page *pg = buff_pool_load(pool, tbl, blk_no);
+    pthread_mutex_unlock(&pool->lock);
+
+    return pg;
+}
+
+
+/*
+ * Write pg back to its table's file if it has been modified, as
+ * buff_pool_write does, taking the lock of the table's pool.
+ */
 void buff_flush(page* pg)
 {
-    if (pg->modified) {
-        blk_write(pg->tbl->file, pg->blk_id, pg->data);
+    if (!pg->tbl) return;
+
+    buff_pool *pool = pg->tbl->map ? NULL : buff_pool_of(pg->tbl);
+    if (pool) pthread_mutex_lock(&pool->lock);
+    buff_pool_write(pool, pg);
+    if (pool) pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+ * Write back any modified pages belonging to tbl, and then release their
+ * frames. This must be called before the table's file is closed, as
+ * otherwise a later eviction would attempt to write to it. Returns the
+ * number of frames released, or -1 if one of the table's pages is still
+ * pinned (in which case nothing is released).
+ */
+int buff_evict_tbl(table *tbl)
+{
+    if (tbl->map) return 0;
+
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (int i=0; i<pool->size; i++) {
+        if (pool->pages[i]->tbl == tbl && pool->pages[i]->pinned) {
+            pthread_mutex_unlock(&pool->lock);
+            return -1;
+        }
+    }
+
+    int released = 0;
+    for (int i=0; i<pool->size; i++) {
+        if (pool->pages[i]->tbl == tbl) {
+            buff_pool_write(pool, pool->pages[i]);
+            buff_set_tag(pool, i, NULL, 0);
+            pool->refs[i] = 0;
+            released++;
+        }
     }
+
+    // The table's file is about to be closed, and its handle may be reused
+    if (pool->cache) sc_invalidate_tbl(pool->cache, tbl);
+
+    pthread_mutex_unlock(&pool->lock);
+    return released;
 }
 
 
 void buff_erase(page* pg)
 {
-    memset(pg, 0, sizeof(page));
+    buff_pool *pool = buff_pool_of(pg->tbl);
+
+    memset(pg->data, 0, BLOCKSIZE);
+    if (pool && pg >= pool->frames && pg < pool->frames + pool->size) {
+        buff_set_tag(pool, pg - pool->frames, NULL, 0);
+    }
+    pg->modified = FALSE;
+    pg->pinned = 0;
 }
 
 
 page *buff_pin(table *tbl, int blk_no)
 {
-    page *pg = buff_find_and_load_pg(tbl, blk_no);
-    pg->pinned += 1;
+    // Mapped pages are shared by concurrent scans without any pool lock
+    if (tbl->map) {
+        page *pg = buff_find_pg(tbl, blk_no);
+        if (pg) __atomic_add_fetch(&pg->pinned, 1, __ATOMIC_RELAXED);
+        return pg;
+    }
+
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    page *pg = buff_pool_find_and_load(pool, tbl, blk_no);
+    if (pg) pg->pinned += 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    return pg;
+}
+
+
+/*
+ * Pin a page for block blk_no of tbl, which has just been added to the
+ * table's file and is all zeroes, without reading it. The page starts out
+ * zeroed and marked modified. Returns NULL for mapped tables, or if every
+ * frame is pinned.
+ */
+page *buff_pin_new(table *tbl, int blk_no)
+{
+    buff_pool *pool = buff_pool_of(tbl);
+    if (tbl->map || !pool) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    int i = buff_pool_find(pool, tbl, blk_no);
+    page *pg = (i >= 0) ? pool->pages[i] : buff_pool_claim(pool, tbl, blk_no);
+    if (pg) {
+        memset(pg->data, 0, BLOCKSIZE);
+        pg->modified = TRUE;
+        pg->pinned += 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
 
     return pg;
 }
@@ -151,13 +831,35 @@ page *buff_pin(table *tbl, int blk_no)
 
 int buff_unpin(table *tbl, int blk_no) 
 {
-    page *pg = buff_find_pg(tbl, blk_no);
+    if (tbl->map) {
+        page *pg = buff_find_pg(tbl, blk_no);
+        if (!pg) return 0;
 
-    if (!pg) return 0;
-    if (pg->pinned == 0) return -1;
+        int pinned = __atomic_load_n(&pg->pinned, __ATOMIC_RELAXED);
+        do {
+            if (pinned == 0) return -1;
+        } while (!__atomic_compare_exchange_n(&pg->pinned, &pinned, pinned - 1, TRUE,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return 1;
+    }
 
-    pg->pinned -= 1;
-    return 1;
+    buff_pool *pool = buff_pool_of(tbl);
+    if (!pool) return 0;
+
+    int resp = 1;
+
+    pthread_mutex_lock(&pool->lock);
+    int i = buff_pool_find(pool, tbl, blk_no);
+    if (i < 0) {
+        resp = 0;
+    } else if (pool->pages[i]->pinned == 0) {
+        resp = -1;
+    } else {
+        pool->pages[i]->pinned -= 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return resp;
 }
 
 
@@ -188,6 +890,632 @@ int buff_modified(table *tbl, int blk_no)
     page *pg = buff_find_pg(tbl, blk_no);
     if (!pg) return 0;
 
+    // Mapped pages are read-only
+    if (tbl->map) return -1;
+
     pg->modified = TRUE;
     return 1;
 }
+
+
+/*
+ * Batch pins
+ *
+ * buff_pin_batch takes each pool's lock once for all of the batch's pages
+ * in that pool. Pages already resident are pinned straight away. Frames
+ * are then claimed, and pinned, for all of the missing pages before any
+ * of them is read, so that the reads can be issued together: the misses
+ * are sorted by table and block, and each run of consecutive blocks of an
+ * uncompressed table is read with a single read. A block named more than
+ * once in a batch is read once, and pinned once per handle.
+ */
+typedef struct buff_miss {
+    table *tbl;
+    int blk_no;
+    int handle;
+} buff_miss;
+
+
+static int buff_miss_cmp(const void *a, const void *b)
+{
+    const buff_miss *x = a, *y = b;
+    if (x->tbl != y->tbl) return ((uintptr_t) x->tbl > (uintptr_t) y->tbl) -
+                                 ((uintptr_t) x->tbl < (uintptr_t) y->tbl);
+    return (x->blk_no > y->blk_no) - (x->blk_no < y->blk_no);
+}
+
+
+/*
+ * The end of the run of misses starting at misses[i]: consecutive blocks
+ * of one table, up to BUFF_PIN_RUN of them, and repeats of the last one.
+ * The number of blocks in the run is left in run.
+ */
+static int buff_miss_run(buff_miss *misses, int cnt, int i, int *run)
+{
+    table *tbl = misses[i].tbl;
+    int first = misses[i].blk_no;
+
+    int end = i + 1;
+    *run = 1;
+    while (end < cnt && misses[end].tbl == tbl && !tbl->cmap) {
+        int gap = misses[end].blk_no - (first + *run - 1);
+        if (gap > 1 || (gap == 1 && *run == BUFF_PIN_RUN)) break;
+        *run += gap;
+        end++;
+    }
+
+    return end;
+}
+
+
+/*
+ * Read the blocks of the claimed frames of misses, in runs of up to
+ * BUFF_PIN_RUN consecutive blocks. When there is more than one run, the
+ * operating system is first asked to start reading all of them, so that
+ * the reads overlap rather than each waiting on the last.
+ */
+static void buff_pool_read_misses(buff_handle *handles, buff_miss *misses, int cnt)
+{
+    byte *stage = NULL;
+    int run;
+
+    if (cnt > 0 && buff_miss_run(misses, cnt, 0, &run) < cnt) {
+        for (int i=0; i<cnt; ) {
+            int end = buff_miss_run(misses, cnt, i, &run);
+            if (!misses[i].tbl->cmap) blk_prefetch(misses[i].tbl->file, misses[i].blk_no, run);
+            i = end;
+        }
+    }
+
+    for (int i=0; i<cnt; ) {
+        table *tbl = misses[i].tbl;
+        int first = misses[i].blk_no;
+        int end = buff_miss_run(misses, cnt, i, &run);
+
+        if (run > 1 && !stage) stage = malloc((size_t) BUFF_PIN_RUN * BLOCKSIZE);
+
+        if (run > 1 && stage) {
+            blk_read_n(tbl->file, first, stage, run);
+            for (int k=i; k<end; k++) {
+                if (k > i && misses[k].blk_no == misses[k - 1].blk_no) continue;
+                memcpy(handles[misses[k].handle].pg->data,
+                       stage + (size_t) (misses[k].blk_no - first) * BLOCKSIZE, BLOCKSIZE);
+            }
+        } else {
+            for (int k=i; k<end; k++) {
+                if (k > i && misses[k].blk_no == misses[k - 1].blk_no) continue;
+
+                page *pg = handles[misses[k].handle].pg;
+                if (tbl->cmap) {
+                    pgc_read_blk(tbl, misses[k].blk_no, pg->data);
+                } else {
+                    blk_read(tbl->file, misses[k].blk_no, pg->data);
+                }
+            }
+        }
+
+        i = end;
+    }
+
+    free(stage);
+}
+
+
+/*
+ * Read those of the claimed frames of misses whose blocks are in the
+ * pool's cache from there, and remove them from misses, so that only the
+ * rest are read from the tables' files. Returns the number left.
+ */
+static int buff_pool_read_cached(buff_pool *pool, buff_handle *handles, buff_miss *misses,
+                                 int cnt)
+{
+    int left = 0, hit = FALSE;
+
+    for (int k=0; k<cnt; k++) {
+        // Repeats of a block share its frame, and its fate
+        if (k == 0 || misses[k].tbl != misses[k - 1].tbl ||
+                misses[k].blk_no != misses[k - 1].blk_no) {
+            hit = sc_read(pool->cache, misses[k].tbl, misses[k].blk_no,
+                          handles[misses[k].handle].pg->data);
+        }
+
+        if (!hit) misses[left++] = misses[k];
+    }
+
+    return left;
+}
+
+
+/*
+ * Pin the pages of the batch which are cached in pool, with the pool's
+ * lock held. Returns 1 on success, and 0, having pinned nothing, if there
+ * are too few unpinned frames for the missing pages.
+ */
+static int buff_pool_pin_batch(buff_pool *pool, buff_handle *handles, int cnt)
+{
+    buff_miss *misses = NULL;
+    int miss_cnt = 0;
+
+    for (int i=0; i<cnt; i++) {
+        buff_handle *h = &handles[i];
+        if (h->pg || h->tbl->map || buff_pool_of(h->tbl) != pool) continue;
+
+        int f = buff_pool_find(pool, h->tbl, h->blk_no);
+        if (f >= 0) {
+            STAT_ADD(STAT_HITS, 1);
+            STAT_TBL_ADD(h->tbl, STAT_HITS);
+            pool->refs[f] = 1;
+            pool->pages[f]->pinned += 1;
+            h->pg = pool->pages[f];
+            continue;
+        }
+
+        if (!misses && !(misses = malloc(sizeof(buff_miss) * cnt))) goto fail;
+        misses[miss_cnt++] = (buff_miss) {.tbl = h->tbl, .blk_no = h->blk_no, .handle = i};
+    }
+
+    if (miss_cnt == 0) return 1;
+
+    qsort(misses, miss_cnt, sizeof(buff_miss), buff_miss_cmp);
+
+    for (int k=0; k<miss_cnt; k++) {
+        buff_handle *h = &handles[misses[k].handle];
+
+        if (k > 0 && misses[k].tbl == misses[k - 1].tbl &&
+                misses[k].blk_no == misses[k - 1].blk_no) {
+            h->pg = handles[misses[k - 1].handle].pg;
+            h->pg->pinned += 1;
+            continue;
+        }
+
+        int i = buff_pool_victim(pool);
+        if (i < 0) goto fail;
+
+        STAT_ADD(STAT_MISSES, 1);
+        STAT_TBL_ADD(h->tbl, STAT_MISSES);
+
+        buff_pool_evict(pool, i);
+        buff_set_tag(pool, i, h->tbl, h->blk_no);
+        pool->pages[i]->pinned = 1;
+        pool->pages[i]->modified = FALSE;
+        sem_init(&pool->pages[i]->locked, 0, 1);
+        pool->refs[i] = 1;
+        h->pg = pool->pages[i];
+    }
+
+    STAT_TIMER(start);
+    if (pool->cache) miss_cnt = buff_pool_read_cached(pool, handles, misses, miss_cnt);
+    buff_pool_read_misses(handles, misses, miss_cnt);
+    STAT_RECORD(STAT_HIST_PIN_WAIT, start);
+
+    free(misses);
+    return 1;
+
+fail:
+    // Release everything pinned here, and the frames claimed but not read
+    for (int i=0; i<cnt; i++) {
+        buff_handle *h = &handles[i];
+        if (!h->pg || h->tbl->map || buff_pool_of(h->tbl) != pool) continue;
+
+        if (--h->pg->pinned == 0 && misses) {
+            for (int k=0; k<miss_cnt; k++) {
+                if (misses[k].handle == i) {
+                    buff_set_tag(pool, h->pg - pool->frames, NULL, 0);
+                    pool->refs[h->pg - pool->frames] = 0;
+                    break;
+                }
+            }
+        }
+
+        h->pg = NULL;
+    }
+
+    free(misses);
+    return 0;
+}
+
+
+/*
+ * Pin the pages named by cnt handles, which may belong to any tables, in
+ * any pools, and may repeat. On success, each handle's pg is set to its
+ * pinned page, and 1 is returned. If the pages can't all be pinned at
+ * once, none are, and 0 is returned.
+ */
+int buff_pin_batch(buff_handle *handles, int cnt)
+{
+    for (int i=0; i<cnt; i++) handles[i].pg = NULL;
+
+    for (int i=0; i<cnt; i++) {
+        buff_handle *h = &handles[i];
+        if (h->pg) continue;
+
+        if (h->tbl->map) {
+            h->pg = buff_pin(h->tbl, h->blk_no);
+            if (!h->pg) goto fail;
+            continue;
+        }
+
+        buff_pool *pool = buff_pool_of(h->tbl);
+        if (!pool) goto fail;
+
+        pthread_mutex_lock(&pool->lock);
+        int ok = buff_pool_pin_batch(pool, handles, cnt);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!ok) goto fail;
+    }
+
+    return 1;
+
+fail:
+    buff_unpin_batch(handles, cnt);
+    return 0;
+}
+
+
+/*
+ * Unpin the pages of cnt handles pinned by buff_pin_batch, taking each
+ * pool's lock once, and clear the handles' pages. Handles with no page
+ * are skipped.
+ */
+void buff_unpin_batch(buff_handle *handles, int cnt)
+{
+    for (int i=0; i<cnt; i++) {
+        buff_handle *h = &handles[i];
+        if (!h->pg) continue;
+
+        if (h->tbl->map) {
+            __atomic_sub_fetch(&h->pg->pinned, 1, __ATOMIC_RELAXED);
+            h->pg = NULL;
+            continue;
+        }
+
+        buff_pool *pool = buff_pool_of(h->tbl);
+
+        pthread_mutex_lock(&pool->lock);
+        for (int j=i; j<cnt; j++) {
+            buff_handle *o = &handles[j];
+            if (!o->pg || o->tbl->map || buff_pool_of(o->tbl) != pool) continue;
+
+            if (o->pg->pinned > 0) o->pg->pinned -= 1;
+            o->pg = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+/*
+ * Mark the page of a pinned handle as modified. Returns 1 on success, 0 if
+ * the handle isn't pinned, and -1 if its page is read-only (mapped).
+ */
+int buff_modified_handle(buff_handle *handle)
+{
+    if (!handle->pg) return 0;
+    if (handle->tbl->map) return -1;
+
+    handle->pg->modified = TRUE;
+    return 1;
+}
+
+
+/*
+ * Pool dumps
+ *
+ * A dump lists the (table, block) pairs resident in a pool, naming tables
+ * by database and name, since table handles don't survive a restart. Pages
+ * referenced since the last clock sweep are listed first, so that if the
+ * dump is loaded into a smaller pool the hottest pages are the ones kept.
+ * Dumps are written to a temporary file and renamed into place, so they
+ * may be taken periodically while the pool is in use without a crash ever
+ * leaving a partial one behind.
+ *
+ * Warming only ever fills free frames, and never evicts, so that pages
+ * loaded by traffic that arrives while a background warm is running are
+ * kept. The pages to load are sorted by table and block, and read in runs
+ * of up to BUFF_WARM_BATCH consecutive blocks with a single read each,
+ * holding the pool lock only for one run at a time.
+ */
+#define BUFF_DUMP_MAGIC 0x59485044      // "YHPD"
+
+typedef struct buff_dump_hdr {
+    uint32_t magic;
+    int blocksize;
+    int cnt;
+} buff_dump_hdr;
+
+typedef struct buff_dump_entry {
+    char db[MAX_DB_NAME];
+    char name[MAX_TBL_NAME];
+    int blk_id;
+} buff_dump_entry;
+
+typedef struct buff_warm_pg {
+    int tbl;
+    int blk_id;
+    int order;
+} buff_warm_pg;
+
+
+static void buff_dump_fill(buff_dump_entry *e, page *pg)
+{
+    memcpy(e->db, pg->tbl->db, MAX_DB_NAME);
+    memcpy(e->name, pg->tbl->name, MAX_TBL_NAME);
+    e->blk_id = pg->blk_id;
+}
+
+
+/*
+ * Write the list of pages resident in pool (or the default pool, if pool
+ * is NULL) to path. Returns the number of pages listed, or -1 on error.
+ */
+int buff_pool_dump(buff_pool *pool, char *path)
+{
+    if (!pool) pool = _DEFAULT_POOL;
+    if (!pool) return -1;
+
+    buff_dump_entry *entries = malloc(sizeof(buff_dump_entry) * pool->size);
+    if (!entries) return -1;
+
+    int cnt = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int hot=1; hot>=0; hot--) {
+        for (int i=0; i<pool->size; i++) {
+            if (pool->tags[i].tbl && (pool->refs[i] != 0) == hot) {
+                buff_dump_fill(&entries[cnt++], pool->pages[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    size_t len = strlen(path) + 5;
+    char *tmp = malloc(len);
+    if (!tmp) {
+        free(entries);
+        return -1;
+    }
+    snprintf(tmp, len, "%s.tmp", path);
+
+    buff_dump_hdr hdr = {.magic = BUFF_DUMP_MAGIC, .blocksize = BLOCKSIZE, .cnt = cnt};
+    FILE *file = fopen(tmp, "w");
+    int ok = file && fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+             (cnt == 0 || fwrite(entries, sizeof(buff_dump_entry), cnt, file) == (size_t) cnt);
+    if (file) ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+
+    if (!ok) remove(tmp);
+    free(tmp);
+    free(entries);
+
+    return ok ? cnt : -1;
+}
+
+
+static int buff_warm_cmp(const void *a, const void *b)
+{
+    const buff_warm_pg *x = a, *y = b;
+    if (x->tbl != y->tbl) return (x->tbl > y->tbl) - (x->tbl < y->tbl);
+    return (x->blk_id > y->blk_id) - (x->blk_id < y->blk_id);
+}
+
+
+/*
+ * Read a dump, keeping only the pages of the given tables which still
+ * exist, in the order listed. Returns the number kept, or -1 on error.
+ */
+static int buff_warm_read(char *path, table **tbls, int tbl_cnt, buff_warm_pg **pgs)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+
+    buff_dump_hdr hdr;
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != BUFF_DUMP_MAGIC ||
+            hdr.blocksize != BLOCKSIZE || hdr.cnt < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    *pgs = malloc(sizeof(buff_warm_pg) * (hdr.cnt + 1));
+    if (!*pgs) {
+        fclose(file);
+        return -1;
+    }
+
+    int cnt = 0;
+    buff_dump_entry e;
+    for (int i=0; i<hdr.cnt && fread(&e, sizeof(e), 1, file) == 1; i++) {
+        e.db[MAX_DB_NAME - 1] = '\0';
+        e.name[MAX_TBL_NAME - 1] = '\0';
+
+        for (int t=0; t<tbl_cnt; t++) {
+            table *tbl = tbls[t];
+            if (!tbl || tbl->map || strcmp(tbl->db, e.db) || strcmp(tbl->name, e.name)) continue;
+
+            if (e.blk_id >= TBL_FIRST_BLK && e.blk_id < TBL_FIRST_BLK + tbl_blk_cnt(tbl)) {
+                (*pgs)[cnt++] = (buff_warm_pg) {.tbl = t, .blk_id = e.blk_id, .order = i};
+            }
+            break;
+        }
+    }
+
+    fclose(file);
+    return cnt;
+}
+
+
+/*
+ * Load one run of consecutive blocks of tbl into free frames of pool, with
+ * a single read for uncompressed tables. Blocks which are already resident
+ * are skipped. Returns the number of pages loaded, or -1 once the pool has
+ * no free frames left.
+ */
+static int buff_warm_run(buff_pool *pool, table *tbl, int first, int cnt, byte *stage,
+                         int *cursor)
+{
+    int frames[BUFF_WARM_BATCH];
+    int loaded = 0;
+    int full = FALSE;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (int k=0; k<cnt; k++) {
+        frames[k] = -1;
+        if (full || buff_pool_find(pool, tbl, first + k) >= 0) continue;
+
+        while (*cursor < pool->size &&
+               (pool->tags[*cursor].tbl || pool->pages[*cursor]->pinned)) {
+            (*cursor)++;
+        }
+
+        if (*cursor == pool->size) {
+            full = TRUE;
+            continue;
+        }
+
+        frames[k] = (*cursor)++;
+    }
+
+    int claimed = 0;
+    for (int k=0; k<cnt; k++) claimed += frames[k] >= 0;
+
+    if (claimed > 0 && !tbl->cmap) blk_read_n(tbl->file, first, stage, cnt);
+
+    for (int k=0; k<cnt; k++) {
+        int i = frames[k];
+        if (i < 0) continue;
+
+        if (tbl->cmap) {
+            pgc_read_blk(tbl, first + k, pool->pages[i]->data);
+        } else {
+            memcpy(pool->pages[i]->data, stage + (size_t) k * BLOCKSIZE, BLOCKSIZE);
+        }
+
+        buff_set_tag(pool, i, tbl, first + k);
+        pool->pages[i]->pinned = 0;
+        pool->pages[i]->modified = FALSE;
+        sem_init(&pool->pages[i]->locked, 0, 1);
+        pool->refs[i] = 0;
+        loaded++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return (full && loaded == 0) ? -1 : loaded;
+}
+
+
+static int buff_pool_warm_load(buff_pool *pool, char *path, table **tbls, int tbl_cnt,
+                               _Atomic int *progress)
+{
+    if (!pool) pool = _DEFAULT_POOL;
+    if (!pool) return -1;
+
+    // Only the free frames are filled, and if there are fewer of them than
+    // pages in the dump, it is the first (hottest) pages that are loaded
+    int free_cnt = buff_pool_resident(pool, NULL);
+
+    buff_warm_pg *pgs;
+    int cnt = buff_warm_read(path, tbls, tbl_cnt, &pgs);
+    if (cnt < 0) return -1;
+    if (cnt > free_cnt) cnt = free_cnt;
+
+    qsort(pgs, cnt, sizeof(buff_warm_pg), buff_warm_cmp);
+
+    byte *stage = malloc((size_t) BUFF_WARM_BATCH * BLOCKSIZE);
+    if (!stage) {
+        free(pgs);
+        return -1;
+    }
+
+    int loaded = 0;
+    int cursor = 0;
+    for (int i=0; i<cnt; ) {
+        // Extend the run while the blocks are consecutive
+        int run = 1;
+        while (i + run < cnt && run < BUFF_WARM_BATCH && pgs[i + run].tbl == pgs[i].tbl &&
+               pgs[i + run].blk_id == pgs[i].blk_id + run) {
+            run++;
+        }
+
+        int resp = buff_warm_run(pool, tbls[pgs[i].tbl], pgs[i].blk_id, run, stage, &cursor);
+        if (resp < 0) break;
+
+        loaded += resp;
+        if (progress) atomic_store(progress, loaded);
+        i += run;
+    }
+
+    free(stage);
+    free(pgs);
+    return loaded;
+}
+
+
+/*
+ * Load the pages listed in the dump at path into the free frames of pool
+ * (or of the default pool, if pool is NULL). Pages are matched to the
+ * open tables in tbls by database and name; pages of other tables are
+ * ignored. Returns the number of pages loaded, or -1 if the dump could not
+ * be read.
+ */
+int buff_pool_warm(buff_pool *pool, char *path, table **tbls, int tbl_cnt)
+{
+    return buff_pool_warm_load(pool, path, tbls, tbl_cnt, NULL);
+}
+
+
+static void *buff_warmer_main(void *arg)
+{
+    buff_warmer *w = arg;
+    int loaded = buff_pool_warm_load(w->pool, w->path, w->tbls, w->tbl_cnt, &w->loaded);
+    atomic_store(&w->loaded, loaded);
+
+    return NULL;
+}
+
+
+/*
+ * As buff_pool_warm, but run on a background thread, so that the pool can
+ * be used while it warms. The tables must stay open until the warmer has
+ * been passed to buff_pool_warm_finish. Returns NULL if the thread could
+ * not be started.
+ */
+buff_warmer *buff_pool_warm_start(buff_pool *pool, char *path, table **tbls, int tbl_cnt)
+{
+    buff_warmer *w = calloc(1, sizeof(buff_warmer));
+    if (!w) return NULL;
+
+    w->pool = pool;
+    w->tbl_cnt = tbl_cnt;
+    w->path = strdup(path);
+    w->tbls = malloc(sizeof(table *) * (tbl_cnt + 1));
+
+    if (!w->path || !w->tbls) goto error;
+    memcpy(w->tbls, tbls, sizeof(table *) * tbl_cnt);
+
+    if (pthread_create(&w->thread, NULL, buff_warmer_main, w) != 0) goto error;
+    return w;
+
+error:
+    free(w->path);
+    free(w->tbls);
+    free(w);
+    return NULL;
+}
+
+
+/*
+ * Wait for a background warm to complete, and release the warmer. Returns
+ * the number of pages loaded, or -1 if the dump could not be read.
+ */
+int buff_pool_warm_finish(buff_warmer *warmer)
+{
+    pthread_join(warmer->thread, NULL);
+    int loaded = atomic_load(&warmer->loaded);
+
+    free(warmer->path);
+    free(warmer->tbls);
+    free(warmer);
+
+    return loaded;
+}
@@ -0,0 +1,809 @@
+/* pgcompress.c
+ *
+ * Per-page compression for yahi-db tables.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockio.h"
+#include "pgcompress.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+// Tag byte at the start of each stored page
+#define PGC_TAG_RAW 0
+#define PGC_TAG_LIGHT 1
+#define PGC_TAG_LZ4 2
+
+// Per-column encodings within a PGC_TAG_LIGHT page
+#define PGC_ENC_RAW 0
+#define PGC_ENC_FOR 1
+#define PGC_ENC_RLE 2
+#define PGC_ENC_DICT 3
+
+#define PGC_MAX_DICT 255
+#define PGC_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 6)
+
+/*
+ * Bounded output and input cursors. Once an operation would overrun the
+ * buffer, ok is cleared and all further operations are ignored, so that
+ * the encoders can be written without checking after every step.
+ */
+typedef struct pgc_cursor {
+    byte *data;
+    int len;
+    int cap;
+    int ok;
+} pgc_cursor;
+
+
+static void pgc_put(pgc_cursor *c, const void *src, int n)
+{
+    if (!c->ok || c->len + n > c->cap) {
+        c->ok = FALSE;
+        return;
+    }
+
+    memcpy(c->data + c->len, src, n);
+    c->len += n;
+}
+
+
+static void pgc_put8(pgc_cursor *c, int v)
+{
+    uint8_t b = v;
+    pgc_put(c, &b, 1);
+}
+
+
+static void pgc_put16(pgc_cursor *c, int v)
+{
+    uint16_t h = v;
+    pgc_put(c, &h, 2);
+}
+
+
+static void pgc_get(pgc_cursor *c, void *dst, int n)
+{
+    if (!c->ok || c->len + n > c->cap) {
+        c->ok = FALSE;
+        memset(dst, 0, n);
+        return;
+    }
+
+    memcpy(dst, c->data + c->len, n);
+    c->len += n;
+}
+
+
+static int pgc_get8(pgc_cursor *c)
+{
+    uint8_t b;
+    pgc_get(c, &b, 1);
+    return b;
+}
+
+
+static int pgc_get16(pgc_cursor *c)
+{
+    uint16_t h;
+    pgc_get(c, &h, 2);
+    return h;
+}
+
+
+static int pgc_bits(uint32_t v)
+{
+    int bits = 0;
+    while (v) {
+        bits++;
+        v >>= 1;
+    }
+
+    return bits;
+}
+
+
+static int pgc_packed_size(int n, int bits)
+{
+    return (n * bits + 7) / 8;
+}
+
+
+/*
+ * Write n values of the given bit width, least significant bits first.
+ */
+static void pgc_pack(pgc_cursor *c, uint32_t *vals, int n, int bits)
+{
+    uint64_t acc = 0;
+    int acc_bits = 0;
+
+    for (int i=0; i<n; i++) {
+        acc |= (uint64_t) vals[i] << acc_bits;
+        acc_bits += bits;
+
+        while (acc_bits >= 8) {
+            pgc_put8(c, acc & 0xff);
+            acc >>= 8;
+            acc_bits -= 8;
+        }
+    }
+
+    if (acc_bits > 0) pgc_put8(c, acc & 0xff);
+}
+
+
+static void pgc_unpack(pgc_cursor *c, uint32_t *vals, int n, int bits)
+{
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    uint64_t mask = (bits == 32) ? 0xffffffffULL : ((1ULL << bits) - 1);
+
+    for (int i=0; i<n; i++) {
+        while (acc_bits < bits) {
+            acc |= (uint64_t) pgc_get8(c) << acc_bits;
+            acc_bits += 8;
+        }
+
+        vals[i] = acc & mask;
+        acc >>= bits;
+        acc_bits -= bits;
+    }
+}
+
+
+static void pgc_encode_int(pgc_cursor *c, int *vals, int n)
+{
+    int min = vals[0], max = vals[0], runs = 1;
+    for (int i=1; i<n; i++) {
+        if (vals[i] < min) min = vals[i];
+        if (vals[i] > max) max = vals[i];
+        if (vals[i] != vals[i-1]) runs++;
+    }
+
+    int bits = pgc_bits((uint32_t) max - (uint32_t) min);
+    int for_size = sizeof(int) + 1 + pgc_packed_size(n, bits);
+    int rle_size = 2 + runs * (sizeof(int) + 2);
+    int raw_size = n * sizeof(int);
+
+    if (for_size <= rle_size && for_size < raw_size) {
+        pgc_put8(c, PGC_ENC_FOR);
+        pgc_put(c, &min, sizeof(int));
+        pgc_put8(c, bits);
+
+        uint32_t deltas[n];
+        for (int i=0; i<n; i++) deltas[i] = (uint32_t) vals[i] - (uint32_t) min;
+        pgc_pack(c, deltas, n, bits);
+    } else if (rle_size < raw_size) {
+        pgc_put8(c, PGC_ENC_RLE);
+        pgc_put16(c, runs);
+
+        int start = 0;
+        for (int i=1; i<=n; i++) {
+            if (i == n || vals[i] != vals[start]) {
+                pgc_put(c, &vals[start], sizeof(int));
+                pgc_put16(c, i - start);
+                start = i;
+            }
+        }
+    } else {
+        pgc_put8(c, PGC_ENC_RAW);
+        pgc_put(c, vals, raw_size);
+    }
+}
+
+
+static void pgc_decode_int(pgc_cursor *c, int *vals, int n)
+{
+    int enc = pgc_get8(c);
+
+    if (enc == PGC_ENC_FOR) {
+        int min;
+        pgc_get(c, &min, sizeof(int));
+        int bits = pgc_get8(c);
+
+        uint32_t deltas[n];
+        pgc_unpack(c, deltas, n, bits);
+        for (int i=0; i<n; i++) vals[i] = (int) ((uint32_t) min + deltas[i]);
+    } else if (enc == PGC_ENC_RLE) {
+        int runs = pgc_get16(c);
+        int i = 0;
+
+        for (int r=0; r<runs && c->ok; r++) {
+            int v;
+            pgc_get(c, &v, sizeof(int));
+            int len = pgc_get16(c);
+
+            for (int k=0; k<len && i<n; k++) vals[i++] = v;
+        }
+
+        if (i != n) c->ok = FALSE;
+    } else {
+        pgc_get(c, vals, n * sizeof(int));
+    }
+}
+
+
+/*
+ * Dictionary encode n CHAR values of the given length (stored back to
+ * back in vals), falling back to raw storage when there are too many
+ * distinct values for it to pay off.
+ */
+static void pgc_encode_char(pgc_cursor *c, char *vals, int n, int length)
+{
+    uint32_t codes[n];
+    int dict[PGC_MAX_DICT];
+    int dict_cnt = 0;
+
+    for (int i=0; i<n && dict_cnt <= PGC_MAX_DICT; i++) {
+        int d = 0;
+        while (d < dict_cnt && memcmp(vals + dict[d] * length, vals + i * length, length)) d++;
+
+        if (d == dict_cnt) {
+            if (dict_cnt == PGC_MAX_DICT) {
+                dict_cnt++;
+                break;
+            }
+            dict[dict_cnt++] = i;
+        }
+
+        codes[i] = d;
+    }
+
+    int bits = (dict_cnt > 1) ? pgc_bits(dict_cnt - 1) : 0;
+    int dict_size = 1 + dict_cnt * length + pgc_packed_size(n, bits);
+
+    if (dict_cnt <= PGC_MAX_DICT && dict_size < n * length) {
+        pgc_put8(c, PGC_ENC_DICT);
+        pgc_put8(c, dict_cnt);
+        for (int d=0; d<dict_cnt; d++) {
+            pgc_put(c, vals + dict[d] * length, length);
+        }
+        pgc_pack(c, codes, n, bits);
+    } else {
+        pgc_put8(c, PGC_ENC_RAW);
+        pgc_put(c, vals, n * length);
+    }
+}
+
+
+static void pgc_decode_char(pgc_cursor *c, char *vals, int n, int length)
+{
+    int enc = pgc_get8(c);
+
+    if (enc == PGC_ENC_DICT) {
+        int dict_cnt = pgc_get8(c);
+        char dict[dict_cnt ? dict_cnt * length : 1];
+        pgc_get(c, dict, dict_cnt * length);
+
+        int bits = (dict_cnt > 1) ? pgc_bits(dict_cnt - 1) : 0;
+        uint32_t codes[n];
+        pgc_unpack(c, codes, n, bits);
+
+        for (int i=0; i<n; i++) {
+            if (codes[i] >= (uint32_t) dict_cnt) {
+                c->ok = FALSE;
+                return;
+            }
+            memcpy(vals + i * length, dict + codes[i] * length, length);
+        }
+    } else {
+        pgc_get(c, vals, n * length);
+    }
+}
+
+
+/*
+ * Encode a page column by column. Returns the encoded length, or 0 if it
+ * would not fit within cap bytes.
+ */
+static int pgc_light_compress(table *tbl, byte *page, byte *out, int cap)
+{
+    pgc_cursor c = {.data = out, .cap = cap, .ok = TRUE};
+    schema *sch = &tbl->fields;
+    int n = tbl_recs_per_blk(tbl);
+    int used = n * sch->record_length;
+    int offset = 0;
+
+    for (int f=0; f<sch->field_cnt && c.ok; f++) {
+        int len = sch->field_lengths[f];
+
+        switch (sch->field_types[f]) {
+            case INT: {
+                int vals[n];
+                for (int i=0; i<n; i++) vals[i] = tp_getasint(page, i * sch->record_length + offset);
+                pgc_encode_int(&c, vals, n);
+                break;
+            }
+            case CHAR: {
+                char vals[n * len];
+                for (int i=0; i<n; i++) memcpy(vals + i * len, page + i * sch->record_length + offset, len);
+                pgc_encode_char(&c, vals, n, len);
+                break;
+            }
+            default:
+                for (int i=0; i<n; i++) pgc_put(&c, page + i * sch->record_length + offset, len);
+                break;
+        }
+
+        offset += len;
+    }
+
+    // The bytes following the last record are almost always zero
+    int tail_zero = TRUE;
+    for (int i=used; i<BLOCKSIZE; i++) {
+        if (page[i]) tail_zero = FALSE;
+    }
+
+    pgc_put8(&c, tail_zero);
+    if (!tail_zero) pgc_put(&c, page + used, BLOCKSIZE - used);
+
+    return c.ok ? c.len : 0;
+}
+
+
+static int pgc_light_decompress(table *tbl, byte *in, int length, byte *page)
+{
+    pgc_cursor c = {.data = in, .cap = length, .ok = TRUE};
+    schema *sch = &tbl->fields;
+    int n = tbl_recs_per_blk(tbl);
+    int used = n * sch->record_length;
+    int offset = 0;
+
+    for (int f=0; f<sch->field_cnt && c.ok; f++) {
+        int len = sch->field_lengths[f];
+
+        switch (sch->field_types[f]) {
+            case INT: {
+                int vals[n];
+                pgc_decode_int(&c, vals, n);
+                for (int i=0; i<n; i++) tp_setint(page, i * sch->record_length + offset, vals[i]);
+                break;
+            }
+            case CHAR: {
+                char vals[n * len];
+                pgc_decode_char(&c, vals, n, len);
+                for (int i=0; i<n; i++) memcpy(page + i * sch->record_length + offset, vals + i * len, len);
+                break;
+            }
+            default:
+                for (int i=0; i<n; i++) pgc_get(&c, page + i * sch->record_length + offset, len);
+                break;
+        }
+
+        offset += len;
+    }
+
+    if (pgc_get8(&c)) {
+        memset(page + used, 0, BLOCKSIZE - used);
+    } else {
+        pgc_get(&c, page + used, BLOCKSIZE - used);
+    }
+
+    return c.ok;
+}
+
+
+/*
+ * LZ4
+ *
+ * A small implementation of the LZ4 block format: a sequence of (literal
+ * run, match) pairs, each introduced by a token byte holding the literal
+ * and match lengths, with longer lengths continued in following bytes. The
+ * compressor is the simple greedy one, using a hash table of the positions
+ * of recent 4-byte sequences. As the format requires, the last 5 bytes are
+ * always literals, and no match starts within the last 12 bytes.
+ */
+#define LZ4_MINMATCH 4
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_HASH_BITS 12
+
+static inline uint32_t lz4_read32(byte *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+
+static inline int lz4_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+
+static void lz4_put_length(pgc_cursor *c, int len)
+{
+    while (len >= 255) {
+        pgc_put8(c, 255);
+        len -= 255;
+    }
+
+    pgc_put8(c, len);
+}
+
+
+static void lz4_put_sequence(pgc_cursor *c, byte *lit, int lit_len, int offset, int match_len)
+{
+    int ml = match_len - LZ4_MINMATCH;
+    int token = ((lit_len < 15) ? lit_len : 15) << 4;
+    if (match_len) token |= (ml < 15) ? ml : 15;
+
+    pgc_put8(c, token);
+    if (lit_len >= 15) lz4_put_length(c, lit_len - 15);
+    pgc_put(c, lit, lit_len);
+
+    if (match_len) {
+        pgc_put16(c, offset);
+        if (ml >= 15) lz4_put_length(c, ml - 15);
+    }
+}
+
+
+/*
+ * Compress length bytes of src into dst. Returns the compressed length, or
+ * 0 if it would not fit within capacity.
+ */
+int pgc_lz4_compress(byte *src, int length, byte *dst, int capacity)
+{
+    pgc_cursor c = {.data = dst, .cap = capacity, .ok = TRUE};
+    int table[1 << LZ4_HASH_BITS];
+    int anchor = 0;
+    int ip = 0;
+
+    memset(table, -1, sizeof(table));
+
+    while (ip < length - LZ4_MFLIMIT && c.ok) {
+        uint32_t seq = lz4_read32(src + ip);
+        int h = lz4_hash(seq);
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > 0xffff || lz4_read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        int match_len = LZ4_MINMATCH;
+        while (ip + match_len < length - LZ4_LASTLITERALS && src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+
+        lz4_put_sequence(&c, src + anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    lz4_put_sequence(&c, src + anchor, length - anchor, 0, 0);
+
+    return c.ok ? c.len : 0;
+}
+
+
+static int lz4_get_length(pgc_cursor *c, int len)
+{
+    if (len == 15) {
+        int b;
+        do {
+            b = pgc_get8(c);
+            len += b;
+        } while (b == 255 && c->ok);
+    }
+
+    return len;
+}
+
+
+/*
+ * Decompress length bytes of LZ4 data from src into dst. Returns the
+ * decompressed length, or -1 if the input is malformed or the output
+ * would exceed capacity.
+ */
+int pgc_lz4_decompress(byte *src, int length, byte *dst, int capacity)
+{
+    pgc_cursor c = {.data = src, .cap = length, .ok = TRUE};
+    int op = 0;
+
+    while (c.len < length && c.ok) {
+        int token = pgc_get8(&c);
+
+        int lit_len = lz4_get_length(&c, token >> 4);
+        if (op + lit_len > capacity) return -1;
+        pgc_get(&c, dst + op, lit_len);
+        op += lit_len;
+
+        // The final sequence has no match
+        if (c.len >= length) break;
+
+        int offset = pgc_get16(&c);
+        int match_len = lz4_get_length(&c, token & 0xf) + LZ4_MINMATCH;
+        if (offset == 0 || offset > op || op + match_len > capacity) return -1;
+
+        // Matches may overlap their own output, so copy byte-wise
+        for (int i=0; i<match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+
+    return c.ok ? op : -1;
+}
+
+
+/*
+ * Compress a page of tbl into out (which must hold PGC_MAX_SIZE bytes),
+ * using the table's compression scheme. Returns the stored length.
+ */
+int pgc_compress(table *tbl, byte *page, byte *out)
+{
+    int len = 0;
+
+    if (tbl->compression == PGC_LIGHT) {
+        len = pgc_light_compress(tbl, page, out + 1, BLOCKSIZE - 1);
+        if (len > 0) {
+            out[0] = PGC_TAG_LIGHT;
+            return len + 1;
+        }
+    }
+
+    if (tbl->compression != PGC_NONE) {
+        len = pgc_lz4_compress(page, BLOCKSIZE, out + 1, BLOCKSIZE - 1);
+        if (len > 0) {
+            out[0] = PGC_TAG_LZ4;
+            return len + 1;
+        }
+    }
+
+    out[0] = PGC_TAG_RAW;
+    memcpy(out + 1, page, BLOCKSIZE);
+    return BLOCKSIZE + 1;
+}
+
+
+/*
+ * Reconstruct a page of tbl from its stored form. Returns 1 on success,
+ * and 0 if the stored page is corrupt.
+ */
+int pgc_decompress(table *tbl, byte *in, int length, byte *page)
+{
+    if (length < 1) return 0;
+
+    switch (in[0]) {
+        case PGC_TAG_RAW:
+            if (length != BLOCKSIZE + 1) return 0;
+            memcpy(page, in + 1, BLOCKSIZE);
+            return 1;
+        case PGC_TAG_LIGHT:
+            return pgc_light_decompress(tbl, in + 1, length - 1, page);
+        case PGC_TAG_LZ4:
+            return pgc_lz4_decompress(in + 1, length - 1, page, BLOCKSIZE) == BLOCKSIZE;
+    }
+
+    return 0;
+}
+
+
+static void pgc_map_path(table *tbl, char *path)
+{
+    snprintf(path, PGC_PATH_LEN, "%s/%s.map", tbl->db, tbl->name);
+}
+
+
+/*
+ * Create an empty block map for tbl, replacing any map file left by an
+ * earlier table of the same name.
+ */
+pgc_map *pgc_map_create(table *tbl)
+{
+    char path[PGC_PATH_LEN];
+    pgc_map_path(tbl, path);
+
+    pgc_map *map = calloc(1, sizeof(pgc_map));
+    if (!map) return NULL;
+
+    if (!(map->file = fopen(path, "w+")) ||
+            fwrite(&map->saved, sizeof(int), 1, map->file) != 1 || fflush(map->file) != 0) {
+        pgc_map_free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+
+/*
+ * Make sure that the map has an entry for blk_no. New entries have no
+ * extent, and read back as empty pages.
+ */
+int pgc_map_extend(pgc_map *map, int blk_no)
+{
+    if (blk_no < map->blk_cnt) return 1;
+
+    if (blk_no >= map->cap) {
+        int cap = map->cap ? map->cap : 64;
+        while (cap <= blk_no) cap *= 2;
+
+        pgc_extent *extents = realloc(map->extents, sizeof(pgc_extent) * cap);
+        if (!extents) return 0;
+
+        map->extents = extents;
+        map->cap = cap;
+    }
+
+    for (int i=map->blk_cnt; i<=blk_no; i++) {
+        map->extents[i] = (pgc_extent) {.offset = -1, .length = 0, .capacity = 0};
+    }
+
+    map->blk_cnt = blk_no + 1;
+    return 1;
+}
+
+
+/*
+ * Write the map's entries from first up to (but not including) end to its
+ * file, extending the file's entry count if they run past it.
+ */
+static int pgc_map_put(pgc_map *map, int first, int end)
+{
+    if (first > map->saved) first = map->saved;
+
+    int ok = fseeko(map->file, sizeof(int) + (off_t) first * sizeof(pgc_extent), SEEK_SET) == 0 &&
+        fwrite(map->extents + first, sizeof(pgc_extent), end - first, map->file) == (size_t) (end - first);
+
+    if (ok && end > map->saved) {
+        ok = fseeko(map->file, 0, SEEK_SET) == 0 &&
+            fwrite(&end, sizeof(int), 1, map->file) == 1;
+        if (ok) map->saved = end;
+    }
+
+    return (fflush(map->file) == 0) && ok;
+}
+
+
+/*
+ * Load the block map of a compressed table. The map file is kept up to
+ * date as blocks are written back, so this picks up every block flushed
+ * before the table was last closed, or before the process went away.
+ */
+pgc_map *pgc_map_load(table *tbl)
+{
+    char path[PGC_PATH_LEN];
+    pgc_map_path(tbl, path);
+
+    FILE *file = fopen(path, "r+");
+    if (!file) return pgc_map_create(tbl);
+
+    pgc_map *map = calloc(1, sizeof(pgc_map));
+    if (!map) {
+        fclose(file);
+        return NULL;
+    }
+
+    map->file = file;
+
+    int blk_cnt = 0;
+    int ok = fread(&blk_cnt, sizeof(int), 1, file) == 1;
+
+    if (ok && blk_cnt > 0) {
+        ok = pgc_map_extend(map, blk_cnt - 1) &&
+            fread(map->extents, sizeof(pgc_extent), blk_cnt, file) == (size_t) blk_cnt;
+    }
+
+    if (!ok) {
+        pgc_map_free(map);
+        return NULL;
+    }
+
+    map->saved = blk_cnt;
+    return map;
+}
+
+
+/*
+ * Write out the whole of the table's block map.
+ */
+int pgc_map_save(table *tbl)
+{
+    pgc_map *map = tbl->cmap;
+    return pgc_map_put(map, 0, map->blk_cnt);
+}
+
+
+void pgc_map_free(pgc_map *map)
+{
+    if (!map) return;
+
+    if (map->file) fclose(map->file);
+    free(map->extents);
+    free(map);
+}
+
+
+/*
+ * Read and decompress logical block blk_no of a compressed table into
+ * data. Blocks which have never been written read as zeroes. Returns the
+ * number of bytes placed in data (BLOCKSIZE), or 0 on error, as blk_read
+ * does.
+ */
+int pgc_read_blk(table *tbl, int blk_no, byte *data)
+{
+    pgc_map *map = tbl->cmap;
+
+    if (blk_no >= map->blk_cnt || map->extents[blk_no].offset < 0) {
+        memset(data, 0, BLOCKSIZE);
+        return BLOCKSIZE;
+    }
+
+    pgc_extent *ext = &map->extents[blk_no];
+    byte stored[PGC_MAX_SIZE];
+
+    if (ext->length > PGC_MAX_SIZE ||
+            blk_ext_read(tbl->file, ext->offset, stored, ext->length) != ext->length) {
+        return 0;
+    }
+
+    return pgc_decompress(tbl, stored, ext->length, data) ? BLOCKSIZE : 0;
+}
+
+
+/*
+ * Compress data and write it as logical block blk_no of a compressed
+ * table. The block's existing extent is reused if the page still fits in
+ * it; otherwise a new extent is appended to the file. The block's map entry
+ * is written through to the map file once the extent is in place. Returns
+ * BLOCKSIZE on success and 0 on error, as blk_write does.
+ */
+int pgc_write_blk(table *tbl, int blk_no, byte *data)
+{
+    pgc_map *map = tbl->cmap;
+    if (!pgc_map_extend(map, blk_no)) return 0;
+
+    byte stored[PGC_MAX_SIZE];
+    int len = pgc_compress(tbl, data, stored);
+    pgc_extent *ext = &map->extents[blk_no];
+
+    if (ext->offset >= 0 && len <= ext->capacity) {
+        if (blk_ext_write(tbl->file, ext->offset, stored, len) != len) return 0;
+    } else {
+        off_t offset = blk_ext_append(tbl->file, stored, len);
+        if (offset < 0) return 0;
+
+        ext->offset = offset;
+        ext->capacity = len;
+    }
+
+    ext->length = len;
+
+    // The extent has to reach the table file before the map points at it
+    if (fflush(tbl->file) != 0 || !pgc_map_put(map, blk_no, blk_no + 1)) return 0;
+
+    return BLOCKSIZE;
+}
+
+
+/*
+ * The number of bytes occupied by the table's pages, as stored.
+ */
+long pgc_stored_bytes(table *tbl)
+{
+    long bytes = 0;
+
+    if (!tbl->cmap) {
+        return (long) tbl_blk_cnt(tbl) * BLOCKSIZE;
+    }
+
+    for (int i=0; i<tbl->cmap->blk_cnt; i++) {
+        bytes += tbl->cmap->extents[i].length;
+    }
+
+    return bytes;
+}
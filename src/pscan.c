@@ -0,0 +1,310 @@
+/*
+ * pscan.c
+ *
+ * Morsel-driven parallel table scans for the yahi-db project.
+ *
+ * The morsels of each deque are never added to once the scan starts, so a
+ * deque is just a range [head, tail) of morsel numbers, packed into a
+ * single atomic word. The owner takes from the head and thieves from the
+ * tail, each with a compare-and-swap of the whole word, so that no morsel
+ * is handed out twice and no locks are needed. Deques are padded to a
+ * cache line apiece, so that the owners' updates don't contend.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License, see the LICENSE
+ * file in the main project directory for details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "codec.h"
+#include "exec.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "pscan.h"
+#include "table.h"
+#include "yahi.h"
+
+#define PS_PIN_BATCH 8
+
+typedef struct ps_deque {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} ps_deque;
+
+
+typedef struct ps_scan {
+    table *tbl;
+    int threads;
+    int morsel_blks;
+    int blk_cnt;
+    ps_pipeline fn;
+    void *ctx;
+
+    ps_deque *deques;
+    atomic_int stop;
+} ps_scan;
+
+
+typedef struct ps_worker {
+    ps_scan *scan;
+    int thread;
+    int ok;
+    ps_stats stats;
+} ps_worker;
+
+
+void ps_default_opts(ps_opts *opts)
+{
+    opts->threads = PS_DEFAULT_THREADS;
+    opts->morsel_blks = PS_DEFAULT_MORSEL_BLKS;
+}
+
+
+static inline uint64_t ps_range(uint64_t head, uint64_t tail)
+{
+    return (head << 32) | tail;
+}
+
+
+/*
+ * Take the next morsel from the front of a thread's own deque, or -1 if
+ * it is empty.
+ */
+static long ps_pop(ps_deque *dq)
+{
+    uint64_t r = atomic_load(&dq->range);
+
+    while (TRUE) {
+        uint64_t head = r >> 32, tail = r & 0xffffffff;
+        if (head >= tail) return -1;
+
+        if (atomic_compare_exchange_weak(&dq->range, &r, ps_range(head + 1, tail))) {
+            return head;
+        }
+    }
+}
+
+
+/*
+ * Take the last morsel from the back of another thread's deque, or -1 if
+ * it is empty.
+ */
+static long ps_steal(ps_deque *dq)
+{
+    uint64_t r = atomic_load(&dq->range);
+
+    while (TRUE) {
+        uint64_t head = r >> 32, tail = r & 0xffffffff;
+        if (head >= tail) return -1;
+
+        if (atomic_compare_exchange_weak(&dq->range, &r, ps_range(head, tail - 1))) {
+            return tail - 1;
+        }
+    }
+}
+
+
+static int ps_flush(ps_worker *w, batch *b)
+{
+    if (b->count == 0) return TRUE;
+
+    w->stats.rows += b->count;
+    int resp = w->scan->fn(b, w->thread, w->scan->ctx);
+    b->count = 0;
+
+    if (!resp) atomic_store(&w->scan->stop, TRUE);
+    return resp;
+}
+
+
+/*
+ * Decode the records of one block into b, passing it to the pipeline each
+ * time it fills. Returns FALSE if the pipeline stopped the scan.
+ */
+static int ps_block(ps_worker *w, batch *b, page *pg, int blk_no)
+{
+    table *tbl = w->scan->tbl;
+    codec *cd = tbl->codec;
+    int per_blk = tbl_recs_per_blk(tbl);
+    void *cols[MAX_ATTRS];
+
+    int rid = (blk_no - TBL_FIRST_BLK) * per_blk;
+    int remain = tbl->record_cnt - rid;
+    if (remain > per_blk) remain = per_blk;
+
+    for (int done=0; done<remain; ) {
+        if (b->count == EXEC_BATCH_SIZE && !ps_flush(w, b)) return FALSE;
+
+        int cnt = remain - done;
+        if (cnt > EXEC_BATCH_SIZE - b->count) cnt = EXEC_BATCH_SIZE - b->count;
+
+        for (int c=0; c<cd->col_cnt; c++) cols[c] = exec_col_at(&b->cols[c], b->count);
+        cd_decode(cd, pg->data + (size_t) done * cd->width, cd->width, cnt, cols);
+
+        b->count += cnt;
+        done += cnt;
+    }
+
+    w->stats.blocks++;
+    return TRUE;
+}
+
+
+/*
+ * Decode every record of a morsel into b, passing it to the pipeline each
+ * time it fills, and once more at the end of the morsel. The morsel's
+ * blocks are pinned PS_PIN_BATCH at a time, so that those missing from
+ * the pool are read together, or one at a time if the pool hasn't the
+ * frames to spare.
+ */
+static int ps_morsel(ps_worker *w, long morsel, batch *b)
+{
+    ps_scan *scan = w->scan;
+    table *tbl = scan->tbl;
+    buff_handle pins[PS_PIN_BATCH];
+
+    int first = TBL_FIRST_BLK + morsel * scan->morsel_blks;
+    int last = first + scan->morsel_blks;
+    if (last > TBL_FIRST_BLK + scan->blk_cnt) last = TBL_FIRST_BLK + scan->blk_cnt;
+
+    for (int blk_no=first; blk_no<last; ) {
+        int cnt = (last - blk_no < PS_PIN_BATCH) ? last - blk_no : PS_PIN_BATCH;
+        for (int k=0; k<cnt; k++) pins[k] = (buff_handle) {.tbl = tbl, .blk_no = blk_no + k};
+
+        if (!buff_pin_batch(pins, cnt)) {
+            cnt = 1;
+            if (!buff_pin_batch(pins, cnt)) return FALSE;
+        }
+
+        for (int k=0; k<cnt; k++) {
+            if (!ps_block(w, b, pins[k].pg, blk_no + k)) {
+                buff_unpin_batch(pins, cnt);
+                return TRUE;
+            }
+        }
+
+        buff_unpin_batch(pins, cnt);
+        blk_no += cnt;
+    }
+
+    ps_flush(w, b);
+    return TRUE;
+}
+
+
+static void *ps_worker_main(void *arg)
+{
+    ps_worker *w = arg;
+    ps_scan *scan = w->scan;
+    table *tbl = scan->tbl;
+    batch b;
+
+    if (!exec_batch_init(&b, tbl->fields.field_cnt, tbl->fields.field_types,
+                tbl->fields.field_lengths)) {
+        w->ok = FALSE;
+        atomic_store(&scan->stop, TRUE);
+        return NULL;
+    }
+
+    while (!atomic_load(&scan->stop)) {
+        long morsel = ps_pop(&scan->deques[w->thread]);
+
+        // Once our own deque is empty, steal from the others, starting
+        // with our neighbour so that thieves spread out
+        for (int k=1; morsel < 0 && k<scan->threads; k++) {
+            morsel = ps_steal(&scan->deques[(w->thread + k) % scan->threads]);
+            if (morsel >= 0) w->stats.stolen++;
+        }
+
+        if (morsel < 0) break;
+
+        if (!ps_morsel(w, morsel, &b)) {
+            w->ok = FALSE;
+            atomic_store(&scan->stop, TRUE);
+            break;
+        }
+        w->stats.morsels++;
+    }
+
+    exec_batch_free(&b);
+    return NULL;
+}
+
+
+/*
+ * Scan every record of tbl in parallel, passing the rows to fn in batches
+ * from each of the worker threads. If opts is NULL, the defaults from
+ * ps_default_opts() are used, and if stats is not NULL it is filled in
+ * with the totals across threads. Returns 1 once the whole table has been
+ * scanned, and 0 if the scan failed or was stopped by the pipeline.
+ */
+int ps_run(table *tbl, ps_opts *opts, ps_pipeline fn, void *ctx, ps_stats *stats)
+{
+    ps_opts defaults;
+    if (!opts) {
+        ps_default_opts(&defaults);
+        opts = &defaults;
+    }
+
+    if (stats) *stats = (ps_stats) {0};
+    if (!tbl || !fn || !tbl->codec || opts->threads < 1 || opts->morsel_blks < 1) return 0;
+
+    ps_scan scan = {
+        .tbl = tbl,
+        .morsel_blks = opts->morsel_blks,
+        .blk_cnt = tbl_blk_cnt(tbl),
+        .fn = fn,
+        .ctx = ctx,
+    };
+    atomic_init(&scan.stop, FALSE);
+
+    long morsel_cnt = (scan.blk_cnt + scan.morsel_blks - 1) / scan.morsel_blks;
+    if (morsel_cnt == 0) return 1;
+
+    scan.threads = opts->threads;
+    if (scan.threads > PS_MAX_THREADS) scan.threads = PS_MAX_THREADS;
+    if (scan.threads > morsel_cnt) scan.threads = morsel_cnt;
+
+    scan.deques = aligned_alloc(64, sizeof(ps_deque) * scan.threads);
+    if (!scan.deques) return 0;
+
+    // Deal the morsels out in contiguous runs, so that each thread starts
+    // on a sequential stretch of the table
+    for (int t=0; t<scan.threads; t++) {
+        atomic_init(&scan.deques[t].range, ps_range(morsel_cnt * t / scan.threads,
+                                                    morsel_cnt * (t + 1) / scan.threads));
+    }
+
+    pthread_t tids[PS_MAX_THREADS];
+    ps_worker workers[PS_MAX_THREADS];
+    int started[PS_MAX_THREADS] = {0};
+
+    for (int t=0; t<scan.threads; t++) {
+        workers[t] = (ps_worker) {.scan = &scan, .thread = t, .ok = TRUE};
+        started[t] = pthread_create(&tids[t], NULL, ps_worker_main, &workers[t]) == 0;
+        if (!started[t]) {
+            workers[t].ok = FALSE;
+            atomic_store(&scan.stop, TRUE);
+        }
+    }
+
+    int ok = TRUE;
+    for (int t=0; t<scan.threads; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+        ok = ok && workers[t].ok;
+
+        if (stats) {
+            stats->morsels += workers[t].stats.morsels;
+            stats->stolen += workers[t].stats.stolen;
+            stats->blocks += workers[t].stats.blocks;
+            stats->rows += workers[t].stats.rows;
+        }
+    }
+
+    free(scan.deques);
+    return ok && !atomic_load(&scan.stop);
+}
@@ -0,0 +1,725 @@
+/*
+ * roaring.c
+ *
+ * Compressed bitmaps of record ids for the yahi-db project.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "yahi.h"
+
+#define RB_BITMAP_BYTES (RB_BITMAP_WORDS * sizeof(uint64_t))
+#define RB_VEC_WORDS 4
+#define RB_MIN_ARRAY 4
+
+typedef uint64_t rb_vec __attribute__((vector_size(RB_VEC_WORDS * sizeof(uint64_t))));
+
+// Bitmap container operations
+#define RB_OP_AND 0
+#define RB_OP_OR 1
+#define RB_OP_ANDNOT 2
+
+
+static uint64_t *rb_bits_alloc()
+{
+    return aligned_alloc(64, RB_BITMAP_BYTES);
+}
+
+
+static inline int rb_bit(uint64_t *bits, uint16_t low)
+{
+    return (bits[low >> 6] >> (low & 63)) & 1;
+}
+
+
+static int rb_popcount(uint64_t *bits)
+{
+    int card = 0;
+    for (int i=0; i<RB_BITMAP_WORDS; i++) card += __builtin_popcountll(bits[i]);
+
+    return card;
+}
+
+
+static void rb_container_free(rb_container *c)
+{
+    if (c->type == RB_ARRAY) free(c->array);
+    else free(c->bits);
+}
+
+
+/*
+ * Turn a bitmap container of at most RB_ARRAY_MAX ids into an array
+ * container, or an array container into a bitmap. Returns 1 on success
+ * and 0 on failure, leaving the container unchanged.
+ */
+static int rb_to_array(rb_container *c)
+{
+    int cap = (c->card > RB_MIN_ARRAY) ? c->card : RB_MIN_ARRAY;
+    uint16_t *array = malloc(sizeof(uint16_t) * cap);
+    if (!array) return 0;
+
+    int n = 0;
+    for (int w=0; w<RB_BITMAP_WORDS; w++) {
+        for (uint64_t word=c->bits[w]; word; word &= word - 1) {
+            array[n++] = (w << 6) + __builtin_ctzll(word);
+        }
+    }
+
+    free(c->bits);
+    c->type = RB_ARRAY;
+    c->array = array;
+    c->cap = cap;
+
+    return 1;
+}
+
+
+static int rb_to_bitmap(rb_container *c)
+{
+    uint64_t *bits = rb_bits_alloc();
+    if (!bits) return 0;
+
+    memset(bits, 0, RB_BITMAP_BYTES);
+    for (int i=0; i<c->card; i++) bits[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+
+    free(c->array);
+    c->type = RB_BITMAP;
+    c->bits = bits;
+    c->cap = 0;
+
+    return 1;
+}
+
+
+/*
+ * Give a newly computed container the right representation for its
+ * cardinality. Returns 1 if it should be kept, 0 if it is empty, and -1
+ * if it cannot be converted; in either of the latter cases it is freed.
+ */
+static int rb_normalize(rb_container *c)
+{
+    if (c->card == 0) {
+        rb_container_free(c);
+        return 0;
+    }
+
+    if (c->type == RB_BITMAP && c->card <= RB_ARRAY_MAX) rb_to_array(c);
+    if (c->type == RB_ARRAY && c->card > RB_ARRAY_MAX && !rb_to_bitmap(c)) {
+        rb_container_free(c);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+/*
+ * The position of the first value in array which is not less than low.
+ */
+static int rb_array_lower(uint16_t *array, int card, uint16_t low)
+{
+    int lo = 0, hi = card;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (array[mid] < low) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+
+/*
+ * The index of the container with key, or -(i + 1) if there is none and
+ * it would be inserted at i.
+ */
+static int rb_find(roaring *rb, uint16_t key)
+{
+    int lo = 0, hi = rb->cnt;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rb->cs[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return (lo < rb->cnt && rb->cs[lo].key == key) ? lo : -(lo + 1);
+}
+
+
+/*
+ * Append a container (which the bitmap takes ownership of) to the end
+ * of rb, whose keys must all be less than its key.
+ */
+static int rb_append(roaring *rb, rb_container *c)
+{
+    if (rb->cnt == rb->cap) {
+        int cap = rb->cap ? 2 * rb->cap : 4;
+        rb_container *cs = realloc(rb->cs, sizeof(rb_container) * cap);
+        if (!cs) return 0;
+
+        rb->cs = cs;
+        rb->cap = cap;
+    }
+
+    rb->cs[rb->cnt++] = *c;
+    return 1;
+}
+
+
+roaring *rb_create()
+{
+    return calloc(1, sizeof(roaring));
+}
+
+
+void rb_free(roaring *rb)
+{
+    if (!rb) return;
+
+    for (int i=0; i<rb->cnt; i++) rb_container_free(&rb->cs[i]);
+    free(rb->cs);
+    free(rb);
+}
+
+
+static int rb_container_copy(rb_container *dst, rb_container *src)
+{
+    *dst = *src;
+
+    if (src->type == RB_BITMAP) {
+        if (!(dst->bits = rb_bits_alloc())) return 0;
+        memcpy(dst->bits, src->bits, RB_BITMAP_BYTES);
+        return 1;
+    }
+
+    dst->cap = (src->card > RB_MIN_ARRAY) ? src->card : RB_MIN_ARRAY;
+    if (!(dst->array = malloc(sizeof(uint16_t) * dst->cap))) return 0;
+    memcpy(dst->array, src->array, sizeof(uint16_t) * src->card);
+
+    return 1;
+}
+
+
+roaring *rb_copy(roaring *rb)
+{
+    roaring *copy = rb_create();
+    if (!copy) return NULL;
+
+    for (int i=0; i<rb->cnt; i++) {
+        rb_container c;
+        if (!rb_container_copy(&c, &rb->cs[i]) || !rb_append(copy, &c)) {
+            rb_free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+
+/*
+ * Add id to the bitmap. Returns 1 on success (including if it was
+ * already there), and 0 on failure.
+ */
+int rb_add(roaring *rb, uint32_t id)
+{
+    uint16_t key = id >> 16, low = id & 0xffff;
+    int i = rb_find(rb, key);
+
+    if (i < 0) {
+        i = -i - 1;
+        rb_container c = {.key = key, .type = RB_ARRAY, .cap = RB_MIN_ARRAY};
+        if (!(c.array = malloc(sizeof(uint16_t) * c.cap))) return 0;
+
+        if (!rb_append(rb, &c)) {
+            free(c.array);
+            return 0;
+        }
+
+        memmove(&rb->cs[i + 1], &rb->cs[i], sizeof(rb_container) * (rb->cnt - 1 - i));
+        rb->cs[i] = c;
+    }
+
+    rb_container *c = &rb->cs[i];
+    if (c->type == RB_BITMAP) {
+        c->card += !rb_bit(c->bits, low);
+        c->bits[low >> 6] |= 1ULL << (low & 63);
+        return 1;
+    }
+
+    int pos = rb_array_lower(c->array, c->card, low);
+    if (pos < c->card && c->array[pos] == low) return 1;
+
+    if (c->card == RB_ARRAY_MAX) {
+        if (!rb_to_bitmap(c)) return 0;
+        c->bits[low >> 6] |= 1ULL << (low & 63);
+        c->card++;
+        return 1;
+    }
+
+    if (c->card == c->cap) {
+        int cap = (2 * c->cap < RB_ARRAY_MAX) ? 2 * c->cap : RB_ARRAY_MAX;
+        uint16_t *array = realloc(c->array, sizeof(uint16_t) * cap);
+        if (!array) return 0;
+
+        c->array = array;
+        c->cap = cap;
+    }
+
+    memmove(&c->array[pos + 1], &c->array[pos], sizeof(uint16_t) * (c->card - pos));
+    c->array[pos] = low;
+    c->card++;
+
+    return 1;
+}
+
+
+/*
+ * Remove id from the bitmap. Returns 1 if it was there, and 0 if not.
+ */
+int rb_remove(roaring *rb, uint32_t id)
+{
+    uint16_t key = id >> 16, low = id & 0xffff;
+    int i = rb_find(rb, key);
+    if (i < 0) return 0;
+
+    rb_container *c = &rb->cs[i];
+    if (c->type == RB_BITMAP) {
+        if (!rb_bit(c->bits, low)) return 0;
+
+        c->bits[low >> 6] &= ~(1ULL << (low & 63));
+        if (--c->card <= RB_ARRAY_MAX) rb_to_array(c);
+    } else {
+        int pos = rb_array_lower(c->array, c->card, low);
+        if (pos == c->card || c->array[pos] != low) return 0;
+
+        memmove(&c->array[pos], &c->array[pos + 1], sizeof(uint16_t) * (c->card - pos - 1));
+        c->card--;
+    }
+
+    if (c->card == 0) {
+        rb_container_free(c);
+        memmove(&rb->cs[i], &rb->cs[i + 1], sizeof(rb_container) * (rb->cnt - i - 1));
+        rb->cnt--;
+    }
+
+    return 1;
+}
+
+
+int rb_contains(roaring *rb, uint32_t id)
+{
+    uint16_t low = id & 0xffff;
+    int i = rb_find(rb, id >> 16);
+    if (i < 0) return FALSE;
+
+    rb_container *c = &rb->cs[i];
+    if (c->type == RB_BITMAP) return rb_bit(c->bits, low);
+
+    int pos = rb_array_lower(c->array, c->card, low);
+    return pos < c->card && c->array[pos] == low;
+}
+
+
+long rb_cardinality(roaring *rb)
+{
+    long card = 0;
+    for (int i=0; i<rb->cnt; i++) card += rb->cs[i].card;
+
+    return card;
+}
+
+
+/*
+ * Combine two bitmap containers into a new one, a vector at a time.
+ */
+static int rb_bits_op(rb_container *out, rb_container *a, rb_container *b, int op)
+{
+    if (!(out->bits = rb_bits_alloc())) return 0;
+    out->type = RB_BITMAP;
+
+    rb_vec *va = (rb_vec *) a->bits, *vb = (rb_vec *) b->bits, *vo = (rb_vec *) out->bits;
+    int n = RB_BITMAP_WORDS / RB_VEC_WORDS;
+
+    switch (op) {
+        case RB_OP_AND: for (int i=0; i<n; i++) vo[i] = va[i] & vb[i]; break;
+        case RB_OP_OR: for (int i=0; i<n; i++) vo[i] = va[i] | vb[i]; break;
+        case RB_OP_ANDNOT: for (int i=0; i<n; i++) vo[i] = va[i] & ~vb[i]; break;
+    }
+
+    out->card = rb_popcount(out->bits);
+    return 1;
+}
+
+
+/*
+ * The ids of array container a which are (or, with keep FALSE, are not)
+ * in bitmap container b.
+ */
+static int rb_array_probe(rb_container *out, rb_container *a, rb_container *b, int keep)
+{
+    out->type = RB_ARRAY;
+    out->cap = (a->card > RB_MIN_ARRAY) ? a->card : RB_MIN_ARRAY;
+    if (!(out->array = malloc(sizeof(uint16_t) * out->cap))) return 0;
+
+    int n = 0;
+    for (int i=0; i<a->card; i++) {
+        out->array[n] = a->array[i];
+        n += rb_bit(b->bits, a->array[i]) == keep;
+    }
+
+    out->card = n;
+    return 1;
+}
+
+
+/*
+ * Merge two array containers, keeping the values in both (AND), either
+ * (OR), or only the first (ANDNOT).
+ */
+static int rb_array_merge(rb_container *out, rb_container *a, rb_container *b, int op)
+{
+    int cap = (op == RB_OP_OR) ? a->card + b->card : a->card;
+    if (cap < RB_MIN_ARRAY) cap = RB_MIN_ARRAY;
+
+    out->type = RB_ARRAY;
+    out->cap = cap;
+    if (!(out->array = malloc(sizeof(uint16_t) * cap))) return 0;
+
+    int i = 0, j = 0, n = 0;
+    while (i < a->card && j < b->card) {
+        uint16_t x = a->array[i], y = b->array[j];
+
+        if (x < y) {
+            if (op != RB_OP_AND) out->array[n++] = x;
+            i++;
+        } else if (y < x) {
+            if (op == RB_OP_OR) out->array[n++] = y;
+            j++;
+        } else {
+            if (op != RB_OP_ANDNOT) out->array[n++] = x;
+            i++;
+            j++;
+        }
+    }
+
+    if (op != RB_OP_AND) {
+        memcpy(&out->array[n], &a->array[i], sizeof(uint16_t) * (a->card - i));
+        n += a->card - i;
+    }
+
+    if (op == RB_OP_OR) {
+        memcpy(&out->array[n], &b->array[j], sizeof(uint16_t) * (b->card - j));
+        n += b->card - j;
+    }
+
+    out->card = n;
+    return 1;
+}
+
+
+/*
+ * Set (OR) or clear (ANDNOT) the ids of array container b in a copy of
+ * bitmap container a.
+ */
+static int rb_bits_apply(rb_container *out, rb_container *a, rb_container *b, int op)
+{
+    if (!rb_container_copy(out, a)) return 0;
+
+    for (int i=0; i<b->card; i++) {
+        uint16_t low = b->array[i];
+        if (op == RB_OP_OR) out->bits[low >> 6] |= 1ULL << (low & 63);
+        else out->bits[low >> 6] &= ~(1ULL << (low & 63));
+    }
+
+    out->card = rb_popcount(out->bits);
+    return 1;
+}
+
+
+static int rb_container_op(rb_container *out, rb_container *a, rb_container *b, int op)
+{
+    out->key = a->key;
+    out->cap = 0;
+
+    if (a->type == RB_BITMAP && b->type == RB_BITMAP) return rb_bits_op(out, a, b, op);
+    if (a->type == RB_ARRAY && b->type == RB_ARRAY) return rb_array_merge(out, a, b, op);
+
+    switch (op) {
+        case RB_OP_AND:
+            return (a->type == RB_ARRAY) ? rb_array_probe(out, a, b, TRUE) :
+                                           rb_array_probe(out, b, a, TRUE);
+        case RB_OP_OR:
+            return (a->type == RB_BITMAP) ? rb_bits_apply(out, a, b, op) :
+                                            rb_bits_apply(out, b, a, op);
+        default:
+            return (a->type == RB_ARRAY) ? rb_array_probe(out, a, b, FALSE) :
+                                           rb_bits_apply(out, a, b, op);
+    }
+}
+
+
+/*
+ * Walk the containers of a and b together in key order, combining those
+ * with matching keys, and copying those without a match where op keeps
+ * them.
+ */
+static roaring *rb_op(roaring *a, roaring *b, int op)
+{
+    roaring *out = rb_create();
+    if (!out) return NULL;
+
+    rb_container c;
+    int i = 0, j = 0;
+
+    while (i < a->cnt || j < b->cnt) {
+        rb_container *src = NULL;
+
+        if (j == b->cnt || (i < a->cnt && a->cs[i].key < b->cs[j].key)) {
+            src = (op != RB_OP_AND) ? &a->cs[i] : NULL;
+            i++;
+        } else if (i == a->cnt || b->cs[j].key < a->cs[i].key) {
+            src = (op == RB_OP_OR) ? &b->cs[j] : NULL;
+            j++;
+        } else {
+            if (!rb_container_op(&c, &a->cs[i++], &b->cs[j++], op)) goto error;
+
+            int keep = rb_normalize(&c);
+            if (keep < 0) goto error;
+            if (keep && !rb_append(out, &c)) goto error_container;
+            continue;
+        }
+
+        if (!src) continue;
+        if (!rb_container_copy(&c, src)) goto error;
+        if (!rb_append(out, &c)) goto error_container;
+    }
+
+    return out;
+
+error_container:
+    rb_container_free(&c);
+error:
+    rb_free(out);
+    return NULL;
+}
+
+
+/*
+ * The ids in both a and b. Returns NULL on failure, as do the other
+ * operations.
+ */
+roaring *rb_and(roaring *a, roaring *b)
+{
+    return rb_op(a, b, RB_OP_AND);
+}
+
+
+/*
+ * The ids in either a or b.
+ */
+roaring *rb_or(roaring *a, roaring *b)
+{
+    return rb_op(a, b, RB_OP_OR);
+}
+
+
+/*
+ * The ids in a but not in b.
+ */
+roaring *rb_andnot(roaring *a, roaring *b)
+{
+    return rb_op(a, b, RB_OP_ANDNOT);
+}
+
+
+/*
+ * The ids in [0, n) which are not in a.
+ */
+roaring *rb_not(roaring *a, uint32_t n)
+{
+    roaring *out = rb_create();
+    if (!out || n == 0) return out;
+
+    for (uint32_t key=0; key<=(n - 1) >> 16; key++) {
+        uint32_t hi = (n - (key << 16) < 65536) ? n - (key << 16) : 65536;
+        rb_container c = {.key = key, .type = RB_BITMAP};
+
+        if (!(c.bits = rb_bits_alloc())) goto error;
+
+        // The chunk's part of the range, less the ids of a
+        memset(c.bits, 0, RB_BITMAP_BYTES);
+        memset(c.bits, 0xff, (hi >> 6) * sizeof(uint64_t));
+        if (hi & 63) c.bits[hi >> 6] = (1ULL << (hi & 63)) - 1;
+
+        int i = rb_find(a, key);
+        if (i >= 0 && a->cs[i].type == RB_BITMAP) {
+            rb_vec *vc = (rb_vec *) c.bits, *va = (rb_vec *) a->cs[i].bits;
+            for (int v=0; v<RB_BITMAP_WORDS / RB_VEC_WORDS; v++) vc[v] &= ~va[v];
+        } else if (i >= 0) {
+            for (int k=0; k<a->cs[i].card; k++) {
+                uint16_t low = a->cs[i].array[k];
+                c.bits[low >> 6] &= ~(1ULL << (low & 63));
+            }
+        }
+
+        c.card = rb_popcount(c.bits);
+
+        int keep = rb_normalize(&c);
+        if (keep < 0) goto error;
+        if (keep && !rb_append(out, &c)) {
+            rb_container_free(&c);
+            goto error;
+        }
+    }
+
+    return out;
+
+error:
+    rb_free(out);
+    return NULL;
+}
+
+
+void rb_iter_init(rb_iter *it, roaring *rb)
+{
+    it->rb = rb;
+    it->c = 0;
+    it->pos = 0;
+}
+
+
+/*
+ * Copy up to max of the bitmap's next ids, in increasing order, into
+ * ids. Returns the number copied, which is 0 once all have been.
+ */
+int rb_iter_next(rb_iter *it, uint32_t *ids, int max)
+{
+    int n = 0;
+
+    while (n < max && it->c < it->rb->cnt) {
+        rb_container *c = &it->rb->cs[it->c];
+        uint32_t high = (uint32_t) c->key << 16;
+
+        if (c->type == RB_ARRAY) {
+            while (n < max && it->pos < c->card) ids[n++] = high | c->array[it->pos++];
+        } else {
+            // pos is the next bit to look at
+            while (n < max && it->pos < 65536) {
+                uint64_t word = c->bits[it->pos >> 6] >> (it->pos & 63);
+                if (!word) {
+                    it->pos = (it->pos | 63) + 1;
+                    continue;
+                }
+
+                it->pos += __builtin_ctzll(word);
+                ids[n++] = high | it->pos++;
+            }
+        }
+
+        if ((c->type == RB_ARRAY && it->pos == c->card) || it->pos == 65536) {
+            it->c++;
+            it->pos = 0;
+        }
+    }
+
+    return n;
+}
+
+
+/*
+ * Bitmaps are serialized as a count of containers, followed by each
+ * container's key, type and cardinality and then its values or words.
+ */
+long rb_serialized_size(roaring *rb)
+{
+    long size = sizeof(int);
+    for (int i=0; i<rb->cnt; i++) {
+        size += 2 * sizeof(uint16_t) + sizeof(int);
+        size += (rb->cs[i].type == RB_ARRAY) ? rb->cs[i].card * sizeof(uint16_t) :
+                                               RB_BITMAP_BYTES;
+    }
+
+    return size;
+}
+
+
+void rb_serialize(roaring *rb, byte *buf)
+{
+    memcpy(buf, &rb->cnt, sizeof(int));
+    buf += sizeof(int);
+
+    for (int i=0; i<rb->cnt; i++) {
+        rb_container *c = &rb->cs[i];
+        memcpy(buf, &c->key, sizeof(uint16_t));
+        memcpy(buf + 2, &c->type, sizeof(uint16_t));
+        memcpy(buf + 4, &c->card, sizeof(int));
+        buf += 2 * sizeof(uint16_t) + sizeof(int);
+
+        long len = (c->type == RB_ARRAY) ? c->card * sizeof(uint16_t) : RB_BITMAP_BYTES;
+        memcpy(buf, (c->type == RB_ARRAY) ? (void *) c->array : (void *) c->bits, len);
+        buf += len;
+    }
+}
+
+
+/*
+ * Rebuild a bitmap from len bytes written by rb_serialize. Returns NULL
+ * if they don't hold a valid bitmap.
+ */
+roaring *rb_deserialize(byte *buf, long len)
+{
+    int cnt;
+    if (len < (long) sizeof(int)) return NULL;
+    memcpy(&cnt, buf, sizeof(int));
+
+    roaring *rb = rb_create();
+    if (!rb || cnt < 0 || cnt > 65536) goto error;
+
+    long off = sizeof(int);
+    for (int i=0; i<cnt; i++) {
+        rb_container c = {0};
+        if (off + 8 > len) goto error;
+
+        memcpy(&c.key, buf + off, sizeof(uint16_t));
+        memcpy(&c.type, buf + off + 2, sizeof(uint16_t));
+        memcpy(&c.card, buf + off + 4, sizeof(int));
+        off += 8;
+
+        if ((i > 0 && c.key <= rb->cs[i - 1].key) || c.card <= 0 || c.card > 65536) goto error;
+
+        if (c.type == RB_ARRAY && c.card <= RB_ARRAY_MAX) {
+            long n = c.card * sizeof(uint16_t);
+            c.cap = (c.card > RB_MIN_ARRAY) ? c.card : RB_MIN_ARRAY;
+            if (off + n > len || !(c.array = malloc(sizeof(uint16_t) * c.cap))) goto error;
+            memcpy(c.array, buf + off, n);
+            off += n;
+        } else if (c.type == RB_BITMAP) {
+            if (off + (long) RB_BITMAP_BYTES > len || !(c.bits = rb_bits_alloc())) goto error;
+            memcpy(c.bits, buf + off, RB_BITMAP_BYTES);
+            off += RB_BITMAP_BYTES;
+        } else {
+            goto error;
+        }
+
+        if (!rb_append(rb, &c)) {
+            rb_container_free(&c);
+            goto error;
+        }
+    }
+
+    return rb;
+
+error:
+    rb_free(rb);
+    return NULL;
+}
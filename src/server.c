@@ -0,0 +1,671 @@
+/*
+ * server.c
+ *
+ * A local database server for the yahi-db project.
+ *
+ * The server's lock protects the ready queue and the list of open
+ * connections. A connection is only ever touched by the worker handling
+ * it (epoll won't report it again until it is re-armed), so its buffers
+ * need no lock of their own. The table registry only grows while the
+ * server runs, so a handle, once checked against the table count, can be
+ * used without the registry lock.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "blockio.h"
+#include "server.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+
+#define SRV_READ_CHUNK (64 * 1024)
+#define SRV_READ_MAX (1024 * 1024)
+#define SRV_EVENTS 64
+
+typedef struct srv_conn {
+    int fd;
+
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+
+    struct srv_conn *next_ready;
+    struct srv_conn *prev;
+    struct srv_conn *next;
+} srv_conn;
+
+
+void srv_default_opts(srv_opts *opts)
+{
+    opts->workers = SRV_DEFAULT_WORKERS;
+}
+
+
+/*
+ * Buffers
+ */
+static int srv_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap) return 1;
+
+    size_t new_cap = *cap ? *cap : SRV_READ_CHUNK;
+    while (new_cap < need) new_cap *= 2;
+
+    char *grown = realloc(*buf, new_cap);
+    if (!grown) return 0;
+
+    *buf = grown;
+    *cap = new_cap;
+    return 1;
+}
+
+
+/*
+ * Start a response in the connection's output, with room for len bytes
+ * of payload, and return a pointer to that payload. The header's length
+ * is set to len, and may be lowered by the caller.
+ */
+static char *srv_respond(srv_conn *conn, uint32_t id, int32_t status, uint32_t len)
+{
+    if (!srv_reserve(&conn->out, &conn->out_cap, conn->out_len + sizeof(srv_resp) + len)) {
+        return NULL;
+    }
+
+    srv_resp resp = {.len = len, .id = id, .status = status};
+    memcpy(conn->out + conn->out_len, &resp, sizeof(srv_resp));
+    conn->out_len += sizeof(srv_resp) + len;
+
+    return conn->out + conn->out_len - len;
+}
+
+
+/*
+ * Tables
+ */
+static int srv_find_table(server *srv, char *name)
+{
+    for (int i=0; i<srv->tbl_cnt; i++) {
+        if (strcmp(srv->tables[i].tbl->name, name) == 0) return i;
+    }
+
+    return -1;
+}
+
+
+// Register a table newly created or loaded, returning its handle
+static int srv_add_table(server *srv, table *tbl)
+{
+    if (srv->tbl_cnt == SRV_MAX_TABLES) {
+        tbl_close(tbl);
+        return SRV_ERR;
+    }
+
+    int handle = srv->tbl_cnt;
+    srv->tables[handle].tbl = tbl;
+    pthread_rwlock_init(&srv->tables[handle].lock, NULL);
+    srv->tbl_cnt = handle + 1;
+
+    return handle;
+}
+
+
+// Copy a table name out of a payload, rejecting any which isn't a plain file name
+static int srv_name(char *name, const char *payload, uint32_t len)
+{
+    if (len == 0 || len >= MAX_TBL_NAME) return 0;
+
+    memcpy(name, payload, len);
+    name[len] = '\0';
+
+    return strlen(name) == len && !strchr(name, '/') && strcmp(name, ".") != 0 &&
+           strcmp(name, "..") != 0;
+}
+
+
+static void srv_create(server *srv, srv_conn *conn, srv_req *req, const char *payload)
+{
+    srv_schema wire;
+    schema sch = {0};
+    char name[MAX_TBL_NAME];
+
+    if (req->len <= sizeof(srv_schema)) goto malformed;
+    memcpy(&wire, payload, sizeof(srv_schema));
+    if (!srv_name(name, payload + sizeof(srv_schema), req->len - sizeof(srv_schema))) {
+        goto malformed;
+    }
+
+    if (wire.field_cnt == 0 || wire.field_cnt > MAX_ATTRS) goto malformed;
+    sch.field_cnt = wire.field_cnt;
+    for (int i=0; i<sch.field_cnt; i++) {
+        if (wire.field_types[i] != INT && wire.field_types[i] != CHAR &&
+                wire.field_types[i] != FLOAT) {
+            goto malformed;
+        }
+
+        sch.field_types[i] = wire.field_types[i];
+        sch.field_lengths[i] = wire.field_lengths[i];
+    }
+
+    pthread_mutex_lock(&srv->tbl_lock);
+
+    // A table which is open can't be replaced out from under its users
+    int handle = SRV_ERR;
+    if (srv_find_table(srv, name) < 0) {
+        table *tbl = tbl_create(name, srv->db, &sch);
+        if (tbl) handle = srv_add_table(srv, tbl);
+    }
+
+    pthread_mutex_unlock(&srv->tbl_lock);
+
+    if (handle < 0) {
+        srv_respond(conn, req->id, handle, 0);
+        return;
+    }
+
+    uint32_t rec_len = srv->tables[handle].tbl->fields.record_length;
+    char *out = srv_respond(conn, req->id, handle, sizeof(uint32_t));
+    if (out) memcpy(out, &rec_len, sizeof(uint32_t));
+    return;
+
+malformed:
+    srv_respond(conn, req->id, SRV_EPROTO, 0);
+}
+
+
+static void srv_open(server *srv, srv_conn *conn, srv_req *req, const char *payload)
+{
+    char name[MAX_TBL_NAME];
+    if (!srv_name(name, payload, req->len)) {
+        srv_respond(conn, req->id, SRV_EPROTO, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&srv->tbl_lock);
+
+    int handle = srv_find_table(srv, name);
+    if (handle < 0) {
+        table *tbl = tbl_load(name, srv->db);
+        handle = tbl ? srv_add_table(srv, tbl) : SRV_ERR;
+    }
+
+    pthread_mutex_unlock(&srv->tbl_lock);
+
+    if (handle < 0) {
+        srv_respond(conn, req->id, handle, 0);
+        return;
+    }
+
+    uint32_t rec_len = srv->tables[handle].tbl->fields.record_length;
+    char *out = srv_respond(conn, req->id, handle, sizeof(uint32_t));
+    if (out) memcpy(out, &rec_len, sizeof(uint32_t));
+}
+
+
+/*
+ * Execute one request, appending its response to the connection's output.
+ */
+static void srv_execute(server *srv, srv_conn *conn, srv_req *req, const char *payload)
+{
+    switch (req->op) {
+        case SRV_PING:
+            srv_respond(conn, req->id, 0, 0);
+            return;
+
+        case SRV_CREATE:
+            srv_create(srv, conn, req, payload);
+            return;
+
+        case SRV_OPEN:
+            srv_open(srv, conn, req, payload);
+            return;
+
+        case SRV_INSERT:
+        case SRV_READ:
+        case SRV_UPDATE:
+            break;
+
+        default:
+            srv_respond(conn, req->id, SRV_EPROTO, 0);
+            return;
+    }
+
+    if (req->tbl >= srv->tbl_cnt) {
+        srv_respond(conn, req->id, SRV_ENOTBL, 0);
+        return;
+    }
+
+    srv_table *st = &srv->tables[req->tbl];
+    uint32_t rec_len = st->tbl->fields.record_length;
+    uint32_t rid;
+
+    if (req->op == SRV_INSERT) {
+        if (req->len != rec_len) {
+            srv_respond(conn, req->id, SRV_EPROTO, 0);
+            return;
+        }
+
+        // The payload isn't aligned, and tbl_insert may read it as a record
+        byte record[BLOCKSIZE];
+        memcpy(record, payload, rec_len);
+
+        pthread_rwlock_wrlock(&st->lock);
+        int res = tbl_insert(st->tbl, record);
+        pthread_rwlock_unlock(&st->lock);
+
+        srv_respond(conn, req->id, (res < 0) ? SRV_ERR : res, 0);
+        return;
+    }
+
+    if (req->op == SRV_READ) {
+        if (req->len != sizeof(uint32_t)) {
+            srv_respond(conn, req->id, SRV_EPROTO, 0);
+            return;
+        }
+
+        memcpy(&rid, payload, sizeof(uint32_t));
+        char *out = srv_respond(conn, req->id, 1, rec_len);
+        if (!out) return;
+
+        pthread_rwlock_rdlock(&st->lock);
+        int found = rid <= INT32_MAX && tbl_read(st->tbl, rid, out);
+        pthread_rwlock_unlock(&st->lock);
+
+        if (!found) {
+            // Take back the payload, and turn the response into a miss
+            conn->out_len -= sizeof(srv_resp) + rec_len;
+            srv_respond(conn, req->id, 0, 0);
+        }
+
+        return;
+    }
+
+    if (req->len != sizeof(uint32_t) + rec_len) {
+        srv_respond(conn, req->id, SRV_EPROTO, 0);
+        return;
+    }
+
+    byte record[BLOCKSIZE];
+    memcpy(&rid, payload, sizeof(uint32_t));
+    memcpy(record, payload + sizeof(uint32_t), rec_len);
+
+    pthread_rwlock_wrlock(&st->lock);
+    int res = rid <= INT32_MAX && tbl_update(st->tbl, rid, record);
+    pthread_rwlock_unlock(&st->lock);
+
+    srv_respond(conn, req->id, res, 0);
+}
+
+
+/*
+ * Connections
+ */
+static void srv_close_conn(server *srv, srv_conn *conn)
+{
+    pthread_mutex_lock(&srv->lock);
+    if (conn->prev) conn->prev->next = conn->next;
+    else srv->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&srv->lock);
+
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+
+static int srv_arm(server *srv, srv_conn *conn, uint32_t events)
+{
+    struct epoll_event ev = {.events = events | EPOLLONESHOT, .data.ptr = conn};
+    return epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == 0;
+}
+
+
+/*
+ * Send as much of the connection's pending output as the socket will take.
+ * Returns 1 if all of it was sent, 0 if some is left, and -1 on error.
+ */
+static int srv_send(srv_conn *conn)
+{
+    while (conn->out_sent < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        conn->out_sent += n;
+    }
+
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    return 1;
+}
+
+
+/*
+ * Read what is available of a connection's input, up to SRV_READ_MAX
+ * bytes at a time (any more will be reported again by epoll once the
+ * connection is re-armed). Returns 1 if the connection is still open, and
+ * 0 if the client has closed it or it has failed.
+ */
+static int srv_read(srv_conn *conn)
+{
+    size_t got = 0;
+
+    while (got < SRV_READ_MAX) {
+        if (!srv_reserve(&conn->in, &conn->in_cap, conn->in_len + SRV_READ_CHUNK)) return 0;
+
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n == 0) return 0;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        conn->in_len += n;
+        got += n;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Handle a connection reported ready: finish sending any output left over
+ * from last time, or else read its input, execute the complete requests
+ * in it, and send all of their responses, before re-arming it.
+ */
+static void srv_handle(server *srv, srv_conn *conn)
+{
+    if (conn->out_len > 0) {
+        int sent = srv_send(conn);
+        if (sent < 0) goto close;
+        if (sent == 0) {
+            if (!srv_arm(srv, conn, EPOLLOUT)) goto close;
+            return;
+        }
+    }
+
+    int open = srv_read(conn);
+
+    size_t pos = 0;
+    long executed = 0;
+    while (conn->in_len - pos >= sizeof(srv_req)) {
+        srv_req req;
+        memcpy(&req, conn->in + pos, sizeof(srv_req));
+        if (req.len > SRV_MAX_PAYLOAD) goto close;
+        if (conn->in_len - pos < sizeof(srv_req) + req.len) break;
+
+        srv_execute(srv, conn, &req, conn->in + pos + sizeof(srv_req));
+        pos += sizeof(srv_req) + req.len;
+        executed++;
+    }
+
+    if (pos > 0) {
+        memmove(conn->in, conn->in + pos, conn->in_len - pos);
+        conn->in_len -= pos;
+    }
+
+    if (executed > 0) {
+        srv->requests += executed;
+        srv->batches++;
+    }
+
+    int sent = srv_send(conn);
+    if (sent < 0 || !open) goto close;
+    if (srv_arm(srv, conn, sent ? EPOLLIN : EPOLLOUT)) return;
+
+close:
+    srv_close_conn(srv, conn);
+}
+
+
+static void srv_accept(server *srv)
+{
+    for (;;) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        srv_conn *conn = calloc(1, sizeof(srv_conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+
+        conn->fd = fd;
+
+        pthread_mutex_lock(&srv->lock);
+        conn->next = srv->conns;
+        if (srv->conns) srv->conns->prev = conn;
+        srv->conns = conn;
+        pthread_mutex_unlock(&srv->lock);
+
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn};
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            srv_close_conn(srv, conn);
+            continue;
+        }
+
+        srv->connections++;
+    }
+}
+
+
+/*
+ * Threads
+ */
+static void *srv_loop(void *arg)
+{
+    server *srv = arg;
+    struct epoll_event events[SRV_EVENTS];
+
+    for (;;) {
+        int cnt = epoll_wait(srv->epoll_fd, events, SRV_EVENTS, -1);
+        if (cnt < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i=0; i<cnt; i++) {
+            if (events[i].data.ptr == &srv->stop_fd) return NULL;
+
+            if (events[i].data.ptr == &srv->listen_fd) {
+                srv_accept(srv);
+                continue;
+            }
+
+            srv_conn *conn = events[i].data.ptr;
+
+            pthread_mutex_lock(&srv->lock);
+            conn->next_ready = NULL;
+            if (srv->ready_tail) srv->ready_tail->next_ready = conn;
+            else srv->ready_head = conn;
+            srv->ready_tail = conn;
+            pthread_cond_signal(&srv->ready_cv);
+            pthread_mutex_unlock(&srv->lock);
+        }
+    }
+
+    return NULL;
+}
+
+
+static void *srv_worker(void *arg)
+{
+    server *srv = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&srv->lock);
+        while (!srv->ready_head && !srv->stopping) pthread_cond_wait(&srv->ready_cv, &srv->lock);
+
+        if (srv->stopping) {
+            pthread_mutex_unlock(&srv->lock);
+            return NULL;
+        }
+
+        srv_conn *conn = srv->ready_head;
+        srv->ready_head = conn->next_ready;
+        if (!srv->ready_head) srv->ready_tail = NULL;
+        pthread_mutex_unlock(&srv->lock);
+
+        srv_handle(srv, conn);
+    }
+}
+
+
+static int srv_listen(server *srv)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, srv->path);
+
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv->listen_fd < 0) return 0;
+
+    // Replace the socket left behind by a server which didn't shut down
+    unlink(srv->path);
+
+    return bind(srv->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+           listen(srv->listen_fd, SOMAXCONN) == 0;
+}
+
+
+/*
+ * Start a server on the Unix socket path, serving the tables of the
+ * database directory db from the default buffer pool, which must already
+ * have been initialized. Returns NULL on failure.
+ */
+server *srv_start(char *path, char *db, srv_opts *opts)
+{
+    srv_opts defaults;
+    if (!opts) {
+        srv_default_opts(&defaults);
+        opts = &defaults;
+    }
+
+    server *srv = calloc(1, sizeof(server));
+    if (!srv) return NULL;
+
+    if (strlen(path) >= sizeof(srv->path) || strlen(db) >= MAX_DB_NAME || opts->workers <= 0 ||
+            opts->workers > SRV_MAX_WORKERS) {
+        free(srv);
+        return NULL;
+    }
+
+    strcpy(srv->path, path);
+    strcpy(srv->db, db);
+    srv->opts = *opts;
+    srv->listen_fd = srv->epoll_fd = srv->stop_fd = -1;
+
+    pthread_mutex_init(&srv->lock, NULL);
+    pthread_cond_init(&srv->ready_cv, NULL);
+    pthread_mutex_init(&srv->tbl_lock, NULL);
+
+    struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = &srv->listen_fd};
+    struct epoll_event stop_ev = {.events = EPOLLIN, .data.ptr = &srv->stop_fd};
+
+    if (!srv_listen(srv) || (srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            (srv->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+            epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &listen_ev) != 0 ||
+            epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->stop_fd, &stop_ev) != 0) {
+        goto error;
+    }
+
+    int started = 0;
+    for (; started<opts->workers; started++) {
+        if (pthread_create(&srv->workers[started], NULL, srv_worker, srv) != 0) break;
+    }
+
+    if (started == opts->workers && pthread_create(&srv->loop, NULL, srv_loop, srv) == 0) {
+        return srv;
+    }
+
+    pthread_mutex_lock(&srv->lock);
+    srv->stopping = TRUE;
+    pthread_cond_broadcast(&srv->ready_cv);
+    pthread_mutex_unlock(&srv->lock);
+
+    for (int i=0; i<started; i++) pthread_join(srv->workers[i], NULL);
+
+error:
+    if (srv->listen_fd >= 0) {
+        close(srv->listen_fd);
+        unlink(srv->path);
+    }
+    if (srv->epoll_fd >= 0) close(srv->epoll_fd);
+    if (srv->stop_fd >= 0) close(srv->stop_fd);
+    free(srv);
+    return NULL;
+}
+
+
+/*
+ * Stop a server, closing its clients' connections, and its tables, and
+ * free it. Requests being executed are finished, but those not yet read
+ * are dropped.
+ */
+void srv_stop(server *srv)
+{
+    uint64_t one = 1;
+    while (write(srv->stop_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+    pthread_join(srv->loop, NULL);
+
+    pthread_mutex_lock(&srv->lock);
+    srv->stopping = TRUE;
+    pthread_cond_broadcast(&srv->ready_cv);
+    pthread_mutex_unlock(&srv->lock);
+
+    for (int i=0; i<srv->opts.workers; i++) pthread_join(srv->workers[i], NULL);
+
+    while (srv->conns) srv_close_conn(srv, srv->conns);
+
+    for (int i=0; i<srv->tbl_cnt; i++) {
+        tbl_close(srv->tables[i].tbl);
+        pthread_rwlock_destroy(&srv->tables[i].lock);
+    }
+
+    close(srv->listen_fd);
+    unlink(srv->path);
+    close(srv->epoll_fd);
+    close(srv->stop_fd);
+
+    pthread_mutex_destroy(&srv->lock);
+    pthread_cond_destroy(&srv->ready_cv);
+    pthread_mutex_destroy(&srv->tbl_lock);
+    free(srv);
+}
+
+
+void srv_stats_get(server *srv, srv_stats *stats)
+{
+    stats->connections = srv->connections;
+    stats->requests = srv->requests;
+    stats->batches = srv->batches;
+}
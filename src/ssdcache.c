@@ -0,0 +1,318 @@
+/*
+ * ssdcache.c
+ *
+ * A second-tier page cache for the yahi-db buffer pool, kept in a file on
+ * fast local storage.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "blockio.h"
+#include "ssdcache.h"
+#include "stats.h"
+#include "table.h"
+#include "yahi.h"
+
+
+static inline uint64_t sc_hash(table *tbl, int blk_no)
+{
+    uint64_t x = (uintptr_t) tbl ^ ((uint64_t) (uint32_t) blk_no * 0x9e3779b97f4a7c15ULL);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+
+static int sc_pow2(int n)
+{
+    int p = 1;
+    while (p < n) p <<= 1;
+
+    return p;
+}
+
+
+/*
+ * Create a cache of slots pages in a new file at path, replacing any file
+ * already there, using admission policy (one of the SC_ADMIT_* constants).
+ * Returns NULL if the arguments are invalid, or the file or directory
+ * cannot be created.
+ */
+sc_cache *sc_create(char *path, int slots, int policy)
+{
+    if (!path || strlen(path) >= SC_PATH_LEN || slots <= 0) return NULL;
+    if (policy != SC_ADMIT_ALL && policy != SC_ADMIT_REPEAT) return NULL;
+
+    sc_cache *cache = calloc(1, sizeof(sc_cache));
+    if (!cache) return NULL;
+
+    strcpy(cache->path, path);
+    cache->slots = slots;
+    cache->policy = policy;
+    cache->dir_mask = sc_pow2(2 * slots) - 1;
+    cache->ghost_mask = sc_pow2(slots) - 1;
+
+    cache->tags = calloc(slots, sizeof(sc_tag));
+    cache->refs = calloc(slots, sizeof(byte));
+    cache->free = malloc(sizeof(int) * slots);
+    cache->dir = malloc(sizeof(int32_t) * (cache->dir_mask + 1));
+    cache->ghosts = calloc(cache->ghost_mask + 1, sizeof(uint32_t));
+    cache->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (!cache->tags || !cache->refs || !cache->free || !cache->dir || !cache->ghosts ||
+            cache->fd < 0 || ftruncate(cache->fd, (off_t) slots * BLOCKSIZE) != 0) {
+        sc_free(cache);
+        return NULL;
+    }
+
+    memset(cache->dir, 0xff, sizeof(int32_t) * (cache->dir_mask + 1));
+
+    // Hand out the lowest slots first
+    for (int i=0; i<slots; i++) cache->free[i] = slots - 1 - i;
+    cache->free_cnt = slots;
+
+    return cache;
+}
+
+
+void sc_free(sc_cache *cache)
+{
+    if (!cache) return;
+
+    if (cache->fd >= 0) {
+        close(cache->fd);
+        unlink(cache->path);
+    }
+
+    free(cache->tags);
+    free(cache->refs);
+    free(cache->free);
+    free(cache->dir);
+    free(cache->ghosts);
+    free(cache);
+}
+
+
+/*
+ * The directory position holding the slot of (tbl, blk_no), or of the
+ * empty entry where it would go.
+ */
+static int sc_dir_pos(sc_cache *cache, table *tbl, int blk_no)
+{
+    int pos = sc_hash(tbl, blk_no) & cache->dir_mask;
+
+    for (;;) {
+        int32_t s = cache->dir[pos];
+        if (s < 0 || (cache->tags[s].tbl == tbl && cache->tags[s].blk_no == blk_no)) return pos;
+        pos = (pos + 1) & cache->dir_mask;
+    }
+}
+
+
+/*
+ * Empty directory position pos, shifting back any later entries of its
+ * run that would no longer be found past the gap.
+ */
+static void sc_dir_delete(sc_cache *cache, int pos)
+{
+    int mask = cache->dir_mask;
+
+    for (int j=(pos + 1) & mask; cache->dir[j] >= 0; j=(j + 1) & mask) {
+        sc_tag *t = &cache->tags[cache->dir[j]];
+        int home = sc_hash(t->tbl, t->blk_no) & mask;
+
+        if (((j - home) & mask) >= ((j - pos) & mask)) {
+            cache->dir[pos] = cache->dir[j];
+            pos = j;
+        }
+    }
+
+    cache->dir[pos] = -1;
+}
+
+
+/*
+ * Remove the block in slot s from the directory, and free the slot.
+ */
+static void sc_release(sc_cache *cache, int s)
+{
+    sc_dir_delete(cache, sc_dir_pos(cache, cache->tags[s].tbl, cache->tags[s].blk_no));
+    cache->tags[s].tbl = NULL;
+    cache->refs[s] = 0;
+    cache->free[cache->free_cnt++] = s;
+}
+
+
+int sc_contains(sc_cache *cache, table *tbl, int blk_no)
+{
+    return cache->dir[sc_dir_pos(cache, tbl, blk_no)] >= 0;
+}
+
+
+/*
+ * Copy block blk_no of tbl into data, if it is cached. Returns 1 if it
+ * was, and 0 if not (or if it could not be read).
+ */
+int sc_read(sc_cache *cache, table *tbl, int blk_no, byte *data)
+{
+    int pos = sc_dir_pos(cache, tbl, blk_no);
+    int s = cache->dir[pos];
+
+    if (s < 0) {
+        cache->misses++;
+        STAT_ADD(STAT_CACHE_MISSES, 1);
+        return 0;
+    }
+
+    STAT_TIMER(start);
+    ssize_t got = pread(cache->fd, data, BLOCKSIZE, (off_t) s * BLOCKSIZE);
+    STAT_RECORD(STAT_HIST_CACHE_READ, start);
+
+    if (got != BLOCKSIZE) {
+        sc_release(cache, s);
+        cache->misses++;
+        STAT_ADD(STAT_CACHE_MISSES, 1);
+        return 0;
+    }
+
+    cache->refs[s] = 1;
+    cache->hits++;
+    STAT_ADD(STAT_CACHE_HITS, 1);
+    return 1;
+}
+
+
+/*
+ * Whether a block the full cache is offered should be admitted. Under
+ * SC_ADMIT_REPEAT, a block is turned away the first time, and its hash is
+ * noted in the ghost filter, where a second offer before some other block
+ * overwrites it will find it.
+ */
+static int sc_should_admit(sc_cache *cache, table *tbl, int blk_no)
+{
+    if (cache->policy == SC_ADMIT_ALL) return TRUE;
+
+    uint64_t h = sc_hash(tbl, blk_no);
+    uint32_t fp = (uint32_t) (h >> 32) | 1;
+    uint32_t *ghost = &cache->ghosts[h & cache->ghost_mask];
+
+    if (*ghost == fp) {
+        *ghost = 0;
+        return TRUE;
+    }
+
+    *ghost = fp;
+    return FALSE;
+}
+
+
+/*
+ * Choose a slot to reuse by clock, passing over (and clearing the
+ * reference bit of) any slot referenced since the hand last came by. Only
+ * called when every slot is in use.
+ */
+static int sc_victim(sc_cache *cache)
+{
+    for (;;) {
+        int s = cache->hand;
+        cache->hand = (s + 1 < cache->slots) ? s + 1 : 0;
+
+        if (!cache->refs[s]) return s;
+        cache->refs[s] = 0;
+    }
+}
+
+
+/*
+ * Offer the cache block blk_no of tbl, just evicted from the pool, whose
+ * contents are data (the same as in the table's file). Returns
+ * 1 if the block is now cached, and 0 if it was turned away or could not
+ * be written.
+ */
+int sc_admit(sc_cache *cache, table *tbl, int blk_no, byte *data)
+{
+    int pos = sc_dir_pos(cache, tbl, blk_no);
+    if (cache->dir[pos] >= 0) {
+        cache->refs[cache->dir[pos]] = 1;
+        return 1;
+    }
+
+    int s;
+    if (cache->free_cnt > 0) {
+        s = cache->free[--cache->free_cnt];
+    } else {
+        if (!sc_should_admit(cache, tbl, blk_no)) {
+            cache->rejects++;
+            return 0;
+        }
+
+        s = sc_victim(cache);
+        sc_release(cache, s);
+        cache->free_cnt--;
+        cache->evictions++;
+    }
+
+    STAT_TIMER(start);
+    ssize_t put = pwrite(cache->fd, data, BLOCKSIZE, (off_t) s * BLOCKSIZE);
+    STAT_RECORD(STAT_HIST_CACHE_WRITE, start);
+
+    if (put != BLOCKSIZE) {
+        cache->free[cache->free_cnt++] = s;
+        return 0;
+    }
+
+    // The release above may have moved entries, so look again
+    pos = sc_dir_pos(cache, tbl, blk_no);
+    cache->dir[pos] = s;
+    cache->tags[s] = (sc_tag) {.tbl = tbl, .blk_no = blk_no};
+    cache->refs[s] = 0;
+
+    cache->admits++;
+    STAT_ADD(STAT_CACHE_ADMITS, 1);
+    return 1;
+}
+
+
+/*
+ * Drop any cached copy of block blk_no of tbl, which is about to change
+ * in the table's file.
+ */
+void sc_invalidate(sc_cache *cache, table *tbl, int blk_no)
+{
+    int s = cache->dir[sc_dir_pos(cache, tbl, blk_no)];
+    if (s < 0) return;
+
+    sc_release(cache, s);
+    cache->invalidations++;
+}
+
+
+/*
+ * Drop every cached block of tbl. Returns the number dropped.
+ */
+int sc_invalidate_tbl(sc_cache *cache, table *tbl)
+{
+    int dropped = 0;
+
+    for (int s=0; s<cache->slots; s++) {
+        if (!tbl || cache->tags[s].tbl != tbl) continue;
+
+        sc_release(cache, s);
+        dropped++;
+    }
+
+    cache->invalidations += dropped;
+    return dropped;
+}
@@ -0,0 +1,282 @@
+/* stats.c
+ *
+ * Buffer pool and block I/O statistics for yahi-db.
+ *
+ * Each thread's statistics are allocated the first time it records
+ * anything, and linked into a global list which snapshots walk. When a
+ * thread exits, its totals are folded into a retired set and its storage
+ * is released. Resetting doesn't touch any thread's counters (which only
+ * their owner may write); instead it records a baseline that is
+ * subtracted from later snapshots.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "table.h"
+#include "yahi.h"
+
+__thread stat_local *_STAT_LOCAL = NULL;
+
+static pthread_mutex_t _STAT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _STAT_ONCE = PTHREAD_ONCE_INIT;
+static pthread_key_t _STAT_KEY;
+
+static stat_local *_STAT_THREADS = NULL;
+static stat_snapshot _STAT_RETIRED;
+static stat_snapshot _STAT_BASELINE;
+
+
+static void stat_accumulate(stat_snapshot *snap, stat_local *local)
+{
+    for (int c=0; c<STAT_CNT; c++) {
+        snap->counters[c] += atomic_load_explicit(&local->counters[c], memory_order_relaxed);
+    }
+
+    for (int h=0; h<STAT_HIST_CNT; h++) {
+        stat_hist *hist = &snap->hists[h];
+        for (int b=0; b<STAT_HIST_BUCKETS; b++) {
+            hist->counts[b] += atomic_load_explicit(&local->hist_counts[h][b], memory_order_relaxed);
+        }
+
+        hist->total += atomic_load_explicit(&local->hist_total[h], memory_order_relaxed);
+        hist->sum += atomic_load_explicit(&local->hist_sum[h], memory_order_relaxed);
+    }
+}
+
+
+static void stat_local_retire(void *arg)
+{
+    stat_local *local = arg;
+
+    pthread_mutex_lock(&_STAT_LOCK);
+    stat_accumulate(&_STAT_RETIRED, local);
+
+    stat_local **link = &_STAT_THREADS;
+    while (*link && *link != local) link = &(*link)->next;
+    if (*link) *link = local->next;
+    pthread_mutex_unlock(&_STAT_LOCK);
+
+    _STAT_LOCAL = NULL;
+    free(local);
+}
+
+
+static void stat_key_init()
+{
+    pthread_key_create(&_STAT_KEY, stat_local_retire);
+}
+
+
+/*
+ * Allocate and register the calling thread's statistics. Returns NULL if
+ * they cannot be allocated, in which case the thread's events go
+ * uncounted.
+ */
+stat_local *stat_local_init()
+{
+    pthread_once(&_STAT_ONCE, stat_key_init);
+
+    stat_local *local = calloc(1, sizeof(stat_local));
+    if (!local) return NULL;
+
+    pthread_mutex_lock(&_STAT_LOCK);
+    local->next = _STAT_THREADS;
+    _STAT_THREADS = local;
+    pthread_mutex_unlock(&_STAT_LOCK);
+
+    pthread_setspecific(_STAT_KEY, local);
+    _STAT_LOCAL = local;
+
+    return local;
+}
+
+
+static void stat_collect(stat_snapshot *snap)
+{
+    *snap = _STAT_RETIRED;
+    for (stat_local *local = _STAT_THREADS; local; local = local->next) {
+        stat_accumulate(snap, local);
+    }
+}
+
+
+/*
+ * Sum the global statistics of all threads, less those at the last reset,
+ * into snap.
+ */
+void stat_snapshot_get(stat_snapshot *snap)
+{
+    pthread_mutex_lock(&_STAT_LOCK);
+    stat_collect(snap);
+
+    for (int c=0; c<STAT_CNT; c++) {
+        snap->counters[c] -= _STAT_BASELINE.counters[c];
+    }
+
+    for (int h=0; h<STAT_HIST_CNT; h++) {
+        for (int b=0; b<STAT_HIST_BUCKETS; b++) {
+            snap->hists[h].counts[b] -= _STAT_BASELINE.hists[h].counts[b];
+        }
+
+        snap->hists[h].total -= _STAT_BASELINE.hists[h].total;
+        snap->hists[h].sum -= _STAT_BASELINE.hists[h].sum;
+    }
+    pthread_mutex_unlock(&_STAT_LOCK);
+}
+
+
+/*
+ * Zero the global statistics, as seen by later snapshots.
+ */
+void stat_reset()
+{
+    pthread_mutex_lock(&_STAT_LOCK);
+    stat_collect(&_STAT_BASELINE);
+    pthread_mutex_unlock(&_STAT_LOCK);
+}
+
+
+/*
+ * Copy tbl's STAT_TBL_CNT counters into counters.
+ */
+void stat_tbl_get(table *tbl, long *counters)
+{
+    for (int c=0; c<STAT_TBL_CNT; c++) {
+        counters[c] = atomic_load_explicit(&tbl->stats.counters[c], memory_order_relaxed);
+    }
+}
+
+
+void stat_tbl_reset(table *tbl)
+{
+    for (int c=0; c<STAT_TBL_CNT; c++) {
+        atomic_store_explicit(&tbl->stats.counters[c], 0, memory_order_relaxed);
+    }
+}
+
+
+/*
+ * Values below 2^STAT_SUB_BITS get a bucket each. Above that, each power
+ * of two is split into 2^STAT_SUB_BITS equal buckets. Values beyond
+ * 2^(STAT_MAX_EXP + 1) all land in the last bucket.
+ */
+int stat_hist_bucket(long value)
+{
+    if (value < (1L << STAT_SUB_BITS)) return (value < 0) ? 0 : value;
+
+    int exp = 63 - __builtin_clzl(value);
+    if (exp > STAT_MAX_EXP) return STAT_HIST_BUCKETS - 1;
+
+    int sub = (value >> (exp - STAT_SUB_BITS)) & ((1 << STAT_SUB_BITS) - 1);
+    return ((exp - STAT_SUB_BITS + 1) << STAT_SUB_BITS) + sub;
+}
+
+
+/*
+ * The largest value that falls in bucket.
+ */
+long stat_hist_bucket_max(int bucket)
+{
+    if (bucket < (1 << STAT_SUB_BITS)) return bucket;
+
+    int exp = (bucket >> STAT_SUB_BITS) + STAT_SUB_BITS - 1;
+    long sub = bucket & ((1 << STAT_SUB_BITS) - 1);
+
+    return ((((1L << STAT_SUB_BITS) + sub + 1) << (exp - STAT_SUB_BITS))) - 1;
+}
+
+
+/*
+ * The value below which pct percent of the recorded values fall, to the
+ * precision of the histogram. Returns 0 for an empty histogram.
+ */
+long stat_hist_percentile(stat_hist *hist, double pct)
+{
+    if (hist->total <= 0) return 0;
+
+    long rank = (long) (pct / 100.0 * hist->total + 0.5);
+    if (rank < 1) rank = 1;
+
+    long seen = 0;
+    for (int b=0; b<STAT_HIST_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen >= rank) return stat_hist_bucket_max(b);
+    }
+
+    return stat_hist_bucket_max(STAT_HIST_BUCKETS - 1);
+}
+
+
+double stat_hist_mean(stat_hist *hist)
+{
+    return (hist->total > 0) ? (double) hist->sum / hist->total : 0.0;
+}
+
+
+/*
+ * Break a snapshot down by the tier that served each page request: the
+ * buffer pool, the second-tier cache (see ssdcache.h), or the table's own
+ * file. Each tier is looked up by the requests the tiers above it missed.
+ * Pool hits involve no I/O, so no latency is recorded for them; the
+ * latencies of the other two are those of their reads.
+ */
+void stat_tiers(stat_snapshot *snap, stat_tier *tiers)
+{
+    long *c = snap->counters;
+    long lookups[] = {c[STAT_HITS] + c[STAT_MISSES], c[STAT_CACHE_HITS] + c[STAT_CACHE_MISSES],
+                      c[STAT_MISSES] - c[STAT_CACHE_HITS]};
+    long hits[] = {c[STAT_HITS], c[STAT_CACHE_HITS], c[STAT_MISSES] - c[STAT_CACHE_HITS]};
+    stat_hist *hists[] = {NULL, &snap->hists[STAT_HIST_CACHE_READ], &snap->hists[STAT_HIST_READ]};
+
+    for (int t=0; t<STAT_TIER_CNT; t++) {
+        tiers[t].lookups = lookups[t];
+        tiers[t].hits = hits[t];
+        tiers[t].hit_ratio = (lookups[t] > 0) ? (double) hits[t] / lookups[t] : 0.0;
+        tiers[t].mean_ns = hists[t] ? stat_hist_mean(hists[t]) : 0.0;
+        tiers[t].p99_ns = hists[t] ? stat_hist_percentile(hists[t], 99) : 0;
+    }
+}
+
+
+/*
+ * Write a snapshot as key=value lines, suitable for scraping.
+ */
+void stat_print(FILE *out, stat_snapshot *snap)
+{
+    static const char *counters[] = {"hits", "misses", "evictions", "writebacks",
+                                     "blk_reads", "blk_writes", "bytes_read", "bytes_written",
+                                     "cache_hits", "cache_misses", "cache_admits"};
+    static const char *hists[] = {"read_ns", "write_ns", "pin_wait_ns", "cache_read_ns",
+                                  "cache_write_ns"};
+
+    for (int c=0; c<STAT_CNT; c++) {
+        fprintf(out, "%s=%ld\n", counters[c], snap->counters[c]);
+    }
+
+    for (int h=0; h<STAT_HIST_CNT; h++) {
+        stat_hist *hist = &snap->hists[h];
+        fprintf(out, "%s.count=%ld\n%s.mean=%.1f\n%s.p50=%ld\n%s.p99=%ld\n%s.max=%ld\n",
+                hists[h], hist->total, hists[h], stat_hist_mean(hist),
+                hists[h], stat_hist_percentile(hist, 50), hists[h], stat_hist_percentile(hist, 99),
+                hists[h], stat_hist_percentile(hist, 100));
+    }
+
+    stat_tier tiers[STAT_TIER_CNT];
+    static const char *names[] = {"pool", "cache", "disk"};
+
+    stat_tiers(snap, tiers);
+    for (int t=0; t<STAT_TIER_CNT; t++) {
+        fprintf(out, "tier.%s.lookups=%ld\ntier.%s.hits=%ld\ntier.%s.hit_ratio=%.4f\n"
+                "tier.%s.mean_ns=%.1f\ntier.%s.p99_ns=%ld\n", names[t], tiers[t].lookups,
+                names[t], tiers[t].hits, names[t], tiers[t].hit_ratio, names[t],
+                tiers[t].mean_ns, names[t], tiers[t].p99_ns);
+    }
+}
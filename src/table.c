@@ -0,0 +1,593 @@
+/*
+ * table.c
+ *
+ * yahi-db table operations.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "aggview.h"
+#include "art.h"
+#include "blockio.h"
+#include "bloom.h"
+#include "bmindex.h"
+#include "codec.h"
+#include "inserter.h"
+#include "lsm.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "pgcompress.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+#include "zonemap.h"
+
+#define TBL_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 6)
+
+
+static void tbl_path(char *path, char *name, char *database)
+{
+    snprintf(path, TBL_PATH_LEN, "%s/%s.tbl", database, name);
+}
+
+
+/*
+ * The header block is a flat sequence of ints:
+ *      record_cnt, field_cnt, record_length,
+ *      field_lengths[MAX_ATTRS], field_types[MAX_ATTRS],
+ *      compression, engine, key_col
+ *
+ * key_col is the key column of an LSM table, and -1 for a heap.
+ */
+static int tbl_write_header(table *tbl)
+{
+    byte blk[BLOCKSIZE];
+    memset(blk, 0, BLOCKSIZE);
+
+    int offset = 0;
+    tp_setint(blk, offset, tbl->record_cnt); offset += sizeof(int);
+    tp_setint(blk, offset, tbl->fields.field_cnt); offset += sizeof(int);
+    tp_setint(blk, offset, tbl->fields.record_length); offset += sizeof(int);
+
+    for (int i=0; i<MAX_ATTRS; i++) {
+        tp_setint(blk, offset, tbl->fields.field_lengths[i]);
+        offset += sizeof(int);
+    }
+
+    for (int i=0; i<MAX_ATTRS; i++) {
+        tp_setint(blk, offset, tbl->fields.field_types[i]);
+        offset += sizeof(int);
+    }
+
+    tp_setint(blk, offset, tbl->compression); offset += sizeof(int);
+    tp_setint(blk, offset, tbl->engine); offset += sizeof(int);
+    tp_setint(blk, offset, tbl->lsm ? tbl->lsm->key_col : -1);
+
+    return blk_write(tbl->file, TBL_HEADER_BLK, blk) == BLOCKSIZE;
+}
+
+
+static int tbl_read_header(table *tbl, int *key_col)
+{
+    byte blk[BLOCKSIZE];
+    if (blk_read(tbl->file, TBL_HEADER_BLK, blk) != BLOCKSIZE) {
+        return 0;
+    }
+
+    int offset = 0;
+    tbl->record_cnt = tp_getasint(blk, offset); offset += sizeof(int);
+    tbl->fields.field_cnt = tp_getasint(blk, offset); offset += sizeof(int);
+    tbl->fields.record_length = tp_getasint(blk, offset); offset += sizeof(int);
+
+    for (int i=0; i<MAX_ATTRS; i++) {
+        tbl->fields.field_lengths[i] = tp_getasint(blk, offset);
+        offset += sizeof(int);
+    }
+
+    for (int i=0; i<MAX_ATTRS; i++) {
+        tbl->fields.field_types[i] = tp_getasint(blk, offset);
+        offset += sizeof(int);
+    }
+
+    tbl->compression = tp_getasint(blk, offset); offset += sizeof(int);
+    tbl->engine = tp_getasint(blk, offset); offset += sizeof(int);
+    *key_col = tp_getasint(blk, offset);
+
+    return 1;
+}
+
+
+/*
+ * Create a new, empty, table in the specified database (which is simply a
+ * directory that must already exist). Any existing table of the same name
+ * will be overwritten. The field lengths of INT and FLOAT fields are set
+ * from their types, and the record length is computed from the fields, so
+ * the caller need only fill in field_cnt, field_types, and the lengths of
+ * CHAR fields. Returns NULL on error.
+ */
+table *tbl_create(char* name, char* database, schema *schema)
+{
+    return tbl_create_compressed(name, database, schema, PGC_NONE);
+}
+
+
+/*
+ * As tbl_create, but with the table's pages stored compressed using the
+ * specified scheme (one of the PGC_* constants).
+ */
+table *tbl_create_compressed(char* name, char* database, schema *schema, int compression)
+{
+    if (compression < PGC_NONE || compression > PGC_LZ4) return NULL;
+    if (schema->field_cnt <= 0 || schema->field_cnt > MAX_ATTRS) return NULL;
+    if (strlen(name) >= MAX_TBL_NAME || strlen(database) >= MAX_DB_NAME) return NULL;
+
+    table *tbl = calloc(1, sizeof(table));
+    if (!tbl) return NULL;
+
+    strcpy(tbl->name, name);
+    strcpy(tbl->db, database);
+    tbl->fields = *schema;
+    tbl->compression = compression;
+    tbl->fields.record_length = 0;
+
+    for (int i=0; i<tbl->fields.field_cnt; i++) {
+        int len = tp_size(schema->field_types[i], schema->field_lengths[i]);
+        tbl->fields.field_lengths[i] = len;
+        tbl->fields.record_length += len;
+    }
+
+    if (tbl->fields.record_length <= 0 || tbl->fields.record_length > BLOCKSIZE ||
+            !(tbl->codec = cd_create(&tbl->fields))) {
+        free(tbl);
+        return NULL;
+    }
+
+    char path[TBL_PATH_LEN];
+    tbl_path(path, name, database);
+    tbl->file = fopen(path, "w+");
+    if (!tbl->file) {
+        cd_free(tbl->codec);
+        free(tbl);
+        return NULL;
+    }
+
+    if (blk_new(tbl->file) != TBL_HEADER_BLK || !tbl_write_header(tbl)) {
+        fclose(tbl->file);
+        cd_free(tbl->codec);
+        free(tbl);
+        return NULL;
+    }
+
+    if (compression != PGC_NONE && !(tbl->cmap = pgc_map_create(tbl))) {
+        fclose(tbl->file);
+        cd_free(tbl->codec);
+        free(tbl);
+        return NULL;
+    }
+
+    // A table without a zone map still works, it just can't skip blocks
+    tbl->zmap = zm_create(tbl);
+
+    // Don't pick up the zone map, filter or indexes of an earlier table of
+    // the same name
+    zm_remove(tbl);
+    bf_remove(tbl);
+    bmi_remove(tbl);
+
+    return tbl;
+}
+
+
+/*
+ * As tbl_create, but with the table's records stored in a log-structured
+ * merge tree keyed on column key_col, which must be an INT column (see
+ * lsm.h). If opts is NULL, the tree's defaults are used.
+ */
+table *tbl_create_lsm(char* name, char* database, schema *schema, int key_col,
+                      struct lsm_opts *opts)
+{
+    table *tbl = tbl_create(name, database, schema);
+    if (!tbl) return NULL;
+
+    // Zone maps and filters cover heap blocks, which an LSM table has none of
+    zm_free(tbl->zmap);
+    tbl->zmap = NULL;
+
+    if (!(tbl->lsm = lsm_create(tbl, key_col, opts))) {
+        tbl_close(tbl);
+        return NULL;
+    }
+
+    tbl->engine = TBL_ENGINE_LSM;
+    if (!tbl_write_header(tbl)) {
+        tbl_close(tbl);
+        return NULL;
+    }
+
+    return tbl;
+}
+
+
+/*
+ * Open an existing table from the specified database. Returns NULL if the
+ * table does not exist or its header cannot be read.
+ */
+table *tbl_load(char* name, char* database)
+{
+    if (strlen(name) >= MAX_TBL_NAME || strlen(database) >= MAX_DB_NAME) return NULL;
+
+    table *tbl = calloc(1, sizeof(table));
+    if (!tbl) return NULL;
+
+    strcpy(tbl->name, name);
+    strcpy(tbl->db, database);
+
+    char path[TBL_PATH_LEN];
+    tbl_path(path, name, database);
+    tbl->file = fopen(path, "r+");
+    if (!tbl->file) {
+        free(tbl);
+        return NULL;
+    }
+
+    int key_col;
+    if (!tbl_read_header(tbl, &key_col) || !(tbl->codec = cd_create(&tbl->fields))) {
+        fclose(tbl->file);
+        free(tbl);
+        return NULL;
+    }
+
+    if (tbl->engine == TBL_ENGINE_LSM) {
+        if (!(tbl->lsm = lsm_open(tbl, key_col))) {
+            fclose(tbl->file);
+            cd_free(tbl->codec);
+            free(tbl);
+            return NULL;
+        }
+
+        return tbl;
+    }
+
+    if (tbl->compression != PGC_NONE && !(tbl->cmap = pgc_map_load(tbl))) {
+        fclose(tbl->file);
+        cd_free(tbl->codec);
+        free(tbl);
+        return NULL;
+    }
+
+    tbl->zmap = zm_load(tbl);
+    tbl->bloom = bf_load(tbl);
+    bmi_load(tbl);
+
+    return tbl;
+}
+
+
+static int tbl_madvise_flag(int access)
+{
+    switch (access) {
+        case TBL_ACCESS_SEQUENTIAL:
+            return MADV_SEQUENTIAL;
+        case TBL_ACCESS_RANDOM:
+            return MADV_RANDOM;
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+
+/*
+ * Open an existing, uncompressed table read-only by mapping its file into
+ * memory, with access (one of the TBL_ACCESS_* constants) passed on to the
+ * kernel as an madvise hint. The table is used through the usual pin/unpin
+ * interface, but its pages are served directly from the mapping and never
+ * enter the buffer pool. Mapped pages must not be modified, and inserts
+ * into the table fail. Returns NULL if the table cannot be opened or is
+ * compressed.
+ */
+table *tbl_load_mmap(char* name, char* database, int access)
+{
+    if (strlen(name) >= MAX_TBL_NAME || strlen(database) >= MAX_DB_NAME) return NULL;
+
+    table *tbl = calloc(1, sizeof(table));
+    if (!tbl) return NULL;
+
+    strcpy(tbl->name, name);
+    strcpy(tbl->db, database);
+
+    char path[TBL_PATH_LEN];
+    tbl_path(path, name, database);
+    tbl->file = fopen(path, "r");
+    if (!tbl->file) {
+        free(tbl);
+        return NULL;
+    }
+
+    int key_col;
+    if (!tbl_read_header(tbl, &key_col) || tbl->compression != PGC_NONE ||
+            tbl->engine != TBL_ENGINE_HEAP ||
+            !(tbl->codec = cd_create(&tbl->fields))) {
+        goto error;
+    }
+
+    tbl->map_len = blk_flen(tbl->file);
+    tbl->map_blks = tbl->map_len / BLOCKSIZE;
+    tbl->map = mmap(NULL, tbl->map_len, PROT_READ, MAP_SHARED, fileno(tbl->file), 0);
+    if (tbl->map == MAP_FAILED) {
+        tbl->map = NULL;
+        goto error;
+    }
+
+    madvise(tbl->map, tbl->map_len, tbl_madvise_flag(access));
+
+    tbl->map_pages = calloc(tbl->map_blks, sizeof(page));
+    if (!tbl->map_pages) {
+        munmap(tbl->map, tbl->map_len);
+        goto error;
+    }
+
+    for (int i=0; i<tbl->map_blks; i++) {
+        tbl->map_pages[i].data = tbl->map + (size_t) i * BLOCKSIZE;
+        tbl->map_pages[i].blk_id = i;
+        tbl->map_pages[i].tbl = tbl;
+        sem_init(&tbl->map_pages[i].locked, FALSE, 1);
+    }
+
+    tbl->zmap = zm_load(tbl);
+    tbl->bloom = bf_load(tbl);
+    bmi_load(tbl);
+
+    return tbl;
+
+error:
+    fclose(tbl->file);
+    cd_free(tbl->codec);
+    free(tbl);
+    return NULL;
+}
+
+
+/*
+ * Change the madvise hint of a memory-mapped table, for example before
+ * and after a full scan. Returns 1 on success and 0 if the table is not
+ * mapped or the hint is rejected.
+ */
+int tbl_advise(table *tbl, int access)
+{
+    if (!tbl->map) return 0;
+
+    return madvise(tbl->map, tbl->map_len, tbl_madvise_flag(access)) == 0;
+}
+
+
+/*
+ * Write the table's pages out of the buffer pool, update the header,
+ * and close the table. The table handle is freed. Fails (returning 0) if
+ * any of the table's pages are still pinned, in which case the table is
+ * left open, or if the memtable of an LSM table could not be written out.
+ */
+int tbl_close(table *tbl)
+{
+    if (tbl->map) {
+        for (int i=0; i<tbl->map_blks; i++) {
+            if (tbl->map_pages[i].pinned) return 0;
+        }
+
+        munmap(tbl->map, tbl->map_len);
+        free(tbl->map_pages);
+        art_free(tbl->art);
+        while (tbl->views) tbl_view_drop(tbl, tbl->views);
+        for (int c=0; c<tbl->fields.field_cnt; c++) bmi_free(tbl->bitmaps[c]);
+        zm_free(tbl->zmap);
+        bf_free(tbl->bloom);
+        cd_free(tbl->codec);
+        fclose(tbl->file);
+        free(tbl);
+
+        return 1;
+    }
+
+    // Records inserted concurrently are only counted once the session ends
+    if (tbl->ins && tbl_ins_end(tbl) < 0) return 0;
+    if (buff_evict_tbl(tbl) < 0) return 0;
+
+    tbl_write_header(tbl);
+    int ok = !tbl->lsm || lsm_close(tbl->lsm);
+
+    if (tbl->cmap) {
+        pgc_map_save(tbl);
+        pgc_map_free(tbl->cmap);
+    }
+
+    if (tbl->zmap) {
+        zm_save(tbl);
+        zm_free(tbl->zmap);
+    }
+
+    if (tbl->bloom) {
+        bf_save(tbl);
+        bf_free(tbl->bloom);
+    }
+
+    bmi_save(tbl);
+    for (int c=0; c<tbl->fields.field_cnt; c++) bmi_free(tbl->bitmaps[c]);
+
+    art_free(tbl->art);
+    while (tbl->views) tbl_view_drop(tbl, tbl->views);
+    cd_free(tbl->codec);
+    fclose(tbl->file);
+    free(tbl);
+
+    return ok;
+}
+
+
+int tbl_field_offset(schema *schema, int field)
+{
+    int offset = 0;
+    for (int i=0; i<field; i++) {
+        offset += schema->field_lengths[i];
+    }
+
+    return offset;
+}
+
+
+int tbl_recs_per_blk(table *tbl)
+{
+    return BLOCKSIZE / tbl->fields.record_length;
+}
+
+
+int tbl_rec_blk(table *tbl, int rid)
+{
+    return TBL_FIRST_BLK + rid / tbl_recs_per_blk(tbl);
+}
+
+
+int tbl_rec_offset(table *tbl, int rid)
+{
+    return (rid % tbl_recs_per_blk(tbl)) * tbl->fields.record_length;
+}
+
+
+/*
+ * The number of data blocks (not counting the header) occupied by the
+ * table's records.
+ */
+int tbl_blk_cnt(table *tbl)
+{
+    int per_blk = tbl_recs_per_blk(tbl);
+    return (tbl->record_cnt + per_blk - 1) / per_blk;
+}
+
+
+/*
+ * Append a record (of the table's record_length) to the end of the table,
+ * through the buffer pool. Returns the new record's id, or -1 on error,
+ * or if the record's key is already in the table's index. LSM tables have
+ * no record ids; the record is put into the tree, and 0 returned on
+ * success.
+ */
+int tbl_insert(table *tbl, byte *record)
+{
+    if (tbl->map || tbl->ins) return -1;
+    if (tbl->lsm) return lsm_put(tbl->lsm, record) ? 0 : -1;
+    if (tbl->art && tbl_art_find(tbl, record) >= 0) return -1;
+
+    int rid = tbl->record_cnt;
+    int blk_no = tbl_rec_blk(tbl, rid);
+
+    if (tbl_rec_offset(tbl, rid) == 0) {
+        if (tbl->cmap) {
+            if (!pgc_map_extend(tbl->cmap, blk_no)) return -1;
+        } else if (blk_no * BLOCKSIZE >= blk_flen(tbl->file)) {
+            if (blk_new(tbl->file) != blk_no) return -1;
+        }
+    }
+
+    page *pg = buff_pin(tbl, blk_no);
+    if (!pg) return -1;
+
+    memcpy(pg->data + tbl_rec_offset(tbl, rid), record, tbl->fields.record_length);
+    pg->modified = TRUE;
+    buff_unpin(tbl, blk_no);
+
+    if (tbl->art) tbl_art_add(tbl, record, rid);
+    tbl_index_add(tbl, record, rid);
+
+    tbl->record_cnt++;
+    return rid;
+}
+
+
+/*
+ * Bring the table's zone map, Bloom filter, views and bitmap indexes up to
+ * date with record, just added with id rid. Its unique index is left to
+ * the caller, which must check it before adding the record.
+ */
+void tbl_index_add(table *tbl, byte *record, int rid)
+{
+    if (tbl->zmap) zm_update(tbl, rid, record);
+    if (tbl->bloom) tbl_bloom_add(tbl, record);
+    if (tbl->views) tbl_view_add(tbl, record);
+    tbl_bitmap_add(tbl, record, rid);
+}
+
+
+/*
+ * Copy the record identified by rid into the record buffer. Returns 1 on
+ * success and 0 if there is no such record.
+ */
+int tbl_read(table *tbl, int rid, byte *record)
+{
+    if (rid < 0 || rid >= tbl->record_cnt) return 0;
+
+    int blk_no = tbl_rec_blk(tbl, rid);
+    page *pg = buff_pin(tbl, blk_no);
+    if (!pg) return 0;
+
+    memcpy(record, pg->data + tbl_rec_offset(tbl, rid), tbl->fields.record_length);
+    buff_unpin(tbl, blk_no);
+
+    return 1;
+}
+
+
+/*
+ * Overwrite the record identified by rid with the contents of record.
+ * Returns 1 on success and 0 if there is no such record, the table is
+ * read-only, or the new record's key is already in the table's index.
+ */
+int tbl_update(table *tbl, int rid, byte *record)
+{
+    if (tbl->map || rid < 0 || rid >= tbl->record_cnt) return 0;
+
+    int blk_no = tbl_rec_blk(tbl, rid);
+    page *pg = buff_pin(tbl, blk_no);
+    if (!pg) return 0;
+
+    // Move the record's index entry if its key changes
+    if (tbl->art) {
+        int other = tbl_art_find(tbl, record);
+        if (other >= 0 && other != rid) {
+            buff_unpin(tbl, blk_no);
+            return 0;
+        }
+
+        if (other < 0) {
+            unsigned char key[BLOCKSIZE];
+            int col = tbl->art->col;
+            tp_getaskey(pg->data + tbl_rec_offset(tbl, rid), tbl_field_offset(&tbl->fields, col),
+                        tbl->fields.field_types[col], tbl->fields.field_lengths[col], key);
+            art_remove(tbl->art, key);
+            tbl_art_add(tbl, record, rid);
+        }
+    }
+
+    byte *stored = pg->data + tbl_rec_offset(tbl, rid);
+    tbl_bitmap_replace(tbl, stored, record, rid);
+
+    // Views take the new version as it is written, so that their scans
+    // never see the page out of step with them
+    if (tbl->views) {
+        tbl_view_replace(tbl, stored, record);
+    } else {
+        memcpy(stored, record, tbl->fields.record_length);
+    }
+    pg->modified = TRUE;
+    buff_unpin(tbl, blk_no);
+
+    if (tbl->zmap) zm_update(tbl, rid, record);
+    if (tbl->bloom) tbl_bloom_add(tbl, record);
+
+    return 1;
+}
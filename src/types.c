@@ -5,28 +5,195 @@
  *
  */
 
+#include "arena.h"
 #include "yahi.h"
+#include "types.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Fields are not guaranteed to be aligned within a record, so all of the
+ * accessors go through memcpy rather than casting the record pointer.
+ */
 int tp_getasint(byte* record, int offset)
 {
-    int value = *(record + offset);
+    int value;
+    memcpy(&value, record + offset, sizeof(int));
     return value;
 }
 
 
 double tp_getasfloat(byte* record, int offset)
 {
-    double value = *(record + offset);
+    double value;
+    memcpy(&value, record + offset, sizeof(double));
     return value;
 }
 
 
-char *tp_getaschar(byte* record, int offset, int length)
+/*
+ * Returns a null-terminated copy of a CHAR field, allocated from the arena
+ * a, or, if a is NULL, with malloc, in which case the caller frees it.
+ */
+char *tp_getaschar(byte* record, int offset, int length, arena *a)
 {
-    char *value = malloc(sizeof(char) * length);
+    if (a) return arena_strndup(a, record + offset, length);
+
+    char *value = malloc(sizeof(char) * (length + 1));
+    if (!value) return NULL;
+
     memcpy(value, record+offset, length);
+    value[length] = '\0';
 
     return value;
 }
+
+
+void tp_setint(byte* record, int offset, int value)
+{
+    memcpy(record + offset, &value, sizeof(int));
+}
+
+
+void tp_setfloat(byte* record, int offset, double value)
+{
+    memcpy(record + offset, &value, sizeof(double));
+}
+
+
+void tp_setchar(byte* record, int offset, char *value, int length)
+{
+    // CHAR fields are fixed width and padded with nulls
+    int len = strnlen(value, length);
+    memcpy(record + offset, value, len);
+    memset(record + offset + len, 0, length - len);
+}
+
+
+/*
+ * Return the number of bytes occupied by a field of the specified type. The
+ * length is only considered for CHAR fields.
+ */
+int tp_size(int type, int length)
+{
+    switch (type) {
+        case INT:
+            return sizeof(int);
+        case FLOAT:
+            return sizeof(double);
+        case CHAR:
+            return length;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Binary-comparable keys. A field's key is its value encoded so that
+ * comparing two keys with memcmp orders them as the values are ordered:
+ * INTs are stored big-endian with the sign bit flipped, and FLOATs
+ * big-endian with the sign bit flipped if positive, and every bit flipped
+ * if negative. CHAR fields, being null padded, already compare correctly,
+ * and are used as they are. Keys of a given type and length are all the
+ * same length (tp_keysize), so that no key is a prefix of another.
+ */
+int tp_keysize(int type, int length)
+{
+    return tp_size(type, length);
+}
+
+
+void tp_intkey(int value, unsigned char *key)
+{
+    uint32_t u = (uint32_t) value ^ 0x80000000u;
+
+    for (int i=0; i<4; i++) key[i] = u >> (24 - 8 * i);
+}
+
+
+void tp_floatkey(double value, unsigned char *key)
+{
+    uint64_t u;
+    memcpy(&u, &value, sizeof(double));
+    u = (u >> 63) ? ~u : u | (1ULL << 63);
+
+    for (int i=0; i<8; i++) key[i] = u >> (56 - 8 * i);
+}
+
+
+void tp_getaskey(byte* record, int offset, int type, int length, unsigned char *key)
+{
+    switch (type) {
+        case INT:
+            tp_intkey(tp_getasint(record, offset), key);
+            break;
+        case FLOAT:
+            tp_floatkey(tp_getasfloat(record, offset), key);
+            break;
+        case CHAR:
+            memcpy(key, record + offset, length);
+            break;
+    }
+}
+
+
+/*
+ * The selection kernels are written so that the loop body is branch-free;
+ * the index is always stored and the output cursor only advances when the
+ * predicate holds. Pulling the switch out of the loop leaves gcc/clang with
+ * a simple loop per operator that they are able to vectorize.
+ */
+#define TP_SELECT_LOOP(expr)                        \
+    for (int i=0; i<n; i++) {                       \
+        sel[k] = i;                                 \
+        k += (expr);                                \
+    }
+
+int tp_selint(const int *values, int n, int cmp, int rhs, int *sel)
+{
+    int k = 0;
+    switch (cmp) {
+        case CMP_EQ: TP_SELECT_LOOP(values[i] == rhs); break;
+        case CMP_NE: TP_SELECT_LOOP(values[i] != rhs); break;
+        case CMP_LT: TP_SELECT_LOOP(values[i] < rhs); break;
+        case CMP_LE: TP_SELECT_LOOP(values[i] <= rhs); break;
+        case CMP_GT: TP_SELECT_LOOP(values[i] > rhs); break;
+        case CMP_GE: TP_SELECT_LOOP(values[i] >= rhs); break;
+    }
+
+    return k;
+}
+
+
+int tp_selfloat(const double *values, int n, int cmp, double rhs, int *sel)
+{
+    int k = 0;
+    switch (cmp) {
+        case CMP_EQ: TP_SELECT_LOOP(values[i] == rhs); break;
+        case CMP_NE: TP_SELECT_LOOP(values[i] != rhs); break;
+        case CMP_LT: TP_SELECT_LOOP(values[i] < rhs); break;
+        case CMP_LE: TP_SELECT_LOOP(values[i] <= rhs); break;
+        case CMP_GT: TP_SELECT_LOOP(values[i] > rhs); break;
+        case CMP_GE: TP_SELECT_LOOP(values[i] >= rhs); break;
+    }
+
+    return k;
+}
+
+
+int tp_selchar(const char *values, int n, int length, int cmp, const char *rhs, int *sel)
+{
+    int k = 0;
+    switch (cmp) {
+        case CMP_EQ: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) == 0); break;
+        case CMP_NE: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) != 0); break;
+        case CMP_LT: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) < 0); break;
+        case CMP_LE: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) <= 0); break;
+        case CMP_GT: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) > 0); break;
+        case CMP_GE: TP_SELECT_LOOP(strncmp(values + i*length, rhs, length) >= 0); break;
+    }
+
+    return k;
+}
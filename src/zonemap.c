@@ -0,0 +1,275 @@
+/* zonemap.c
+ *
+ * Per-block zone maps for yahi-db tables.
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ * This code is published under the BSD 3-Clause License,
+ * see the LICENSE file in the main project directory
+ * for details.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockio.h"
+#include "pgcompress.h"
+#include "table.h"
+#include "types.h"
+#include "yahi.h"
+#include "zonemap.h"
+
+#define ZM_PATH_LEN (MAX_DB_NAME + MAX_TBL_NAME + 5)
+
+
+static double *zm_bounds(zone_map *zm, int blk_no, int col)
+{
+    return zm->bounds + ((size_t) (blk_no - TBL_FIRST_BLK) * zm->col_cnt + col) * 2;
+}
+
+
+/*
+ * Make sure the map covers blk_no. The bounds of new blocks are empty
+ * (min > max), so that nothing matches them.
+ */
+static int zm_extend(zone_map *zm, int blk_no)
+{
+    int idx = blk_no - TBL_FIRST_BLK;
+    if (idx < zm->blk_cnt) return 1;
+
+    if (idx >= zm->cap) {
+        int cap = zm->cap ? zm->cap : 64;
+        while (cap <= idx) cap *= 2;
+
+        double *bounds = realloc(zm->bounds, sizeof(double) * 2 * zm->col_cnt * cap);
+        if (!bounds) return 0;
+
+        zm->bounds = bounds;
+        zm->cap = cap;
+    }
+
+    for (int b=zm->blk_cnt; b<=idx; b++) {
+        for (int c=0; c<zm->col_cnt; c++) {
+            double *bnd = zm_bounds(zm, b + TBL_FIRST_BLK, c);
+            bnd[0] = INFINITY;
+            bnd[1] = -INFINITY;
+        }
+    }
+
+    zm->blk_cnt = idx + 1;
+    return 1;
+}
+
+
+zone_map *zm_create(table *tbl)
+{
+    zone_map *zm = calloc(1, sizeof(zone_map));
+    if (!zm) return NULL;
+
+    zm->col_cnt = tbl->fields.field_cnt;
+    memcpy(zm->types, tbl->fields.field_types, sizeof(zm->types));
+    return zm;
+}
+
+
+/*
+ * Widen the bounds of rid's block to include record.
+ */
+int zm_update(table *tbl, int rid, byte *record)
+{
+    zone_map *zm = tbl->zmap;
+    int blk_no = tbl_rec_blk(tbl, rid);
+    if (!zm_extend(zm, blk_no)) return 0;
+
+    int offset = 0;
+    for (int c=0; c<zm->col_cnt; c++) {
+        double v;
+
+        switch (zm->types[c]) {
+            case INT:
+                v = tp_getasint(record, offset);
+                break;
+            case FLOAT:
+                v = tp_getasfloat(record, offset);
+                break;
+            default:
+                offset += tbl->fields.field_lengths[c];
+                continue;
+        }
+
+        double *bnd = zm_bounds(zm, blk_no, c);
+
+        // NaN compares false against anything, so it can't narrow the
+        // bounds; it only matches CMP_NE, which the widest bounds allow
+        if (isnan(v)) {
+            bnd[0] = -INFINITY;
+            bnd[1] = INFINITY;
+        }
+
+        if (v < bnd[0]) bnd[0] = v;
+        if (v > bnd[1]) bnd[1] = v;
+
+        offset += tbl->fields.field_lengths[c];
+    }
+
+    return 1;
+}
+
+
+/*
+ * Returns TRUE if some record in blk_no may satisfy (col cmp value), and
+ * FALSE only if none can. Blocks outside the map, and CHAR columns, may
+ * always match.
+ */
+int zm_may_match(zone_map *zm, int blk_no, int col, int cmp, double value)
+{
+    if (!zm || col < 0 || col >= zm->col_cnt) return TRUE;
+    if (zm->types[col] != INT && zm->types[col] != FLOAT) return TRUE;
+
+    int idx = blk_no - TBL_FIRST_BLK;
+    if (idx < 0 || idx >= zm->blk_cnt) return TRUE;
+
+    double *bnd = zm_bounds(zm, blk_no, col);
+    double min = bnd[0], max = bnd[1];
+
+    // The block holds no records
+    if (min > max) return FALSE;
+
+    switch (cmp) {
+        case CMP_EQ:
+            return min <= value && value <= max;
+        case CMP_NE:
+            return !(min == value && max == value);
+        case CMP_LT:
+            return min < value;
+        case CMP_LE:
+            return min <= value;
+        case CMP_GT:
+            return max > value;
+        case CMP_GE:
+            return max >= value;
+    }
+
+    return TRUE;
+}
+
+
+static void zm_path(table *tbl, char *path)
+{
+    snprintf(path, ZM_PATH_LEN, "%s/%s.zm", tbl->db, tbl->name);
+}
+
+
+/*
+ * Rebuild the map from the table's blocks as stored, without going through
+ * the buffer pool (which needn't be initialized when a table is opened).
+ */
+static zone_map *zm_rebuild(table *tbl)
+{
+    zone_map *zm = zm_create(tbl);
+    if (!zm) return NULL;
+
+    zone_map *prev = tbl->zmap;
+    tbl->zmap = zm;
+
+    int per_blk = tbl_recs_per_blk(tbl);
+    byte data[BLOCKSIZE];
+    int ok = TRUE;
+
+    for (int rid=0; ok && rid<tbl->record_cnt; rid++) {
+        int blk_no = tbl_rec_blk(tbl, rid);
+
+        if (rid % per_blk == 0) {
+            if (tbl->map) {
+                memcpy(data, tbl->map + (size_t) blk_no * BLOCKSIZE, BLOCKSIZE);
+            } else if (tbl->cmap) {
+                ok = pgc_read_blk(tbl, blk_no, data) == BLOCKSIZE;
+            } else {
+                ok = blk_read(tbl->file, blk_no, data) == BLOCKSIZE;
+            }
+        }
+
+        ok = ok && zm_update(tbl, rid, data + tbl_rec_offset(tbl, rid));
+    }
+
+    tbl->zmap = prev;
+    if (!ok) {
+        zm_free(zm);
+        return NULL;
+    }
+
+    return zm;
+}
+
+
+/*
+ * Load the zone map of a table, rebuilding it if it is missing or was
+ * saved for a different number of blocks or records than the table has.
+ */
+zone_map *zm_load(table *tbl)
+{
+    char path[ZM_PATH_LEN];
+    zm_path(tbl, path);
+
+    FILE *file = fopen(path, "r");
+    if (!file) return zm_rebuild(tbl);
+
+    zone_map *zm = zm_create(tbl);
+    int blk_cnt = 0, col_cnt = 0, record_cnt = 0;
+
+    int ok = zm && fread(&blk_cnt, sizeof(int), 1, file) == 1 &&
+        fread(&col_cnt, sizeof(int), 1, file) == 1 &&
+        fread(&record_cnt, sizeof(int), 1, file) == 1 &&
+        col_cnt == zm->col_cnt && blk_cnt == tbl_blk_cnt(tbl) &&
+        record_cnt == tbl->record_cnt;
+
+    if (ok && blk_cnt > 0) {
+        ok = zm_extend(zm, blk_cnt - 1 + TBL_FIRST_BLK) &&
+            fread(zm->bounds, sizeof(double) * 2 * col_cnt, blk_cnt, file) == (size_t) blk_cnt;
+    }
+
+    fclose(file);
+
+    if (!ok) {
+        zm_free(zm);
+        return zm_rebuild(tbl);
+    }
+
+    return zm;
+}
+
+
+int zm_save(table *tbl)
+{
+    char path[ZM_PATH_LEN];
+    zm_path(tbl, path);
+
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+
+    zone_map *zm = tbl->zmap;
+    int ok = fwrite(&zm->blk_cnt, sizeof(int), 1, file) == 1 &&
+        fwrite(&zm->col_cnt, sizeof(int), 1, file) == 1 &&
+        fwrite(&tbl->record_cnt, sizeof(int), 1, file) == 1 &&
+        (zm->blk_cnt == 0 || fwrite(zm->bounds, sizeof(double) * 2 * zm->col_cnt, zm->blk_cnt, file) == (size_t) zm->blk_cnt);
+
+    return (fclose(file) == 0) && ok;
+}
+
+
+void zm_remove(table *tbl)
+{
+    char path[ZM_PATH_LEN];
+    zm_path(tbl, path);
+    remove(path);
+}
+
+
+void zm_free(zone_map *zm)
+{
+    if (!zm) return;
+
+    free(zm->bounds);
+    free(zm);
+}
@@ -0,0 +1,346 @@
+/*
+ * aggview_tests.c
+ *
+ * A set of unit tests for the functionality of aggview.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "aggview.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (grp CHAR(8), val INT, score FLOAT)
+schema rec_schema = {
+    .field_cnt = 3,
+    .field_types = {CHAR, INT, FLOAT},
+    .field_lengths = {8, 0, 0}
+};
+
+#define GROUPS 7
+#define RECORDS 2000
+
+// (grp, COUNT, SUM(val), MIN(val), MAX(val), AVG(score))
+int group_cols[] = {0};
+agg_spec aggs[] = {{AGG_COUNT, 0}, {AGG_SUM, 1}, {AGG_MIN, 1}, {AGG_MAX, 1}, {AGG_AVG, 2}};
+
+table *tbl;
+byte recs[RECORDS][20];
+
+
+void setup()
+{
+    buff_pool_init(16);
+    tbl = tbl_create("aggview", "tests/testdb", &rec_schema);
+    ck_assert_ptr_nonnull(tbl);
+}
+
+
+void teardown()
+{
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+
+
+static void make_rec(byte *rec, int grp, int val)
+{
+    char name[9];
+    snprintf(name, sizeof(name), "g%d", grp);
+    memset(rec, 0, 20);
+    tp_setchar(rec, 0, name, 8);
+    tp_setint(rec, 8, val);
+    tp_setfloat(rec, 12, val * 0.5);
+}
+
+
+/*
+ * Check every group of the view against the records in recs.
+ */
+static void check_view(av_view *view, int cnt)
+{
+    ck_assert_int_eq(view->out.record_length, 36);
+
+    for (int g=0; g<GROUPS; g++) {
+        long count = 0, sum = 0;
+        int min = 0, max = 0;
+
+        byte key[20];
+        make_rec(key, g, 0);
+        for (int i=0; i<cnt; i++) {
+            if (memcmp(recs[i], key, 8) != 0) continue;
+
+            int v = tp_getasint(recs[i], 8);
+            if (count == 0 || v < min) min = v;
+            if (count == 0 || v > max) max = v;
+            sum += v;
+            count++;
+        }
+
+        byte row[64];
+        int found = av_lookup(view, key, row);
+        ck_assert_int_eq(found, count > 0);
+        if (!found) continue;
+
+        ck_assert_int_eq(memcmp(row, key, 8), 0);
+        ck_assert_int_eq(tp_getasint(row, 8), count);
+        ck_assert_double_eq(tp_getasfloat(row, 12), sum);
+        ck_assert_int_eq(tp_getasint(row, 20), min);
+        ck_assert_int_eq(tp_getasint(row, 24), max);
+        ck_assert_double_eq_tol(tp_getasfloat(row, 28), sum * 0.5 / count, 1e-9);
+    }
+}
+
+
+static int count_rows(byte *row, void *ctx)
+{
+    *(long *) ctx += tp_getasint(row, 8);
+    return 1;
+}
+
+
+START_TEST(maintained_on_write)
+{
+    // Built from the records already in the table...
+    for (int i=0; i<RECORDS / 2; i++) {
+        make_rec(recs[i], i % GROUPS, (i * 37) % 1000 - 300);
+        tbl_insert(tbl, recs[i]);
+    }
+
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, 1);
+    ck_assert_ptr_nonnull(view);
+    ck_assert_ptr_eq(tbl->views, view);
+    check_view(view, RECORDS / 2);
+
+    // ...and kept up to date by inserts and updates, with at most one
+    // scan, for the bounds which the updates retracted
+    for (int i=RECORDS / 2; i<RECORDS; i++) {
+        make_rec(recs[i], i % GROUPS, (i * 37) % 1000 - 300);
+        tbl_insert(tbl, recs[i]);
+    }
+
+    for (int i=0; i<RECORDS; i+=3) {
+        make_rec(recs[i], (i + 1) % GROUPS, i);
+        ck_assert_int_eq(tbl_update(tbl, i, recs[i]), 1);
+    }
+
+    check_view(view, RECORDS);
+    ck_assert_int_le(view->rescans, 1);
+
+    long total = 0;
+    ck_assert_int_eq(av_scan(view, count_rows, &total), GROUPS);
+    ck_assert_int_eq(total, RECORDS);
+
+    // Moving every record of a group away removes the group
+    for (int i=0; i<RECORDS; i++) {
+        if (memcmp(recs[i], "g3", 3) != 0) continue;
+        make_rec(recs[i], 4, 5);
+        tbl_update(tbl, i, recs[i]);
+    }
+
+    check_view(view, RECORDS);
+    ck_assert_int_eq(view->groups, GROUPS - 1);
+}
+END_TEST
+
+
+START_TEST(min_max_retraction)
+{
+    for (int i=0; i<100; i++) {
+        make_rec(recs[i], 0, i);
+        tbl_insert(tbl, recs[i]);
+    }
+
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, 1);
+
+    // Updating a record which doesn't hold a bound leaves them known
+    make_rec(recs[50], 0, 500);
+    tbl_update(tbl, 50, recs[50]);
+    check_view(view, 100);
+    ck_assert_int_eq(view->rescans, 0);
+
+    // Updating the only record holding the MIN leaves the group stale,
+    // until a read recomputes it
+    make_rec(recs[0], 0, 250);
+    tbl_update(tbl, 0, recs[0]);
+    ck_assert_int_eq(view->stale, 1);
+    check_view(view, 100);
+    ck_assert_int_eq(view->stale, 0);
+    ck_assert_int_eq(view->rescans, 1);
+
+    // A bound held by several records survives losing one of them
+    make_rec(recs[2], 0, 1);
+    tbl_update(tbl, 2, recs[2]);
+    make_rec(recs[1], 0, 300);
+    tbl_update(tbl, 1, recs[1]);
+    check_view(view, 100);
+    ck_assert_int_eq(view->rescans, 1);
+}
+END_TEST
+
+
+#define UPDATES 20000
+
+atomic_int progress;
+
+
+static void *update_worker(void *arg)
+{
+    (void) arg;
+
+    // Each update retracts the group's MIN, and replaces it with a new MAX
+    for (int t=100; t<100 + UPDATES; t++) {
+        make_rec(recs[t % 100], 0, t);
+        tbl_update(tbl, t % 100, recs[t % 100]);
+        atomic_store(&progress, t);
+    }
+
+    return NULL;
+}
+
+
+START_TEST(concurrent_refresh)
+{
+    for (int i=0; i<100; i++) {
+        make_rec(recs[i], 0, i);
+        tbl_insert(tbl, recs[i]);
+    }
+
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, 1);
+    atomic_store(&progress, 99);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, update_worker, NULL);
+
+    // Reads recompute the MIN while it is being retracted, and must never
+    // find one lower than the table held when the read began
+    byte key[20], row[64];
+    make_rec(key, 0, 0);
+    for (int t=99; t<99 + UPDATES; t=atomic_load(&progress)) {
+        ck_assert_int_eq(av_lookup(view, key, row), 1);
+        ck_assert_int_ge(tp_getasint(row, 20), t - 99);
+        ck_assert_int_eq(tp_getasint(row, 8), 100);
+    }
+
+    pthread_join(tid, NULL);
+    check_view(view, 100);
+}
+END_TEST
+
+
+START_TEST(deferred_batches)
+{
+    av_view *view = tbl_view_create(tbl, 1, group_cols, 5, aggs, 64);
+    ck_assert_ptr_nonnull(view);
+
+    for (int i=0; i<RECORDS; i++) {
+        make_rec(recs[i], i % GROUPS, i % 500);
+        tbl_insert(tbl, recs[i]);
+    }
+
+    // Only whole batches have been applied...
+    ck_assert_int_eq(view->applied, RECORDS / 64 * 64);
+    ck_assert_int_eq(view->pending_cnt, RECORDS % 64);
+
+    // ...but reads see every write
+    check_view(view, RECORDS);
+    ck_assert_int_eq(view->pending_cnt, 0);
+
+    for (int i=0; i<RECORDS; i+=5) {
+        make_rec(recs[i], i % 3, i);
+        tbl_update(tbl, i, recs[i]);
+    }
+    check_view(view, RECORDS);
+
+    // A second view, over the whole table
+    agg_spec total[] = {{AGG_COUNT, 0}, {AGG_MAX, 2}};
+    av_view *all = tbl_view_create(tbl, 0, NULL, 2, total, 0);
+    ck_assert_ptr_nonnull(all);
+    ck_assert_int_eq(all->out.record_length, 12);
+
+    byte row[64];
+    ck_assert_int_eq(av_lookup(all, recs[0], row), 1);
+    ck_assert_int_eq(tp_getasint(row, 0), RECORDS);
+    ck_assert_double_eq(tp_getasfloat(row, 4), (RECORDS - 5) * 0.5);
+
+    ck_assert_int_eq(tbl_view_drop(tbl, all), 1);
+    ck_assert_int_eq(tbl_view_drop(tbl, all), 0);
+    ck_assert_ptr_eq(tbl->views, view);
+}
+END_TEST
+
+
+START_TEST(invalid_views)
+{
+    agg_spec on_char[] = {{AGG_SUM, 0}};
+    agg_spec bad_col[] = {{AGG_MIN, 3}};
+    agg_spec bad_func[] = {{9, 1}};
+    int bad_group[] = {5};
+
+    ck_assert_ptr_null(tbl_view_create(tbl, 1, group_cols, 1, on_char, 1));
+    ck_assert_ptr_null(tbl_view_create(tbl, 1, group_cols, 1, bad_col, 1));
+    ck_assert_ptr_null(tbl_view_create(tbl, 1, group_cols, 1, bad_func, 1));
+    ck_assert_ptr_null(tbl_view_create(tbl, 1, bad_group, 5, aggs, 1));
+    ck_assert_ptr_null(tbl_view_create(tbl, 1, group_cols, 0, aggs, 1));
+    ck_assert_ptr_null(tbl->views);
+
+    // COUNT needs no column
+    agg_spec count[] = {{AGG_COUNT, -1}};
+    ck_assert_ptr_nonnull(tbl_view_create(tbl, 1, group_cols, 1, count, 1));
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("aggview");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, maintained_on_write);
+    tcase_add_test(basic, min_max_retraction);
+    tcase_add_test(basic, concurrent_refresh);
+    tcase_add_test(basic, deferred_batches);
+    tcase_add_test(basic, invalid_views);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
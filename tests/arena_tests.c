@@ -0,0 +1,193 @@
+/*
+ * arena_tests.c
+ *
+ * A set of unit tests for the functionality of arena.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "arena.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define THREADS 4
+#define PER_THREAD 20000
+
+
+START_TEST(bump_allocation)
+{
+    arena *a = arena_create(4096);
+    ck_assert_ptr_nonnull(a);
+
+    char *prev = NULL;
+    for (int i=0; i<1000; i++) {
+        char *p = arena_alloc(a, 1 + i % 40);
+        ck_assert_ptr_nonnull(p);
+        ck_assert_int_eq((uintptr_t) p % ARENA_ALIGN, 0);
+        memset(p, i, 1 + i % 40);
+        if (prev) ck_assert_ptr_ne(p, prev);
+        prev = p;
+    }
+
+    // 1000 allocations of up to 48 bytes fill a handful of chunks
+    long mallocs = a->mallocs;
+    ck_assert_int_le(mallocs, 12);
+
+    // Resetting keeps the chunks, so the same allocations need no more
+    arena_reset(a);
+    for (int i=0; i<1000; i++) arena_alloc(a, 1 + i % 40);
+    ck_assert_int_eq(a->mallocs, mallocs);
+
+    // Large allocations get chunks of their own, and aren't kept
+    char *big = arena_alloc(a, 100000);
+    ck_assert_ptr_nonnull(big);
+    memset(big, 1, 100000);
+    ck_assert_int_eq(a->mallocs, mallocs + 1);
+
+    char *s = arena_strndup(a, "abcdef", 3);
+    ck_assert_str_eq(s, "abc");
+
+    arena_reset(a);
+    arena_alloc(a, 100000);
+    ck_assert_int_eq(a->mallocs, mallocs + 2);
+
+    arena_free(a);
+}
+END_TEST
+
+
+START_TEST(accessors)
+{
+    arena *a = arena_create(0);
+    byte rec[32] = {0};
+    tp_setchar(rec, 4, "a full name!", 12);
+
+    // Fields which fill their width still come back terminated
+    char *name = tp_getaschar(rec, 4, 12, a);
+    ck_assert_str_eq(name, "a full name!");
+    ck_assert_int_eq(name[12], '\0');
+
+    page pg = {.data = calloc(1, BLOCKSIZE)};
+    pg_setchar(&pg, 8, "on a page", 9);
+    ck_assert_str_eq(pg_getchar(&pg, 8, 9, a), "on a page");
+    ck_assert_ptr_null(pg_getchar(&pg, BLOCKSIZE - 4, 9, a));
+
+    // Without an arena, the caller owns the copy
+    char *copy = pg_getchar(&pg, 8, 9, NULL);
+    ck_assert_str_eq(copy, "on a page");
+    free(copy);
+
+    // However many values are read, the arena's first chunk holds them
+    for (int i=0; i<1000; i++) {
+        tp_getaschar(rec, 4, 12, a);
+        if (i % 100 == 99) arena_reset(a);
+    }
+    ck_assert_int_eq(a->mallocs, 1);
+
+    free(pg.data);
+    arena_free(a);
+}
+END_TEST
+
+
+typedef struct worker_arg {
+    arena *a;
+    int thread;
+    char *ptrs[PER_THREAD];
+} worker_arg;
+
+
+static void *alloc_worker(void *arg)
+{
+    worker_arg *w = arg;
+
+    for (int i=0; i<PER_THREAD; i++) {
+        w->ptrs[i] = arena_alloc(w->a, 24);
+        memset(w->ptrs[i], 'a' + w->thread, 24);
+    }
+
+    return NULL;
+}
+
+
+START_TEST(concurrent_threads)
+{
+    arena *a = arena_create(0);
+    pthread_t tids[THREADS];
+    worker_arg *args = calloc(THREADS, sizeof(worker_arg));
+
+    for (int t=0; t<THREADS; t++) {
+        args[t].a = a;
+        args[t].thread = t;
+        pthread_create(&tids[t], NULL, alloc_worker, &args[t]);
+    }
+
+    for (int t=0; t<THREADS; t++) pthread_join(tids[t], NULL);
+
+    // No allocation was handed to two threads, or overwritten
+    for (int t=0; t<THREADS; t++) {
+        for (int i=0; i<PER_THREAD; i++) {
+            for (int k=0; k<24; k++) ck_assert_int_eq(args[t].ptrs[i][k], 'a' + t);
+        }
+    }
+
+    // Each thread bumps through chunks of its own
+    long per_chunk = ARENA_DEFAULT_CHUNK / 32;
+    ck_assert_int_le(a->mallocs, THREADS * (PER_THREAD / per_chunk + 2));
+
+    free(args);
+    arena_free(a);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("arena");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_test(basic, bump_allocation);
+    tcase_add_test(basic, accessors);
+    tcase_add_test(basic, concurrent_threads);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,533 @@
+/*
+ * art_tests.c
+ *
+ * A set of unit tests for the functionality of art.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "art.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (id INT, name CHAR(12), score FLOAT)
+schema rec_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, CHAR, FLOAT},
+    .field_lengths = {0, 12, 0}
+};
+
+#define THREADS 4
+#define PER_THREAD 20000
+
+
+typedef struct scan_ctx {
+    int keys[1000];
+    int rids[1000];
+    int cnt;
+    int limit;
+} scan_ctx;
+
+
+static int collect(const unsigned char *key, int rid, void *arg)
+{
+    scan_ctx *ctx = arg;
+
+    // Undo tp_intkey
+    unsigned int u = ((unsigned int) key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+    ctx->keys[ctx->cnt] = (int) (u ^ 0x80000000u);
+    ctx->rids[ctx->cnt++] = rid;
+
+    return ctx->limit == 0 || ctx->cnt < ctx->limit;
+}
+
+
+START_TEST(binary_comparable_keys)
+{
+    int ints[] = {-2147483647 - 1, -70000, -256, -1, 0, 1, 255, 256, 70000, 2147483647};
+    double floats[] = {-1e300, -2.5, -1e-300, 0.0, 1e-300, 0.5, 2.5, 1e300};
+    unsigned char a[12], b[12];
+
+    for (int i=1; i<10; i++) {
+        tp_intkey(ints[i - 1], a);
+        tp_intkey(ints[i], b);
+        ck_assert_int_lt(memcmp(a, b, 4), 0);
+    }
+
+    for (int i=1; i<8; i++) {
+        tp_floatkey(floats[i - 1], a);
+        tp_floatkey(floats[i], b);
+        ck_assert_int_lt(memcmp(a, b, 8), 0);
+    }
+
+    byte rec[64] = {0};
+    tp_setchar(rec, 4, "abc", 12);
+    tp_getaskey(rec, 4, CHAR, 12, a);
+    ck_assert_int_eq(memcmp(a, "abc\0\0\0\0\0", 8), 0);
+    ck_assert_int_eq(tp_keysize(CHAR, 12), 12);
+    ck_assert_int_eq(tp_keysize(FLOAT, 0), 8);
+}
+END_TEST
+
+
+START_TEST(insert_lookup_remove)
+{
+    art_tree *art = art_create(4);
+    unsigned char key[4];
+    int n = 100000;
+
+    // Scrambled, so that nodes of every size are built and grown
+    for (int i=0; i<n; i++) {
+        int k = (int) ((i * 7919L) % n) * 3 - n;
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_insert(art, key, k + n), 1);
+    }
+
+    ck_assert_int_eq(art->size, n);
+
+    for (int k=-n; k<2 * n; k++) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_lookup(art, key), ((k + n) % 3 == 0) ? k + n : -1);
+    }
+
+    // Duplicates are refused, and leave the original alone
+    tp_intkey(-n, key);
+    ck_assert_int_eq(art_insert(art, key, 12345), 0);
+    ck_assert_int_eq(art_lookup(art, key), 0);
+
+    for (int k=-n; k<2 * n; k+=6) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_remove(art, key), 1);
+        ck_assert_int_eq(art_remove(art, key), 0);
+    }
+
+    ck_assert_int_eq(art->size, n / 2);
+
+    for (int k=-n; k<2 * n; k+=3) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_lookup(art, key), ((k + n) % 6 == 0) ? -1 : k + n);
+    }
+
+    // Removed keys can be added back
+    tp_intkey(-n, key);
+    ck_assert_int_eq(art_insert(art, key, 7), 1);
+    ck_assert_int_eq(art_lookup(art, key), 7);
+
+    art_free(art);
+}
+END_TEST
+
+
+START_TEST(range_scan)
+{
+    art_tree *art = art_create(4);
+    unsigned char key[4], lo[4], hi[4];
+
+    for (int k=-5000; k<5000; k+=5) {
+        tp_intkey(k, key);
+        art_insert(art, key, k + 5000);
+    }
+
+    scan_ctx ctx = {0};
+    tp_intkey(-52, lo);
+    tp_intkey(100, hi);
+    ck_assert_int_eq(art_scan(art, lo, hi, collect, &ctx), 31);
+    ck_assert_int_eq(ctx.cnt, 31);
+
+    for (int i=0; i<ctx.cnt; i++) {
+        ck_assert_int_eq(ctx.keys[i], -50 + 5 * i);
+        ck_assert_int_eq(ctx.rids[i], ctx.keys[i] + 5000);
+    }
+
+    // Bounds are inclusive, and may be left open
+    ctx = (scan_ctx) {0};
+    tp_intkey(4990, lo);
+    ck_assert_int_eq(art_scan(art, lo, NULL, collect, &ctx), 2);
+    ck_assert_int_eq(ctx.keys[0], 4990);
+    ck_assert_int_eq(ctx.keys[1], 4995);
+
+    ctx = (scan_ctx) {0};
+    tp_intkey(-4995, hi);
+    ck_assert_int_eq(art_scan(art, NULL, hi, collect, &ctx), 2);
+    ck_assert_int_eq(ctx.keys[0], -5000);
+
+    // The callback can stop the scan
+    ctx = (scan_ctx) {.limit = 10};
+    ck_assert_int_eq(art_scan(art, NULL, NULL, collect, &ctx), 10);
+    ck_assert_int_eq(ctx.keys[9], -4955);
+
+    // Empty ranges
+    ctx = (scan_ctx) {0};
+    tp_intkey(1, lo);
+    tp_intkey(4, hi);
+    ck_assert_int_eq(art_scan(art, lo, hi, collect, &ctx), 0);
+    ck_assert_int_eq(art_scan(art, hi, lo, collect, &ctx), 0);
+
+    art_free(art);
+}
+END_TEST
+
+
+typedef struct worker_arg {
+    art_tree *art;
+    int thread;
+    int errors;
+} worker_arg;
+
+
+static void *insert_worker(void *arg)
+{
+    worker_arg *w = arg;
+    unsigned char key[4];
+
+    // Interleave the threads' keys, so that they contend for nodes
+    for (int i=0; i<PER_THREAD; i++) {
+        int k = i * THREADS + w->thread;
+        tp_intkey(k, key);
+        if (art_insert(w->art, key, k) != 1) w->errors++;
+
+        // Look up an earlier key of our own, which must be there
+        tp_intkey((i / 2) * THREADS + w->thread, key);
+        if (art_lookup(w->art, key) != (i / 2) * THREADS + w->thread) w->errors++;
+    }
+
+    return NULL;
+}
+
+
+static int count_keys(const unsigned char *key, int rid, void *arg)
+{
+    (void) key;
+    (void) rid;
+    (*(long *) arg)++;
+    return 1;
+}
+
+
+START_TEST(concurrent_inserts)
+{
+    art_tree *art = art_create(4);
+    pthread_t tids[THREADS];
+    worker_arg args[THREADS];
+
+    for (int t=0; t<THREADS; t++) {
+        args[t] = (worker_arg) {.art = art, .thread = t};
+        pthread_create(&tids[t], NULL, insert_worker, &args[t]);
+    }
+
+    // Scan while the inserts run; keys must come out in order
+    long seen = 0;
+    while (seen < THREADS * PER_THREAD) {
+        seen = 0;
+        ck_assert_int_ge(art_scan(art, NULL, NULL, count_keys, &seen), 0);
+    }
+
+    for (int t=0; t<THREADS; t++) {
+        pthread_join(tids[t], NULL);
+        ck_assert_int_eq(args[t].errors, 0);
+    }
+
+    ck_assert_int_eq(art->size, THREADS * PER_THREAD);
+
+    unsigned char key[4];
+    for (int k=0; k<THREADS * PER_THREAD; k++) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_lookup(art, key), k);
+    }
+
+    art_free(art);
+}
+END_TEST
+
+
+static void *update_worker(void *arg)
+{
+    worker_arg *w = arg;
+    unsigned char key[4];
+
+    for (int round=1; round<=10; round++) {
+        for (int k=0; k<PER_THREAD; k++) {
+            tp_intkey(k, key);
+            if (art_update(w->art, key, round * PER_THREAD + k) != 1) w->errors++;
+        }
+    }
+
+    return NULL;
+}
+
+
+START_TEST(concurrent_updates)
+{
+    art_tree *art = art_create(4);
+    unsigned char key[4];
+
+    for (int k=0; k<PER_THREAD; k++) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_insert(art, key, k), 1);
+    }
+
+    tp_intkey(PER_THREAD, key);
+    ck_assert_int_eq(art_update(art, key, 0), 0);
+
+    pthread_t tid;
+    worker_arg arg = {.art = art};
+    pthread_create(&tid, NULL, update_worker, &arg);
+
+    // While ids are being changed, every key is always found, with one of
+    // its ids, and can never be inserted a second time
+    for (int pass=0; pass<5; pass++) {
+        for (int k=0; k<PER_THREAD; k++) {
+            tp_intkey(k, key);
+            int rid = art_lookup(art, key);
+            ck_assert_int_ge(rid, 0);
+            ck_assert_int_eq(rid % PER_THREAD, k);
+            ck_assert_int_eq(art_insert(art, key, -1), 0);
+        }
+    }
+
+    pthread_join(tid, NULL);
+    ck_assert_int_eq(arg.errors, 0);
+    ck_assert_int_eq(art->size, PER_THREAD);
+
+    for (int k=0; k<PER_THREAD; k++) {
+        tp_intkey(k, key);
+        ck_assert_int_eq(art_lookup(art, key), 10 * PER_THREAD + k);
+    }
+
+    art_free(art);
+}
+END_TEST
+
+
+START_TEST(table_index)
+{
+    buff_pool_init(8);
+    table *tbl = tbl_create("art", "tests/testdb", &rec_schema);
+
+    byte rec[64] = {0};
+    char name[16];
+    for (int i=0; i<500; i++) {
+        snprintf(name, sizeof(name), "user%04d", i);
+        tp_setint(rec, 0, i);
+        tp_setchar(rec, 4, name, 12);
+        tp_setfloat(rec, 16, i * 0.25);
+        tbl_insert(tbl, rec);
+    }
+
+    // An index on the CHAR column, built from the existing records
+    ck_assert_int_eq(tbl_art_create(tbl, 1), 1);
+    ck_assert_int_eq(tbl->art->size, 500);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), 499);
+
+    tp_setchar(rec, 4, "user0123", 12);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), 123);
+
+    // Duplicate keys are refused by inserts and updates
+    ck_assert_int_eq(tbl_insert(tbl, rec), -1);
+    ck_assert_int_eq(tbl->record_cnt, 500);
+    ck_assert_int_eq(tbl_update(tbl, 7, rec), 0);
+
+    // New keys are indexed, and an update moves its record's entry
+    tp_setchar(rec, 4, "new", 12);
+    ck_assert_int_eq(tbl_insert(tbl, rec), 500);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), 500);
+
+    tp_setchar(rec, 4, "moved", 12);
+    ck_assert_int_eq(tbl_update(tbl, 42, rec), 1);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), 42);
+    tp_setchar(rec, 4, "user0042", 12);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), -1);
+
+    // An index can't be built over duplicate keys (records 42, 499 and 500
+    // now have the same score), and the existing one is kept
+    ck_assert_int_eq(tbl_art_create(tbl, 2), 0);
+    ck_assert_int_eq(tbl->art->col, 1);
+    tp_setchar(rec, 4, "moved", 12);
+    ck_assert_int_eq(tbl_art_find(tbl, rec), 42);
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(batch_lookup)
+{
+    art_tree *art = art_create(4);
+    int n = PER_THREAD;
+    unsigned char key[4];
+
+    // Thread 0's keys are there from the start...
+    for (int i=0; i<n; i++) {
+        tp_intkey(i * THREADS, key);
+        ck_assert_int_eq(art_insert(art, key, i * THREADS), 1);
+    }
+
+    // ...and thread 1's are added while the batches run
+    pthread_t tid;
+    worker_arg arg = {.art = art, .thread = 1};
+    pthread_create(&tid, NULL, insert_worker, &arg);
+
+    // Batches of every size up to past ART_BATCH_MAX, of keys in a
+    // scrambled order, and answered as art_lookup would answer them
+    int cnt_max = 2 * ART_BATCH_MAX + 3;
+    unsigned char *keys = malloc((size_t) cnt_max * 4);
+    int *rids = malloc(sizeof(int) * cnt_max);
+    int *expect = malloc(sizeof(int) * cnt_max);
+    int total = THREADS * n;
+
+    for (int cnt=0, k=0; cnt<=cnt_max; cnt++) {
+        int found = 0;
+        for (int i=0; i<cnt; i++) {
+            k = (int) ((k + 7919L) % total);
+            tp_intkey(k, keys + i * 4);
+            expect[i] = (k % THREADS == 0) ? k : -1;
+            found += (k % THREADS == 0);
+        }
+
+        int got = art_lookup_batch(art, keys, cnt, rids);
+        for (int i=0; i<cnt; i++) {
+            int k = (int) ((keys[i * 4] ^ 0x80) << 24 | keys[i * 4 + 1] << 16 |
+                           keys[i * 4 + 2] << 8 | keys[i * 4 + 3]);
+            if (k % THREADS == 1 && rids[i] >= 0) {
+                ck_assert_int_eq(rids[i], k);
+                found++;
+            } else {
+                ck_assert_int_eq(rids[i], expect[i]);
+            }
+        }
+
+        ck_assert_int_eq(got, found);
+    }
+
+    pthread_join(tid, NULL);
+    ck_assert_int_eq(arg.errors, 0);
+
+    // With the inserts done, every key of thread 1 is found too
+    for (int i=0; i<cnt_max; i++) tp_intkey(i * THREADS + 1, keys + i * 4);
+    ck_assert_int_eq(art_lookup_batch(art, keys, cnt_max, rids), cnt_max);
+    for (int i=0; i<cnt_max; i++) ck_assert_int_eq(rids[i], i * THREADS + 1);
+
+    free(keys);
+    free(rids);
+    free(expect);
+    art_free(art);
+}
+END_TEST
+
+
+START_TEST(table_batch_read)
+{
+    buff_pool_init(8);
+    table *tbl = tbl_create("artbatch", "tests/testdb", &rec_schema);
+    int rec_len = tbl->fields.record_length;
+
+    byte rec[64] = {0};
+    for (int i=0; i<500; i++) {
+        tp_setint(rec, 0, i * 2);
+        tp_setfloat(rec, 16, i * 0.5);
+        tbl_insert(tbl, rec);
+    }
+
+    ck_assert_int_eq(tbl_art_create(tbl, 0), 1);
+
+    byte probes[100 * 64], records[100 * 64];
+    int rids[100];
+
+    // Probes for odd ids miss. A few probes fit their blocks in the pool,
+    // and are pinned together; many don't, and are read one at a time.
+    int sizes[] = {1, 6, 100};
+    for (int s=0; s<3; s++) {
+        int cnt = sizes[s];
+        memset(records, 0, sizeof(records));
+
+        for (int i=0; i<cnt; i++) {
+            tp_setint(probes + i * rec_len, 0, (i * 37) % 1000);
+        }
+
+        int expect = 0;
+        ck_assert_int_ge(tbl_art_read_batch(tbl, probes, cnt, records, rids), 0);
+        for (int i=0; i<cnt; i++) {
+            int id = (i * 37) % 1000;
+            if (id % 2) {
+                ck_assert_int_eq(rids[i], -1);
+                continue;
+            }
+
+            expect++;
+            ck_assert_int_eq(rids[i], id / 2);
+            ck_assert_int_eq(tp_getasint(records + i * rec_len, 0), id);
+            ck_assert(tp_getasfloat(records + i * rec_len, 16) == id / 2 * 0.5);
+        }
+
+        ck_assert_int_eq(tbl_art_read_batch(tbl, probes, cnt, records, rids), expect);
+    }
+
+    // Nothing is left pinned
+    for (int b=0; b<tbl_blk_cnt(tbl); b++) {
+        page *pg = buff_find_pg(tbl, TBL_FIRST_BLK + b);
+        if (pg) ck_assert_int_eq(pg->pinned, 0);
+    }
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("art");
+
+    TCase *basic = tcase_create("basic");
+    tcase_set_timeout(basic, 60);
+
+    tcase_add_test(basic, binary_comparable_keys);
+    tcase_add_test(basic, insert_lookup_remove);
+    tcase_add_test(basic, range_scan);
+    tcase_add_test(basic, concurrent_inserts);
+    tcase_add_test(basic, concurrent_updates);
+    tcase_add_test(basic, table_index);
+    tcase_add_test(basic, batch_lookup);
+    tcase_add_test(basic, table_batch_read);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,6 +15,7 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 // table record structure for testing.  We'll use this same record
@@ -231,6 +232,42 @@ START_TEST(read_write_to_block)
 END_TEST
 
 
+START_TEST(append_blocks)
+{
+    off_t init_len = blk_flen(tbl_file);
+    int cnt = 3;
+
+    byte *data = calloc(cnt * BLOCKSIZE, sizeof(byte));
+    for (int i=0; i<cnt * BLOCKSIZE; i++) {
+        data[i] = i % 127;
+    }
+
+    // The new blocks must start at the old end of the file
+    int blk_no = blk_append(tbl_file, data, cnt);
+    ck_assert_int_eq(blk_no, init_len / BLOCKSIZE);
+    ck_assert_int_eq(blk_flen(tbl_file), init_len + cnt * BLOCKSIZE);
+
+    // and must be readable back in one call
+    byte *read_data = calloc(cnt * BLOCKSIZE, sizeof(byte));
+    int read = blk_read_n(tbl_file, blk_no, read_data, cnt);
+    ck_assert_int_eq(read, cnt * BLOCKSIZE);
+    ck_assert_int_eq(memcmp(data, read_data, cnt * BLOCKSIZE), 0);
+
+    // or one block at a time
+    read = blk_read(tbl_file, blk_no + 2, read_data);
+    ck_assert_int_eq(read, BLOCKSIZE);
+    ck_assert_int_eq(memcmp(data + 2 * BLOCKSIZE, read_data, BLOCKSIZE), 0);
+
+    // Reading past the end returns only what is there.
+    read = blk_read_n(tbl_file, blk_no + 1, read_data, cnt);
+    ck_assert_int_eq(read, (cnt - 1) * BLOCKSIZE);
+
+    free(data);
+    free(read_data);
+}
+END_TEST
+
+
 Suite *test_suite()
 {
     Suite *suite = suite_create("blockio");
@@ -245,6 +282,7 @@ Suite *test_suite()
     tcase_add_test(basic, write_nonexistant_block);
     tcase_add_test(basic, create_new_block);
     tcase_add_test(basic, read_write_to_block);
+    tcase_add_test(basic, append_blocks);
 
     // TODO: Add stress testing
     TCase *stress = tcase_create("stress");
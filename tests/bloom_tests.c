@@ -0,0 +1,214 @@
+/*
+ * bloom_tests.c
+ *
+ * A set of unit tests for the functionality of bloom.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bloom.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (key INT, val INT)
+schema kv_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, INT},
+    .field_lengths = {0, 0}
+};
+
+int pool_size = 8;
+int record_cnt = 3000;
+
+
+START_TEST(filter_accuracy)
+{
+    bloom *bf = bf_create(0, 100000, 10);
+    ck_assert_ptr_nonnull(bf);
+    ck_assert_int_eq((size_t) bf->blocks % 64, 0);
+
+    for (int k=0; k<100000; k++) bf_add(bf, k * 7);
+
+    // No false negatives
+    for (int k=0; k<100000; k++) {
+        ck_assert(bf_may_contain(bf, k * 7));
+    }
+
+    // And roughly 1% false positives at 10 bits per key
+    int fp = 0;
+    for (int k=0; k<100000; k++) {
+        if (bf_may_contain(bf, k * 7 + 3)) fp++;
+    }
+
+    ck_assert_int_lt(fp, 2500);
+    bf_free(bf);
+}
+END_TEST
+
+
+/*
+ * Count the records with key == k with a filtered scan, returning the
+ * number of blocks skipped through skipped.
+ */
+int lookup(table *tbl, int k, long *skipped)
+{
+    exec_op *scan = exec_scan(tbl);
+    exec_op *op = exec_filter_int(scan, 0, CMP_EQ, k);
+
+    int rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) rows += b->count;
+
+    *skipped = exec_scan_skipped(scan);
+    exec_close(op);
+    return rows;
+}
+
+
+START_TEST(table_filter)
+{
+    buff_pool_init(pool_size);
+    table *tbl = tbl_create("bloomkv", "tests/testdb", &kv_schema);
+
+    // Keys are scattered, so that zone maps can't help
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, (i * 7919) % 100003 * 2);
+        tp_setint(rec, 4, i);
+        tbl_insert(tbl, rec);
+    }
+
+    ck_assert_int_eq(tbl_bloom_create(tbl, 1, 0), 1);
+    ck_assert_int_eq(tbl_bloom_create(tbl, 0, 0), 1);
+    ck_assert_int_eq(tbl->bloom->col, 0);
+
+    long skipped;
+    ck_assert_int_eq(lookup(tbl, (1234 * 7919) % 100003 * 2, &skipped), 1);
+
+    int absent_skipped = 0;
+    for (int k=1; k<2001; k+=2) {
+        ck_assert_int_eq(lookup(tbl, k, &skipped), 0);
+        if (skipped == tbl_blk_cnt(tbl)) absent_skipped++;
+    }
+    ck_assert_int_gt(absent_skipped, 950);
+
+    // Inserts are added to the filter, growing it as needed
+    long capacity = tbl->bloom->capacity;
+    for (int i=0; i<4 * capacity; i++) {
+        tp_setint(rec, 0, 1000001 + 2 * i);
+        tbl_insert(tbl, rec);
+    }
+
+    ck_assert_int_gt(tbl->bloom->capacity, capacity);
+    for (int i=0; i<4 * capacity; i+=97) {
+        ck_assert(tbl_may_contain(tbl, 0, 1000001 + 2 * i));
+    }
+
+    // The filter is saved with the table
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load("bloomkv", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl->bloom);
+    ck_assert(tbl_may_contain(tbl, 0, 1000001));
+    ck_assert(tbl_may_contain(tbl, 1, 12345));
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    // ... and forgotten when the table is recreated
+    tbl = tbl_create("bloomkv", "tests/testdb", &kv_schema);
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load("bloomkv", "tests/testdb");
+    ck_assert_ptr_null(tbl->bloom);
+    tbl_close(tbl);
+
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(stale_filter_rebuilt)
+{
+    buff_pool_init(pool_size);
+    table *tbl = tbl_create("bloomkv", "tests/testdb", &kv_schema);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, 2 * i);
+        tp_setint(rec, 4, i);
+        tbl_insert(tbl, rec);
+    }
+
+    ck_assert_int_eq(tbl_bloom_create(tbl, 0, 0), 1);
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    ck_assert_int_eq(rename("tests/testdb/bloomkv.bf", "tests/testdb/bloomkv.bf.old"), 0);
+
+    // Records written while the saved filter is out of the way
+    tbl = tbl_load("bloomkv", "tests/testdb");
+    ck_assert_ptr_null(tbl->bloom);
+    for (int i=0; i<1000; i++) {
+        tp_setint(rec, 0, 2 * i + 1);
+        tbl_insert(tbl, rec);
+    }
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    ck_assert_int_eq(rename("tests/testdb/bloomkv.bf.old", "tests/testdb/bloomkv.bf"), 0);
+
+    // The saved filter doesn't cover them, and is rebuilt rather than
+    // giving false negatives
+    tbl = tbl_load("bloomkv", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl->bloom);
+    ck_assert_int_eq(tbl->bloom->col, 0);
+    for (int i=0; i<1000; i++) {
+        ck_assert(tbl_may_contain(tbl, 0, 2 * i + 1));
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("bloom");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_test(basic, filter_accuracy);
+    tcase_add_test(basic, table_filter);
+    tcase_add_test(basic, stale_filter_rebuilt);
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
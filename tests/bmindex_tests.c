@@ -0,0 +1,293 @@
+/*
+ * bmindex_tests.c
+ *
+ * A set of unit tests for the functionality of bmindex.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "bmindex.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "roaring.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, region CHAR(8), status INT)
+schema rec_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, CHAR, INT},
+    .field_lengths = {0, 8, 0}
+};
+
+#define RECORDS 3000
+#define REGIONS 5
+#define STATUSES 3
+
+table *tbl;
+int region_of[RECORDS + 20], status_of[RECORDS + 20];
+
+
+static void make_rec(byte *rec, int id, int region, int status)
+{
+    char name[9];
+    snprintf(name, sizeof(name), "r%d", region);
+    memset(rec, 0, 16);
+    tp_setint(rec, 0, id);
+    tp_setchar(rec, 4, name, 8);
+    tp_setint(rec, 12, status);
+
+    region_of[id] = region;
+    status_of[id] = status;
+}
+
+
+static void fill(int from, int to)
+{
+    byte rec[16];
+    for (int i=from; i<to; i++) {
+        make_rec(rec, i, (i * 7) % REGIONS, i % STATUSES);
+        ck_assert_int_eq(tbl_insert(tbl, rec), i);
+    }
+}
+
+
+void setup()
+{
+    buff_pool_init(16);
+    tbl = tbl_create("bmindex", "tests/testdb", &rec_schema);
+    ck_assert_ptr_nonnull(tbl);
+}
+
+
+void teardown()
+{
+    if (tbl) ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+
+
+/*
+ * Check the bitmaps of every region and status against the records.
+ */
+static void check_index()
+{
+    for (int r=0; r<REGIONS; r++) {
+        char name[9];
+        snprintf(name, sizeof(name), "r%d", r);
+
+        roaring *rows = tbl_bitmap_char(tbl, 1, name);
+        ck_assert_ptr_nonnull(rows);
+        for (int i=0; i<tbl->record_cnt; i++) {
+            ck_assert_int_eq(rb_contains(rows, i), region_of[i] == r);
+        }
+        rb_free(rows);
+    }
+
+    for (int s=0; s<STATUSES; s++) {
+        roaring *rows = tbl_bitmap_int(tbl, 2, s);
+        ck_assert_ptr_nonnull(rows);
+        for (int i=0; i<tbl->record_cnt; i++) {
+            ck_assert_int_eq(rb_contains(rows, i), status_of[i] == s);
+        }
+        rb_free(rows);
+    }
+}
+
+
+START_TEST(maintained_on_write)
+{
+    fill(0, RECORDS / 2);
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 1), 1);
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 2), 1);
+    ck_assert_ptr_null(tbl->bitmaps[0]);
+    ck_assert_int_eq(tbl->bitmaps[1]->value_cnt, REGIONS);
+    check_index();
+
+    fill(RECORDS / 2, RECORDS);
+
+    byte rec[16];
+    for (int i=0; i<RECORDS; i+=4) {
+        make_rec(rec, i, (i + 1) % REGIONS, (i + 2) % STATUSES);
+        ck_assert_int_eq(tbl_update(tbl, i, rec), 1);
+    }
+    check_index();
+
+    // A value missing from the column has an empty bitmap, and a column
+    // without an index none at all
+    roaring *rows = tbl_bitmap_int(tbl, 2, 99);
+    ck_assert_int_eq(rb_cardinality(rows), 0);
+    rb_free(rows);
+    ck_assert_ptr_null(tbl_bitmap_int(tbl, 0, 1));
+    ck_assert_ptr_null(tbl_bitmap_int(tbl, 1, 1));
+
+    // Moving every record away from a value removes it
+    for (int i=0; i<RECORDS; i++) {
+        if (status_of[i] != 0) continue;
+        make_rec(rec, i, region_of[i], 1);
+        tbl_update(tbl, i, rec);
+    }
+    ck_assert_int_eq(tbl->bitmaps[2]->value_cnt, STATUSES - 1);
+    check_index();
+}
+END_TEST
+
+
+START_TEST(too_many_values)
+{
+    fill(0, 100);
+
+    // The id column is unique, so an index on it is refused once there
+    // are too many records, and dropped if it gets too many later
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 0), 1);
+    fill(100, BMI_MAX_VALUES);
+    ck_assert_ptr_nonnull(tbl->bitmaps[0]);
+
+    byte rec[16];
+    make_rec(rec, BMI_MAX_VALUES, 0, 0);
+    ck_assert_int_eq(tbl_insert(tbl, rec), BMI_MAX_VALUES);
+    ck_assert_ptr_null(tbl->bitmaps[0]);
+
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 0), 0);
+    ck_assert_ptr_null(tbl->bitmaps[0]);
+}
+END_TEST
+
+
+START_TEST(persistence)
+{
+    fill(0, RECORDS);
+    tbl_bitmap_create(tbl, 1);
+    tbl_bitmap_create(tbl, 2);
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    // Saved with the table, and read back...
+    tbl = tbl_load("bmindex", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl);
+    ck_assert_ptr_null(tbl->bitmaps[0]);
+    ck_assert_ptr_nonnull(tbl->bitmaps[1]);
+    ck_assert_ptr_nonnull(tbl->bitmaps[2]);
+    check_index();
+
+    // ...or rebuilt, if the table has changed since
+    tbl_bitmap_drop(tbl, 2);
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    tbl = tbl_load("bmindex", "tests/testdb");
+    ck_assert_ptr_null(tbl->bitmaps[2]);
+    fill(RECORDS, RECORDS + 10);
+    ck_assert_int_eq(bmi_save(tbl), 1);
+    fill(RECORDS + 10, RECORDS + 20);
+
+    bmi_free(tbl->bitmaps[1]);
+    tbl->bitmaps[1] = NULL;
+    bmi_load(tbl);
+    ck_assert_ptr_nonnull(tbl->bitmaps[1]);
+    ck_assert_int_eq(tbl->record_cnt, RECORDS + 20);
+
+    tbl_bitmap_create(tbl, 2);
+    check_index();
+}
+END_TEST
+
+
+START_TEST(scan_rows)
+{
+    fill(0, RECORDS);
+    tbl_bitmap_create(tbl, 1);
+    tbl_bitmap_create(tbl, 2);
+
+    // region = r2 AND status != 1, OR region = r4
+    roaring *r2 = tbl_bitmap_char(tbl, 1, "r2");
+    roaring *r4 = tbl_bitmap_char(tbl, 1, "r4");
+    roaring *s1 = tbl_bitmap_int(tbl, 2, 1);
+    roaring *not_s1 = rb_not(s1, tbl->record_cnt);
+    roaring *both = rb_and(r2, not_s1);
+    roaring *rows = rb_or(both, r4);
+
+    // An id past the end of the table is ignored
+    rb_add(rows, RECORDS + 5);
+
+    exec_op *scan = exec_scan_rows(tbl, rows);
+    ck_assert_ptr_nonnull(scan);
+
+    int expect = 0, seen = 0, prev = -1;
+    for (int i=0; i<RECORDS; i++) {
+        expect += (region_of[i] == 2 && status_of[i] != 1) || region_of[i] == 4;
+    }
+
+    batch *b;
+    while ((b = exec_next(scan))) {
+        for (int i=0; i<b->count; i++) {
+            int id = b->cols[0].ints[i];
+            ck_assert_int_gt(id, prev);
+            ck_assert((region_of[id] == 2 && status_of[id] != 1) || region_of[id] == 4);
+            ck_assert_int_eq(b->cols[2].ints[i], status_of[id]);
+            prev = id;
+            seen++;
+        }
+    }
+
+    ck_assert_int_eq(seen, expect);
+    exec_close(scan);
+
+    rb_free(r2);
+    rb_free(r4);
+    rb_free(s1);
+    rb_free(not_s1);
+    rb_free(both);
+    rb_free(rows);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("bmindex");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+    tcase_set_timeout(basic, 30);
+
+    tcase_add_test(basic, maintained_on_write);
+    tcase_add_test(basic, too_many_values);
+    tcase_add_test(basic, persistence);
+    tcase_add_test(basic, scan_rows);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,215 @@
+/*
+ * codec_tests.c
+ *
+ * A set of unit tests for the functionality of codec.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "codec.h"
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, price FLOAT, code CHAR(8), note CHAR(5))
+schema item_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, FLOAT, CHAR, CHAR},
+    .field_lengths = {0, 0, 8, 5}
+};
+
+
+START_TEST(layout_and_kernels)
+{
+    codec *cd = cd_create(&item_schema);
+    ck_assert_ptr_ne(cd, NULL);
+
+    ck_assert_int_eq(cd->col_cnt, 4);
+    ck_assert_int_eq(cd->width, 4 + 8 + 8 + 5);
+    ck_assert_int_eq(cd->offsets[0], 0);
+    ck_assert_int_eq(cd->offsets[1], 4);
+    ck_assert_int_eq(cd->offsets[2], 12);
+    ck_assert_int_eq(cd->offsets[3], 20);
+
+    // Fixed-width fields get specialized kernels, and odd CHAR widths the
+    // generic ones
+    ck_assert_ptr_eq(cd->decode[2], cd_decode_for(CHAR, 8));
+    ck_assert_ptr_eq(cd->decode[1], cd_decode_for(CHAR, 8));
+    ck_assert_ptr_ne(cd->decode[3], cd->decode[2]);
+    ck_assert_ptr_eq(cd->decode[3], cd_decode_for(CHAR, 13));
+    ck_assert_ptr_ne(cd->cmp[0], cd->cmp[1]);
+    ck_assert_ptr_eq(cd_decode_for(99, 4), NULL);
+
+    int bad_types[] = {INT, 99};
+    int lengths[] = {0, 0};
+    codec tmp;
+    ck_assert_int_eq(cd_init(&tmp, 2, bad_types, lengths), 0);
+
+    cd_free(cd);
+}
+END_TEST
+
+
+START_TEST(encode_decode_roundtrip)
+{
+    codec *cd = cd_create(&item_schema);
+    int n = 37;
+
+    int ids[37], ids_out[37];
+    double prices[37], prices_out[37];
+    char codes[37 * 8], codes_out[37 * 8];
+    char notes[37 * 5], notes_out[37 * 5];
+
+    for (int i=0; i<n; i++) {
+        ids[i] = i * 7 - 100;
+        prices[i] = i * 1.25;
+        memset(codes + i*8, 'a' + i % 26, 8);
+        memset(notes + i*5, 'A' + i % 26, 5);
+    }
+
+    // Records are written with a stride wider than the record, as they
+    // are within a larger row
+    int stride = cd->width + 3;
+    byte *rows = calloc(n, stride);
+
+    void *in[] = {ids, prices, codes, notes};
+    void *out[] = {ids_out, prices_out, codes_out, notes_out};
+    cd_encode(cd, rows, stride, n, in);
+    cd_decode(cd, rows, stride, n, out);
+
+    ck_assert_int_eq(memcmp(ids, ids_out, sizeof(ids)), 0);
+    ck_assert_int_eq(memcmp(prices, prices_out, sizeof(prices)), 0);
+    ck_assert_int_eq(memcmp(codes, codes_out, sizeof(codes)), 0);
+    ck_assert_int_eq(memcmp(notes, notes_out, sizeof(notes)), 0);
+
+    // The encoded rows agree with the record accessors
+    ck_assert_int_eq(tp_getasint(rows + 5 * stride, 0), ids[5]);
+    ck_assert(tp_getasfloat(rows + 5 * stride, 4) == prices[5]);
+
+    free(rows);
+    cd_free(cd);
+}
+END_TEST
+
+
+START_TEST(compare_records)
+{
+    codec *cd = cd_create(&item_schema);
+    byte a[64] = {0}, b[64] = {0};
+
+    // Numeric fields compare by value, not by bytes
+    tp_setint(a, 0, -5);
+    tp_setint(b, 0, 3);
+    ck_assert_int_lt(cd_compare(cd, a, b), 0);
+    ck_assert_int_gt(cd_compare(cd, b, a), 0);
+
+    tp_setint(b, 0, -5);
+    tp_setfloat(a, 4, -0.5);
+    tp_setfloat(b, 4, 0.25);
+    ck_assert_int_lt(cd_compare(cd, a, b), 0);
+
+    tp_setfloat(b, 4, -0.5);
+    tp_setchar(a, 12, "apple", 8);
+    tp_setchar(b, 12, "apricot", 8);
+    ck_assert_int_lt(cd_compare(cd, a, b), 0);
+
+    tp_setchar(b, 12, "apple", 8);
+    ck_assert_int_eq(cd_compare(cd, a, b), 0);
+
+    cd_free(cd);
+}
+END_TEST
+
+
+START_TEST(table_codec)
+{
+    buff_pool_init(8);
+    table *tbl = tbl_create("items", "tests/testdb", &item_schema);
+    ck_assert_ptr_ne(tbl, NULL);
+    ck_assert_ptr_ne(tbl->codec, NULL);
+
+    for (int i=0; i<tbl->fields.field_cnt; i++) {
+        ck_assert_int_eq(tbl->codec->offsets[i], tbl_field_offset(&tbl->fields, i));
+    }
+    ck_assert_int_eq(tbl->codec->width, tbl->fields.record_length);
+
+    byte rec[64] = {0};
+    for (int i=0; i<50; i++) {
+        tp_setint(rec, 0, i);
+        tp_setfloat(rec, 4, i / 2.0);
+        tp_setchar(rec, 12, "code", 8);
+        tp_setchar(rec, 20, "note", 5);
+        tbl_insert(tbl, rec);
+    }
+    tbl_close(tbl);
+
+    // The codec is rebuilt on load, and drives the scan
+    tbl = tbl_load("items", "tests/testdb");
+    ck_assert_ptr_ne(tbl->codec, NULL);
+    ck_assert_int_eq(tbl->codec->width, tbl->fields.record_length);
+
+    exec_op *scan = exec_scan(tbl);
+    batch *b = exec_next(scan);
+    ck_assert_int_eq(b->count, 50);
+    for (int i=0; i<50; i++) {
+        ck_assert_int_eq(b->cols[0].ints[i], i);
+        ck_assert(b->cols[1].floats[i] == i / 2.0);
+        ck_assert_int_eq(memcmp(b->cols[3].chars + i*5, "note", 4), 0);
+    }
+    exec_close(scan);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("codec");
+
+    TCase *basic = tcase_create("basic");
+
+    tcase_add_test(basic, layout_and_kernels);
+    tcase_add_test(basic, encode_decode_roundtrip);
+    tcase_add_test(basic, compare_records);
+    tcase_add_test(basic, table_codec);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
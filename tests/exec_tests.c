@@ -0,0 +1,336 @@
+/*
+ * exec_tests.c
+ *
+ * A set of unit tests for the functionality of table.c and exec.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "page.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, age INT, score FLOAT, name CHAR(12))
+schema person_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 12}
+};
+
+int pool_size = 10;
+int record_cnt = 5000;
+table *tbl;
+
+
+void fill_record(byte *rec, int id)
+{
+    char name[12];
+    snprintf(name, 12, "p%d", id % 7);
+
+    tp_setint(rec, 0, id);
+    tp_setint(rec, 4, id % 100);
+    tp_setfloat(rec, 8, id * 0.5);
+    tp_setchar(rec, 16, name, 12);
+}
+
+
+void setup()
+{
+    buff_pool_init(pool_size);
+    tbl = tbl_create("persons", "tests/testdb", &person_schema);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        fill_record(rec, i);
+        tbl_insert(tbl, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+
+
+START_TEST(table_roundtrip)
+{
+    ck_assert_int_eq(tbl->fields.record_length, 28);
+    ck_assert_int_eq(tbl->record_cnt, record_cnt);
+
+    byte rec[BLOCKSIZE];
+    ck_assert_int_eq(tbl_read(tbl, 1234, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 1234);
+    ck_assert_int_eq(tp_getasint(rec, 4), 34);
+
+    // Closing and reloading the table must preserve the header and
+    // all of the records.
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load("persons", "tests/testdb");
+    ck_assert_ptr_ne(tbl, NULL);
+    ck_assert_int_eq(tbl->record_cnt, record_cnt);
+    ck_assert_int_eq(tbl->fields.field_types[3], CHAR);
+
+    ck_assert_int_eq(tbl_read(tbl, record_cnt - 1, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), record_cnt - 1);
+    ck_assert_int_eq(tbl_read(tbl, record_cnt, rec), 0);
+}
+END_TEST
+
+
+START_TEST(table_update)
+{
+    byte rec[BLOCKSIZE];
+    fill_record(rec, 77);
+    ck_assert_int_eq(tbl_update(tbl, 12, rec), 1);
+    ck_assert_int_eq(tbl_update(tbl, record_cnt, rec), 0);
+
+    ck_assert_int_eq(tbl_read(tbl, 12, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 77);
+    ck_assert_int_eq(tbl_read(tbl, 13, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 13);
+    ck_assert_int_eq(tbl->record_cnt, record_cnt);
+}
+END_TEST
+
+
+START_TEST(scan_all_rows)
+{
+    exec_op *scan = exec_scan(tbl);
+    batch *b;
+    int expected = 0;
+
+    while ((b = exec_next(scan))) {
+        ck_assert_int_le(b->count, EXEC_BATCH_SIZE);
+        for (int i=0; i<b->count; i++) {
+            ck_assert_int_eq(b->cols[0].ints[i], expected);
+            ck_assert_double_eq_tol(b->cols[2].floats[i], expected * 0.5, 1e-9);
+            expected++;
+        }
+    }
+
+    ck_assert_int_eq(expected, record_cnt);
+    ck_assert_int_eq(scan->rows, record_cnt);
+    ck_assert(!exec_failed(scan));
+
+    exec_close(scan);
+}
+END_TEST
+
+
+START_TEST(scan_pin_failure)
+{
+    // Fill the pool with pinned pages from the end of the table, so that
+    // the scan can't load its first block
+    int last = TBL_FIRST_BLK + tbl_blk_cnt(tbl) - 1;
+    ck_assert_int_gt(tbl_blk_cnt(tbl), pool_size);
+    for (int i=0; i<pool_size; i++) ck_assert_ptr_nonnull(buff_pin(tbl, last - i));
+
+    exec_op *op = exec_filter_int(exec_scan(tbl), 1, CMP_GE, 0);
+    ck_assert_ptr_null(exec_next(op));
+    ck_assert(exec_failed(op));
+    ck_assert(op->child->failed);
+
+    // A failed scan stays failed, even once pages are free again
+    buff_unpin(tbl, last);
+    ck_assert_ptr_null(exec_next(op));
+    exec_close(op);
+
+    // Likewise for a scan of the rows of a bitmap
+    roaring *rows = rb_create();
+    rb_add(rows, 0);
+    rb_add(rows, record_cnt - 1);
+    buff_pin(tbl, last);
+
+    op = exec_scan_rows(tbl, rows);
+    ck_assert_ptr_null(exec_next(op));
+    ck_assert(exec_failed(op));
+    exec_close(op);
+
+    for (int i=0; i<pool_size; i++) buff_unpin(tbl, last - i);
+
+    op = exec_scan_rows(tbl, rows);
+    batch *b = exec_next(op);
+    ck_assert_ptr_nonnull(b);
+    ck_assert_int_eq(b->count, 2);
+    ck_assert(!exec_failed(op));
+    exec_close(op);
+
+    rb_free(rows);
+}
+END_TEST
+
+
+START_TEST(scan_mmap)
+{
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    // A read-only mapping serves its pages without using the pool
+    table *mapped = tbl_load_mmap("persons", "tests/testdb", TBL_ACCESS_SEQUENTIAL);
+    ck_assert_ptr_ne(mapped, NULL);
+    ck_assert_int_eq(mapped->record_cnt, record_cnt);
+
+    exec_op *scan = exec_scan(mapped);
+    batch *b;
+    int expected = 0;
+
+    while ((b = exec_next(scan))) {
+        for (int i=0; i<b->count; i++) {
+            ck_assert_int_eq(b->cols[0].ints[i], expected);
+            expected++;
+        }
+    }
+
+    ck_assert_int_eq(expected, record_cnt);
+    exec_close(scan);
+
+    ck_assert_int_eq(tbl_advise(mapped, TBL_ACCESS_RANDOM), 1);
+
+    byte rec[BLOCKSIZE];
+    ck_assert_int_eq(tbl_read(mapped, 4321, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 4321);
+    ck_assert_int_eq(tbl_insert(mapped, rec), -1);
+
+    page *pg = buff_pin(mapped, TBL_FIRST_BLK);
+    ck_assert_ptr_eq(pg->data, mapped->map + TBL_FIRST_BLK * BLOCKSIZE);
+    ck_assert_int_eq(buff_modified(mapped, TBL_FIRST_BLK), -1);
+    ck_assert_int_eq(tbl_close(mapped), 0);
+    ck_assert_int_eq(buff_unpin(mapped, TBL_FIRST_BLK), 1);
+    ck_assert_ptr_eq(buff_pin(mapped, mapped->map_blks), NULL);
+
+    ck_assert_int_eq(tbl_close(mapped), 1);
+    tbl = tbl_load("persons", "tests/testdb");
+}
+END_TEST
+
+
+START_TEST(filter_and_project)
+{
+    // SELECT name, id FROM persons WHERE age < 10 AND score >= 100.0
+    exec_op *op = exec_scan(tbl);
+    op = exec_filter_int(op, 1, CMP_LT, 10);
+    op = exec_filter_float(op, 2, CMP_GE, 100.0);
+    int cols[] = {3, 0};
+    op = exec_project(op, 2, cols);
+
+    int matched = 0;
+    batch *b;
+    while ((b = exec_next(op))) {
+        ck_assert_int_eq(b->col_cnt, 2);
+        ck_assert_int_eq(b->cols[0].type, CHAR);
+        for (int i=0; i<b->count; i++) {
+            int id = b->cols[1].ints[i];
+            ck_assert_int_lt(id % 100, 10);
+            ck_assert_int_ge(id, 200);
+            matched++;
+        }
+    }
+
+    int expected = 0;
+    for (int i=200; i<record_cnt; i++) {
+        if (i % 100 < 10) expected++;
+    }
+
+    ck_assert_int_eq(matched, expected);
+    exec_close(op);
+}
+END_TEST
+
+
+START_TEST(filter_char)
+{
+    exec_op *op = exec_filter_char(exec_scan(tbl), 3, CMP_EQ, "p3");
+
+    int matched = 0;
+    batch *b;
+    while ((b = exec_next(op))) {
+        for (int i=0; i<b->count; i++) {
+            ck_assert_int_eq(b->cols[0].ints[i] % 7, 3);
+            matched++;
+        }
+    }
+
+    ck_assert_int_eq(matched, (record_cnt - 3 + 6) / 7);
+    exec_close(op);
+}
+END_TEST
+
+
+START_TEST(limit_rows)
+{
+    exec_op *op = exec_limit(exec_filter_int(exec_scan(tbl), 1, CMP_EQ, 5), 7);
+
+    int matched = 0;
+    batch *b;
+    while ((b = exec_next(op))) {
+        matched += b->count;
+    }
+
+    ck_assert_int_eq(matched, 7);
+
+    // The limit must stop pulling once satisfied, rather than
+    // draining the rest of the table.
+    ck_assert_int_lt(op->child->child->rows, record_cnt);
+
+    exec_close(op);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("exec");
+
+    // Test the basic functionality
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, table_roundtrip);
+    tcase_add_test(basic, table_update);
+    tcase_add_test(basic, scan_all_rows);
+    tcase_add_test(basic, scan_pin_failure);
+    tcase_add_test(basic, scan_mmap);
+    tcase_add_test(basic, filter_and_project);
+    tcase_add_test(basic, filter_char);
+    tcase_add_test(basic, limit_rows);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,212 @@
+/*
+ * extsort_tests.c
+ *
+ * A set of unit tests for the functionality of extsort.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "extsort.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// events (id INT, bucket INT, weight FLOAT, label CHAR(6))
+schema event_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 6}
+};
+
+int record_cnt = 20000;
+table *events;
+
+
+void setup()
+{
+    buff_pool_init(10);
+    events = tbl_create("events", "tests/testdb", &event_schema);
+
+    byte rec[BLOCKSIZE];
+    char label[6];
+    srand(7);
+    for (int i=0; i<record_cnt; i++) {
+        snprintf(label, 6, "l%03d", rand() % 500);
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, rand() % 50);
+        tp_setfloat(rec, 8, rand() / (double) RAND_MAX);
+        tp_setchar(rec, 16, label, 6);
+        tbl_insert(events, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(events);
+    buff_pool_destroy();
+}
+
+
+// Sort events by (bucket ASC, weight DESC) and verify the order, and that
+// every row was produced exactly once.
+void check_sorted(sort_opts *opts)
+{
+    sort_key keys[] = {{.col = 1, .desc = FALSE}, {.col = 2, .desc = TRUE}};
+    exec_op *sort = exec_sort(exec_scan(events), 2, keys, opts);
+
+    char *seen = calloc(record_cnt, 1);
+    int prev_bucket = -1;
+    double prev_weight = 2.0;
+    long rows = 0;
+    batch *b;
+
+    while ((b = exec_next(sort))) {
+        for (int i=0; i<b->count; i++) {
+            int bucket = b->cols[1].ints[i];
+            double weight = b->cols[2].floats[i];
+
+            ck_assert_int_ge(bucket, prev_bucket);
+            if (bucket == prev_bucket) {
+                ck_assert(weight <= prev_weight);
+            }
+
+            ck_assert_int_eq(seen[b->cols[0].ints[i]], 0);
+            seen[b->cols[0].ints[i]] = 1;
+
+            prev_bucket = bucket;
+            prev_weight = weight;
+            rows++;
+        }
+    }
+
+    ck_assert_int_eq(rows, record_cnt);
+    ck_assert(!exec_failed(sort));
+
+    free(seen);
+    exec_close(sort);
+}
+
+
+START_TEST(sort_in_memory)
+{
+    sort_opts opts;
+    sort_default_opts(&opts);
+    check_sorted(&opts);
+}
+END_TEST
+
+
+START_TEST(sort_with_runs)
+{
+    // 20000 rows of 22 bytes (+ a pointer apiece) take ~600KB, so a
+    // 64KB budget forces a number of runs to be written, but still
+    // allows them to be merged in one pass.
+    sort_opts opts;
+    sort_default_opts(&opts);
+    opts.mem_budget = 64 * 1024;
+    opts.threads = 3;
+    opts.readahead = 4;
+
+    check_sorted(&opts);
+}
+END_TEST
+
+
+START_TEST(sort_multiple_passes)
+{
+    sort_opts opts;
+    sort_default_opts(&opts);
+    opts.mem_budget = 2 * 4 * BLOCKSIZE;
+    opts.threads = 2;
+    opts.readahead = 4;
+
+    sort_key keys[] = {{.col = 3, .desc = FALSE}};
+    exec_op *sort = exec_sort(exec_scan(events), 1, keys, &opts);
+
+    char prev[7] = "";
+    long rows = 0;
+    batch *b;
+
+    while ((b = exec_next(sort))) {
+        for (int i=0; i<b->count; i++) {
+            char *label = b->cols[3].chars + i * 6;
+            ck_assert_int_le(memcmp(prev, label, 6), 0);
+            memcpy(prev, label, 6);
+            rows++;
+        }
+    }
+
+    ck_assert_int_eq(rows, record_cnt);
+    ck_assert_int_gt(exec_sort_passes(sort), 1);
+    ck_assert(!exec_failed(sort));
+
+    exec_close(sort);
+}
+END_TEST
+
+
+START_TEST(sort_empty_input)
+{
+    sort_key keys[] = {{.col = 0, .desc = FALSE}};
+    exec_op *sort = exec_sort(exec_filter_int(exec_scan(events), 0, CMP_LT, 0), 1, keys, NULL);
+
+    ck_assert_ptr_eq(exec_next(sort), NULL);
+    ck_assert_int_eq(exec_sort_runs(sort), 0);
+    ck_assert(!exec_failed(sort));
+
+    exec_close(sort);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("extsort");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, sort_in_memory);
+    tcase_add_test(basic, sort_with_runs);
+    tcase_add_test(basic, sort_multiple_passes);
+    tcase_add_test(basic, sort_empty_input);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
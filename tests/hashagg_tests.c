@@ -0,0 +1,249 @@
+/*
+ * hashagg_tests.c
+ *
+ * A set of unit tests for the functionality of hashagg.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "hashagg.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// sales (id INT, store INT, amount FLOAT, region CHAR(4))
+schema sales_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 4}
+};
+
+int record_cnt = 12000;
+int store_cnt = 1500;
+table *sales;
+
+agg_spec aggs[] = {
+    {.func = AGG_COUNT},
+    {.func = AGG_SUM, .col = 2},
+    {.func = AGG_MIN, .col = 0},
+    {.func = AGG_MAX, .col = 2},
+    {.func = AGG_AVG, .col = 0},
+};
+
+
+void setup()
+{
+    buff_pool_init(10);
+    sales = tbl_create("sales", "tests/testdb", &sales_schema);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i % store_cnt);
+        tp_setfloat(rec, 8, 1.0 + (i % 3));
+        tp_setchar(rec, 16, (i % 2) ? "east" : "west", 4);
+        tbl_insert(sales, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(sales);
+    buff_pool_destroy();
+}
+
+
+// SELECT store, COUNT(*), SUM(amount), MIN(id), MAX(amount), AVG(id)
+// GROUP BY store
+void check_by_store(agg_opts *opts, int expect_spill, int expect_split)
+{
+    int groups[] = {1};
+    exec_op *agg = exec_hashagg(exec_scan(sales), 1, groups, 5, aggs, opts);
+
+    char *seen = calloc(store_cnt, 1);
+    int per_store = record_cnt / store_cnt;
+    long rows = 0;
+    batch *b;
+
+    while ((b = exec_next(agg))) {
+        ck_assert_int_eq(b->col_cnt, 6);
+        ck_assert_int_eq(b->cols[3].type, INT);
+        ck_assert_int_eq(b->cols[4].type, FLOAT);
+
+        for (int i=0; i<b->count; i++) {
+            int store = b->cols[0].ints[i];
+            ck_assert_int_eq(seen[store], 0);
+            seen[store] = 1;
+
+            // Store s has the rows s, s + store_cnt, s + 2*store_cnt, ...
+            double sum = 0, max = 0;
+            for (int k=0; k<per_store; k++) {
+                double amount = 1.0 + ((store + k * store_cnt) % 3);
+                sum += amount;
+                if (amount > max) max = amount;
+            }
+
+            ck_assert_int_eq(b->cols[1].ints[i], per_store);
+            ck_assert_double_eq_tol(b->cols[2].floats[i], sum, 1e-9);
+            ck_assert_int_eq(b->cols[3].ints[i], store);
+            ck_assert_double_eq_tol(b->cols[4].floats[i], max, 1e-9);
+            ck_assert_double_eq_tol(b->cols[5].floats[i],
+                    store + store_cnt * (per_store - 1) / 2.0, 1e-9);
+            rows++;
+        }
+    }
+
+    ck_assert_int_eq(rows, store_cnt);
+    if (expect_spill) {
+        ck_assert_int_gt(exec_hashagg_spills(agg), 0);
+    } else {
+        ck_assert_int_eq(exec_hashagg_spills(agg), 0);
+    }
+
+    if (expect_split) {
+        ck_assert_int_gt(exec_hashagg_splits(agg), 0);
+    } else {
+        ck_assert_int_eq(exec_hashagg_splits(agg), 0);
+    }
+    ck_assert(!exec_failed(agg));
+
+    free(seen);
+    exec_close(agg);
+}
+
+
+START_TEST(group_single_thread)
+{
+    agg_opts opts;
+    agg_default_opts(&opts);
+    opts.threads = 1;
+
+    check_by_store(&opts, FALSE, FALSE);
+}
+END_TEST
+
+
+START_TEST(group_parallel)
+{
+    check_by_store(NULL, FALSE, FALSE);
+}
+END_TEST
+
+
+START_TEST(group_with_spill)
+{
+    agg_opts opts;
+    agg_default_opts(&opts);
+    opts.threads = 3;
+    opts.radix_bits = 3;
+    opts.mem_budget = 16 * 1024;
+
+    check_by_store(&opts, TRUE, TRUE);
+}
+END_TEST
+
+
+START_TEST(group_one_partition)
+{
+    // Every group lands in the one partition, which is far too large to
+    // merge within the budget, and so is split, more than once
+    agg_opts opts;
+    agg_default_opts(&opts);
+    opts.threads = 2;
+    opts.radix_bits = 0;
+    opts.mem_budget = 16 * 1024;
+
+    check_by_store(&opts, TRUE, TRUE);
+}
+END_TEST
+
+
+START_TEST(group_empty_input)
+{
+    int groups[] = {1};
+    exec_op *agg = exec_hashagg(exec_filter_int(exec_scan(sales), 0, CMP_LT, 0), 1, groups,
+            5, aggs, NULL);
+
+    ck_assert_ptr_null(exec_next(agg));
+    ck_assert(!exec_failed(agg));
+    exec_close(agg);
+}
+END_TEST
+
+
+START_TEST(group_by_char)
+{
+    int groups[] = {3};
+    agg_spec count[] = {{.func = AGG_COUNT}};
+    exec_op *agg = exec_hashagg(exec_scan(sales), 1, groups, 1, count, NULL);
+
+    int groups_seen = 0;
+    batch *b;
+    while ((b = exec_next(agg))) {
+        for (int i=0; i<b->count; i++) {
+            ck_assert(memcmp(b->cols[0].chars + i*4, "east", 4) == 0 ||
+                    memcmp(b->cols[0].chars + i*4, "west", 4) == 0);
+            ck_assert_int_eq(b->cols[1].ints[i], record_cnt / 2);
+            groups_seen++;
+        }
+    }
+
+    ck_assert_int_eq(groups_seen, 2);
+    exec_close(agg);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("hashagg");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, group_single_thread);
+    tcase_add_test(basic, group_parallel);
+    tcase_add_test(basic, group_with_spill);
+    tcase_add_test(basic, group_one_partition);
+    tcase_add_test(basic, group_empty_input);
+    tcase_add_test(basic, group_by_char);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
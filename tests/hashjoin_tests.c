@@ -0,0 +1,251 @@
+/*
+ * hashjoin_tests.c
+ *
+ * A set of unit tests for the functionality of hashjoin.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "hashjoin.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// customers (id INT, region INT)
+schema cust_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, INT},
+};
+
+// orders (id INT, cust_id INT, total FLOAT)
+schema order_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, FLOAT},
+};
+
+int cust_cnt = 2000;
+int order_cnt = 10000;
+table *customers;
+table *orders;
+
+
+void setup()
+{
+    buff_pool_init(10);
+    customers = tbl_create("customers", "tests/testdb", &cust_schema);
+    orders = tbl_create("orders", "tests/testdb", &order_schema);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<cust_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i % 10);
+        tbl_insert(customers, rec);
+    }
+
+    // Every order references a customer, except those with ids divisible
+    // by 5, which reference a customer that doesn't exist.
+    for (int i=0; i<order_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, (i % 5 == 0) ? cust_cnt + i : (i * 7) % cust_cnt);
+        tp_setfloat(rec, 8, i * 1.5);
+        tbl_insert(orders, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(customers);
+    tbl_close(orders);
+    buff_pool_destroy();
+}
+
+
+// Run the join to completion, validating each output row, and return
+// the number of rows produced.
+long run_join(exec_op *join)
+{
+    long rows = 0;
+    batch *b;
+
+    while ((b = exec_next(join))) {
+        ck_assert_int_eq(b->col_cnt, 5);
+        for (int i=0; i<b->count; i++) {
+            int order_id = b->cols[2].ints[i];
+            ck_assert_int_eq(b->cols[0].ints[i], b->cols[3].ints[i]);
+            ck_assert_int_eq(b->cols[1].ints[i], b->cols[0].ints[i] % 10);
+            ck_assert_int_eq(b->cols[3].ints[i], (order_id * 7) % cust_cnt);
+            ck_assert_double_eq_tol(b->cols[4].floats[i], order_id * 1.5, 1e-9);
+            rows++;
+        }
+    }
+
+    ck_assert(!exec_failed(join));
+    return rows;
+}
+
+
+START_TEST(join_in_memory)
+{
+    exec_op *join = exec_hashjoin(exec_scan(customers), exec_scan(orders), 0, 1, NULL);
+
+    ck_assert_int_eq(run_join(join), order_cnt - order_cnt / 5);
+    ck_assert_int_eq(exec_hashjoin_spilled(join), 0);
+
+    exec_close(join);
+}
+END_TEST
+
+
+START_TEST(join_single_thread_subpartitioned)
+{
+    hj_opts opts;
+    hj_default_opts(&opts);
+    opts.threads = 1;
+    opts.radix_bits = 1;
+    opts.cache_size = 512;
+
+    exec_op *join = exec_hashjoin(exec_scan(customers), exec_scan(orders), 0, 1, &opts);
+    ck_assert_int_eq(run_join(join), order_cnt - order_cnt / 5);
+
+    exec_close(join);
+}
+END_TEST
+
+
+START_TEST(join_with_spill)
+{
+    hj_opts opts;
+    hj_default_opts(&opts);
+    opts.threads = 3;
+    opts.radix_bits = 4;
+    opts.mem_budget = 2048;
+
+    exec_op *join = exec_hashjoin(exec_scan(customers), exec_scan(orders), 0, 1, &opts);
+
+    ck_assert_int_eq(run_join(join), order_cnt - order_cnt / 5);
+    ck_assert_int_gt(exec_hashjoin_spilled(join), 0);
+
+    exec_close(join);
+}
+END_TEST
+
+
+START_TEST(join_skewed_keys)
+{
+    // Customers joined with each other on region, whose 10 values are
+    // shared by 200 customers apiece. With so small a budget, every
+    // partition is spilled, and none can be split by hashing, so each is
+    // joined a few build tuples at a time.
+    hj_opts opts;
+    hj_default_opts(&opts);
+    opts.threads = 2;
+    opts.mem_budget = 256;
+
+    exec_op *join = exec_hashjoin(exec_scan(customers), exec_scan(customers), 1, 1, &opts);
+    long rows = 0;
+    long *per_region = calloc(10, sizeof(long));
+    batch *b;
+
+    while ((b = exec_next(join))) {
+        for (int i=0; i<b->count; i++) {
+            ck_assert_int_eq(b->cols[1].ints[i], b->cols[3].ints[i]);
+            ck_assert_int_eq(b->cols[0].ints[i] % 10, b->cols[1].ints[i]);
+            ck_assert_int_eq(b->cols[2].ints[i] % 10, b->cols[3].ints[i]);
+            per_region[b->cols[1].ints[i]]++;
+            rows++;
+        }
+    }
+
+    ck_assert(!exec_failed(join));
+    ck_assert_int_gt(exec_hashjoin_spilled(join), 0);
+    ck_assert_int_eq(rows, 10L * 200 * 200);
+    for (int r=0; r<10; r++) ck_assert_int_eq(per_region[r], 200L * 200);
+
+    free(per_region);
+    exec_close(join);
+}
+END_TEST
+
+
+START_TEST(join_closed_early)
+{
+    // More output than the workers can hand over before waiting on the
+    // consumer, which goes away after the first batch
+    hj_opts opts;
+    hj_default_opts(&opts);
+    opts.threads = 3;
+    opts.mem_budget = 2048;
+
+    exec_op *join = exec_hashjoin(exec_scan(customers), exec_scan(orders), 0, 1, &opts);
+    ck_assert_ptr_nonnull(exec_next(join));
+    exec_close(join);
+}
+END_TEST
+
+
+START_TEST(join_no_matches)
+{
+    exec_op *build = exec_filter_int(exec_scan(customers), 0, CMP_LT, 0);
+    exec_op *join = exec_hashjoin(build, exec_scan(orders), 0, 1, NULL);
+
+    ck_assert_ptr_eq(exec_next(join), NULL);
+    ck_assert(!exec_failed(join));
+
+    exec_close(join);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("hashjoin");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, join_in_memory);
+    tcase_add_test(basic, join_single_thread_subpartitioned);
+    tcase_add_test(basic, join_with_spill);
+    tcase_add_test(basic, join_skewed_keys);
+    tcase_add_test(basic, join_closed_early);
+    tcase_add_test(basic, join_no_matches);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
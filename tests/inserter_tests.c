@@ -0,0 +1,312 @@
+/*
+ * inserter_tests.c
+ *
+ * A set of unit tests for the functionality of inserter.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "art.h"
+#include "bloom.h"
+#include "bmindex.h"
+#include "inserter.h"
+#include "pgbuffer.h"
+#include "roaring.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, group INT)
+schema rec_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, INT},
+    .field_lengths = {0, 0}
+};
+
+#define THREADS 4
+#define PER_THREAD 3000
+#define INITIAL 37
+#define GROUPS 7
+
+typedef struct worker_arg {
+    table *tbl;
+    int thread;
+    int errors;
+    int dups;
+} worker_arg;
+
+
+/*
+ * Insert this thread's ids, closing and reopening its inserter every so
+ * often so that blocks are left part full, and trying a duplicate of an
+ * existing id now and then.
+ */
+static void *insert_worker(void *arg)
+{
+    worker_arg *w = arg;
+    inserter *ins = ins_open(w->tbl);
+    byte rec[8];
+
+    for (int i=0; i<PER_THREAD; i++) {
+        int id = INITIAL + i * THREADS + w->thread;
+        tp_setint(rec, 0, id);
+        tp_setint(rec, 4, id % GROUPS);
+        if (ins_insert(ins, rec) != 1) w->errors++;
+
+        if (i % 97 == 0) {
+            tp_setint(rec, 0, i % INITIAL);
+            if (ins_insert(ins, rec) == 0) w->dups++;
+        }
+
+        if (i % (250 + 50 * w->thread) == 0) {
+            if (ins_close(ins) != 1) w->errors++;
+            ins = ins_open(w->tbl);
+        }
+    }
+
+    if (ins_close(ins) != 1) w->errors++;
+    return NULL;
+}
+
+
+/*
+ * Check that the table holds ids 0 to cnt - 1, once each, packed, and that
+ * its index and bitmaps agree.
+ */
+static void check_table(table *tbl, int cnt)
+{
+    ck_assert_int_eq(tbl->record_cnt, cnt);
+
+    char *seen = calloc(cnt, 1);
+    byte rec[8];
+    for (int rid=0; rid<cnt; rid++) {
+        ck_assert_int_eq(tbl_read(tbl, rid, rec), 1);
+
+        int id = tp_getasint(rec, 0);
+        ck_assert(id >= 0 && id < cnt);
+        ck_assert(!seen[id]);
+        seen[id] = 1;
+
+        ck_assert_int_eq(tp_getasint(rec, 4), id % GROUPS);
+        ck_assert_int_eq(tbl_art_find(tbl, rec), rid);
+    }
+    free(seen);
+
+    long total = 0;
+    for (int g=0; g<GROUPS; g++) {
+        roaring *rows = tbl_bitmap_int(tbl, 1, g);
+        ck_assert_int_eq(rb_cardinality(rows), (cnt - g + GROUPS - 1) / GROUPS);
+        total += rb_cardinality(rows);
+        rb_free(rows);
+    }
+    ck_assert_int_eq(total, cnt);
+}
+
+
+START_TEST(concurrent_inserts)
+{
+    buff_pool_init(32);
+    table *tbl = tbl_create("inserter", "tests/testdb", &rec_schema);
+    ck_assert_int_eq(tbl_art_create(tbl, 0), 1);
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 1), 1);
+
+    // A few records to start with, leaving the last block part full
+    byte rec[8];
+    for (int i=0; i<INITIAL; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i % GROUPS);
+        ck_assert_int_eq(tbl_insert(tbl, rec), i);
+    }
+    ck_assert(INITIAL % tbl_recs_per_blk(tbl) != 0);
+
+    ck_assert_int_eq(tbl_ins_begin(tbl), 1);
+    ck_assert_int_eq(tbl_ins_begin(tbl), 0);
+    ck_assert_int_eq(tbl_insert(tbl, rec), -1);
+
+    pthread_t tids[THREADS];
+    worker_arg args[THREADS];
+    for (int t=0; t<THREADS; t++) {
+        args[t] = (worker_arg) {.tbl = tbl, .thread = t};
+        pthread_create(&tids[t], NULL, insert_worker, &args[t]);
+    }
+
+    // Readers only see the records from before the session
+    for (int i=0; i<1000; i++) {
+        ck_assert_int_eq(tbl->record_cnt, INITIAL);
+        ck_assert_int_eq(tbl_read(tbl, INITIAL, rec), 0);
+        ck_assert_int_eq(tbl_read(tbl, i % INITIAL, rec), 1);
+        ck_assert_int_eq(tp_getasint(rec, 0), i % INITIAL);
+    }
+
+    for (int t=0; t<THREADS; t++) {
+        pthread_join(tids[t], NULL);
+        ck_assert_int_eq(args[t].errors, 0);
+        ck_assert(args[t].dups > 0);
+    }
+
+    // Ending the session packs the records, and counts them
+    ck_assert_int_eq(tbl_ins_end(tbl), THREADS * PER_THREAD);
+    ck_assert_ptr_null(tbl->ins);
+    check_table(tbl, INITIAL + THREADS * PER_THREAD);
+
+    // Every block of the table is full but the last
+    ck_assert_int_eq(tbl_blk_cnt(tbl),
+            (INITIAL + THREADS * PER_THREAD + tbl_recs_per_blk(tbl) - 1) / tbl_recs_per_blk(tbl));
+
+    // The table takes plain inserts again, and all of it is written out
+    int cnt = INITIAL + THREADS * PER_THREAD;
+    tp_setint(rec, 0, cnt);
+    tp_setint(rec, 4, cnt % GROUPS);
+    ck_assert_int_eq(tbl_insert(tbl, rec), cnt);
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    tbl = tbl_load("inserter", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl);
+    ck_assert_int_eq(tbl_art_create(tbl, 0), 1);
+    ck_assert_int_eq(tbl_bitmap_create(tbl, 1), 1);
+    check_table(tbl, cnt + 1);
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(session_lifecycle)
+{
+    buff_pool_init(8);
+    table *tbl = tbl_create("inserter", "tests/testdb", &rec_schema);
+    ck_assert_int_eq(tbl_ins_end(tbl), -1);
+
+    // An empty session changes nothing
+    ck_assert_int_eq(tbl_ins_begin(tbl), 1);
+    inserter *ins = ins_open(tbl);
+    ck_assert_ptr_nonnull(ins);
+    ck_assert_int_eq(tbl_ins_end(tbl), -1);
+    ck_assert_int_eq(ins_close(ins), 1);
+    ck_assert_int_eq(tbl_ins_end(tbl), 0);
+    ck_assert_int_eq(tbl->record_cnt, 0);
+    ck_assert_ptr_null(ins_open(tbl));
+
+    // Several inserters, each leaving its block part full, with the
+    // records packed into the first blocks at the end
+    int per_blk = tbl_recs_per_blk(tbl);
+    ck_assert_int_eq(tbl_ins_begin(tbl), 1);
+
+    inserter *inss[3];
+    for (int k=0; k<3; k++) ck_assert_ptr_nonnull(inss[k] = ins_open(tbl));
+
+    byte rec[8];
+    int id = 0;
+    for (int k=0; k<3; k++) {
+        for (int i=0; i<per_blk + per_blk / 2; i++, id++) {
+            tp_setint(rec, 0, id);
+            tp_setint(rec, 4, id % GROUPS);
+            ck_assert_int_eq(ins_insert(inss[k], rec), 1);
+        }
+    }
+    for (int k=0; k<3; k++) ck_assert_int_eq(ins_close(inss[k]), 1);
+
+    // A session is ended when the table is closed
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load("inserter", "tests/testdb");
+    ck_assert_int_eq(tbl->record_cnt, id);
+
+    char *seen = calloc(id, 1);
+    for (int rid=0; rid<id; rid++) {
+        ck_assert_int_eq(tbl_read(tbl, rid, rec), 1);
+        ck_assert(!seen[tp_getasint(rec, 0)]);
+        seen[tp_getasint(rec, 0)] = 1;
+    }
+    free(seen);
+
+    // Tables which don't take concurrent inserts
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load_mmap("inserter", "tests/testdb", TBL_ACCESS_NORMAL);
+    ck_assert_ptr_nonnull(tbl);
+    ck_assert_int_eq(tbl_ins_begin(tbl), 0);
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(bloom_filter_grown)
+{
+    buff_pool_init(8);
+    table *tbl = tbl_create("inserter", "tests/testdb", &rec_schema);
+
+    // The filter starts out small, and is grown several times over as the
+    // session's records are indexed
+    ck_assert_int_eq(tbl_bloom_create(tbl, 0, 0), 1);
+    long capacity = tbl->bloom->capacity;
+
+    ck_assert_int_eq(tbl_ins_begin(tbl), 1);
+    inserter *ins = ins_open(tbl);
+    byte rec[8];
+    int cnt = 5000;
+    for (int i=0; i<cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setint(rec, 4, i % GROUPS);
+        ck_assert_int_eq(ins_insert(ins, rec), 1);
+    }
+    ck_assert_int_eq(ins_close(ins), 1);
+    ck_assert_int_eq(tbl_ins_end(tbl), cnt);
+
+    ck_assert_int_gt(tbl->bloom->capacity, capacity);
+    for (int i=0; i<cnt; i++) ck_assert(tbl_may_contain(tbl, 0, i));
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("inserter");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_test(basic, concurrent_inserts);
+    tcase_add_test(basic, session_lifecycle);
+    tcase_add_test(basic, bloom_filter_grown);
+    tcase_set_timeout(basic, 60);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,250 @@
+/*
+ * lsm_tests.c
+ *
+ * A set of unit tests for the functionality of lsm.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "lsm.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (val INT, key INT, pad CHAR(8))
+schema kv_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, INT, CHAR},
+    .field_lengths = {0, 0, 8}
+};
+
+lsm_opts small_opts = {.memtable_recs = 64, .l0_runs = 2, .fanout = 3};
+int key_cnt = 5000;
+
+
+void setup()
+{
+    buff_pool_init(8);
+}
+
+
+void teardown()
+{
+    buff_pool_destroy();
+}
+
+
+// Insert keys 0 .. key_cnt-1 in a scrambled order, each with val
+static void put_all(table *tbl, int val)
+{
+    byte rec[64] = {0};
+    for (int i=0; i<key_cnt; i++) {
+        int key = (i * 7919) % key_cnt;
+        tp_setint(rec, 0, val);
+        tp_setint(rec, 4, key);
+        ck_assert_int_eq(tbl_insert(tbl, rec), 0);
+    }
+}
+
+
+static void check_all(table *tbl, int val)
+{
+    byte rec[64];
+    for (int key=0; key<key_cnt; key++) {
+        ck_assert_int_eq(lsm_get(tbl->lsm, key, rec), 1);
+        ck_assert_int_eq(tp_getasint(rec, 4), key);
+        ck_assert_int_eq(tp_getasint(rec, 0), val);
+    }
+
+    ck_assert_int_eq(lsm_get(tbl->lsm, -1, rec), 0);
+    ck_assert_int_eq(lsm_get(tbl->lsm, key_cnt, rec), 0);
+}
+
+
+START_TEST(put_and_get)
+{
+    table *tbl = tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 1, &small_opts);
+    ck_assert_ptr_nonnull(tbl);
+
+    // Read back while the background thread is flushing and merging
+    put_all(tbl, 1);
+    check_all(tbl, 1);
+
+    ck_assert_int_eq(lsm_flush(tbl->lsm), 1);
+    check_all(tbl, 1);
+
+    lsm_stats stats;
+    lsm_stats_get(tbl->lsm, &stats);
+    ck_assert_int_eq(stats.puts, key_cnt);
+    ck_assert_int_eq(stats.flushes, (key_cnt + 63) / 64);
+    ck_assert_int_gt(stats.merges, 0);
+    ck_assert_int_ge(stats.bytes_written, stats.bytes_put);
+
+    long recs = 0;
+    for (int l=0; l<LSM_MAX_LEVELS; l++) recs += stats.recs[l];
+    ck_assert_int_eq(recs, key_cnt);
+    ck_assert_int_lt(stats.runs[0], small_opts.l0_runs);
+
+    // Records can't be addressed by id
+    byte rec[64] = {0};
+    ck_assert_int_eq(tbl_read(tbl, 0, rec), 0);
+    ck_assert_int_eq(tbl_update(tbl, 0, rec), 0);
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+}
+END_TEST
+
+
+START_TEST(newest_version_wins)
+{
+    table *tbl = tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 1, &small_opts);
+
+    put_all(tbl, 1);
+    ck_assert_int_eq(lsm_flush(tbl->lsm), 1);
+
+    // Overwrite half the keys, leaving the new versions spread across the
+    // memtable and the upper levels
+    byte rec[64] = {0};
+    for (int key=0; key<key_cnt; key+=2) {
+        tp_setint(rec, 0, 2);
+        tp_setint(rec, 4, key);
+        tbl_insert(tbl, rec);
+    }
+
+    for (int key=0; key<key_cnt; key++) {
+        ck_assert_int_eq(lsm_get(tbl->lsm, key, rec), 1);
+        ck_assert_int_eq(tp_getasint(rec, 0), (key % 2 == 0) ? 2 : 1);
+    }
+
+    // Once merged down, the new versions still shadow the old, and merges
+    // have dropped some of the old ones
+    ck_assert_int_eq(lsm_flush(tbl->lsm), 1);
+
+    lsm_stats stats;
+    lsm_stats_get(tbl->lsm, &stats);
+
+    long recs = 0;
+    for (int l=0; l<LSM_MAX_LEVELS; l++) recs += stats.recs[l];
+    ck_assert_int_lt(recs, stats.puts);
+
+    for (int key=0; key<key_cnt; key++) {
+        ck_assert_int_eq(lsm_get(tbl->lsm, key, rec), 1);
+        ck_assert_int_eq(tp_getasint(rec, 0), (key % 2 == 0) ? 2 : 1);
+    }
+
+    // The runs of each level below 0 are sorted and disjoint
+    lsm_tree *lsm = tbl->lsm;
+    for (int l=1; l<LSM_MAX_LEVELS; l++) {
+        for (int i=0; i<lsm->run_cnt[l]; i++) {
+            ck_assert_int_le(lsm->runs[l][i]->min_key, lsm->runs[l][i]->max_key);
+            if (i > 0) ck_assert_int_lt(lsm->runs[l][i - 1]->max_key, lsm->runs[l][i]->min_key);
+        }
+    }
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+}
+END_TEST
+
+
+START_TEST(reopen)
+{
+    table *tbl = tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 1, &small_opts);
+    put_all(tbl, 3);
+
+    // Leave some records in the memtable
+    byte rec[64] = {0};
+    tp_setint(rec, 0, 3);
+    tp_setint(rec, 4, key_cnt + 10);
+    tbl_insert(tbl, rec);
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    tbl = tbl_load("lsm", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl);
+    ck_assert_int_eq(tbl->engine, TBL_ENGINE_LSM);
+    ck_assert_int_eq(tbl->lsm->key_col, 1);
+    ck_assert_int_eq(tbl->lsm->opts.memtable_recs, small_opts.memtable_recs);
+
+    check_all(tbl, 3);
+    ck_assert_int_eq(lsm_get(tbl->lsm, key_cnt + 10, rec), 1);
+
+    // LSM tables can't be mapped
+    ck_assert_ptr_null(tbl_load_mmap("lsm", "tests/testdb", TBL_ACCESS_NORMAL));
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+}
+END_TEST
+
+
+START_TEST(bad_key_column)
+{
+    // The key must be an INT column
+    ck_assert_ptr_null(tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 2, NULL));
+    ck_assert_ptr_null(tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 3, NULL));
+
+    lsm_opts bad = {.memtable_recs = 0, .l0_runs = 2, .fanout = 3};
+    ck_assert_ptr_null(tbl_create_lsm("lsm", "tests/testdb", &kv_schema, 1, &bad));
+
+    // Heap tables are unaffected
+    table *tbl = tbl_create("heap", "tests/testdb", &kv_schema);
+    ck_assert_int_eq(tbl->engine, TBL_ENGINE_HEAP);
+    ck_assert_ptr_null(tbl->lsm);
+    tbl_close(tbl);
+
+    tbl = tbl_load("heap", "tests/testdb");
+    ck_assert_int_eq(tbl->engine, TBL_ENGINE_HEAP);
+    tbl_close(tbl);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("lsm");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+    tcase_set_timeout(basic, 30);
+
+    tcase_add_test(basic, put_and_get);
+    tcase_add_test(basic, newest_version_wins);
+    tcase_add_test(basic, reopen);
+    tcase_add_test(basic, bad_key_column);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
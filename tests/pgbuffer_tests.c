@@ -21,6 +21,7 @@
 #include "pgbuffer.h"
 #include "page.h"
 #include "table.h"
+#include "types.h"
 
 #include <check.h>
 #include <stdio.h>
@@ -47,7 +48,7 @@ START_TEST(initialize_pool)
     for (int i=0; i<pool_size; i++) {
         ck_assert_int_eq(_PAGE_POOL[i]->pinned, 0);
         ck_assert_ptr_eq(_PAGE_POOL[i]->tbl, NULL);
-        ck_assert_int_eq(memcmp(&(_PAGE_POOL[i]->data), empty_blk, BLOCKSIZE), 0);
+        ck_assert_int_eq(memcmp(_PAGE_POOL[i]->data, empty_blk, BLOCKSIZE), 0);
 
         int locked = sem_trywait(&(_PAGE_POOL[i]->locked));
         ck_assert_int_eq(locked, 0);
@@ -71,6 +72,32 @@ START_TEST(initialize_pool)
 END_TEST
 
 
+START_TEST(pool_arena_layout)
+{
+    ck_assert_int_eq(buff_pool_init(pool_size), 1);
+
+    // Frame data is carved, cache line aligned, from a single arena
+    // separate from the page descriptors
+    for (int i=0; i<pool_size; i++) {
+        ck_assert_int_eq((size_t) _PAGE_POOL[i]->data % 64, 0);
+        ck_assert_ptr_eq(_PAGE_POOL[i], _PAGE_POOL[0] + i);
+
+        if (i > 0) {
+            ck_assert_int_eq(_PAGE_POOL[i]->data - _PAGE_POOL[i-1]->data,
+                             _PAGE_POOL[1]->data - _PAGE_POOL[0]->data);
+        }
+    }
+
+    ck_assert_int_ge(_PAGE_POOL[1]->data - _PAGE_POOL[0]->data, BLOCKSIZE);
+    ck_assert_int_ge(buff_pool_hugepages(), BUFF_HUGE_NONE);
+    ck_assert_int_le(buff_pool_hugepages(), BUFF_HUGE_EXPLICIT);
+    ck_assert_int_ge(buff_pool_nodes(), 1);
+
+    buff_pool_destroy();
+}
+END_TEST
+
+
 START_TEST(destroy_pool)
 {
     int resp = buff_pool_init(pool_size);
@@ -233,6 +260,264 @@ START_TEST(pin_page_with_full_pool)
 END_TEST
 
 
+START_TEST(named_pools)
+{
+    buff_pool *hot = buff_pool_create("hot", 4, BUFF_POLICY_CLOCK);
+    buff_pool *cold = buff_pool_create("cold", 2, BUFF_POLICY_FIRST);
+
+    ck_assert_ptr_ne(hot, NULL);
+    ck_assert_ptr_ne(cold, NULL);
+    ck_assert_int_eq(hot->size, 4);
+    ck_assert_int_eq(cold->size, 2);
+
+    // Pools are found by name, and names are unique
+    ck_assert_ptr_eq(buff_pool_get("hot"), hot);
+    ck_assert_ptr_eq(buff_pool_get("cold"), cold);
+    ck_assert_ptr_eq(buff_pool_create("hot", 8, BUFF_POLICY_CLOCK), NULL);
+    ck_assert_ptr_eq(buff_pool_create("bad", 8, 99), NULL);
+
+    // Named pools are independent of the default pool
+    ck_assert_ptr_eq(buff_pool_default(), NULL);
+    ck_assert_int_eq(buff_pool_init(pool_size), 1);
+    ck_assert_ptr_eq(buff_pool_get("default"), buff_pool_default());
+    ck_assert_ptr_ne(buff_pool_default(), hot);
+
+    buff_pool_free(hot);
+    ck_assert_ptr_eq(buff_pool_get("hot"), NULL);
+    ck_assert_ptr_eq(buff_pool_get("cold"), cold);
+
+    buff_pool_free(cold);
+    buff_pool_destroy();
+    ck_assert_ptr_eq(buff_pool_default(), NULL);
+}
+END_TEST
+
+
+START_TEST(pool_isolation)
+{
+    buff_pool_init(3);
+    buff_pool *oltp = buff_pool_create("oltp", 3, BUFF_POLICY_CLOCK);
+
+    // Two tenants over the same file: one bound to its own pool, and one
+    // scanning through the default pool
+    table hot = tbl;
+    table scan = tbl;
+    ck_assert_int_eq(buff_pool_bind(&hot, oltp), 1);
+
+    for (int i=0; i<3; i++) {
+        page *pg = buff_pin(&hot, i);
+        ck_assert_ptr_eq(pg, oltp->pages[0] + i);
+        buff_unpin(&hot, i);
+    }
+
+    for (int i=0; i<50; i++) {
+        buff_pin(&scan, i % 5);
+        buff_unpin(&scan, i % 5);
+    }
+
+    // The scan has cycled the default pool without touching the other
+    ck_assert_int_eq(buff_pool_resident(oltp, &hot), 3);
+    ck_assert_int_eq(buff_pool_resident(oltp, &scan), 0);
+    ck_assert_int_eq(buff_pool_resident(buff_pool_default(), &hot), 0);
+    ck_assert_int_eq(buff_pool_resident(buff_pool_default(), &scan), 3);
+    for (int i=0; i<3; i++) {
+        ck_assert_ptr_ne(buff_find_pg(&hot, i), NULL);
+    }
+
+    // Rebinding releases the table's frames in its old pool, and fails
+    // while any of them are pinned
+    buff_pin(&hot, 0);
+    ck_assert_int_eq(buff_pool_bind(&hot, NULL), 0);
+    buff_unpin(&hot, 0);
+    ck_assert_int_eq(buff_pool_bind(&hot, NULL), 1);
+    ck_assert_int_eq(buff_pool_resident(oltp, &hot), 0);
+
+    buff_evict_tbl(&scan);
+    buff_evict_tbl(&hot);
+    buff_pool_free(oltp);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(clock_second_chance)
+{
+    buff_pool *pool = buff_pool_create("clock", 3, BUFF_POLICY_CLOCK);
+    table t = tbl;
+    buff_pool_bind(&t, pool);
+
+    for (int i=0; i<4; i++) {
+        buff_pin(&t, i);
+        buff_unpin(&t, i);
+    }
+
+    // Block 0 was the victim for block 3; referencing block 1 again
+    // should now spare it in favour of block 2
+    ck_assert_ptr_eq(buff_find_pg(&t, 0), NULL);
+    buff_pin(&t, 1);
+    buff_unpin(&t, 1);
+
+    buff_pin(&t, 4);
+    buff_unpin(&t, 4);
+
+    ck_assert_ptr_ne(buff_find_pg(&t, 1), NULL);
+    ck_assert_ptr_ne(buff_find_pg(&t, 3), NULL);
+    ck_assert_ptr_ne(buff_find_pg(&t, 4), NULL);
+    ck_assert_ptr_eq(buff_find_pg(&t, 2), NULL);
+
+    // With every frame pinned, there is nothing to evict
+    buff_pin(&t, 1);
+    buff_pin(&t, 3);
+    buff_pin(&t, 4);
+    ck_assert_ptr_eq(buff_pin(&t, 5), NULL);
+
+    buff_unpin(&t, 1);
+    buff_unpin(&t, 3);
+    buff_unpin(&t, 4);
+
+    buff_evict_tbl(&t);
+    buff_pool_free(pool);
+}
+END_TEST
+
+
+START_TEST(dump_and_warm)
+{
+    schema sch = {.field_cnt = 1, .field_types = {INT}, .field_lengths = {0}};
+    char *dump = "tests/testdb/pool.dump";
+    int hot[] = {3, 4, 5, 9, 12};
+
+    buff_pool_init(8);
+    table *t = tbl_create("warm", "tests/testdb", &sch);
+    byte rec[sizeof(int)];
+    for (int i=0; i<20 * tbl_recs_per_blk(t); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(t, rec);
+    }
+
+    buff_evict_tbl(t);
+    for (int i=0; i<5; i++) {
+        buff_pin(t, hot[i]);
+        buff_unpin(t, hot[i]);
+    }
+    ck_assert_int_eq(buff_pool_dump(NULL, dump), 5);
+
+    tbl_close(t);
+    buff_pool_destroy();
+
+    // Restart, and reload the dump into the new pool
+    buff_pool_init(8);
+    t = tbl_load("warm", "tests/testdb");
+    ck_assert_int_eq(buff_pool_warm(NULL, dump, &t, 1), 5);
+    ck_assert_int_eq(buff_pool_resident(buff_pool_default(), t), 5);
+
+    for (int i=0; i<5; i++) {
+        page *pg = buff_find_pg(t, hot[i]);
+        ck_assert_ptr_ne(pg, NULL);
+        ck_assert_int_eq(pg->pinned, 0);
+        ck_assert_int_eq(pg_getint(pg, 0), (hot[i] - TBL_FIRST_BLK) * tbl_recs_per_blk(t));
+    }
+
+    // Pages already resident are not loaded again
+    ck_assert_int_eq(buff_pool_warm(NULL, dump, &t, 1), 0);
+    tbl_close(t);
+    buff_pool_destroy();
+
+    // Warming only fills free frames, and never evicts
+    buff_pool_init(3);
+    t = tbl_load("warm", "tests/testdb");
+    buff_pin(t, 1);
+    ck_assert_int_eq(buff_pool_warm(NULL, dump, &t, 1), 2);
+    ck_assert_ptr_ne(buff_find_pg(t, 1), NULL);
+    buff_unpin(t, 1);
+    tbl_close(t);
+    buff_pool_destroy();
+
+    // In the background
+    buff_pool_init(8);
+    t = tbl_load("warm", "tests/testdb");
+    buff_warmer *w = buff_pool_warm_start(NULL, dump, &t, 1);
+    ck_assert_ptr_ne(w, NULL);
+    ck_assert_int_eq(buff_pool_warm_finish(w), 5);
+    ck_assert_int_eq(buff_pool_resident(buff_pool_default(), t), 5);
+
+    // Pages of tables that aren't open are skipped, and bad dumps rejected
+    table *none = NULL;
+    ck_assert_int_eq(buff_pool_warm(NULL, dump, &none, 1), 0);
+    ck_assert_int_eq(buff_pool_warm(NULL, "tests/testdb/missing.dump", &t, 1), -1);
+
+    tbl_close(t);
+    buff_pool_destroy();
+}
+END_TEST
+
+START_TEST(batch_pins)
+{
+    schema sch = {.field_cnt = 1, .field_types = {INT}, .field_lengths = {0}};
+
+    buff_pool_init(6);
+    table *t = tbl_create("batch", "tests/testdb", &sch);
+    byte rec[sizeof(int)];
+    for (int i=0; i<20 * tbl_recs_per_blk(t); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(t, rec);
+    }
+
+    buff_evict_tbl(t);
+    buff_pin(t, 5);
+    buff_unpin(t, 5);
+
+    // A hit, a run of misses, a repeat, and an isolated miss
+    int blks[] = {5, 2, 3, 4, 3, 9};
+    buff_handle hs[6];
+    for (int i=0; i<6; i++) hs[i] = (buff_handle) {.tbl = t, .blk_no = blks[i]};
+
+    ck_assert_int_eq(buff_pin_batch(hs, 6), 1);
+    ck_assert_int_eq(buff_pool_resident(buff_pool_default(), t), 5);
+    ck_assert_ptr_eq(hs[2].pg, hs[4].pg);
+    ck_assert_int_eq(hs[2].pg->pinned, 2);
+
+    for (int i=0; i<6; i++) {
+        ck_assert_ptr_eq(hs[i].pg, buff_find_pg(t, blks[i]));
+        ck_assert_int_eq(pg_getint(hs[i].pg, 0), (blks[i] - TBL_FIRST_BLK) * tbl_recs_per_blk(t));
+    }
+
+    // Too few frames left for the batch: nothing is pinned, and the
+    // resident pages are left as they were
+    buff_handle more[3] = {{.tbl = t, .blk_no = 10}, {.tbl = t, .blk_no = 5},
+                           {.tbl = t, .blk_no = 11}};
+    ck_assert_int_eq(buff_pin_batch(more, 3), 0);
+    ck_assert_ptr_null(more[0].pg);
+    ck_assert_ptr_null(more[1].pg);
+    ck_assert_int_eq(hs[0].pg->pinned, 1);
+    ck_assert_ptr_null(buff_find_pg(t, 10));
+    ck_assert_ptr_null(buff_find_pg(t, 11));
+
+    // Handles are marked modified and unpinned without a lookup
+    pg_setint(hs[1].pg, 0, -1);
+    ck_assert_int_eq(buff_modified_handle(&hs[1]), 1);
+    page *modified = hs[1].pg;
+
+    buff_unpin_batch(hs, 6);
+    ck_assert_ptr_null(hs[1].pg);
+    ck_assert_int_eq(modified->modified, TRUE);
+    for (int i=0; i<6; i++) ck_assert_int_eq(buff_find_pg(t, blks[i])->pinned, 0);
+    ck_assert_int_eq(buff_modified_handle(&hs[1]), 0);
+
+    // Now there is room, and the modified page is written back on eviction
+    ck_assert_int_eq(buff_pin_batch(more, 3), 1);
+    buff_unpin_batch(more, 3);
+    buff_evict_tbl(t);
+    ck_assert_int_eq(tbl_read(t, tbl_recs_per_blk(t), rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), -1);
+
+    tbl_close(t);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+
 Suite *test_suite()
 {
     Suite *suite = suite_create("pgbuffer");
@@ -242,11 +527,17 @@ Suite *test_suite()
     
     tcase_add_test(basic, initialize_pool);
     tcase_add_test(basic, destroy_pool);
+    tcase_add_test(basic, pool_arena_layout);
     tcase_add_test(basic, pin_page_in_pool);
     tcase_add_test(basic, unpin_page_in_pool);
     tcase_add_test(basic, unpin_page_not_in_pool);
     tcase_add_test(basic, pin_page_not_in_pool);
     tcase_add_test(basic, pin_page_with_full_pool);
+    tcase_add_test(basic, named_pools);
+    tcase_add_test(basic, pool_isolation);
+    tcase_add_test(basic, clock_second_chance);
+    tcase_add_test(basic, dump_and_warm);
+    tcase_add_test(basic, batch_pins);
 
     // TODO: Add stress testing
     TCase *stress = tcase_create("stress");
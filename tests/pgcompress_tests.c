@@ -0,0 +1,225 @@
+/*
+ * pgcompress_tests.c
+ *
+ * A set of unit tests for the functionality of pgcompress.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "pgbuffer.h"
+#include "pgcompress.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// (id INT, grp INT, score FLOAT, name CHAR(12))
+schema item_schema = {
+    .field_cnt = 4,
+    .field_types = {INT, INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 0, 12}
+};
+
+int pool_size = 4;
+int record_cnt = 3000;
+
+
+void fill_record(byte *rec, int id)
+{
+    char name[12];
+    snprintf(name, 12, "item%d", id % 5);
+
+    tp_setint(rec, 0, id);
+    tp_setint(rec, 4, id / 100);
+    tp_setfloat(rec, 8, id * 0.25);
+    tp_setchar(rec, 16, name, 12);
+}
+
+
+/*
+ * Fill a compressed table through a small pool, so that pages are
+ * repeatedly evicted and reloaded, then check every record both before
+ * and after reopening the table.
+ */
+void check_roundtrip(int compression)
+{
+    buff_pool_init(pool_size);
+    table *tbl = tbl_create_compressed("items", "tests/testdb", &item_schema, compression);
+    ck_assert_ptr_nonnull(tbl);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        fill_record(rec, i);
+        ck_assert_int_eq(tbl_insert(tbl, rec), i);
+    }
+
+    for (int pass=0; pass<2; pass++) {
+        for (int i=0; i<record_cnt; i++) {
+            ck_assert_int_eq(tbl_read(tbl, i, rec), 1);
+            ck_assert_int_eq(tp_getasint(rec, 0), i);
+            ck_assert_int_eq(tp_getasint(rec, 4), i / 100);
+            ck_assert(tp_getasfloat(rec, 8) == i * 0.25);
+        }
+
+        if (pass == 0) {
+            long stored = pgc_stored_bytes(tbl);
+            ck_assert_int_eq(tbl_close(tbl), 1);
+
+            tbl = tbl_load("items", "tests/testdb");
+            ck_assert_ptr_nonnull(tbl);
+            ck_assert_int_eq(tbl->compression, compression);
+            ck_assert_int_eq(pgc_stored_bytes(tbl), stored);
+        }
+    }
+
+    char *name = tp_getaschar(rec, 16, 12, NULL);
+    ck_assert_str_eq(name, "item4");
+    free(name);
+
+    if (compression != PGC_NONE) {
+        ck_assert_int_lt(pgc_stored_bytes(tbl), (long) tbl_blk_cnt(tbl) * BLOCKSIZE);
+    }
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+
+
+START_TEST(roundtrip_none)
+{
+    check_roundtrip(PGC_NONE);
+}
+END_TEST
+
+
+START_TEST(roundtrip_light)
+{
+    check_roundtrip(PGC_LIGHT);
+}
+END_TEST
+
+
+START_TEST(roundtrip_lz4)
+{
+    check_roundtrip(PGC_LZ4);
+}
+END_TEST
+
+
+START_TEST(map_written_through)
+{
+    buff_pool_init(pool_size);
+    table *tbl = tbl_create_compressed("items", "tests/testdb", &item_schema, PGC_LIGHT);
+    ck_assert_ptr_nonnull(tbl);
+
+    byte rec[BLOCKSIZE];
+    for (int i=0; i<record_cnt; i++) {
+        fill_record(rec, i);
+        ck_assert_int_eq(tbl_insert(tbl, rec), i);
+    }
+    ck_assert_int_eq(tbl_close(tbl), 1);
+
+    // Scattered ids compress worse than the originals, so the rewritten
+    // pages are moved to new extents as they are evicted.
+    tbl = tbl_load("items", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl);
+    for (int i=0; i<record_cnt; i++) {
+        fill_record(rec, (i * 7919) % 100003);
+        ck_assert_int_eq(tbl_update(tbl, i, rec), 1);
+    }
+    ck_assert_int_ge(buff_evict_tbl(tbl), 0);
+
+    // Without closing the table, a second handle sees every page as it
+    // was written back
+    table *reopened = tbl_load("items", "tests/testdb");
+    ck_assert_ptr_nonnull(reopened);
+    for (int i=0; i<record_cnt; i++) {
+        ck_assert_int_eq(tbl_read(reopened, i, rec), 1);
+        ck_assert_int_eq(tp_getasint(rec, 0), (i * 7919) % 100003);
+    }
+
+    tbl_close(reopened);
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+START_TEST(lz4_codec)
+{
+    byte src[BLOCKSIZE], out[2 * BLOCKSIZE], back[BLOCKSIZE];
+
+    // Repetitive data compresses, including overlapping matches
+    memset(src, 'a', BLOCKSIZE);
+    memcpy(src + 50, "yahi-db yahi-db yahi-db", 23);
+
+    int len = pgc_lz4_compress(src, BLOCKSIZE, out, BLOCKSIZE);
+    ck_assert_int_gt(len, 0);
+    ck_assert_int_lt(len, BLOCKSIZE / 2);
+    ck_assert_int_eq(pgc_lz4_decompress(out, len, back, BLOCKSIZE), BLOCKSIZE);
+    ck_assert_int_eq(memcmp(src, back, BLOCKSIZE), 0);
+
+    // Random data does not fit in fewer bytes than the input
+    srand(42);
+    for (int i=0; i<BLOCKSIZE; i++) src[i] = rand();
+    ck_assert_int_eq(pgc_lz4_compress(src, BLOCKSIZE, out, BLOCKSIZE - 1), 0);
+
+    len = pgc_lz4_compress(src, BLOCKSIZE, out, 2 * BLOCKSIZE);
+    ck_assert_int_gt(len, 0);
+    ck_assert_int_eq(pgc_lz4_decompress(out, len, back, BLOCKSIZE), BLOCKSIZE);
+    ck_assert_int_eq(memcmp(src, back, BLOCKSIZE), 0);
+
+    // Truncated input is rejected
+    ck_assert_int_eq(pgc_lz4_decompress(out, len, back, BLOCKSIZE / 2), -1);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("pgcompress");
+
+    TCase *roundtrip = tcase_create("roundtrip");
+    tcase_add_test(roundtrip, roundtrip_none);
+    tcase_add_test(roundtrip, roundtrip_light);
+    tcase_add_test(roundtrip, roundtrip_lz4);
+    tcase_add_test(roundtrip, map_written_through);
+    suite_add_tcase(suite, roundtrip);
+
+    TCase *codec = tcase_create("codec");
+    tcase_add_test(codec, lz4_codec);
+    suite_add_tcase(suite, codec);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
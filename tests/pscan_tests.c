@@ -0,0 +1,213 @@
+/*
+ * pscan_tests.c
+ *
+ * A set of unit tests for the functionality of pscan.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "pgbuffer.h"
+#include "pscan.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (id INT, val FLOAT)
+schema rec_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, FLOAT},
+    .field_lengths = {0, 0}
+};
+
+int pool_size = 16;
+int record_cnt = 5000;
+table *tbl;
+
+
+typedef struct seen_ctx {
+    char *seen;
+    long rows[PS_MAX_THREADS];
+    double sums[PS_MAX_THREADS];
+    int slow_thread;
+    long limit;
+} seen_ctx;
+
+
+static int mark_seen(batch *b, int thread, void *arg)
+{
+    seen_ctx *ctx = arg;
+
+    for (int i=0; i<b->count; i++) {
+        // Each id belongs to exactly one morsel, so no two threads ever
+        // write the same byte
+        ctx->seen[b->cols[0].ints[i]]++;
+        ctx->sums[thread] += b->cols[1].floats[i];
+    }
+    ctx->rows[thread] += b->count;
+
+    if (thread == ctx->slow_thread) usleep(2000);
+    return ctx->limit == 0 || ctx->rows[thread] < ctx->limit;
+}
+
+
+void setup()
+{
+    buff_pool_init(pool_size);
+    tbl = tbl_create("pscan", "tests/testdb", &rec_schema);
+
+    byte rec[64];
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setfloat(rec, 4, i * 0.5);
+        tbl_insert(tbl, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+
+
+static void check_all_seen(seen_ctx *ctx, ps_stats *stats, int threads)
+{
+    long rows = 0;
+    double sum = 0;
+    for (int t=0; t<threads; t++) {
+        rows += ctx->rows[t];
+        sum += ctx->sums[t];
+    }
+
+    ck_assert_int_eq(rows, record_cnt);
+    ck_assert_int_eq(stats->rows, record_cnt);
+    ck_assert_int_eq(stats->blocks, tbl_blk_cnt(tbl));
+    ck_assert(sum == 0.5 * record_cnt * (record_cnt - 1) / 2);
+
+    for (int i=0; i<record_cnt; i++) {
+        ck_assert_int_eq(ctx->seen[i], 1);
+    }
+}
+
+
+START_TEST(every_row_once)
+{
+    for (int threads=1; threads<=8; threads*=2) {
+        seen_ctx ctx = {.seen = calloc(record_cnt, 1), .slow_thread = -1};
+        ps_opts opts = {.threads = threads, .morsel_blks = 3};
+        ps_stats stats;
+
+        ck_assert_int_eq(ps_run(tbl, &opts, mark_seen, &ctx, &stats), 1);
+        check_all_seen(&ctx, &stats, threads);
+        ck_assert_int_eq(stats.morsels, (tbl_blk_cnt(tbl) + 2) / 3);
+
+        free(ctx.seen);
+    }
+}
+END_TEST
+
+
+START_TEST(idle_threads_steal)
+{
+    // Thread 0 is slowed down, so the others should run out of work of
+    // their own and take over the rest of its morsels
+    seen_ctx ctx = {.seen = calloc(record_cnt, 1), .slow_thread = 0};
+    ps_opts opts = {.threads = 4, .morsel_blks = 2};
+    ps_stats stats;
+
+    ck_assert_int_eq(ps_run(tbl, &opts, mark_seen, &ctx, &stats), 1);
+    check_all_seen(&ctx, &stats, 4);
+    ck_assert_int_gt(stats.stolen, 0);
+    ck_assert_int_lt(ctx.rows[0], record_cnt / 4);
+
+    free(ctx.seen);
+}
+END_TEST
+
+
+START_TEST(pipeline_stops_scan)
+{
+    seen_ctx ctx = {.seen = calloc(record_cnt, 1), .slow_thread = -1, .limit = 100};
+    ps_opts opts = {.threads = 2, .morsel_blks = 4};
+    ps_stats stats;
+
+    ck_assert_int_eq(ps_run(tbl, &opts, mark_seen, &ctx, &stats), 0);
+    ck_assert_int_lt(stats.rows, record_cnt);
+
+    // No pages are left pinned
+    ck_assert_int_ge(buff_evict_tbl(tbl), 0);
+
+    free(ctx.seen);
+}
+END_TEST
+
+
+START_TEST(scan_mapped_table)
+{
+    tbl_close(tbl);
+    tbl = tbl_load_mmap("pscan", "tests/testdb", TBL_ACCESS_SEQUENTIAL);
+    ck_assert_ptr_ne(tbl, NULL);
+
+    seen_ctx ctx = {.seen = calloc(record_cnt, 1), .slow_thread = -1};
+    ps_stats stats;
+
+    ck_assert_int_eq(ps_run(tbl, NULL, mark_seen, &ctx, &stats), 1);
+    check_all_seen(&ctx, &stats, PS_DEFAULT_THREADS);
+
+    free(ctx.seen);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("pscan");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+    tcase_set_timeout(basic, 30);
+
+    tcase_add_test(basic, every_row_once);
+    tcase_add_test(basic, idle_threads_steal);
+    tcase_add_test(basic, pipeline_stops_scan);
+    tcase_add_test(basic, scan_mapped_table);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,246 @@
+/*
+ * roaring_tests.c
+ *
+ * A set of unit tests for the functionality of roaring.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "roaring.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Ids span four chunks of 2^16
+#define RANGE (4 * 65536)
+
+
+/*
+ * Check that rb holds exactly the ids set in expect, through both
+ * rb_contains and iteration.
+ */
+static void check_bitmap(roaring *rb, char *expect)
+{
+    long card = 0;
+    for (uint32_t id=0; id<RANGE; id++) {
+        ck_assert_int_eq(rb_contains(rb, id), expect[id]);
+        card += expect[id];
+    }
+
+    ck_assert_int_eq(rb_cardinality(rb), card);
+
+    rb_iter it;
+    uint32_t ids[100];
+    long seen = 0;
+    uint32_t prev = 0;
+    int n;
+
+    rb_iter_init(&it, rb);
+    while ((n = rb_iter_next(&it, ids, 100)) > 0) {
+        for (int i=0; i<n; i++) {
+            ck_assert(expect[ids[i]]);
+            if (seen > 0) ck_assert(ids[i] > prev);
+            prev = ids[i];
+            seen++;
+        }
+    }
+
+    ck_assert_int_eq(seen, card);
+}
+
+
+/*
+ * Fill a bitmap with a mix of densities: a sparse chunk, a dense chunk,
+ * an empty chunk, and one on the boundary between the two kinds.
+ */
+static roaring *fill(char *expect, unsigned int seed)
+{
+    roaring *rb = rb_create();
+    memset(expect, 0, RANGE);
+
+    for (int i=0; i<500; i++) expect[rand_r(&seed) % 65536] = 1;
+    for (int i=0; i<40000; i++) expect[65536 + rand_r(&seed) % 65536] = 1;
+    for (int i=0; i<RB_ARRAY_MAX; i++) expect[3 * 65536 + i * 16 + seed % 16] = 1;
+
+    for (uint32_t id=0; id<RANGE; id++) {
+        if (expect[id]) ck_assert_int_eq(rb_add(rb, id), 1);
+    }
+
+    return rb;
+}
+
+
+START_TEST(add_remove)
+{
+    char *expect = malloc(RANGE);
+    roaring *rb = fill(expect, 1);
+
+    ck_assert_int_eq(rb->cnt, 3);
+    ck_assert_int_eq(rb->cs[0].type, RB_ARRAY);
+    ck_assert_int_eq(rb->cs[1].type, RB_BITMAP);
+    ck_assert_int_eq(rb->cs[2].type, RB_ARRAY);
+    ck_assert_int_eq(rb->cs[2].card, RB_ARRAY_MAX);
+    check_bitmap(rb, expect);
+
+    // One more id turns the full array into a bitmap, and removing it
+    // turns it back
+    uint32_t extra = 3 * 65536 + 65535;
+    ck_assert_int_eq(rb_add(rb, extra), 1);
+    ck_assert_int_eq(rb->cs[2].type, RB_BITMAP);
+    ck_assert_int_eq(rb_add(rb, extra), 1);
+    ck_assert_int_eq(rb->cs[2].card, RB_ARRAY_MAX + 1);
+
+    ck_assert_int_eq(rb_remove(rb, extra), 1);
+    ck_assert_int_eq(rb_remove(rb, extra), 0);
+    ck_assert_int_eq(rb->cs[2].type, RB_ARRAY);
+    check_bitmap(rb, expect);
+
+    // Emptying a chunk removes its container
+    for (uint32_t id=0; id<65536; id++) {
+        if (expect[id]) ck_assert_int_eq(rb_remove(rb, id), 1);
+        expect[id] = 0;
+    }
+    ck_assert_int_eq(rb->cnt, 2);
+    check_bitmap(rb, expect);
+
+    roaring *copy = rb_copy(rb);
+    rb_free(rb);
+    check_bitmap(copy, expect);
+
+    rb_free(copy);
+    free(expect);
+}
+END_TEST
+
+
+START_TEST(set_operations)
+{
+    char *ea = malloc(RANGE), *eb = malloc(RANGE), *expect = malloc(RANGE);
+    roaring *a = fill(ea, 1);
+    roaring *b = fill(eb, 2);
+
+    // Give b a dense chunk where a has a sparse one, and vice versa
+    for (int i=0; i<30000; i++) {
+        uint32_t id = (i * 7) % 65536;
+        rb_add(b, id);
+        eb[id] = 1;
+    }
+
+    roaring *r = rb_and(a, b);
+    for (int i=0; i<RANGE; i++) expect[i] = ea[i] && eb[i];
+    check_bitmap(r, expect);
+    rb_free(r);
+
+    r = rb_or(a, b);
+    for (int i=0; i<RANGE; i++) expect[i] = ea[i] || eb[i];
+    check_bitmap(r, expect);
+    rb_free(r);
+
+    r = rb_andnot(a, b);
+    for (int i=0; i<RANGE; i++) expect[i] = ea[i] && !eb[i];
+    check_bitmap(r, expect);
+    rb_free(r);
+
+    r = rb_andnot(b, a);
+    for (int i=0; i<RANGE; i++) expect[i] = eb[i] && !ea[i];
+    check_bitmap(r, expect);
+    rb_free(r);
+
+    // The complement, up to a bound in the middle of a chunk
+    uint32_t n = 2 * 65536 + 1000;
+    r = rb_not(a, n);
+    for (uint32_t i=0; i<RANGE; i++) expect[i] = i < n && !ea[i];
+    check_bitmap(r, expect);
+    rb_free(r);
+
+    // The operands are unchanged
+    check_bitmap(a, ea);
+    check_bitmap(b, eb);
+
+    rb_free(a);
+    rb_free(b);
+    free(ea);
+    free(eb);
+    free(expect);
+}
+END_TEST
+
+
+START_TEST(serialization)
+{
+    char *expect = malloc(RANGE);
+    roaring *rb = fill(expect, 3);
+
+    long size = rb_serialized_size(rb);
+    byte *buf = malloc(size);
+    rb_serialize(rb, buf);
+
+    roaring *back = rb_deserialize(buf, size);
+    ck_assert_ptr_nonnull(back);
+    check_bitmap(back, expect);
+
+    // Truncated or corrupt input is refused
+    ck_assert_ptr_null(rb_deserialize(buf, size - 1));
+    buf[sizeof(int) + 2] = 7;
+    ck_assert_ptr_null(rb_deserialize(buf, size));
+
+    roaring *empty = rb_create();
+    rb_serialize(empty, buf);
+    rb_free(back);
+    back = rb_deserialize(buf, rb_serialized_size(empty));
+    ck_assert_int_eq(rb_cardinality(back), 0);
+
+    rb_free(empty);
+    rb_free(back);
+    rb_free(rb);
+    free(buf);
+    free(expect);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("roaring");
+
+    TCase *basic = tcase_create("basic");
+    tcase_set_timeout(basic, 30);
+
+    tcase_add_test(basic, add_remove);
+    tcase_add_test(basic, set_operations);
+    tcase_add_test(basic, serialization);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
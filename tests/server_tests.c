@@ -0,0 +1,353 @@
+/*
+ * server_tests.c
+ *
+ * A set of unit tests for the functionality of server.c and client.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "client.h"
+#include "pgbuffer.h"
+#include "server.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SOCK "tests/testdb/yahid.sock"
+#define DB "tests/testdb"
+
+#define THREADS 4
+#define PER_THREAD 2000
+#define WINDOW 64
+
+// (id INT, name CHAR(12))
+schema rec_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 12}
+};
+
+server *srv;
+
+
+void setup()
+{
+    buff_pool_init(16);
+    srv = srv_start(SOCK, DB, NULL);
+    ck_assert_ptr_nonnull(srv);
+}
+
+
+void teardown()
+{
+    srv_stop(srv);
+    buff_pool_destroy();
+}
+
+
+START_TEST(pipelined_requests)
+{
+    srv_client *cli = cli_connect(SOCK);
+    ck_assert_ptr_nonnull(cli);
+
+    int rec_len;
+    int tbl = cli_create(cli, "srv", &rec_schema, &rec_len);
+    ck_assert_int_eq(tbl, 0);
+    ck_assert_int_eq(rec_len, 16);
+
+    // Send every insert before reading any of the responses
+    byte rec[16] = {0};
+    uint32_t ids[1000];
+    for (int i=0; i<1000; i++) {
+        tp_setint(rec, 0, i);
+        tp_setchar(rec, 4, "pipelined", 12);
+        ids[i] = cli_queue(cli, SRV_INSERT, tbl, rec, rec_len, NULL, 0);
+    }
+    cli_queue(cli, SRV_PING, 0, NULL, 0, NULL, 0);
+    ck_assert_int_eq(cli_flush(cli), 1);
+
+    srv_resp resp;
+    char *payload;
+    for (int i=0; i<1000; i++) {
+        ck_assert_int_eq(cli_recv(cli, &resp, &payload), 1);
+        ck_assert_uint_eq(resp.id, ids[i]);
+        ck_assert_int_eq(resp.status, i);
+        ck_assert_uint_eq(resp.len, 0);
+    }
+
+    ck_assert_int_eq(cli_recv(cli, &resp, &payload), 1);
+    ck_assert_int_eq(resp.status, 0);
+    ck_assert_int_eq(cli_buffered(cli), FALSE);
+
+    // Far fewer writes than responses
+    srv_stats stats;
+    srv_stats_get(srv, &stats);
+    ck_assert_int_eq(stats.requests, 1002);
+    ck_assert_int_lt(stats.batches, 100);
+
+    ck_assert_int_eq(cli_read(cli, tbl, 321, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 321);
+    ck_assert_int_eq(cli_read(cli, tbl, 1000, rec), 0);
+
+    // A call answers its own request, not one pipelined ahead of it
+    cli_queue(cli, SRV_PING, 0, NULL, 0, NULL, 0);
+    ck_assert_int_eq(cli_flush(cli), 1);
+    cli_queue(cli, SRV_READ, tbl, &(uint32_t) {1000}, sizeof(uint32_t), NULL, 0);
+    ck_assert_int_eq(cli_read(cli, tbl, 322, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 322);
+    ck_assert_int_eq(cli_buffered(cli), FALSE);
+
+    tp_setchar(rec, 4, "updated", 12);
+    ck_assert_int_eq(cli_update(cli, tbl, 321, rec, rec_len), 1);
+    ck_assert_int_eq(cli_update(cli, tbl, 5000, rec, rec_len), 0);
+
+    // Another connection shares the open table
+    srv_client *other = cli_connect(SOCK);
+    ck_assert_int_eq(cli_open(other, "srv", &rec_len), tbl);
+
+    byte read[16];
+    ck_assert_int_eq(cli_read(other, tbl, 321, read), 1);
+    ck_assert_int_eq(memcmp(read, rec, rec_len), 0);
+
+    cli_close(other);
+    cli_close(cli);
+}
+END_TEST
+
+
+START_TEST(bad_requests)
+{
+    srv_client *cli = cli_connect(SOCK);
+    srv_resp resp;
+    char *payload;
+
+    ck_assert_int_eq(cli_open(cli, "missing", NULL), SRV_ERR);
+    ck_assert_int_eq(cli_open(cli, "../escape", NULL), SRV_EPROTO);
+
+    int tbl = cli_create(cli, "srv", &rec_schema, NULL);
+    ck_assert_int_ge(tbl, 0);
+    ck_assert_int_eq(cli_create(cli, "srv", &rec_schema, NULL), SRV_ERR);
+
+    schema bad = {.field_cnt = 1, .field_types = {7}};
+    ck_assert_int_eq(cli_create(cli, "bad", &bad, NULL), SRV_EPROTO);
+
+    byte rec[16] = {0};
+    ck_assert_int_eq(cli_insert(cli, tbl + 1, rec, 16), SRV_ENOTBL);
+    ck_assert_int_eq(cli_insert(cli, tbl, rec, 15), SRV_EPROTO);
+    ck_assert_int_eq(cli_read(cli, tbl + 1, 0, rec), SRV_ENOTBL);
+
+    cli_queue(cli, 99, 0, NULL, 0, NULL, 0);
+    cli_flush(cli);
+    ck_assert_int_eq(cli_recv(cli, &resp, &payload), 1);
+    ck_assert_int_eq(resp.status, SRV_EPROTO);
+
+    // Errors leave the connection usable...
+    ck_assert_int_eq(cli_insert(cli, tbl, rec, 16), 0);
+
+    // ...but an oversized request closes it
+    srv_req huge = {.len = SRV_MAX_PAYLOAD + 1, .id = 1, .op = SRV_PING};
+    ck_assert_int_eq(write(cli->fd, &huge, sizeof(huge)), sizeof(huge));
+    ck_assert_int_eq(cli_recv(cli, &resp, &payload), 0);
+
+    cli_close(cli);
+}
+END_TEST
+
+
+typedef struct client_arg {
+    int thread;
+    int tbl;
+    int rids[PER_THREAD];
+    int errors;
+} client_arg;
+
+
+static void *client_worker(void *arg)
+{
+    client_arg *c = arg;
+    srv_client *cli = cli_connect(SOCK);
+    byte rec[16] = {0};
+    srv_resp resp;
+    char *payload;
+
+    // Keep a window of requests outstanding
+    int sent = 0, done = 0;
+    while (done < PER_THREAD) {
+        while (sent < PER_THREAD && sent - done < WINDOW) {
+            tp_setint(rec, 0, c->thread * PER_THREAD + sent++);
+            cli_queue(cli, SRV_INSERT, c->tbl, rec, 16, NULL, 0);
+        }
+
+        if (!cli_flush(cli) || !cli_recv(cli, &resp, &payload)) {
+            c->errors++;
+            break;
+        }
+
+        c->rids[done++] = resp.status;
+    }
+
+    // Read back what was inserted, pipelined
+    for (int i=0; i<PER_THREAD; i++) {
+        uint32_t rid = c->rids[i];
+        cli_queue(cli, SRV_READ, c->tbl, &rid, sizeof(rid), NULL, 0);
+    }
+    cli_flush(cli);
+
+    for (int i=0; i<PER_THREAD; i++) {
+        if (!cli_recv(cli, &resp, &payload) || resp.status != 1 ||
+                tp_getasint(payload, 0) != c->thread * PER_THREAD + i) {
+            c->errors++;
+        }
+    }
+
+    cli_close(cli);
+    return NULL;
+}
+
+
+START_TEST(concurrent_clients)
+{
+    srv_client *cli = cli_connect(SOCK);
+    int tbl = cli_create(cli, "srv", &rec_schema, NULL);
+
+    pthread_t tids[THREADS];
+    client_arg *args = calloc(THREADS, sizeof(client_arg));
+    for (int t=0; t<THREADS; t++) {
+        args[t].thread = t;
+        args[t].tbl = tbl;
+        pthread_create(&tids[t], NULL, client_worker, &args[t]);
+    }
+
+    // Every record id is handed out once
+    char *seen = calloc(THREADS * PER_THREAD, 1);
+    for (int t=0; t<THREADS; t++) {
+        pthread_join(tids[t], NULL);
+        ck_assert_int_eq(args[t].errors, 0);
+
+        for (int i=0; i<PER_THREAD; i++) {
+            int rid = args[t].rids[i];
+            ck_assert(rid >= 0 && rid < THREADS * PER_THREAD && !seen[rid]);
+            seen[rid] = 1;
+        }
+    }
+
+    srv_stats stats;
+    srv_stats_get(srv, &stats);
+    ck_assert_int_eq(stats.connections, THREADS + 1);
+
+    free(seen);
+    free(args);
+    cli_close(cli);
+}
+END_TEST
+
+
+START_TEST(concurrent_tables)
+{
+    srv_client *cli = cli_connect(SOCK);
+
+    // A table apiece, each of them many times the size of the pool, so
+    // that every client's inserts evict the others' pages
+    pthread_t tids[THREADS];
+    client_arg *args = calloc(THREADS, sizeof(client_arg));
+    for (int t=0; t<THREADS; t++) {
+        char name[16];
+        snprintf(name, sizeof(name), "srv%d", t);
+
+        args[t].thread = t;
+        args[t].tbl = cli_create(cli, name, &rec_schema, NULL);
+        ck_assert_int_ge(args[t].tbl, 0);
+        pthread_create(&tids[t], NULL, client_worker, &args[t]);
+    }
+
+    for (int t=0; t<THREADS; t++) {
+        pthread_join(tids[t], NULL);
+        ck_assert_int_eq(args[t].errors, 0);
+
+        for (int i=0; i<PER_THREAD; i++) ck_assert_int_eq(args[t].rids[i], i);
+    }
+
+    free(args);
+    cli_close(cli);
+}
+END_TEST
+
+
+START_TEST(restart)
+{
+    srv_client *cli = cli_connect(SOCK);
+    int tbl = cli_create(cli, "srv", &rec_schema, NULL);
+
+    byte rec[16] = {0};
+    tp_setint(rec, 0, 77);
+    ck_assert_int_eq(cli_insert(cli, tbl, rec, 16), 0);
+
+    // Stopping the server closes its tables, and its clients' connections
+    srv_stop(srv);
+    ck_assert_int_eq(cli_read(cli, tbl, 0, rec), SRV_ERR);
+    cli_close(cli);
+
+    srv = srv_start(SOCK, DB, NULL);
+    cli = cli_connect(SOCK);
+    tbl = cli_open(cli, "srv", NULL);
+    ck_assert_int_eq(tbl, 0);
+    ck_assert_int_eq(cli_read(cli, tbl, 0, rec), 1);
+    ck_assert_int_eq(tp_getasint(rec, 0), 77);
+
+    cli_close(cli);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("server");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+    tcase_set_timeout(basic, 30);
+
+    tcase_add_test(basic, pipelined_requests);
+    tcase_add_test(basic, bad_requests);
+    tcase_add_test(basic, concurrent_clients);
+    tcase_add_test(basic, concurrent_tables);
+    tcase_add_test(basic, restart);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,331 @@
+/*
+ * ssdcache_tests.c
+ *
+ * A set of unit tests for the functionality of ssdcache.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "page.h"
+#include "pgbuffer.h"
+#include "ssdcache.h"
+#include "stats.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_PATH "tests/testdb/ssd.cache"
+#define BLOCKS 40
+
+// Stand-ins for tables, which the cache only uses as keys
+table tbl_a, tbl_b;
+
+
+static void fill_blk(byte *data, table *tbl, int blk_no)
+{
+    for (int i=0; i<BLOCKSIZE; i++) data[i] = (byte) (blk_no * 7 + i + (tbl == &tbl_b));
+}
+
+
+/*
+ * Check that every block the directory holds reads back as written, and
+ * that the slot accounting adds up.
+ */
+static void check_cache(sc_cache *cache)
+{
+    byte data[BLOCKSIZE], expect[BLOCKSIZE];
+    int used = 0;
+
+    for (int s=0; s<cache->slots; s++) {
+        sc_tag t = cache->tags[s];
+        if (!t.tbl) continue;
+
+        used++;
+        ck_assert(sc_contains(cache, t.tbl, t.blk_no));
+        ck_assert_int_eq(sc_read(cache, t.tbl, t.blk_no, data), 1);
+        fill_blk(expect, t.tbl, t.blk_no);
+        ck_assert_int_eq(memcmp(data, expect, BLOCKSIZE), 0);
+    }
+
+    ck_assert_int_eq(used + cache->free_cnt, cache->slots);
+}
+
+
+START_TEST(directory)
+{
+    sc_cache *cache = sc_create(CACHE_PATH, 16, SC_ADMIT_ALL);
+    ck_assert_ptr_nonnull(cache);
+    ck_assert_int_eq(access(CACHE_PATH, F_OK), 0);
+
+    byte data[BLOCKSIZE];
+    unsigned int seed = 11;
+
+    // A random mix of admissions, reads and invalidations, with far more
+    // blocks than slots, so that slots and directory entries are reused
+    for (int op=0; op<20000; op++) {
+        table *tbl = (rand_r(&seed) % 2) ? &tbl_a : &tbl_b;
+        int blk_no = rand_r(&seed) % 64;
+
+        switch (rand_r(&seed) % 4) {
+            case 0:
+            case 1:
+                fill_blk(data, tbl, blk_no);
+                ck_assert_int_eq(sc_admit(cache, tbl, blk_no, data), 1);
+                ck_assert(sc_contains(cache, tbl, blk_no));
+                break;
+            case 2:
+                sc_read(cache, tbl, blk_no, data);
+                break;
+            case 3:
+                sc_invalidate(cache, tbl, blk_no);
+                ck_assert(!sc_contains(cache, tbl, blk_no));
+                break;
+        }
+
+        if (op % 1000 == 0) check_cache(cache);
+    }
+
+    check_cache(cache);
+    ck_assert_int_gt(cache->evictions, 0);
+    ck_assert_int_gt(cache->hits, 0);
+
+    // Dropping a table leaves the other's blocks alone
+    int free_cnt = cache->free_cnt;
+    int dropped = sc_invalidate_tbl(cache, &tbl_a);
+    for (int s=0; s<cache->slots; s++) ck_assert_ptr_ne(cache->tags[s].tbl, &tbl_a);
+    ck_assert_int_eq(cache->free_cnt, free_cnt + dropped);
+    check_cache(cache);
+
+    sc_free(cache);
+    ck_assert_int_ne(access(CACHE_PATH, F_OK), 0);
+
+    ck_assert_ptr_null(sc_create(CACHE_PATH, 0, SC_ADMIT_ALL));
+    ck_assert_ptr_null(sc_create(CACHE_PATH, 4, 7));
+}
+END_TEST
+
+
+START_TEST(admission)
+{
+    sc_cache *cache = sc_create(CACHE_PATH, 4, SC_ADMIT_REPEAT);
+    byte data[BLOCKSIZE];
+
+    // Admitted freely while there is room
+    for (int b=0; b<4; b++) {
+        fill_blk(data, &tbl_a, b);
+        ck_assert_int_eq(sc_admit(cache, &tbl_a, b, data), 1);
+    }
+
+    // Once full, a block is only admitted when offered a second time...
+    fill_blk(data, &tbl_a, 10);
+    ck_assert_int_eq(sc_admit(cache, &tbl_a, 10, data), 0);
+    ck_assert_int_eq(cache->rejects, 1);
+    ck_assert(!sc_contains(cache, &tbl_a, 10));
+    ck_assert_int_eq(sc_admit(cache, &tbl_a, 10, data), 1);
+    ck_assert(sc_contains(cache, &tbl_a, 10));
+    ck_assert_int_eq(cache->evictions, 1);
+
+    // ...and a block read since the clock last passed is passed over
+    ck_assert(!sc_contains(cache, &tbl_a, 0));
+    ck_assert_int_eq(sc_read(cache, &tbl_a, 1, data), 1);
+    fill_blk(data, &tbl_a, 11);
+    ck_assert_int_eq(sc_admit(cache, &tbl_a, 11, data), 0);
+    ck_assert_int_eq(sc_admit(cache, &tbl_a, 11, data), 1);
+    ck_assert(sc_contains(cache, &tbl_a, 1));
+    ck_assert(!sc_contains(cache, &tbl_a, 2));
+    ck_assert(sc_contains(cache, &tbl_a, 11));
+
+    // A one-off pass over many blocks leaves the cache as it was
+    for (int b=100; b<200; b++) {
+        fill_blk(data, &tbl_b, b);
+        ck_assert_int_eq(sc_admit(cache, &tbl_b, b, data), 0);
+    }
+    ck_assert(sc_contains(cache, &tbl_a, 10));
+    ck_assert(sc_contains(cache, &tbl_a, 11));
+    check_cache(cache);
+
+    sc_free(cache);
+}
+END_TEST
+
+
+static table *make_table(char *name)
+{
+    schema sch = {.field_cnt = 1, .field_types = {INT}, .field_lengths = {0}};
+    table *t = tbl_create(name, "tests/testdb", &sch);
+    ck_assert_ptr_nonnull(t);
+
+    byte rec[sizeof(int)];
+    for (int i=0; i<BLOCKS * tbl_recs_per_blk(t); i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(t, rec);
+    }
+
+    buff_evict_tbl(t);
+    return t;
+}
+
+
+static void scan_blocks(table *t)
+{
+    for (int b=TBL_FIRST_BLK; b<TBL_FIRST_BLK + BLOCKS; b++) {
+        page *pg = buff_pin(t, b);
+        ck_assert_ptr_nonnull(pg);
+        ck_assert_int_eq(pg_getint(pg, 0), (b - TBL_FIRST_BLK) * tbl_recs_per_blk(t));
+        buff_unpin(t, b);
+    }
+}
+
+
+START_TEST(second_tier)
+{
+    buff_pool_init(4);
+    buff_pool *pool = buff_pool_default();
+    table *t = make_table("ssdcache");
+
+    sc_cache *cache = sc_create(CACHE_PATH, 2 * BLOCKS, SC_ADMIT_REPEAT);
+    ck_assert_int_eq(buff_pool_set_cache(pool, cache), 1);
+
+    // The first pass reads from the table, and leaves all but the pages
+    // still in the pool in the cache; the second is served from it
+    stat_reset();
+    scan_blocks(t);
+    ck_assert_int_eq(cache->hits, 0);
+    ck_assert_int_eq(cache->admits, BLOCKS - 4);
+
+    scan_blocks(t);
+    ck_assert_int_eq(cache->hits, BLOCKS);
+    ck_assert_int_eq(cache->admits, BLOCKS);
+
+    // Pages evicted unchanged are already cached, and not written again
+    scan_blocks(t);
+    ck_assert_int_eq(cache->hits, 2 * BLOCKS);
+    ck_assert_int_eq(cache->admits, BLOCKS);
+
+    stat_snapshot snap;
+    stat_tier tiers[STAT_TIER_CNT];
+    stat_snapshot_get(&snap);
+    stat_tiers(&snap, tiers);
+
+#ifndef YAHI_NO_STATS
+    ck_assert_int_eq(tiers[STAT_TIER_POOL].lookups, 3 * BLOCKS);
+    ck_assert_int_eq(tiers[STAT_TIER_CACHE].lookups, 3 * BLOCKS);
+    ck_assert_int_eq(tiers[STAT_TIER_CACHE].hits, 2 * BLOCKS);
+    ck_assert_int_eq(tiers[STAT_TIER_DISK].lookups, BLOCKS);
+    ck_assert_double_eq(tiers[STAT_TIER_DISK].hit_ratio, 1.0);
+    ck_assert_int_eq(snap.hists[STAT_HIST_CACHE_READ].total, cache->hits);
+#endif
+
+    // A page modified in the pool is written back on eviction, and its
+    // stale copy dropped, so that the change is read back from the table
+    page *pg = buff_pin(t, TBL_FIRST_BLK);
+    pg_setint(pg, 0, -5);
+    buff_modified(t, TBL_FIRST_BLK);
+    buff_unpin(t, TBL_FIRST_BLK);
+    ck_assert(sc_contains(cache, t, TBL_FIRST_BLK));
+
+    for (int b=TBL_FIRST_BLK + 1; b<TBL_FIRST_BLK + 9; b++) {
+        buff_pin(t, b);
+        buff_unpin(t, b);
+    }
+    ck_assert_ptr_null(buff_find_pg(t, TBL_FIRST_BLK));
+    ck_assert(!sc_contains(cache, t, TBL_FIRST_BLK));
+
+    pg = buff_pin(t, TBL_FIRST_BLK);
+    ck_assert_int_eq(pg_getint(pg, 0), -5);
+    buff_unpin(t, TBL_FIRST_BLK);
+
+    // So is one written back by buff_flush, which is then evicted clean
+    for (int b=TBL_FIRST_BLK + 1; b<TBL_FIRST_BLK + 9; b++) {
+        buff_pin(t, b);
+        buff_unpin(t, b);
+    }
+    ck_assert(sc_contains(cache, t, TBL_FIRST_BLK));
+
+    pg = buff_pin(t, TBL_FIRST_BLK);
+    pg_setint(pg, 0, -7);
+    buff_modified(t, TBL_FIRST_BLK);
+    buff_flush(pg);
+    buff_unpin(t, TBL_FIRST_BLK);
+    ck_assert(!sc_contains(cache, t, TBL_FIRST_BLK));
+
+    for (int b=TBL_FIRST_BLK + 1; b<TBL_FIRST_BLK + 9; b++) {
+        buff_pin(t, b);
+        buff_unpin(t, b);
+    }
+    ck_assert_ptr_null(buff_find_pg(t, TBL_FIRST_BLK));
+
+    pg = buff_pin(t, TBL_FIRST_BLK);
+    ck_assert_int_eq(pg_getint(pg, 0), -7);
+    buff_unpin(t, TBL_FIRST_BLK);
+
+    // Batch pins look in the cache too
+    long hits = cache->hits;
+    buff_handle hs[3] = {{.tbl = t, .blk_no = 20}, {.tbl = t, .blk_no = 21},
+                         {.tbl = t, .blk_no = 20}};
+    ck_assert_int_eq(buff_pin_batch(hs, 3), 1);
+    ck_assert_int_eq(cache->hits, hits + 2);
+    ck_assert_ptr_eq(hs[0].pg, hs[2].pg);
+    ck_assert_int_eq(pg_getint(hs[1].pg, 0), (21 - TBL_FIRST_BLK) * tbl_recs_per_blk(t));
+    buff_unpin_batch(hs, 3);
+
+    // Closing the table drops its blocks
+    tbl_close(t);
+    ck_assert_int_eq(cache->free_cnt, cache->slots);
+
+    // A cache which has held pages can't be attached again
+    ck_assert_int_eq(buff_pool_set_cache(pool, NULL), 1);
+    ck_assert_int_eq(buff_pool_set_cache(pool, cache), 0);
+
+    sc_free(cache);
+    buff_pool_destroy();
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("ssdcache");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_test(basic, directory);
+    tcase_add_test(basic, admission);
+    tcase_add_test(basic, second_tier);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main()
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
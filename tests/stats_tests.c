@@ -0,0 +1,195 @@
+/*
+ * stats_tests.c
+ *
+ * A set of unit tests for the functionality of stats.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "pgbuffer.h"
+#include "stats.h"
+#include "table.h"
+#include "types.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// (id INT, pad CHAR(46))
+schema wide_schema = {
+    .field_cnt = 2,
+    .field_types = {INT, CHAR},
+    .field_lengths = {0, 46}
+};
+
+
+START_TEST(hist_buckets)
+{
+    // Small values are exact, and larger ones are within 1/16th
+    for (long v=0; v<16; v++) {
+        ck_assert_int_eq(stat_hist_bucket_max(stat_hist_bucket(v)), v);
+    }
+
+    for (long v=16; v<(1L << 30); v = v * 3 + 1) {
+        int b = stat_hist_bucket(v);
+        long hi = stat_hist_bucket_max(b);
+        long lo = (b > 0) ? stat_hist_bucket_max(b - 1) + 1 : 0;
+
+        ck_assert_int_ge(v, lo);
+        ck_assert_int_le(v, hi);
+        ck_assert_int_le(hi - lo, v / 16 + 1);
+    }
+
+    ck_assert_int_eq(stat_hist_bucket(1L << 50), STAT_HIST_BUCKETS - 1);
+
+    stat_hist hist = {0};
+    for (long v=1; v<=100; v++) {
+        hist.counts[stat_hist_bucket(v * 1000)]++;
+        hist.total++;
+        hist.sum += v * 1000;
+    }
+
+    ck_assert_double_eq_tol(stat_hist_mean(&hist), 50500.0, 1e-9);
+    long p50 = stat_hist_percentile(&hist, 50);
+    ck_assert_int_ge(p50, 50000);
+    ck_assert_int_le(p50, 50000 + 50000 / 16);
+    ck_assert_int_ge(stat_hist_percentile(&hist, 100), 100000);
+}
+END_TEST
+
+
+#ifndef YAHI_NO_STATS
+START_TEST(pool_counters)
+{
+    buff_pool_init(4);
+    table *tbl = tbl_create("stats", "tests/testdb", &wide_schema);
+    ck_assert_ptr_nonnull(tbl);
+
+    stat_reset();
+    stat_tbl_reset(tbl);
+
+    // 12 blocks of 4 records each, through a 4 frame pool
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<48; i++) {
+        tp_setint(rec, 0, i);
+        tbl_insert(tbl, rec);
+    }
+
+    stat_snapshot snap;
+    long tbl_counters[STAT_TBL_CNT];
+    stat_snapshot_get(&snap);
+    stat_tbl_get(tbl, tbl_counters);
+
+    ck_assert_int_eq(snap.counters[STAT_HITS] + snap.counters[STAT_MISSES], 48);
+    ck_assert_int_eq(snap.counters[STAT_MISSES], 12);
+    // Every evicted page was dirty, and at most 4 of the 12 never left
+    ck_assert_int_ge(snap.counters[STAT_EVICTIONS], 8);
+    ck_assert_int_le(snap.counters[STAT_EVICTIONS], 11);
+    ck_assert_int_eq(snap.counters[STAT_WRITEBACKS], snap.counters[STAT_EVICTIONS]);
+    ck_assert_int_eq(snap.hists[STAT_HIST_PIN_WAIT].total, 12);
+    ck_assert_int_ge(snap.counters[STAT_BLK_WRITES], 12 + 8);
+    ck_assert_int_eq(snap.hists[STAT_HIST_WRITE].total, snap.counters[STAT_BLK_WRITES]);
+
+    for (int c=0; c<STAT_TBL_CNT; c++) {
+        ck_assert_int_eq(tbl_counters[c], snap.counters[c]);
+    }
+
+    // Reset zeroes later snapshots, but not the table's counters
+    stat_reset();
+    stat_snapshot_get(&snap);
+    ck_assert_int_eq(snap.counters[STAT_MISSES], 0);
+    ck_assert_int_eq(snap.hists[STAT_HIST_PIN_WAIT].total, 0);
+
+    stat_tbl_get(tbl, tbl_counters);
+    ck_assert_int_eq(tbl_counters[STAT_MISSES], 12);
+
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+END_TEST
+#endif
+
+
+void *count_reads(void *arg)
+{
+    long n = (long) arg;
+    for (long i=0; i<n; i++) {
+        stat_add(STAT_BLK_READS, 1);
+        stat_record(STAT_HIST_READ, 100);
+    }
+
+    return NULL;
+}
+
+
+START_TEST(thread_aggregation)
+{
+    stat_reset();
+
+    // Counts from exited threads must survive in later snapshots
+    pthread_t threads[4];
+    for (long t=0; t<4; t++) {
+        pthread_create(&threads[t], NULL, count_reads, (void *) (1000 * (t + 1)));
+    }
+
+    for (int t=0; t<4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    count_reads((void *) 10);
+
+    stat_snapshot snap;
+    stat_snapshot_get(&snap);
+    ck_assert_int_eq(snap.counters[STAT_BLK_READS], 10010);
+    ck_assert_int_eq(snap.hists[STAT_HIST_READ].total, 10010);
+    ck_assert_int_eq(snap.hists[STAT_HIST_READ].counts[stat_hist_bucket(100)], 10010);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("stats");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_test(basic, hist_buckets);
+    tcase_add_test(basic, thread_aggregation);
+    suite_add_tcase(suite, basic);
+
+#ifndef YAHI_NO_STATS
+    TCase *pool = tcase_create("pool");
+    tcase_add_test(pool, pool_counters);
+    suite_add_tcase(suite, pool);
+#endif
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
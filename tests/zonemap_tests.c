@@ -0,0 +1,277 @@
+/*
+ * zonemap_tests.c
+ *
+ * A set of unit tests for the functionality of zonemap.c .
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "exec.h"
+#include "pgbuffer.h"
+#include "table.h"
+#include "types.h"
+#include "zonemap.h"
+
+#include <check.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (ts INT, val FLOAT, tag CHAR(8)), 10 records per block
+schema event_schema = {
+    .field_cnt = 3,
+    .field_types = {INT, FLOAT, CHAR},
+    .field_lengths = {0, 0, 8}
+};
+
+int pool_size = 8;
+int record_cnt = 2000;
+table *tbl;
+
+
+void setup()
+{
+    buff_pool_init(pool_size);
+    tbl = tbl_create("events", "tests/testdb", &event_schema);
+
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<record_cnt; i++) {
+        tp_setint(rec, 0, i);
+        tp_setfloat(rec, 4, (i % 10) * 1.5);
+        tp_setchar(rec, 12, "ev", 8);
+        tbl_insert(tbl, rec);
+    }
+}
+
+
+void teardown()
+{
+    tbl_close(tbl);
+    buff_pool_destroy();
+}
+
+
+/*
+ * Count the rows passing ts >= lo AND ts < hi, returning the number of
+ * blocks the scan skipped through skipped.
+ */
+int count_range(int lo, int hi, long *skipped)
+{
+    exec_op *scan = exec_scan(tbl);
+    exec_op *op = exec_filter_int(scan, 0, CMP_GE, lo);
+    op = exec_filter_int(op, 0, CMP_LT, hi);
+
+    int rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) {
+        for (int i=0; i<b->count; i++) {
+            ck_assert_int_ge(b->cols[0].ints[i], lo);
+            ck_assert_int_lt(b->cols[0].ints[i], hi);
+        }
+        rows += b->count;
+    }
+
+    *skipped = exec_scan_skipped(scan);
+    exec_close(op);
+
+    return rows;
+}
+
+
+START_TEST(block_bounds)
+{
+    zone_map *zm = tbl->zmap;
+    ck_assert_ptr_nonnull(zm);
+    ck_assert_int_eq(zm->blk_cnt, tbl_blk_cnt(tbl));
+
+    // Block 3 holds ts 20..29
+    ck_assert(zm_may_match(zm, 3, 0, CMP_EQ, 25));
+    ck_assert(!zm_may_match(zm, 3, 0, CMP_EQ, 30));
+    ck_assert(!zm_may_match(zm, 3, 0, CMP_LT, 20));
+    ck_assert(zm_may_match(zm, 3, 0, CMP_LE, 20));
+    ck_assert(!zm_may_match(zm, 3, 0, CMP_GT, 29));
+    ck_assert(zm_may_match(zm, 3, 0, CMP_GE, 29));
+    ck_assert(zm_may_match(zm, 3, 0, CMP_NE, 25));
+    ck_assert(!zm_may_match(zm, 3, 1, CMP_GT, 13.5));
+
+    // CHAR columns and blocks beyond the table are never excluded
+    ck_assert(zm_may_match(zm, 3, 2, CMP_EQ, 0));
+    ck_assert(zm_may_match(zm, 5000, 0, CMP_EQ, -1));
+}
+END_TEST
+
+
+START_TEST(scan_skips_blocks)
+{
+    long skipped;
+    ck_assert_int_eq(count_range(500, 600, &skipped), 100);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 10);
+
+    ck_assert_int_eq(count_range(-100, 5000, &skipped), record_cnt);
+    ck_assert_int_eq(skipped, 0);
+
+    ck_assert_int_eq(count_range(5000, 6000, &skipped), 0);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl));
+
+    // Filters which aren't directly over the scan don't push down
+    exec_op *scan = exec_scan(tbl);
+    int cols[] = {0};
+    exec_op *op = exec_filter_int(exec_project(scan, 1, cols), 0, CMP_LT, 10);
+
+    int rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) rows += b->count;
+
+    ck_assert_int_eq(rows, 10);
+    ck_assert_int_eq(exec_scan_skipped(scan), 0);
+    exec_close(op);
+}
+END_TEST
+
+
+START_TEST(updates_widen_bounds)
+{
+    byte rec[BLOCKSIZE] = {0};
+    tp_setint(rec, 0, 100000);
+    ck_assert_int_eq(tbl_update(tbl, 55, rec), 1);
+
+    long skipped;
+    ck_assert_int_eq(count_range(100000, 100001, &skipped), 1);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 1);
+
+    // Record 55's old value is gone, but its block still can't be skipped
+    ck_assert_int_eq(count_range(55, 56, &skipped), 0);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 1);
+}
+END_TEST
+
+
+START_TEST(nan_values)
+{
+    // A block whose FLOAT values are all NaN
+    byte rec[BLOCKSIZE] = {0};
+    for (int i=0; i<10; i++) {
+        tp_setint(rec, 0, record_cnt + i);
+        tp_setfloat(rec, 4, NAN);
+        tp_setchar(rec, 12, "nan", 8);
+        ck_assert_int_eq(tbl_insert(tbl, rec), record_cnt + i);
+    }
+
+    int blk_no = tbl_rec_blk(tbl, record_cnt);
+    ck_assert(zm_may_match(tbl->zmap, blk_no, 1, CMP_NE, 1.5));
+
+    // NaN != 1.5, so each of its records passes the filter
+    exec_op *scan = exec_scan(tbl);
+    exec_op *op = exec_filter_float(scan, 1, CMP_NE, 1.5);
+
+    int rows = 0;
+    batch *b;
+    while ((b = exec_next(op))) rows += b->count;
+
+    ck_assert_int_eq(rows, record_cnt - record_cnt / 10 + 10);
+    exec_close(op);
+}
+END_TEST
+
+
+START_TEST(persist_and_rebuild)
+{
+    long skipped;
+
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    tbl = tbl_load("events", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl->zmap);
+    ck_assert_int_eq(count_range(0, 25, &skipped), 25);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 3);
+
+    // Without the saved map, it is rebuilt from the table
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    ck_assert_int_eq(unlink("tests/testdb/events.zm"), 0);
+    tbl = tbl_load("events", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl->zmap);
+    ck_assert_int_eq(count_range(1990, 2000, &skipped), 10);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 1);
+}
+END_TEST
+
+
+START_TEST(stale_map_rebuilt)
+{
+    long skipped;
+    byte rec[BLOCKSIZE] = {0};
+
+    // A new table doesn't inherit the map of the last one by its name
+    ck_assert_int_ne(access("tests/testdb/events.zm", F_OK), 0);
+
+    for (int i=0; i<5; i++) {
+        tp_setint(rec, 0, 100000);
+        ck_assert_int_eq(tbl_insert(tbl, rec), record_cnt + i);
+    }
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    ck_assert_int_eq(rename("tests/testdb/events.zm", "tests/testdb/events.zm.old"), 0);
+
+    // More records in the same last block, after which the map saved
+    // above no longer describes the table, though its block count does
+    tbl = tbl_load("events", "tests/testdb");
+    for (int i=0; i<5; i++) {
+        tp_setint(rec, 0, 200000);
+        ck_assert_int_eq(tbl_insert(tbl, rec), record_cnt + 5 + i);
+    }
+    ck_assert_int_eq(tbl_close(tbl), 1);
+    ck_assert_int_eq(rename("tests/testdb/events.zm.old", "tests/testdb/events.zm"), 0);
+
+    tbl = tbl_load("events", "tests/testdb");
+    ck_assert_ptr_nonnull(tbl->zmap);
+    ck_assert_int_eq(count_range(200000, 200001, &skipped), 5);
+    ck_assert_int_eq(skipped, tbl_blk_cnt(tbl) - 1);
+}
+END_TEST
+
+
+Suite *test_suite()
+{
+    Suite *suite = suite_create("zonemap");
+
+    TCase *basic = tcase_create("basic");
+    tcase_add_checked_fixture(basic, setup, teardown);
+
+    tcase_add_test(basic, block_bounds);
+    tcase_add_test(basic, scan_skips_blocks);
+    tcase_add_test(basic, updates_widen_bounds);
+    tcase_add_test(basic, nan_values);
+    tcase_add_test(basic, persist_and_rebuild);
+    tcase_add_test(basic, stale_map_rebuilt);
+
+    suite_add_tcase(suite, basic);
+
+    return suite;
+}
+
+
+int run_test_suite()
+{
+    int failed = 0;
+    Suite *suite = test_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return failed;
+}
+
+
+int main() 
+{
+    mkdir("tests/testdb", 0777);
+    int failed = run_test_suite();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
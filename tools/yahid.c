@@ -0,0 +1,87 @@
+/*
+ * yahid.c
+ *
+ * The yahi-db server program. It sets up the buffer pool, and serves the
+ * tables of a database directory over a Unix domain socket (see server.h)
+ * until it is sent SIGINT or SIGTERM, when it closes its tables, writing
+ * back their dirty pages, and prints its statistics.
+ *
+ * usage: yahid [-d db] [-s socket] [-p pool_size] [-w workers]
+ *
+ * Copyright 2021, Douglas B. Rumbaugh
+ *
+ * This code is published under the BSD 3-Clause License, see the
+ * LICENSE file in the main project directory for details.
+ *
+ */
+
+#include "pgbuffer.h"
+#include "server.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: yahid [-d db] [-s socket] [-p pool_size] [-w workers]\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv)
+{
+    char *db = "db";
+    char *path = "yahid.sock";
+    int pool_size = 1024;
+    srv_opts opts;
+    srv_default_opts(&opts);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:p:w:h")) != -1) {
+        switch (opt) {
+            case 'd': db = optarg; break;
+            case 's': path = optarg; break;
+            case 'p': pool_size = atoi(optarg); break;
+            case 'w': opts.workers = atoi(optarg); break;
+            default: usage();
+        }
+    }
+
+    // Handled by sigwait below, so blocked in every thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (!buff_pool_init(pool_size)) {
+        fprintf(stderr, "yahid: could not create a buffer pool of %d pages\n", pool_size);
+        return EXIT_FAILURE;
+    }
+
+    server *srv = srv_start(path, db, &opts);
+    if (!srv) {
+        fprintf(stderr, "yahid: could not serve %s on %s\n", db, path);
+        buff_pool_destroy();
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "yahid: serving %s on %s (pool %d pages, %d workers)\n", db, path, pool_size,
+            opts.workers);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    srv_stats stats;
+    srv_stats_get(srv, &stats);
+    srv_stop(srv);
+    buff_pool_destroy();
+
+    fprintf(stderr, "yahid: %ld connections, %ld requests in %ld batches\n", stats.connections,
+            stats.requests, stats.batches);
+
+    return EXIT_SUCCESS;
+}